@@ -0,0 +1,257 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "fd_io.hpp"
+#include "path.hpp"
+#include "logger.hpp"
+#include "async_sink.hpp"
+
+using namespace std;
+using namespace c4s;
+
+//! Maximum number of log lines written with one writev call.
+const size_t ASYNC_BATCH = 64;
+
+// -------------------------------------------------------------------------------------------------
+/**
+  \param ph Path to the log file. File is created if it does not exist.
+  \param capacity Number of messages the queue can hold. Rounded up to a power of two.
+  \param pol Policy when the queue is full.
+*/
+c4s::async_sink::async_sink(const path& ph, size_t capacity, POLICY pol)
+  : policy(pol)
+  , target(0)
+{
+    fid = open(ph.get_path().c_str(), O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC,
+               S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fid == -1) {
+        ostringstream sserr;
+        sserr << "async_sink::async_sink - unable to open given file for logging: (" << errno
+              << ") " << strerror(errno);
+        throw c4s_exception(sserr.str());
+    }
+    start(capacity);
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param _target Sink that receives the messages in the writer thread. Deleted by this sink.
+  \param capacity Number of messages the queue can hold. Rounded up to a power of two.
+  \param pol Policy when the queue is full.
+*/
+c4s::async_sink::async_sink(log_sink* _target, size_t capacity, POLICY pol)
+  : policy(pol)
+  , fid(-1)
+  , target(_target)
+{
+    if (!target)
+        throw c4s_exception("async_sink::async_sink - target sink missing.");
+    start(capacity);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::async_sink::start(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    cells = new cell[size];
+    for (size_t ndx = 0; ndx < size; ndx++) {
+        cells[ndx].seq.store(ndx, memory_order_relaxed);
+        cells[ndx].spill = 0;
+    }
+    mask = size - 1;
+    head.store(0);
+    tail = 0;
+    done.store(0);
+    dropped.store(0);
+    running.store(true);
+    sleeping.store(false);
+    waiting.store(0);
+    worker = thread(&async_sink::run, this);
+}
+// -------------------------------------------------------------------------------------------------
+c4s::async_sink::~async_sink()
+{
+    flush();
+    running.store(false);
+    {
+        lock_guard<mutex> lg(mtx);
+        wake.notify_one();
+    }
+    worker.join();
+    for (size_t ndx = 0; ndx <= mask; ndx++)
+        delete[] cells[ndx].spill;
+    delete[] cells;
+    if (fid >= 0)
+        close(fid);
+    if (target) {
+        target->flush();
+        delete target;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Claims a slot with the Vyukov bounded queue protocol: slot is free for position 'pos' when its
+  sequence equals 'pos' and ready for the reader when it equals 'pos + 1'.
+  \param ll Log level.
+  \param msg Message to log.
+*/
+void
+c4s::async_sink::print(LOG_LEVEL ll, const char* msg)
+{
+    size_t plen;
+    const char* prefix = get_datetime(ll, &plen);
+    size_t mlen = strlen(msg);
+    size_t total = plen + mlen + 1;
+    size_t pos;
+    cell* slot;
+    for (;;) {
+        bool claimed = false;
+        pos = head.load(memory_order_relaxed);
+        for (;;) {
+            slot = &cells[pos & mask];
+            size_t seq = slot->seq.load(memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    claimed = true;
+                    break;
+                }
+            } else if (dif < 0)
+                break; // Queue is full.
+            else
+                pos = head.load(memory_order_relaxed);
+        }
+        if (claimed)
+            break;
+        if (policy == AS_DROP) {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        unique_lock<mutex> lk(mtx);
+        waiting++;
+        wake.notify_one();
+        written.wait_for(lk, chrono::milliseconds(10));
+        waiting--;
+    }
+    char* out = total <= CELL_SIZE ? slot->text : (slot->spill = new char[total]);
+    memcpy(out, prefix, plen);
+    memcpy(out + plen, msg, mlen);
+    out[total - 1] = '\n';
+    slot->level = ll;
+    slot->msg_off = plen;
+    slot->len = total;
+    slot->seq.store(pos + 1, memory_order_release);
+
+    // Pairs with the sleeping flag in run(): either the writer sees the slot or we see the flag.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (sleeping.load()) {
+        lock_guard<mutex> lg(mtx);
+        wake.notify_one();
+    }
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::async_sink::ready() const
+{
+    return cells[tail & mask].seq.load(memory_order_acquire) == tail + 1;
+}
+// -------------------------------------------------------------------------------------------------
+/** Writes ready messages in one batch and releases their slots.
+  \retval size_t Number of messages handled.
+*/
+size_t
+c4s::async_sink::drain()
+{
+    struct iovec iov[ASYNC_BATCH];
+    size_t first = tail;
+    size_t count = 0;
+    while (count < ASYNC_BATCH && ready()) {
+        cell& slot = cells[tail & mask];
+        if (fid >= 0) {
+            iov[count].iov_base = (void*)slot.data();
+            iov[count].iov_len = slot.len;
+        } else {
+            // Target sink adds its own line end.
+            char* line = slot.spill ? slot.spill : slot.text;
+            line[slot.len - 1] = 0;
+            try {
+                target->print(slot.level, line + slot.msg_off);
+            } catch (...) {
+                dropped.fetch_add(1, memory_order_relaxed);
+            }
+        }
+        count++;
+        tail++;
+    }
+    if (!count)
+        return 0;
+    if (fid >= 0) {
+        try {
+            writev_all(fid, iov, (int)count);
+        } catch (const c4s_exception&) {
+            dropped.fetch_add(count, memory_order_relaxed);
+        }
+    }
+    for (size_t pos = first; pos < tail; pos++) {
+        cell& slot = cells[pos & mask];
+        delete[] slot.spill;
+        slot.spill = 0;
+        slot.seq.store(pos + mask + 1, memory_order_release);
+    }
+    done.store(tail, memory_order_release);
+    if (waiting.load()) {
+        lock_guard<mutex> lg(mtx);
+        written.notify_all();
+    }
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+//! Writer thread.
+void
+c4s::async_sink::run()
+{
+    for (;;) {
+        if (drain())
+            continue;
+        if (!running.load()) {
+            if (ready())
+                continue;
+            break;
+        }
+        unique_lock<mutex> lk(mtx);
+        sleeping.store(true);
+        if (!ready() && running.load())
+            wake.wait_for(lk, chrono::milliseconds(100));
+        sleeping.store(false);
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::async_sink::flush()
+{
+    size_t target_pos = head.load(memory_order_acquire);
+    unique_lock<mutex> lk(mtx);
+    waiting++;
+    while (done.load(memory_order_acquire) < target_pos && running.load()) {
+        wake.notify_one();
+        written.wait_for(lk, chrono::milliseconds(10));
+    }
+    waiting--;
+}
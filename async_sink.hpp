@@ -0,0 +1,97 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_ASYNC_SINK_HPP
+#define C4S_ASYNC_SINK_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Log sink that writes from a background thread.
+/*! The calling thread formats the complete log line (time stamp, level and message) directly into
+  a slot of a bounded lock-free queue and returns. Background thread collects the ready slots and
+  writes them to the file with a single writev call per batch, or passes them one by one to another
+  sink (e.g. syslog_sink) if the async sink was created on top of one.<br>
+  Memory use is fixed by the queue capacity. Messages longer than the slot are copied to the heap.
+  When the queue is full, the policy decides whether the caller waits for space (AS_BLOCK) or the
+  message is dropped and counted (AS_DROP).<br>
+  logbase::close_log flushes the queue before the sink is deleted.
+*/
+class async_sink : public log_sink
+{
+  public:
+    //! Policy for full queue.
+    enum POLICY
+    {
+        AS_BLOCK, //!< Caller waits until there is space in the queue.
+        AS_DROP   //!< Message is discarded. See get_dropped().
+    };
+    //! Opens the log file for appending and starts the writer thread.
+    async_sink(const path& ph, size_t capacity = 4096, POLICY pol = AS_BLOCK);
+    //! Starts the writer thread that forwards messages to the target sink. Sink takes ownership.
+    async_sink(log_sink* target, size_t capacity = 4096, POLICY pol = AS_BLOCK);
+    //! Flushes the queue, stops the writer thread and closes the output.
+    ~async_sink();
+
+    //! Queues the message. Thread safe.
+    void print(LOG_LEVEL, const char*) override;
+    //! Waits until all messages queued before this call have been written.
+    void flush() override;
+    //! Async sink can always be called from several threads.
+    bool is_thread_safe() const override { return true; }
+    //! Returns the number of messages dropped because the queue was full.
+    size_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+  protected:
+    //! Payload bytes in one queue slot.
+    static const size_t CELL_SIZE = 240;
+    //! Queue slot.
+    struct cell
+    {
+        std::atomic<size_t> seq; //!< Vyukov sequence number.
+        LOG_LEVEL level;
+        uint32_t len;            //!< Length of the complete line including the newline.
+        uint32_t msg_off;        //!< Offset of the message after the time stamp and level.
+        char* spill;             //!< Heap copy of the line if it does not fit into text.
+        char text[CELL_SIZE];
+        const char* data() const { return spill ? spill : text; }
+    };
+
+    void start(size_t capacity);
+    void run();
+    size_t drain();
+    bool ready() const;
+
+    cell* cells;
+    size_t mask;
+    POLICY policy;
+    int fid;
+    log_sink* target;
+
+    alignas(64) std::atomic<size_t> head;   //!< Next enqueue position.
+    alignas(64) size_t tail;                //!< Next dequeue position. Writer thread only.
+    std::atomic<size_t> done;               //!< Number of messages written so far.
+    std::atomic<size_t> dropped;
+    std::atomic<bool> running;
+    std::atomic<bool> sleeping;
+    std::atomic<int> waiting;               //!< Callers waiting for space or flush.
+
+    std::mutex mtx;
+    std::condition_variable wake;    //!< Wakes the writer thread.
+    std::condition_variable written; //!< Signals callers after a batch has been written.
+    std::thread worker;
+};
+
+} // namespace c4s
+#endif
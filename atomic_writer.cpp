@@ -0,0 +1,356 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux)
+#include <sys/syscall.h>
+#endif
+#include <atomic>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "fd_io.hpp"
+#include "atomic_writer.hpp"
+
+#if defined(__linux) && !defined(RENAME_EXCHANGE)
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+using namespace std;
+using namespace c4s;
+
+//! False once an O_TMPFILE file could not be linked. Then mkstemp is used directly.
+static atomic<bool> g_link_unnamed(true);
+
+// -------------------------------------------------------------------------------------------------
+static void
+throw_aw(const char* what, const string& name, int err)
+{
+    ostringstream os;
+    os << "atomic_writer - " << what << ' ' << name << ": " << strerror(err);
+    throw path_exception(os.str());
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param _target Name of the file to write.
+  \param _flags See AtomicWriterFlags.
+  \param _meta Stat of the target if the caller already has it. Null to read it here.
+  \param buffer_size Size of the write buffer.
+*/
+c4s::atomic_writer::atomic_writer(const string& _target,
+                                  int _flags,
+                                  const struct stat* _meta,
+                                  size_t buffer_size)
+  : target(_target)
+  , fd(-1)
+  , flags(_flags)
+  , unnamed(false)
+  , has_meta(false)
+  , buffer(buffer_size ? buffer_size : 0x1000)
+  , buffered(0)
+{
+    size_t slash = target.rfind('/');
+    if (slash == string::npos)
+        dir = ".";
+    else if (slash == 0)
+        dir = "/";
+    else
+        dir = target.substr(0, slash);
+    if (_meta) {
+        meta = *_meta;
+        has_meta = true;
+    } else if (!stat(target.c_str(), &meta))
+        has_meta = true;
+    open_temp();
+}
+// -------------------------------------------------------------------------------------------------
+/** Tries O_TMPFILE first. The file has no name and disappears automatically if the process dies
+  before commit. Falls back to mkstemp with a hidden name next to the target.
+*/
+void
+c4s::atomic_writer::open_temp()
+{
+#if defined(__linux) && defined(O_TMPFILE)
+    if (g_link_unnamed.load(memory_order_relaxed)) {
+        mode_t mode = has_meta ? (meta.st_mode & 07777) : 0644;
+        // Read access is needed if the content has to be copied in link_temp.
+        fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, mode);
+        if (fd >= 0)
+            unnamed = true;
+    }
+#endif
+    if (fd < 0)
+        open_named();
+    set_owner_mode();
+}
+// -------------------------------------------------------------------------------------------------
+//! Creates the temporary file with mkstemp.
+void
+c4s::atomic_writer::open_named()
+{
+    size_t slash = target.rfind('/');
+    tmp_name = slash == string::npos ? string() : target.substr(0, slash + 1);
+    tmp_name += '.';
+    tmp_name += slash == string::npos ? target : target.substr(slash + 1);
+    tmp_name += ".~c4sXXXXXX";
+    vector<char> tmpl(tmp_name.begin(), tmp_name.end());
+    tmpl.push_back(0);
+    tmp_name.clear();
+    fd = mkstemp(tmpl.data());
+    if (fd < 0)
+        throw_aw("unable to create temporary file for", target, errno);
+    tmp_name = tmpl.data();
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+// -------------------------------------------------------------------------------------------------
+/** Copies mode and owner on the open descriptor. Owner change is allowed to fail for
+  non-privileged users.
+*/
+void
+c4s::atomic_writer::set_owner_mode()
+{
+    if (!has_meta)
+        return;
+    if (fchmod(fd, meta.st_mode & 07777)) {
+        int err = errno;
+        abort();
+        throw_aw("unable to set mode for", target, err);
+    }
+    if (fchown(fd, meta.st_uid, meta.st_gid) && errno != EPERM) {
+        int err = errno;
+        abort();
+        throw_aw("unable to set owner for", target, err);
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::atomic_writer::flush()
+{
+    if (!buffered)
+        return;
+    struct iovec iov;
+    iov.iov_base = buffer.data();
+    iov.iov_len = buffered;
+    buffered = 0;
+    writev_all(fd, &iov, 1);
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param data Data to write.
+  \param len Length of data.
+*/
+void
+c4s::atomic_writer::write(const void* data, size_t len)
+{
+    if (fd < 0)
+        throw path_exception("atomic_writer::write - writer is not open.");
+    if (buffered + len <= buffer.size()) {
+        memcpy(buffer.data() + buffered, data, len);
+        buffered += len;
+        return;
+    }
+    // Buffered data and the new block go out with a single writev.
+    struct iovec iov[2];
+    iov[0].iov_base = buffer.data();
+    iov[0].iov_len = buffered;
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = len;
+    buffered = 0;
+    writev_all(fd, iov, 2);
+}
+// -------------------------------------------------------------------------------------------------
+/** Vectors are modified during the write.
+  \param iov Array of vectors.
+  \param count Number of vectors.
+*/
+void
+c4s::atomic_writer::writev(struct iovec* iov, int count)
+{
+    if (fd < 0)
+        throw path_exception("atomic_writer::writev - writer is not open.");
+    flush();
+    writev_all(fd, iov, count);
+}
+// -------------------------------------------------------------------------------------------------
+//! Links the descriptor to the name. Returns false with errno set on failure.
+static bool
+link_fd(int fd, const string& name)
+{
+#if defined(AT_EMPTY_PATH)
+    // Works without /proc but needs CAP_DAC_READ_SEARCH.
+    if (!linkat(fd, "", AT_FDCWD, name.c_str(), AT_EMPTY_PATH))
+        return true;
+    if (errno == EEXIST)
+        return false;
+#endif
+    char proc_name[64];
+    snprintf(proc_name, sizeof(proc_name), "/proc/self/fd/%d", fd);
+    return !linkat(AT_FDCWD, proc_name, AT_FDCWD, name.c_str(), AT_SYMLINK_FOLLOW);
+}
+// -------------------------------------------------------------------------------------------------
+/** Gives the O_TMPFILE file a temporary name next to the target. If the file cannot be linked,
+  e.g. in a chroot without /proc, its content is copied into a mkstemp file and later writers
+  use mkstemp directly.
+*/
+void
+c4s::atomic_writer::link_temp()
+{
+    static atomic<unsigned int> counter(0);
+    size_t slash = target.rfind('/');
+    string prefix = slash == string::npos ? string() : target.substr(0, slash + 1);
+    prefix += '.';
+    prefix += slash == string::npos ? target : target.substr(slash + 1);
+    for (int attempt = 0; attempt < 100; attempt++) {
+        ostringstream os;
+        os << prefix << ".~c4s" << getpid() << '-' << counter++;
+        tmp_name = os.str();
+        if (link_fd(fd, tmp_name))
+            return;
+        if (errno != EEXIST)
+            break;
+    }
+    tmp_name.clear();
+    g_link_unnamed.store(false, memory_order_relaxed);
+
+    int ufd = fd;
+    fd = -1;
+    unnamed = false;
+    try {
+        open_named();
+        set_owner_mode();
+        off_t offset = 0;
+        for (;;) {
+            ssize_t br = pread(ufd, buffer.data(), buffer.size(), offset);
+            if (br < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw_aw("unable to read temporary file for", target, errno);
+            }
+            if (br == 0)
+                break;
+            struct iovec iov;
+            iov.iov_base = buffer.data();
+            iov.iov_len = br;
+            writev_all(fd, &iov, 1);
+            offset += br;
+        }
+        if (!(flags & AWF_NOSYNC) && fdatasync(fd))
+            throw_aw("unable to sync", target, errno);
+    } catch (...) {
+        close(ufd);
+        throw;
+    }
+    close(ufd);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::atomic_writer::sync_dir()
+{
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0)
+        return;
+    fsync(dfd);
+    close(dfd);
+}
+// -------------------------------------------------------------------------------------------------
+/** After commit the writer is closed. On failure the target is left untouched, the temporary
+  file is removed and path_exception is thrown.
+*/
+void
+c4s::atomic_writer::commit()
+{
+    if (fd < 0)
+        throw path_exception("atomic_writer::commit - writer is not open.");
+    try {
+        flush();
+    } catch (...) {
+        abort();
+        throw;
+    }
+    if (!(flags & AWF_NOSYNC) && fdatasync(fd)) {
+        int err = errno;
+        abort();
+        throw_aw("unable to sync", target, err);
+    }
+    if (unnamed) {
+        try {
+            link_temp();
+        } catch (...) {
+            abort();
+            throw;
+        }
+    }
+    close(fd);
+    fd = -1;
+
+    bool done = false;
+    if ((flags & AWF_BACKUP) && has_meta) {
+        string backup(target + "~");
+#if defined(__linux) && defined(SYS_renameat2)
+        // Swap the new file with the target and then move the old content to the backup name.
+        if (!syscall(SYS_renameat2, AT_FDCWD, tmp_name.c_str(), AT_FDCWD, target.c_str(),
+                     RENAME_EXCHANGE)) {
+            if (rename(tmp_name.c_str(), backup.c_str())) {
+                // Temporary name holds the only copy of the original content. Swap it back.
+                int err = errno;
+                string old(tmp_name);
+                tmp_name.clear();
+                if (syscall(SYS_renameat2, AT_FDCWD, old.c_str(), AT_FDCWD, target.c_str(),
+                            RENAME_EXCHANGE)) {
+                    ostringstream os;
+                    os << "atomic_writer - unable to create backup " << backup << ": "
+                       << strerror(err) << ". Original content of " << target << " is in " << old;
+                    throw path_exception(os.str());
+                }
+                unlink(old.c_str());
+                throw_aw("unable to create backup", backup, err);
+            }
+            done = true;
+        }
+#endif
+        if (!done) {
+            // Hard link keeps the original name in place until the rename below.
+            unlink(backup.c_str());
+            if (link(target.c_str(), backup.c_str())) {
+                int err = errno;
+                unlink(tmp_name.c_str());
+                tmp_name.clear();
+                throw_aw("unable to create backup", backup, err);
+            }
+        }
+    }
+    if (!done && rename(tmp_name.c_str(), target.c_str())) {
+        int err = errno;
+        unlink(tmp_name.c_str());
+        tmp_name.clear();
+        throw_aw("unable to rename temporary file to", target, err);
+    }
+    tmp_name.clear();
+    if (!(flags & AWF_NOSYNC))
+        sync_dir();
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::atomic_writer::abort()
+{
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (!tmp_name.empty()) {
+        unlink(tmp_name.c_str());
+        tmp_name.clear();
+    }
+    buffered = 0;
+}
@@ -0,0 +1,91 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_ATOMIC_WRITER_HPP
+#define C4S_ATOMIC_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace c4s {
+
+/** \defgroup AtomicWriterFlags Flags for atomic_writer
+    @{
+*/
+const int AWF_NONE = 0;     //!< Defaults: fsync data and directory, no backup.
+const int AWF_BACKUP = 0x1; //!< Keep the original file with '~' appended to its name.
+const int AWF_NOSYNC = 0x2; //!< Skip fsync calls. Faster but not crash safe.
+/**@}*/
+
+// -----------------------------------------------------------------------------------------------------------
+//! Crash safe replacement of a file's content.
+/*! New content is written into an unnamed temporary file (O_TMPFILE) in the target's directory or,
+  if the file system does not support it, into a mkstemp file. Nothing is visible to other
+  processes until commit() is called. Commit flushes and fsyncs the data, gives the temporary file
+  a name, renames it over the target and finally fsyncs the directory. If the unnamed file cannot
+  be linked, e.g. without /proc, its content is copied into a mkstemp file instead. The target name always
+  points either to the complete old or the complete new content.<br>
+  Owner and mode of an existing target are copied to the new file with fchown / fchmod on the
+  already open descriptor. With AWF_BACKUP the old content is moved to the backup name with
+  renameat2(RENAME_EXCHANGE) when the kernel supports it.<br>
+  If the writer is destroyed without commit, the temporary file is removed.
+*/
+class atomic_writer
+{
+  public:
+    //! Opens a temporary file for the target. Throws path_exception on failure.
+    atomic_writer(const std::string& target,
+                  int flags = AWF_NONE,
+                  const struct stat* meta = 0,
+                  size_t buffer_size = 0x40000);
+    //! Removes the temporary file if commit was not called.
+    ~atomic_writer() { abort(); }
+
+    //! Writes data through the internal buffer. Large blocks are written directly.
+    void write(const void* data, size_t len);
+    //! Writes a string through the internal buffer.
+    void write(const std::string& str) { write(str.data(), str.size()); }
+    //! Flushes the buffer and writes the vectors with writev.
+    void writev(struct iovec* iov, int count);
+    //! Writes the internal buffer to the file.
+    void flush();
+    //! Makes the new content visible under the target name.
+    void commit();
+    //! Discards the new content. Target is not touched.
+    void abort();
+    //! Returns true if the temporary file is open.
+    bool is_open() const { return fd >= 0; }
+    //! Returns the target file name.
+    const std::string& get_target() const { return target; }
+
+  private:
+    atomic_writer(const atomic_writer&) = delete;
+    atomic_writer& operator=(const atomic_writer&) = delete;
+
+    void open_temp();
+    void open_named();
+    void set_owner_mode();
+    void link_temp();
+    void sync_dir();
+
+    std::string target;
+    std::string dir;      //!< Directory of the target. "." if target has no directory.
+    std::string tmp_name; //!< Name of the temporary file once it has been linked.
+    int fd;
+    int flags;
+    bool unnamed;         //!< True if the file was created with O_TMPFILE.
+    bool has_meta;        //!< True if the target existed and meta is valid.
+    struct stat meta;
+    std::vector<char> buffer;
+    size_t buffered;
+};
+
+} // namespace c4s
+#endif
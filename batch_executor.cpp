@@ -0,0 +1,469 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <list>
+#include <new>
+#include <system_error>
+#include <thread>
+#if defined(__linux)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#endif
+#include "ntbs/ntbs.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "user.hpp"
+#include "path.hpp"
+#include "path_list.hpp"
+#include "stat_cache.hpp"
+#include "util.hpp"
+#include "batch_executor.hpp"
+
+// Unlinkat and statx opcodes and the native worker feature flag appeared in the same kernel
+// generation. Older headers are compiled with thread pool only.
+#if defined(__linux) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_NATIVE_WORKERS)
+#define C4S_BATCH_URING 1
+#else
+#define C4S_BATCH_URING 0
+#endif
+
+using namespace std;
+using namespace c4s;
+
+#if C4S_BATCH_URING
+// -------------------------------------------------------------------------------------------------
+//! Minimal io_uring submission / completion ring without external libraries.
+struct uring_state
+{
+    int fd;
+    unsigned int entries;
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe* cqes;
+};
+// -------------------------------------------------------------------------------------------------
+static void
+uring_close(uring_state* us)
+{
+    if (us->sqes)
+        munmap(us->sqes, us->sqes_size);
+    if (us->cq_ptr && us->cq_ptr != us->sq_ptr)
+        munmap(us->cq_ptr, us->cq_size);
+    if (us->sq_ptr)
+        munmap(us->sq_ptr, us->sq_size);
+    if (us->fd >= 0)
+        close(us->fd);
+    delete us;
+}
+// -------------------------------------------------------------------------------------------------
+static uring_state*
+uring_open(unsigned int entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        return 0;
+    uring_state* us = new uring_state;
+    memset(us, 0, sizeof(uring_state));
+    us->fd = fd;
+    us->entries = params.sq_entries;
+    us->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    us->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) > 0;
+    if (single && us->cq_size > us->sq_size)
+        us->sq_size = us->cq_size;
+    us->sq_ptr = mmap(0, us->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQ_RING);
+    if (us->sq_ptr == MAP_FAILED) {
+        us->sq_ptr = 0;
+        uring_close(us);
+        return 0;
+    }
+    if (single)
+        us->cq_ptr = us->sq_ptr;
+    else {
+        us->cq_ptr = mmap(0, us->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                          IORING_OFF_CQ_RING);
+        if (us->cq_ptr == MAP_FAILED) {
+            us->cq_ptr = 0;
+            uring_close(us);
+            return 0;
+        }
+    }
+    us->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    us->sqes = (io_uring_sqe*)mmap(0, us->sqes_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (us->sqes == MAP_FAILED) {
+        us->sqes = 0;
+        uring_close(us);
+        return 0;
+    }
+    char* sq = (char*)us->sq_ptr;
+    us->sq_head = (unsigned*)(sq + params.sq_off.head);
+    us->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    us->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    us->sq_array = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)us->cq_ptr;
+    us->cq_head = (unsigned*)(cq + params.cq_off.head);
+    us->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    us->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    us->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return us;
+}
+#endif
+// -------------------------------------------------------------------------------------------------
+/**
+  \param _max_in_flight Maximum number of operations pending at the same time.
+  \param backend Backend to use. See BACKEND.
+*/
+c4s::batch_executor::batch_executor(unsigned int _max_in_flight, BACKEND backend)
+  : max_in_flight(_max_in_flight ? _max_in_flight : 1)
+  , ring(0)
+{
+#if C4S_BATCH_URING
+    if (backend != BACKEND::THREADS)
+        ring = uring_open(max_in_flight);
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+c4s::batch_executor::~batch_executor()
+{
+#if C4S_BATCH_URING
+    if (ring)
+        uring_close((uring_state*)ring);
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::batch_executor::prepare(path_list& list, vector<path*>& targets, batch_results& results)
+{
+    results.clear();
+    results.reserve(list.size());
+    targets.clear();
+    targets.reserve(list.size());
+    for (path_iterator pi = list.begin(); pi != list.end(); pi++) {
+        results.push_back(batch_result(*pi));
+        targets.push_back(&(*pi));
+    }
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::batch_executor::failures(const batch_results& results)
+{
+    size_t count = 0;
+    for (const batch_result& br : results) {
+        if (!br.ok())
+            count++;
+    }
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+static void
+set_error(batch_result& result, int err, const char* what)
+{
+    result.error = err ? err : EIO;
+    result.message = what ? what : strerror(result.error);
+}
+// -------------------------------------------------------------------------------------------------
+/** Each operation is run in a try block. Exceptions are stored as errors into the result of the
+  corresponding path.
+  \param list List of paths to process.
+  \param op Operation to run for each path.
+  \param results Vector of results. Cleared and filled with one result per path.
+  \retval size_t Number of failed operations.
+*/
+size_t
+c4s::batch_executor::for_each(path_list& list,
+                              const function<void(path&)>& op,
+                              batch_results& results)
+{
+    vector<path*> targets;
+    prepare(list, targets, results);
+    parallel_for(targets.size(), threads(), [&](size_t ndx) {
+        errno = 0;
+        try {
+            op(*targets[ndx]);
+        } catch (const c4s_exception& ce) {
+            set_error(results[ndx], errno, ce.what());
+        } catch (const system_error& se) {
+            set_error(results[ndx], se.code().value(), se.what());
+        } catch (const bad_alloc& ba) {
+            set_error(results[ndx], ENOMEM, ba.what());
+        } catch (const exception& e) {
+            set_error(results[ndx], errno, e.what());
+        } catch (...) {
+            set_error(results[ndx], errno, "batch_executor::for_each - unknown exception");
+        }
+    });
+    return failures(results);
+}
+// -------------------------------------------------------------------------------------------------
+/** Completion results are written to the result with the same index as the submitted path.
+  Operations not supported by the running kernel are retried synchronously. Submission queue
+  entries the kernel did not accept are submitted again on the next round. If the ring fails, the
+  entries not yet accepted are dropped and also run synchronously.
+*/
+void
+c4s::batch_executor::run_uring(vector<path*>& targets, bool unlink, batch_results& results)
+{
+    // Entries not completed by the ring are run synchronously at the end.
+    vector<char> retry(targets.size(), 1);
+#if C4S_BATCH_URING
+    uring_state* us = (uring_state*)ring;
+    vector<string> names(targets.size());
+    vector<struct statx> stats(unlink ? 0 : targets.size());
+    // Entries written into the queue, taken by the kernel and completed.
+    size_t queued = 0, accepted = 0, completed = 0;
+    unsigned int limit = max_in_flight < us->entries ? max_in_flight : us->entries;
+
+    auto reap = [&]() {
+        unsigned head = *us->cq_head;
+        while (head != __atomic_load_n(us->cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe* cqe = &us->cqes[head & *us->cq_mask];
+            size_t ndx = cqe->user_data;
+            int res = cqe->res;
+            head++;
+            completed++;
+            if (res == -EINVAL || res == -EOPNOTSUPP)
+                continue;
+            retry[ndx] = 0;
+            if (res < 0) {
+                if (res != -ENOENT)
+                    set_error(results[ndx], -res, 0);
+                continue;
+            }
+            if (unlink)
+                continue;
+            file_meta& meta = results[ndx].meta;
+            struct statx& sx = stats[ndx];
+            meta.exists = true;
+            meta.mode = sx.stx_mode;
+            meta.size = sx.stx_size;
+            meta.ino = sx.stx_ino;
+            meta.dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+            meta.mtime.tv_sec = sx.stx_mtime.tv_sec;
+            meta.mtime.tv_nsec = sx.stx_mtime.tv_nsec;
+        }
+        __atomic_store_n(us->cq_head, head, __ATOMIC_RELEASE);
+    };
+
+    while (completed < targets.size()) {
+        // Fill the submission queue up to the in-flight limit.
+        unsigned tail = *us->sq_tail;
+        while (queued < targets.size() && queued - completed < limit) {
+            names[queued] = targets[queued]->get_path();
+            unsigned idx = tail & *us->sq_mask;
+            io_uring_sqe* sqe = &us->sqes[idx];
+            memset(sqe, 0, sizeof(io_uring_sqe));
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long)names[queued].c_str();
+            if (unlink) {
+                sqe->opcode = IORING_OP_UNLINKAT;
+            } else {
+                sqe->opcode = IORING_OP_STATX;
+                sqe->len = STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME;
+                sqe->off = (unsigned long)&stats[queued];
+                sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            }
+            sqe->user_data = queued;
+            us->sq_array[idx] = idx;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(us->sq_tail, tail, __ATOMIC_RELEASE);
+        // Kernel does not wait for completions after a short submit.
+        int rv = (int)syscall(__NR_io_uring_enter, us->fd, (unsigned)(queued - accepted), 1,
+                              IORING_ENTER_GETEVENTS, 0, 0);
+        if (rv < 0) {
+            if (errno == EINTR)
+                continue;
+            // Drop the entries the kernel did not take. They keep the retry flag.
+            __atomic_store_n(us->sq_tail, __atomic_load_n(us->sq_head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+            queued = accepted;
+            break;
+        }
+        accepted += rv;
+        reap();
+    }
+    // Wait for the accepted operations so that names stay valid until they finish.
+    while (completed < accepted) {
+        if (syscall(__NR_io_uring_enter, us->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0) < 0
+            && errno != EINTR)
+            break;
+        reap();
+    }
+#endif
+    for (size_t ndx = 0; ndx < targets.size(); ndx++) {
+        if (retry[ndx]) {
+            if (unlink)
+                rm_one(*targets[ndx], results[ndx]);
+            else
+                stat_one(*targets[ndx], results[ndx]);
+        }
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Missing files are not considered errors. Check meta.exists from the results.
+  \param list Paths to read.
+  \param results One result per path in the list order.
+  \retval size_t Number of failures.
+*/
+size_t
+c4s::batch_executor::stat(path_list& list, batch_results& results)
+{
+    vector<path*> targets;
+    prepare(list, targets, results);
+    if (ring)
+        run_uring(targets, false, results);
+    else
+        parallel_for(targets.size(), threads(), [&](size_t ndx) {
+            stat_one(*targets[ndx], results[ndx]);
+        });
+    return failures(results);
+}
+// -------------------------------------------------------------------------------------------------
+/** Plain directories (no base) are removed recursively and run in the thread pool. Files that do
+  not exist are not considered errors. USE WITH CARE!!
+  \param list Paths to remove.
+  \param results One result per path in the list order.
+  \retval size_t Number of failures.
+*/
+size_t
+c4s::batch_executor::rm(path_list& list, batch_results& results)
+{
+    vector<path*> targets, files, dirs;
+    vector<size_t> file_ndx, dir_ndx;
+    prepare(list, targets, results);
+    for (size_t ndx = 0; ndx < targets.size(); ndx++) {
+        stat_cache::forget(*targets[ndx]);
+        if (targets[ndx]->is_base()) {
+            files.push_back(targets[ndx]);
+            file_ndx.push_back(ndx);
+        } else {
+            dirs.push_back(targets[ndx]);
+            dir_ndx.push_back(ndx);
+        }
+    }
+    if (ring && !files.empty()) {
+        batch_results file_results;
+        file_results.reserve(files.size());
+        for (path* fp : files)
+            file_results.push_back(batch_result(*fp));
+        run_uring(files, true, file_results);
+        for (size_t ndx = 0; ndx < files.size(); ndx++)
+            results[file_ndx[ndx]] = file_results[ndx];
+    } else {
+        parallel_for(files.size(), threads(), [&](size_t ndx) {
+            rm_one(*files[ndx], results[file_ndx[ndx]]);
+        });
+    }
+    parallel_for(dirs.size(), threads(), [&](size_t ndx) {
+        errno = 0;
+        try {
+            dirs[ndx]->rmdir(true);
+        } catch (const c4s_exception& ce) {
+            set_error(results[dir_ndx[ndx]], errno, ce.what());
+        }
+    });
+    return failures(results);
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param list Paths to change.
+  \param mode Mode to set. \see path::chmod
+  \param results One result per path in the list order.
+  \retval size_t Number of failures.
+*/
+size_t
+c4s::batch_executor::chmod(path_list& list, int mode, batch_results& results)
+{
+    return for_each(list, [mode](path& p) { p.chmod(mode); }, results);
+}
+// -------------------------------------------------------------------------------------------------
+/** Follows the rules of path_list::copy_to: directories are copied only if flags has
+  PCF_RECURSIVE and missing files are skipped. Skipped entries are not errors.
+  \param list Files to copy.
+  \param target Target directory.
+  \param flags Copy flags. PCF_ONAME is always added.
+  \param results One result per path in the list order.
+  \retval size_t Number of failures.
+*/
+size_t
+c4s::batch_executor::copy(path_list& list, const path& target, int flags, batch_results& results)
+{
+    flags |= PCF_ONAME;
+    return for_each(list, [&target, flags](path& p) {
+        if (!p.is_base()) {
+            if ((flags & PCF_RECURSIVE) > 0) {
+                path tmp_target(target);
+                tmp_target.append_last(p);
+                p.cp(tmp_target, flags);
+            }
+        } else if (p.exists())
+            p.cp(target, flags);
+    }, results);
+}
+#if defined(__linux) || defined(__APPLE__)
+// -------------------------------------------------------------------------------------------------
+/**
+  \param list Paths to change.
+  \param owner Owner to set. If null only mode is changed.
+  \param mode Mode to set. If -1 only owner is changed.
+  \param results One result per path in the list order.
+  \retval size_t Number of failures.
+*/
+size_t
+c4s::batch_executor::set_usermode(path_list& list, user* owner, int mode, batch_results& results)
+{
+    return for_each(list, [owner, mode](path& p) { p.ch_owner_mode(owner, mode); }, results);
+}
+#endif
+// -------------------------------------------------------------------------------------------------
+unsigned int
+c4s::batch_executor::threads() const
+{
+    unsigned int count = thread::hardware_concurrency();
+    if (!count || count > max_in_flight)
+        count = max_in_flight;
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::batch_executor::stat_one(const path& p, batch_result& result)
+{
+    if (!stat_cache::read_meta(p.get_path().c_str(), false, result.meta) && errno != ENOENT)
+        set_error(result, errno, 0);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::batch_executor::rm_one(const path& p, batch_result& result)
+{
+    errno = 0;
+    try {
+        if (!p.rm())
+            set_error(result, errno, "unable to delete");
+    } catch (const c4s_exception& ce) {
+        set_error(result, errno, ce.what());
+    }
+}
@@ -0,0 +1,106 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_BATCH_EXECUTOR_HPP
+#define C4S_BATCH_EXECUTOR_HPP
+
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+#include "config.hpp"
+#include "path.hpp"
+#include "path_list.hpp"
+#include "stat_cache.hpp"
+
+namespace c4s {
+
+//! Result of a single operation in a batch.
+struct batch_result
+{
+    batch_result(const path& p)
+      : target(p)
+      , error(0)
+    {
+        meta.exists = false;
+    }
+    //! Returns true if the operation succeeded.
+    bool ok() const { return error == 0; }
+
+    path target;         //!< Path the operation was applied to.
+    int error;           //!< Zero on success, otherwise errno of the failure.
+    std::string message; //!< Error description if the operation failed.
+    file_meta meta;      //!< Metadata read by the stat operation.
+};
+typedef std::vector<batch_result> batch_results;
+
+// -----------------------------------------------------------------------------------------------------------
+//! Executes file operations for a whole path list at once.
+/*! Unlink and stat operations are submitted to the kernel through io_uring when it is available
+  (Linux 5.11+). Other operations and systems without io_uring use a pool of threads. In both cases
+  at most max_in_flight operations are pending at any time.<br>
+  Unlike the corresponding path_list functions, executor does not throw on the first failure.
+  Each entry in the list gets a result with possible error code and message. Functions return
+  the number of failed operations.
+*/
+class batch_executor
+{
+  public:
+    //! Backend selection.
+    enum class BACKEND
+    {
+        AUTO,   //!< Use io_uring when available, threads otherwise.
+        URING,  //!< Prefer io_uring. Falls back to threads if the ring cannot be created.
+        THREADS //!< Always use the thread pool.
+    };
+    //! Creates executor with given in-flight limit and backend preference.
+    batch_executor(unsigned int max_in_flight = 64, BACKEND backend = BACKEND::AUTO);
+    ~batch_executor();
+
+    //! Returns true if io_uring is used for unlink and stat.
+    bool uses_uring() const { return ring != 0; }
+    //! Returns the in-flight limit.
+    unsigned int get_max_in_flight() const { return max_in_flight; }
+
+    //! Reads the metadata (lstat) for all paths in the list.
+    size_t stat(path_list& list, batch_results& results);
+    //! Removes all files in the list. Directories are removed recursively.
+    size_t rm(path_list& list, batch_results& results);
+    //! Changes the mode of all paths in the list.
+    size_t chmod(path_list& list, int mode, batch_results& results);
+    //! Copies all files in the list into target directory.
+    size_t copy(path_list& list, const path& target, int flags, batch_results& results);
+#if defined(__linux) || defined(__APPLE__)
+    //! Changes the owner and mode of all paths in the list.
+    size_t set_usermode(path_list& list, user* owner, int mode, batch_results& results);
+#endif
+    //! Runs the given function for each path using the thread pool.
+    size_t for_each(path_list& list,
+                    const std::function<void(path&)>& op,
+                    batch_results& results);
+
+  protected:
+    //! Submits unlink or statx operations into the ring.
+    void run_uring(std::vector<path*>& targets, bool unlink, batch_results& results);
+    //! Prepares the results vector and target pointers for the list.
+    void prepare(path_list& list, std::vector<path*>& targets, batch_results& results);
+    //! Counts the failed results.
+    size_t failures(const batch_results& results);
+    //! Returns the number of threads to use for the pool.
+    unsigned int threads() const;
+    //! Synchronous stat for a single path.
+    static void stat_one(const path& p, batch_result& result);
+    //! Synchronous remove for a single path.
+    static void rm_one(const path& p, batch_result& result);
+
+    unsigned int max_in_flight;
+    void* ring; //!< Opaque io_uring state. Null when thread pool is used.
+};
+
+} // namespace c4s
+#endif
@@ -0,0 +1,456 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "atomic_writer.hpp"
+#include "path.hpp"
+#include "logger.hpp"
+#include "binlog.hpp"
+
+using namespace std;
+using namespace c4s;
+
+extern const char* g_level_names[c4s::LL_MAX];
+
+const char BINLOG_MAGIC[8] = { 'C', '4', 'S', 'B', 'L', 'O', 'G', '1' };
+const uint64_t BINLOG_OFFSET_MASK = ((uint64_t)1 << 40) - 1;
+//! Largest file size. Leaves room in the offset bits for writers that overshoot the end.
+const size_t BINLOG_MAX_FILE = (size_t)1 << 38;
+
+// -------------------------------------------------------------------------------------------------
+static uint64_t
+binlog_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+// -------------------------------------------------------------------------------------------------
+//! Reads the format file entries. Each entry is run (8 bytes), id (4), length (4) and the format.
+static void
+binlog_read_formats(const string& name, map<pair<uint64_t, uint32_t>, string>& formats)
+{
+    ifstream ff(name.c_str(), ios::binary);
+    uint64_t run;
+    uint32_t id, len;
+    while (ff.read((char*)&run, sizeof(run)) && ff.read((char*)&id, sizeof(id)) &&
+           ff.read((char*)&len, sizeof(len))) {
+        string fmt(len, 0);
+        if (!ff.read(&fmt[0], len))
+            break;
+        formats[make_pair(run, id)] = fmt;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+static void
+binlog_put_format(string& out, uint64_t run, uint32_t id, const char* fmt, uint32_t len)
+{
+    out.append((const char*)&run, sizeof(run));
+    out.append((const char*)&id, sizeof(id));
+    out.append((const char*)&len, sizeof(len));
+    out.append(fmt, len);
+}
+// -------------------------------------------------------------------------------------------------
+/** Formats of the runs that no longer have files in the ring are removed from the format file.
+  Throws c4s_exception if the files cannot be created or mapped.
+  \param base_path Base name of the files.
+  \param size Size of each ring file. Rounded up to the page size.
+  \param files Number of files in the ring. At least two.
+*/
+c4s::binlog_sink::binlog_sink(const path& base_path, size_t size, unsigned int files)
+  : base(base_path.get_path())
+  , format_fid(-1)
+  , run(binlog_now())
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    file_size = (size + page - 1) / page * page;
+    if (file_size < page * 2)
+        file_size = page * 2;
+    if (file_size > BINLOG_MAX_FILE)
+        file_size = BINLOG_MAX_FILE;
+    if (files < 2)
+        files = 2;
+
+    uint64_t last_seq = 0;
+    bool found = false;
+    set<uint64_t> runs;
+    for (unsigned int ndx = 0; ndx < files; ndx++) {
+        string name = base + '.' + to_string(ndx);
+        int fid = open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fid < 0)
+            goto BINLOG_ERROR;
+        fids.push_back(fid);
+        struct stat sb;
+        if (fstat(fid, &sb) || ((size_t)sb.st_size != file_size && ftruncate(fid, file_size)))
+            goto BINLOG_ERROR;
+#if defined(__linux)
+        // Allocate the blocks now so that a full disk does not fault the writers later.
+        posix_fallocate(fid, 0, file_size);
+#endif
+        char* area = (char*)mmap(0, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fid, 0);
+        if (area == MAP_FAILED)
+            goto BINLOG_ERROR;
+        maps.push_back(area);
+        binlog_file_header* hdr = (binlog_file_header*)area;
+        if (!memcmp(hdr->magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC))) {
+            runs.insert(hdr->run);
+            if (!found || hdr->seq > last_seq)
+                last_seq = hdr->seq;
+            found = true;
+        }
+    }
+    try {
+        // Keep the formats that are still needed to read the old files.
+        map<pair<uint64_t, uint32_t>, string> old;
+        binlog_read_formats(base + ".fmt", old);
+        string keep;
+        for (auto& fe : old) {
+            if (runs.count(fe.first.first))
+                binlog_put_format(keep, fe.first.first, fe.first.second, fe.second.data(),
+                                  (uint32_t)fe.second.size());
+        }
+        atomic_writer aw(base + ".fmt", AWF_NOSYNC);
+        aw.write(keep);
+        aw.commit();
+    } catch (const c4s_exception&) {
+        goto BINLOG_ERROR;
+    }
+    format_fid = open((base + ".fmt").c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (format_fid < 0)
+        goto BINLOG_ERROR;
+    formats_written.store(0);
+    write_formats();
+    reset_file(found ? last_seq + 1 : 0);
+    return;
+
+BINLOG_ERROR:
+    ostringstream os;
+    os << "binlog_sink::binlog_sink - unable to open " << base << ": " << strerror(errno);
+    for (char* area : maps)
+        munmap(area, file_size);
+    for (int fid : fids)
+        close(fid);
+    if (format_fid >= 0)
+        close(format_fid);
+    throw c4s_exception(os.str());
+}
+// -------------------------------------------------------------------------------------------------
+c4s::binlog_sink::~binlog_sink()
+{
+    for (char* area : maps)
+        munmap(area, file_size);
+    for (int fid : fids)
+        close(fid);
+    close(format_fid);
+}
+// -------------------------------------------------------------------------------------------------
+/** Clears the file for the sequence and makes it current. Called at construction and under mtx.
+  \param seq Sequence number of the new file.
+*/
+void
+c4s::binlog_sink::reset_file(uint64_t seq)
+{
+    size_t ndx = seq % fids.size();
+    // Truncating drops the old records without touching every page.
+    if (!ftruncate(fids[ndx], 0) && !ftruncate(fids[ndx], file_size)) {
+#if defined(__linux)
+        posix_fallocate(fids[ndx], 0, file_size);
+#endif
+    }
+    binlog_file_header* hdr = (binlog_file_header*)maps[ndx];
+    hdr->seq = seq;
+    hdr->size = file_size;
+    hdr->start = binlog_now();
+    hdr->run = run;
+    memcpy(hdr->magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+    state.store(seq << 40 | sizeof(binlog_file_header), memory_order_release);
+}
+// -------------------------------------------------------------------------------------------------
+/** Only the first writer that overshoots the end of the file rotates. Others see the new sequence
+  and retry.
+*/
+void
+c4s::binlog_sink::rotate(uint64_t seq)
+{
+    lock_guard<mutex> lg(mtx);
+    if (state.load(memory_order_acquire) >> 40 == seq)
+        reset_file(seq + 1);
+}
+// -------------------------------------------------------------------------------------------------
+//! Appends the formats registered since the last call to the format file.
+void
+c4s::binlog_sink::write_formats()
+{
+    lock_guard<mutex> lg(mtx);
+    vector<const char*> list;
+    uint32_t first = formats_written.load(memory_order_relaxed);
+    uint32_t total = log_format::get_registered(list, first);
+    string out;
+    for (uint32_t ndx = 0; ndx < list.size(); ndx++)
+        binlog_put_format(out, run, first + ndx, list[ndx], (uint32_t)strlen(list[ndx]));
+    if (!out.empty() && ::write(format_fid, out.data(), out.size()) != (ssize_t)out.size())
+        return;
+    formats_written.store(total, memory_order_release);
+}
+// -------------------------------------------------------------------------------------------------
+/** Reserves the space with one atomic add and copies the record. Length is stored last so that a
+  reader never sees a partially written record.
+*/
+void
+c4s::binlog_sink::write(LOG_LEVEL ll, uint32_t format, unsigned int count, const char* args1,
+                        size_t len1, const char* args2, size_t len2)
+{
+    size_t total = (sizeof(binlog_record) + len1 + len2 + 7) & ~(size_t)7;
+    if (total > file_size - sizeof(binlog_file_header))
+        return;
+    uint64_t now = binlog_now();
+    for (;;) {
+        uint64_t st = state.fetch_add(total, memory_order_acq_rel);
+        uint64_t seq = st >> 40;
+        size_t off = st & BINLOG_OFFSET_MASK;
+        if (off + total <= file_size) {
+            char* dst = maps[seq % maps.size()] + off;
+            binlog_record* rec = (binlog_record*)dst;
+            rec->format = format;
+            rec->time = now;
+            rec->level = (uint8_t)ll;
+            rec->count = (uint8_t)count;
+            rec->args_len = (uint16_t)(len1 + len2);
+            memcpy(dst + sizeof(binlog_record), args1, len1);
+            if (len2)
+                memcpy(dst + sizeof(binlog_record) + len1, args2, len2);
+            __atomic_store_n(&rec->len, (uint32_t)total, __ATOMIC_RELEASE);
+            return;
+        }
+        rotate(seq);
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::binlog_sink::print(LOG_LEVEL ll, const char* msg)
+{
+    size_t mlen = strlen(msg);
+    if (mlen > 0xffff - 3)
+        mlen = 0xffff - 3;
+    char tag[3];
+    uint16_t mlen16 = (uint16_t)mlen;
+    tag[0] = 's';
+    memcpy(tag + 1, &mlen16, 2);
+    write(ll, 0, 1, tag, 3, msg, mlen);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::binlog_sink::print_record(LOG_LEVEL ll, log_format& lf, const log_args& la)
+{
+    uint32_t id = lf.get_id();
+    if (id >= formats_written.load(memory_order_acquire))
+        write_formats();
+    write(ll, id, la.count, la.data, la.len, 0, 0);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::binlog_sink::flush()
+{
+    uint64_t seq = state.load(memory_order_acquire) >> 40;
+    msync(maps[seq % maps.size()], file_size, MS_ASYNC);
+}
+
+// =================================================================================================
+/** Missing or empty ring files are skipped.
+  \param base_path Base name given to binlog_sink.
+*/
+c4s::binlog_reader::binlog_reader(const path& base_path)
+{
+    string base = base_path.get_path();
+    binlog_read_formats(base + ".fmt", formats);
+    vector<pair<uint64_t, string>> found;
+    for (unsigned int ndx = 0;; ndx++) {
+        ifstream bf((base + '.' + to_string(ndx)).c_str(), ios::binary);
+        if (!bf)
+            break;
+        ostringstream content;
+        content << bf.rdbuf();
+        string data = content.str();
+        if (data.size() < sizeof(binlog_file_header) ||
+            memcmp(data.data(), BINLOG_MAGIC, sizeof(BINLOG_MAGIC)))
+            continue;
+        uint64_t seq = ((const binlog_file_header*)data.data())->seq;
+        found.push_back(make_pair(seq, move(data)));
+    }
+    sort(found.begin(), found.end(),
+         [](const pair<uint64_t, string>& a, const pair<uint64_t, string>& b) {
+             return a.first < b.first;
+         });
+    for (auto& ff : found)
+        files.push_back(move(ff.second));
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param os Output stream. Each record is written as a line in the format of the text sinks.
+  \retval size_t Number of records.
+*/
+size_t
+c4s::binlog_reader::dump(ostream& os) const
+{
+    size_t count = 0;
+    for (const string& data : files) {
+        const binlog_file_header* hdr = (const binlog_file_header*)data.data();
+        size_t off = sizeof(binlog_file_header);
+        while (off + sizeof(binlog_record) <= data.size()) {
+            const binlog_record* rec = (const binlog_record*)(data.data() + off);
+            if (rec->len < sizeof(binlog_record) || off + rec->len > data.size() ||
+                sizeof(binlog_record) + rec->args_len > rec->len)
+                break;
+            time_t sec = (time_t)(rec->time / 1000000000);
+            struct tm ltm;
+            localtime_r(&sec, &ltm);
+            char stamp[64];
+            snprintf(stamp, sizeof(stamp), "%d-%02d-%02d %02d:%02d:%02d.%06u [%-8s] ",
+                     ltm.tm_year + 1900, ltm.tm_mon + 1, ltm.tm_mday, ltm.tm_hour, ltm.tm_min,
+                     ltm.tm_sec, (unsigned int)(rec->time % 1000000000 / 1000),
+                     g_level_names[rec->level < LL_MAX ? rec->level : 0]);
+            os << stamp;
+            auto fi = formats.find(make_pair(hdr->run, rec->format));
+            const char* args = data.data() + off + sizeof(binlog_record);
+            if (rec->format == 0)
+                os << render("%s", args, rec->args_len);
+            else if (fi != formats.end())
+                os << render(fi->second.c_str(), args, rec->args_len);
+            else
+                os << "<unknown format " << rec->format << '>';
+            os << '\n';
+            off += rec->len;
+            count++;
+        }
+    }
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+//! Formats one conversion with snprintf.
+template<typename T>
+static void
+binlog_append(string& out, const string& spec, T val)
+{
+    char buffer[128];
+    int len = snprintf(buffer, sizeof(buffer), spec.c_str(), val);
+    if (len < 0)
+        return;
+    if ((size_t)len < sizeof(buffer))
+        out.append(buffer, len);
+    else {
+        string big(len + 1, 0);
+        snprintf(&big[0], big.size(), spec.c_str(), val);
+        out.append(big.data(), len);
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Length modifiers in the format are replaced with the ones that match the stored argument types.
+  Arguments that are missing are shown as '<?>'.
+  \param fmt Printf style format string.
+  \param args Raw arguments as stored by log_args.
+  \param len Length of the arguments.
+  \retval string Formatted text.
+*/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+string
+c4s::binlog_reader::render(const char* fmt, const char* args, size_t len)
+{
+    string out;
+    size_t pos = 0;
+    // Returns the tag of the next argument and copies its value.
+    auto next = [&](uint64_t& num, string& str) -> char {
+        if (pos >= len)
+            return 0;
+        char tag = args[pos++];
+        if (tag == 's') {
+            uint16_t slen;
+            if (pos + 2 > len)
+                return 0;
+            memcpy(&slen, args + pos, 2);
+            pos += 2;
+            if (pos + slen > len)
+                return 0;
+            str.assign(args + pos, slen);
+            pos += slen;
+        } else {
+            if (pos + 8 > len)
+                return 0;
+            memcpy(&num, args + pos, 8);
+            pos += 8;
+        }
+        return tag;
+    };
+    for (const char* fp = fmt; *fp; fp++) {
+        if (*fp != '%') {
+            out += *fp;
+            continue;
+        }
+        if (fp[1] == '%') {
+            out += '%';
+            fp++;
+            continue;
+        }
+        string spec("%");
+        const char* sp = fp + 1;
+        uint64_t num = 0;
+        string str;
+        for (; *sp && strchr("-+ #0123456789.*", *sp); sp++) {
+            if (*sp == '*') {
+                // Width or precision from the argument list.
+                if (next(num, str))
+                    spec += to_string((int)num);
+            } else
+                spec += *sp;
+        }
+        while (*sp && strchr("hlLqjzt", *sp))
+            sp++;
+        if (!*sp)
+            break;
+        char conv = *sp;
+        fp = sp;
+        char tag = next(num, str);
+        if (!tag) {
+            out += "<?>";
+            continue;
+        }
+        double dv;
+        memcpy(&dv, &num, sizeof(dv));
+        if (strchr("di", conv)) {
+            long long val = tag == 'd' ? (long long)dv : (long long)num;
+            binlog_append(out, spec + "lld", val);
+        } else if (strchr("ouxX", conv)) {
+            unsigned long long val = tag == 'd' ? (unsigned long long)dv : num;
+            binlog_append(out, spec + "ll" + conv, val);
+        } else if (strchr("eEfFgGaA", conv)) {
+            double val = tag == 'd' ? dv : (tag == 'i' ? (double)(int64_t)num : (double)num);
+            binlog_append(out, spec + conv, val);
+        } else if (conv == 'c')
+            binlog_append(out, spec + 'c', (int)num);
+        else if (conv == 's')
+            binlog_append(out, spec + 's', tag == 's' ? str.c_str() : "<?>");
+        else if (conv == 'p')
+            binlog_append(out, spec + 'p', (void*)(uintptr_t)num);
+    }
+    return out;
+}
+#pragma GCC diagnostic pop
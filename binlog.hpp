@@ -0,0 +1,109 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_BINLOG_HPP
+#define C4S_BINLOG_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace c4s {
+
+//! Header at the beginning of each binary log file.
+struct binlog_file_header
+{
+    char magic[8];  //!< "C4SBLOG1"
+    uint64_t seq;   //!< Sequence number of the file. Grows by one at every rotation.
+    uint64_t size;  //!< Size of the file.
+    uint64_t start; //!< Time when the file was taken into use, nanoseconds since epoch.
+    uint64_t run;   //!< Id of the process run that wrote the file. Format ids are run specific.
+    char reserved[24];
+};
+
+//! Header of a single binary log record. Raw arguments (see log_args) follow the header.
+struct binlog_record
+{
+    uint32_t len;      //!< Length of the record including header and padding. Written last.
+    uint32_t format;   //!< Format id. Zero is "%s" for plain text messages.
+    uint64_t time;     //!< Nanoseconds since epoch.
+    uint8_t level;     //!< LOG_LEVEL of the message.
+    uint8_t count;     //!< Number of arguments.
+    uint16_t args_len; //!< Length of the arguments.
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Log sink that writes compact binary records into a ring of memory mapped files.
+/*! Sink is meant for high frequency trace logging. The files 'base.0' ... 'base.N-1' are
+  preallocated and mapped at construction. A message from the CS_VAPRT macros is stored as the
+  format id, time stamp, level and the raw arguments. The text is formatted only when the log is
+  read with binlog_reader or the c4slog tool. Format ids are assigned at run time, so each sink
+  has a run id and the format strings are appended to 'base.fmt' with the run id when a format is
+  written for the first time.<br>
+  Writers reserve space with a single atomic add, so the sink can be called from several threads
+  without locking. When the current file is full, the oldest file in the ring is cleared and taken
+  into use. Records are in the page cache as soon as print returns, so they survive a crash of
+  the process.
+*/
+class binlog_sink : public log_sink
+{
+  public:
+    //! Opens or creates the ring files.
+    binlog_sink(const path& base, size_t file_size = 0x1000000, unsigned int files = 4);
+    //! Unmaps and closes the files.
+    ~binlog_sink();
+
+    //! Stores a plain text message with format id zero.
+    void print(LOG_LEVEL, const char*) override;
+    void print_record(LOG_LEVEL, log_format&, const log_args&) override;
+    //! Schedules the write of the current file to the disk.
+    void flush() override;
+    bool is_thread_safe() const override { return true; }
+    bool is_binary() const override { return true; }
+
+  protected:
+    void write(LOG_LEVEL ll, uint32_t format, unsigned int count, const char* args1, size_t len1,
+               const char* args2, size_t len2);
+    void rotate(uint64_t seq);
+    void reset_file(uint64_t seq);
+    void write_formats();
+
+    std::string base;
+    size_t file_size;
+    std::vector<int> fids;
+    std::vector<char*> maps;
+    int format_fid;
+    uint64_t run;
+    std::atomic<uint64_t> state;            //!< Current file sequence << 40 | next free offset.
+    std::atomic<uint32_t> formats_written;  //!< Number of format ids stored to the format file.
+    std::mutex mtx;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Reads the files written by binlog_sink and renders the records as text.
+class binlog_reader
+{
+  public:
+    //! Reads the format file and the ring files of the given base name.
+    binlog_reader(const path& base);
+    //! Writes all records to the stream in file order. Returns the number of records.
+    size_t dump(std::ostream& os) const;
+    //! Formats the raw arguments of one record with printf format string.
+    static std::string render(const char* fmt, const char* args, size_t len);
+
+  protected:
+    std::map<std::pair<uint64_t, uint32_t>, std::string> formats; //!< Key is run and format id.
+    std::vector<std::string> files; //!< File contents in sequence order.
+};
+
+} // namespace c4s
+#endif
@@ -29,20 +29,38 @@
 
 #include "ntbs/ntbs.hpp"
 #include "ntbs/ntbs.cpp"
+#include "atomic_writer.cpp"
+#include "atomic_writer.hpp"
 #include "builder.cpp"
 #include "builder.hpp"
 #include "builder_gcc.cpp"
 #include "builder_gcc.hpp"
 #include "compiled_file.hpp"
+#include "hash.cpp"
+#include "hash.hpp"
+#include "line_tokenizer.cpp"
+#include "line_tokenizer.hpp"
+#include "manifest.cpp"
+#include "manifest.hpp"
 #include "path.cpp"
 #include "path.hpp"
 #include "path_list.cpp"
 #include "path_list.hpp"
+#include "proc_profile.cpp"
+#include "proc_profile.hpp"
 #include "process.cpp"
 #include "process.hpp" // includes RingBuffer
 #include "program_arguments.cpp"
 #include "program_arguments.hpp"
+#include "replacer.cpp"
+#include "replacer.hpp"
 #include "RingBuffer.cpp"
+#include "searcher.cpp"
+#include "searcher.hpp"
+#include "batch_executor.cpp"
+#include "batch_executor.hpp"
+#include "stat_cache.cpp"
+#include "stat_cache.hpp"
 #include "user.cpp"
 #include "user.hpp"
 #include "util.cpp"
@@ -51,6 +69,12 @@
 #include "variables.hpp"
 
 #include "logger.cpp"
+#include "async_sink.cpp"
+#include "async_sink.hpp"
+#include "binlog.cpp"
+#include "binlog.hpp"
+#include "rotating_sink.cpp"
+#include "rotating_sink.hpp"
 
 using namespace std;
 using namespace c4s;
@@ -62,8 +86,13 @@ program_arguments args;
 
 const char* cpp_list = "builder.cpp logger.cpp path.cpp path_list.cpp "
                        "program_arguments.cpp util.cpp variables.cpp "
-                       "settings.cpp process.cpp user.cpp builder_gcc.cpp "
-                       "RingBuffer.cpp ntbs/ntbs.cpp";
+                       "settings.cpp proc_profile.cpp process.cpp user.cpp builder_gcc.cpp "
+                       "RingBuffer.cpp stat_cache.cpp batch_executor.cpp replacer.cpp "
+                       "searcher.cpp atomic_writer.cpp hash.cpp line_tokenizer.cpp manifest.cpp "
+                       "async_sink.cpp binlog.cpp "
+                       "rotating_sink.cpp live_configuration.cpp proc_reactor.cpp "
+                       "proc_supervisor.cpp "
+                       "ntbs/ntbs.cpp";
 
 int install(const string& install_dir);
 
@@ -177,13 +206,32 @@ build(ostream* log)
         cout << "\nBuild failed.\n";
         delete make2;
         return 2;
+    }
+    delete make2;
+
+    cout << "\nBuilding c4slog\n";
+    path_list plc4slog;
+    plc4slog += path("c4slog.cpp");
+
+    builder* make3 = new builder_gcc(plc4slog, "c4slog", log);
+    make3->set(BUILD::BIN);
+    make3->add(args.is_set("-deb") ? BUILD::DEB : BUILD::REL);
+    if (args.is_set("-V"))
+        make3->add(BUILD::VERBOSE);
+    make3->add_comp("-fno-rtti");
+    make3->add_link("-lc4s");
+    make3->add_link(args.is_set("-deb") ? " -L./debug" : " -L./release");
+    if (builder::is_fail_status(make3->build()) ) {
+        cout << "\nBuild failed.\n";
+        delete make3;
+        return 2;
     } else {
         cout << "Compilation ready.\n";
 #if defined AUTOINSTALL && !__APPLE__
         install("/usr/local/");
 #endif
     }
-    delete make2;
+    delete make3;
     return 0;
 }
 // -------------------------------------------------------------------------------------------------
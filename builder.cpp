@@ -16,6 +16,9 @@
 #include "path.hpp"
 #include "path_list.hpp"
 #include "process.hpp"
+#if defined(__linux) || defined(__APPLE__)
+#include "stat_cache.hpp"
+#endif
 #include "util.hpp"
 #include "compiled_file.hpp"
 #include "builder.hpp"
@@ -186,9 +189,18 @@ builder::compile(const char* out_ext, const char* out_arg, bool echo_name)
         throw c4s_exception("builder::compile - sources not defined!");
 
     string prepared(vars.expand(c_opts.str()));
+#if defined(__linux) || defined(__APPLE__)
+    // Sources, objects and includes are checked repeatedly. Read their metadata only once.
+    stat_cache_scope stats;
+#endif
     try {
         if (logging)
             *log << "Considering " << sources.size() << " source files for build.\n";
+#if defined(__linux) || defined(__APPLE__)
+        path_list objects(sources, build_dir + C4S_DSEP, out_ext);
+        stats.get().prefetch(sources);
+        stats.get().prefetch(objects);
+#endif
         for (src = sources.begin(); src != sources.end(); src++) {
             current_obj.set(build_dir + C4S_DSEP, src->get_base_plain(), out_ext);
             if (src->outdated(current_obj) || (!has_any(BUILD::NOINCLUDES) && check_includes(*src))) {
@@ -208,6 +220,9 @@ builder::compile(const char* out_ext, const char* out_arg, bool echo_name)
                     compiler(options.str().c_str());
                 }
                 exec = true;
+#if defined(__linux) || defined(__APPLE__)
+                stats.get().invalidate(current_obj);
+#endif
                 if (compiler.last_return_value())
                     return BUILD_STATUS::ERROR;
             }
@@ -77,6 +77,14 @@ class builder : public BUILD
     //! Adds a compiled file for linking
     void add_link(const compiled_file& cf);
 
+#if defined(__linux) || defined(__APPLE__)
+    //! Sets the resource constraints for the compiler and linker processes.
+    void set_profile(const proc_profile& prof)
+    {
+        compiler.set_profile(prof);
+        linker.set_profile(prof);
+    }
+#endif
     //! Reads compiler variables from a file.
     void include_variables(const char* filename = 0);
     //! Inserts single variable to the variable list.
@@ -32,6 +32,9 @@ builder_gcc::parse_flags()
     gpp = has_any(BUILD::PLAIN_C) ? "gcc" : "g++";
     link = has_any(BUILD::PLAIN_C) ? "gcc" : "g++";
     compiler.set_command(gpp.c_str());
+    // gcc, g++ and ar read @file arguments. Very long link lines are spilled automatically.
+    compiler.set_response_file(true);
+    linker.set_response_file(true);
 
     if (!sources.size())
         throw c4s_exception("builder_gcc::parse_flags - sources not defined!");
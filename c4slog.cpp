@@ -0,0 +1,60 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+/*! \file c4slog.cpp
+ * \brief Decoder for the binary logs written by binlog_sink.
+ *
+ * Prints the records of the ring files as text in the same format as the text sinks:
+ *   c4slog -b /var/log/myapp.blog [-o myapp.log]
+ */
+
+#include "cpp4scripts.hpp"
+
+using namespace std;
+using namespace c4s;
+
+program_arguments args;
+
+#ifdef C4S_DEBUGTRACE
+std::ofstream c4slog;
+#endif
+
+int
+main(int argc, char** argv)
+{
+    args += argument("-b", true, "Sets VALUE as the base name of the binary log files.");
+    args += argument("-o", true, "Writes the text to file VALUE instead of stdout.");
+    args += argument("--help", false, "Outputs this help / parameter list.");
+    try {
+        args.initialize(argc, argv, 1);
+    } catch (const c4s_exception& ce) {
+        cerr << "Incorrect parameters.\n" << ce.what() << '\n';
+        args.usage();
+        return 1;
+    }
+    if (args.is_set("--help") || !args.is_set("-b")) {
+        args.usage();
+        return args.is_set("--help") ? 0 : 1;
+    }
+    try {
+        binlog_reader reader(path(args.get_value("-b")));
+        if (args.is_set("-o")) {
+            ofstream out(args.get_value("-o").c_str());
+            if (!out) {
+                cerr << "Unable to open " << args.get_value("-o") << " for writing.\n";
+                return 2;
+            }
+            reader.dump(out);
+        } else
+            reader.dump(cout);
+    } catch (const c4s_exception& ce) {
+        cerr << "Error: " << ce.what() << '\n';
+        return 2;
+    }
+    return 0;
+}
@@ -19,14 +19,35 @@
 #if defined(__linux) || defined(__APPLE__)
 #include "user.hpp"
 #endif
+#include "hash.hpp"
+#include "line_tokenizer.hpp"
 #include "path.hpp"
 #include "path_list.hpp"
+#if defined(__linux) || defined(__APPLE__)
+#include "stat_cache.hpp"
+#include "batch_executor.hpp"
+#include "fd_io.hpp"
+#include "atomic_writer.hpp"
+#include "replacer.hpp"
+#include "manifest.hpp"
+#endif
 #include "path_stack.hpp"
 #include "compiled_file.hpp"
 #include "program_arguments.hpp"
 #include "logger.hpp"
+#if defined(__linux) || defined(__APPLE__)
+#include "async_sink.hpp"
+#include "binlog.hpp"
+#include "rotating_sink.hpp"
+#endif
 #include "process.hpp"
 #include "settings.hpp"
+#if defined(__linux)
+#include "live_configuration.hpp"
+#include "proc_reactor.hpp"
+#include "proc_supervisor.hpp"
+#endif
+#include "searcher.hpp"
 #include "util.hpp"
 #include "variables.hpp"
 #include "builder.hpp"
@@ -0,0 +1,21 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_FD_IO_HPP
+#define C4S_FD_IO_HPP
+
+#include <sys/uio.h>
+
+namespace c4s {
+
+//! Writes all vectors to the descriptor, restarting after partial writes. Vectors are modified.
+/*! Throws path_exception if the write fails. (Linux&Apple only)*/
+void writev_all(int fd, struct iovec* iov, int count);
+
+} // namespace c4s
+#endif
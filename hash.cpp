@@ -0,0 +1,559 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__linux) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define C4S_HASH_X86 1
+#else
+#define C4S_HASH_X86 0
+#endif
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "hash.hpp"
+
+using namespace std;
+using namespace c4s;
+
+//! Files smaller than this are read with read() instead of mmap.
+const size_t HASH_MMAP_MIN = 0x40000;
+//! Read size for files that cannot be mapped (e.g. pipes).
+const size_t HASH_READ_SIZE = 0x100000;
+
+// -------------------------------------------------------------------------------------------------
+static inline uint64_t
+hash_rd64(const unsigned char* ptr)
+{
+    uint64_t val;
+    memcpy(&val, ptr, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#endif
+    return val;
+}
+// -------------------------------------------------------------------------------------------------
+static inline uint32_t
+hash_rd32(const unsigned char* ptr)
+{
+    uint32_t val;
+    memcpy(&val, ptr, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap32(val);
+#endif
+    return val;
+}
+// -------------------------------------------------------------------------------------------------
+static inline void
+hash_put64be(unsigned char* out, uint64_t val)
+{
+    for (int ndx = 7; ndx >= 0; ndx--) {
+        out[ndx] = (unsigned char)val;
+        val >>= 8;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+string
+c4s::hasher::hex()
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned char dg[HASH_MAX_DIGEST];
+    size_t len = digest(dg);
+    string result(len * 2, '0');
+    for (size_t ndx = 0; ndx < len; ndx++) {
+        result[ndx * 2] = digits[dg[ndx] >> 4];
+        result[ndx * 2 + 1] = digits[dg[ndx] & 0xf];
+    }
+    return result;
+}
+// -------------------------------------------------------------------------------------------------
+hasher*
+c4s::hasher::create(HASH_ALG alg)
+{
+    switch (alg) {
+    case HASH_FNV64:
+        return new fnv64_hasher();
+    case HASH_SHA256:
+        return new sha256_hasher();
+    default:
+        return new xxh64_hasher();
+    }
+}
+// -------------------------------------------------------------------------------------------------
+HASH_ALG
+c4s::hasher::parse_algorithm(const string& name)
+{
+    if (name == "fnv" || name == "fnv64")
+        return HASH_FNV64;
+    if (name == "xxh64" || name == "xxh")
+        return HASH_XXH64;
+    if (name == "sha256" || name == "sha")
+        return HASH_SHA256;
+    ostringstream os;
+    os << "hasher::parse_algorithm - Unknown hash algorithm: " << name;
+    throw c4s_exception(os.str());
+}
+// -------------------------------------------------------------------------------------------------
+const char*
+c4s::hasher::algorithm_name(HASH_ALG alg)
+{
+    switch (alg) {
+    case HASH_FNV64:
+        return "fnv64";
+    case HASH_SHA256:
+        return "sha256";
+    default:
+        return "xxh64";
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// http://www.isthe.com/chongo/src/fnv/hash_64.c
+void
+c4s::fnv64_hasher::update(const void* data, size_t len)
+{
+    const unsigned char* ptr = (const unsigned char*)data;
+    const unsigned char* end = ptr + len;
+    uint64_t hv = hash;
+    while (ptr < end) {
+        hv *= 0x100000001b3ULL;
+        hv ^= (uint64_t)*ptr++;
+    }
+    hash = hv;
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::fnv64_hasher::digest(unsigned char* out)
+{
+    hash_put64be(out, hash);
+    return 8;
+}
+
+// -------------------------------------------------------------------------------------------------
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+const uint64_t XXH_P1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_P2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_P3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_P4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_P5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t
+xxh_rotl(uint64_t val, int bits)
+{
+    return (val << bits) | (val >> (64 - bits));
+}
+static inline uint64_t
+xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_P1;
+}
+static inline uint64_t
+xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+//! Consumes full 32 byte stripes. Returns pointer past the last consumed byte.
+static const unsigned char*
+xxh_stripes(uint64_t* acc, const unsigned char* ptr, const unsigned char* end)
+{
+    uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+    while (ptr + 32 <= end) {
+        v1 = xxh_round(v1, hash_rd64(ptr));
+        v2 = xxh_round(v2, hash_rd64(ptr + 8));
+        v3 = xxh_round(v3, hash_rd64(ptr + 16));
+        v4 = xxh_round(v4, hash_rd64(ptr + 24));
+        ptr += 32;
+    }
+    acc[0] = v1;
+    acc[1] = v2;
+    acc[2] = v3;
+    acc[3] = v4;
+    return ptr;
+}
+//! Mixes the tail bytes and avalanches the result.
+static uint64_t
+xxh_finish(uint64_t hv, const unsigned char* ptr, size_t len)
+{
+    while (len >= 8) {
+        hv ^= xxh_round(0, hash_rd64(ptr));
+        hv = xxh_rotl(hv, 27) * XXH_P1 + XXH_P4;
+        ptr += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        hv ^= (uint64_t)hash_rd32(ptr) * XXH_P1;
+        hv = xxh_rotl(hv, 23) * XXH_P2 + XXH_P3;
+        ptr += 4;
+        len -= 4;
+    }
+    while (len) {
+        hv ^= (*ptr++) * XXH_P5;
+        hv = xxh_rotl(hv, 11) * XXH_P1;
+        len--;
+    }
+    hv ^= hv >> 33;
+    hv *= XXH_P2;
+    hv ^= hv >> 29;
+    hv *= XXH_P3;
+    hv ^= hv >> 32;
+    return hv;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::xxh64_hasher::reset()
+{
+    acc[0] = seed + XXH_P1 + XXH_P2;
+    acc[1] = seed + XXH_P2;
+    acc[2] = seed;
+    acc[3] = seed - XXH_P1;
+    total = 0;
+    buffered = 0;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::xxh64_hasher::update(const void* data, size_t len)
+{
+    const unsigned char* ptr = (const unsigned char*)data;
+    const unsigned char* end = ptr + len;
+    total += len;
+    if (buffered) {
+        size_t fill = 32 - buffered;
+        if (len < fill) {
+            memcpy(buffer + buffered, ptr, len);
+            buffered += len;
+            return;
+        }
+        memcpy(buffer + buffered, ptr, fill);
+        xxh_stripes(acc, buffer, buffer + 32);
+        ptr += fill;
+        buffered = 0;
+    }
+    ptr = xxh_stripes(acc, ptr, end);
+    if (ptr < end) {
+        buffered = end - ptr;
+        memcpy(buffer, ptr, buffered);
+    }
+}
+// -------------------------------------------------------------------------------------------------
+uint64_t
+c4s::xxh64_hasher::value() const
+{
+    uint64_t hv;
+    if (total >= 32) {
+        hv = xxh_rotl(acc[0], 1) + xxh_rotl(acc[1], 7) + xxh_rotl(acc[2], 12) +
+             xxh_rotl(acc[3], 18);
+        for (int ndx = 0; ndx < 4; ndx++)
+            hv = xxh_merge(hv, acc[ndx]);
+    } else
+        hv = seed + XXH_P5;
+    hv += total;
+    return xxh_finish(hv, buffer, buffered);
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::xxh64_hasher::digest(unsigned char* out)
+{
+    hash_put64be(out, value());
+    return 8;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param data Data to hash.
+  \param len Length of data.
+  \param seed Hash seed.
+  \retval uint64_t XXH64 hash value.
+*/
+uint64_t
+c4s::xxh64(const void* data, size_t len, uint64_t seed)
+{
+    xxh64_hasher hs(seed);
+    hs.update(data, len);
+    return hs.value();
+}
+
+// -------------------------------------------------------------------------------------------------
+// FIPS 180-4
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t
+sha_rotr(uint32_t val, int bits)
+{
+    return (val >> bits) | (val << (32 - bits));
+}
+// -------------------------------------------------------------------------------------------------
+static void
+sha256_blocks_c(uint32_t* state, const unsigned char* data, size_t count)
+{
+    uint32_t w[64];
+    while (count--) {
+        for (int ndx = 0; ndx < 16; ndx++)
+            w[ndx] = (uint32_t)data[ndx * 4] << 24 | (uint32_t)data[ndx * 4 + 1] << 16 |
+                     (uint32_t)data[ndx * 4 + 2] << 8 | data[ndx * 4 + 3];
+        for (int ndx = 16; ndx < 64; ndx++) {
+            uint32_t s0 = sha_rotr(w[ndx - 15], 7) ^ sha_rotr(w[ndx - 15], 18) ^ (w[ndx - 15] >> 3);
+            uint32_t s1 = sha_rotr(w[ndx - 2], 17) ^ sha_rotr(w[ndx - 2], 19) ^ (w[ndx - 2] >> 10);
+            w[ndx] = w[ndx - 16] + s0 + w[ndx - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int ndx = 0; ndx < 64; ndx++) {
+            uint32_t s1 = sha_rotr(e, 6) ^ sha_rotr(e, 11) ^ sha_rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + SHA256_K[ndx] + w[ndx];
+            uint32_t s0 = sha_rotr(a, 2) ^ sha_rotr(a, 13) ^ sha_rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += 64;
+    }
+}
+
+#if C4S_HASH_X86
+// -------------------------------------------------------------------------------------------------
+//! SHA-NI block function. Four rounds per sha256rnds2 pair, message schedule with sha256msg1/2.
+__attribute__((target("sha,sse4.1,ssse3"))) static void
+sha256_blocks_ni(uint32_t* state, const unsigned char* data, size_t count)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i st1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);          // CDAB
+    st1 = _mm_shuffle_epi32(st1, 0x1B);          // EFGH
+    __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);  // ABEF
+    st1 = _mm_blend_epi16(st1, tmp, 0xF0);       // CDGH
+
+    while (count--) {
+        __m128i abef = st0, cdgh = st1;
+        __m128i w[4], msg;
+        for (int g = 0; g < 16; g++) {
+            if (g < 4)
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + g * 16)), MASK);
+            msg = _mm_add_epi32(w[g & 3], _mm_loadu_si128((const __m128i*)&SHA256_K[g * 4]));
+            st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+            if (g >= 3 && g <= 14) {
+                __m128i& next = w[(g + 1) & 3];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[g & 3], w[(g + 3) & 3], 4));
+                next = _mm_sha256msg2_epu32(next, w[g & 3]);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+            if (g >= 1 && g <= 12)
+                w[(g + 3) & 3] = _mm_sha256msg1_epu32(w[(g + 3) & 3], w[g & 3]);
+        }
+        st0 = _mm_add_epi32(st0, abef);
+        st1 = _mm_add_epi32(st1, cdgh);
+        data += 64;
+    }
+    tmp = _mm_shuffle_epi32(st0, 0x1B);          // FEBA
+    st1 = _mm_shuffle_epi32(st1, 0xB1);          // DCHG
+    st0 = _mm_blend_epi16(tmp, st1, 0xF0);       // DCBA
+    st1 = _mm_alignr_epi8(st1, tmp, 8);          // ABEF
+    _mm_storeu_si128((__m128i*)&state[0], st0);
+    _mm_storeu_si128((__m128i*)&state[4], st1);
+}
+#endif
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::sha256_hasher::has_shani()
+{
+#if C4S_HASH_X86
+    static const bool shani = []() {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+            return false;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+        return (ebx & (1u << 29)) != 0;
+    }();
+    return shani;
+#else
+    return false;
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::sha256_hasher::reset()
+{
+    static const uint32_t init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(state, init, sizeof(state));
+    total = 0;
+    buffered = 0;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::sha256_hasher::blocks(const unsigned char* data, size_t count)
+{
+#if C4S_HASH_X86
+    if (has_shani()) {
+        sha256_blocks_ni(state, data, count);
+        return;
+    }
+#endif
+    sha256_blocks_c(state, data, count);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::sha256_hasher::update(const void* data, size_t len)
+{
+    const unsigned char* ptr = (const unsigned char*)data;
+    total += len;
+    if (buffered) {
+        size_t fill = 64 - buffered;
+        if (len < fill) {
+            memcpy(buffer + buffered, ptr, len);
+            buffered += len;
+            return;
+        }
+        memcpy(buffer + buffered, ptr, fill);
+        blocks(buffer, 1);
+        ptr += fill;
+        len -= fill;
+        buffered = 0;
+    }
+    if (len >= 64) {
+        blocks(ptr, len / 64);
+        ptr += len & ~(size_t)63;
+        len &= 63;
+    }
+    if (len) {
+        memcpy(buffer, ptr, len);
+        buffered = len;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Finalizes the hash. Call reset before reusing the hasher.
+ */
+size_t
+c4s::sha256_hasher::digest(unsigned char* out)
+{
+    uint64_t bits = total * 8;
+    unsigned char pad[72];
+    size_t padlen = (buffered < 56 ? 56 : 120) - buffered;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    hash_put64be(pad + padlen, bits);
+    update(pad, padlen + 8);
+    for (int ndx = 0; ndx < 8; ndx++) {
+        out[ndx * 4] = (unsigned char)(state[ndx] >> 24);
+        out[ndx * 4 + 1] = (unsigned char)(state[ndx] >> 16);
+        out[ndx * 4 + 2] = (unsigned char)(state[ndx] >> 8);
+        out[ndx * 4 + 3] = (unsigned char)state[ndx];
+    }
+    return 32;
+}
+
+// -------------------------------------------------------------------------------------------------
+/** Regular files larger than HASH_MMAP_MIN are memory mapped. Other files are read in large blocks.
+  \param name Name of the file.
+  \param hs Hasher to update.
+*/
+void
+c4s::hash_file(const char* name, hasher& hs)
+{
+    ostringstream os;
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        os << "hash_file - Unable to open file " << name << ": " << strerror(errno);
+        throw path_exception(os.str());
+    }
+    struct stat sb;
+    if (fstat(fd, &sb)) {
+        close(fd);
+        os << "hash_file - Unable to stat file " << name << ": " << strerror(errno);
+        throw path_exception(os.str());
+    }
+#if defined(__linux) || defined(__APPLE__)
+    if (S_ISREG(sb.st_mode) && (size_t)sb.st_size >= HASH_MMAP_MIN) {
+        void* map = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            madvise(map, sb.st_size, MADV_SEQUENTIAL);
+            hs.update(map, sb.st_size);
+            munmap(map, sb.st_size);
+            return;
+        }
+    }
+#endif
+    size_t bsize = S_ISREG(sb.st_mode) && (size_t)sb.st_size < HASH_READ_SIZE
+                       ? (size_t)sb.st_size + 1
+                       : HASH_READ_SIZE;
+    string buffer(bsize, 0);
+    for (;;) {
+        ssize_t br = read(fd, &buffer[0], bsize);
+        if (br < 0) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            os << "hash_file - Read error " << name << ": " << strerror(errno);
+            throw path_exception(os.str());
+        }
+        if (br == 0)
+            break;
+        hs.update(buffer.data(), br);
+    }
+    close(fd);
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param name Name of the file.
+  \param alg Hash algorithm.
+  \retval string Hex digest.
+*/
+string
+c4s::hash_file(const char* name, HASH_ALG alg)
+{
+    hasher* hs = hasher::create(alg);
+    try {
+        hash_file(name, *hs);
+    } catch (...) {
+        delete hs;
+        throw;
+    }
+    string result = hs->hex();
+    delete hs;
+    return result;
+}
@@ -0,0 +1,148 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_HASH_HPP
+#define C4S_HASH_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "config.hpp"
+
+namespace c4s {
+
+//! Hash algorithms supported by the hasher classes.
+enum HASH_ALG
+{
+    HASH_FNV64,  //!< FNV-1 64bit. Compatible with path::fnv_hash64.
+    HASH_XXH64,  //!< xxHash 64bit. Fast non-cryptographic hash.
+    HASH_SHA256  //!< SHA-256. Uses the x86 SHA extensions when the CPU has them.
+};
+
+//! Largest digest size in bytes.
+const size_t HASH_MAX_DIGEST = 32;
+
+// -----------------------------------------------------------------------------------------------------------
+//! Streaming hash interface.
+/*! Data is given in any number of update calls. Digest finalizes the hash and writes it in the
+  canonical byte order (big endian for the 64bit hashes) so that hex() gives the same output as the
+  usual command line tools. Call reset to start a new hash with the same object.
+*/
+class hasher
+{
+  public:
+    virtual ~hasher() {}
+    //! Starts a new hash.
+    virtual void reset() = 0;
+    //! Adds data to the hash.
+    virtual void update(const void* data, size_t len) = 0;
+    //! Writes the digest to 'out' which must hold at least size() bytes. Returns size().
+    virtual size_t digest(unsigned char* out) = 0;
+    //! Returns the digest size in bytes.
+    virtual size_t size() const = 0;
+    //! Returns the algorithm of this hasher.
+    virtual HASH_ALG algorithm() const = 0;
+
+    //! Returns the digest as a lower case hex string.
+    std::string hex();
+
+    //! Creates a hasher for the algorithm. Caller must delete it.
+    static hasher* create(HASH_ALG alg);
+    //! Returns the algorithm for a name: 'fnv', 'xxh64' or 'sha256'. Throws c4s_exception.
+    static HASH_ALG parse_algorithm(const std::string& name);
+    //! Returns the name of the algorithm.
+    static const char* algorithm_name(HASH_ALG alg);
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! FNV-1 64bit hash.
+class fnv64_hasher : public hasher
+{
+  public:
+    fnv64_hasher(uint64_t _salt = FNV_1_PRIME)
+      : salt(_salt)
+      , hash(_salt)
+    {}
+    void reset() override { hash = salt; }
+    void update(const void* data, size_t len) override;
+    size_t digest(unsigned char* out) override;
+    size_t size() const override { return 8; }
+    HASH_ALG algorithm() const override { return HASH_FNV64; }
+    //! Returns the current hash value.
+    uint64_t value() const { return hash; }
+
+  protected:
+    uint64_t salt;
+    uint64_t hash;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! xxHash 64bit (XXH64).
+/*! Four independent accumulators consume 32 bytes per round which keeps the CPU pipelines full.
+  On current hardware this runs close to memory bandwidth.
+*/
+class xxh64_hasher : public hasher
+{
+  public:
+    xxh64_hasher(uint64_t _seed = 0)
+      : seed(_seed)
+    {
+        reset();
+    }
+    void reset() override;
+    void update(const void* data, size_t len) override;
+    size_t digest(unsigned char* out) override;
+    size_t size() const override { return 8; }
+    HASH_ALG algorithm() const override { return HASH_XXH64; }
+    //! Returns the final hash value. Hasher can still be updated after this.
+    uint64_t value() const;
+
+  protected:
+    uint64_t seed;
+    uint64_t acc[4];
+    uint64_t total;
+    unsigned char buffer[32];
+    size_t buffered;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! SHA-256.
+/*! Block function uses the SHA-NI instructions if the CPU supports them and falls back to portable
+  C++ otherwise.
+*/
+class sha256_hasher : public hasher
+{
+  public:
+    sha256_hasher() { reset(); }
+    void reset() override;
+    void update(const void* data, size_t len) override;
+    size_t digest(unsigned char* out) override;
+    size_t size() const override { return 32; }
+    HASH_ALG algorithm() const override { return HASH_SHA256; }
+
+    //! Returns true if the CPU has the SHA extensions.
+    static bool has_shani();
+
+  protected:
+    void blocks(const unsigned char* data, size_t count);
+
+    uint32_t state[8];
+    uint64_t total;
+    unsigned char buffer[64];
+    size_t buffered;
+};
+
+//! Calculates XXH64 for the data in one call.
+uint64_t xxh64(const void* data, size_t len, uint64_t seed = 0);
+//! Adds the content of the named file to the hasher. Throws path_exception on errors.
+void hash_file(const char* name, hasher& hs);
+//! Returns the hex digest of the named file with given algorithm.
+std::string hash_file(const char* name, HASH_ALG alg);
+
+} // namespace c4s
+#endif
@@ -0,0 +1,149 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <string.h>
+#if defined(__linux) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <fstream>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "line_tokenizer.hpp"
+
+using namespace std;
+
+// -------------------------------------------------------------------------------------------------
+/** Empty files and files that cannot be mapped, e.g. pipes, are read into the buffer instead.
+  \param file Name of the file.
+*/
+c4s::line_tokenizer::line_tokenizer(const string& file)
+  : lineno(0)
+  , map(0)
+  , map_len(0)
+{
+#if defined(__linux) || defined(__APPLE__)
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        ostringstream os;
+        os << "line_tokenizer - unable to open '" << file << "': " << strerror(errno);
+        throw path_exception(os.str());
+    }
+    struct stat sb;
+    if (!fstat(fd, &sb) && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        void* mem = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem != MAP_FAILED) {
+            map = mem;
+            map_len = sb.st_size;
+#if defined(MADV_SEQUENTIAL)
+            madvise(map, map_len, MADV_SEQUENTIAL);
+#endif
+        }
+    }
+    close(fd);
+    if (map) {
+        begin = (const char*)map;
+        ptr = begin;
+        end = begin + map_len;
+        return;
+    }
+#endif
+    ifstream input(file.c_str(), ios::in | ios::binary);
+    if (!input) {
+        ostringstream os;
+        os << "line_tokenizer - unable to open '" << file << "'";
+        throw path_exception(os.str());
+    }
+    ostringstream content;
+    content << input.rdbuf();
+    buffer = content.str();
+    begin = buffer.data();
+    ptr = begin;
+    end = begin + buffer.size();
+}
+// -------------------------------------------------------------------------------------------------
+c4s::line_tokenizer::line_tokenizer(istream& input)
+  : lineno(0)
+  , map(0)
+  , map_len(0)
+{
+    char chunk[0x10000];
+    while (input.read(chunk, sizeof(chunk)) || input.gcount())
+        buffer.append(chunk, input.gcount());
+    begin = buffer.data();
+    ptr = begin;
+    end = begin + buffer.size();
+}
+// -------------------------------------------------------------------------------------------------
+c4s::line_tokenizer::line_tokenizer(const char* data, size_t len)
+  : begin(data)
+  , ptr(data)
+  , end(data + len)
+  , lineno(0)
+  , map(0)
+  , map_len(0)
+{}
+// -------------------------------------------------------------------------------------------------
+c4s::line_tokenizer::~line_tokenizer()
+{
+#if defined(__linux) || defined(__APPLE__)
+    if (map)
+        munmap(map, map_len);
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+std::string_view
+c4s::line_tokenizer::trim(const char* start, const char* stop)
+{
+    while (start < stop && (*start == ' ' || *start == '\t' || *start == '\r'))
+        start++;
+    while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t' || stop[-1] == '\r'))
+        stop--;
+    return string_view(start, stop - start);
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::line_tokenizer::next_line(string_view& line)
+{
+    while (ptr < end) {
+        const char* nl = (const char*)memchr(ptr, '\n', end - ptr);
+        const char* stop = nl ? nl : end;
+        line = trim(ptr, stop);
+        ptr = nl ? nl + 1 : end;
+        lineno++;
+        if (!line.empty() && line[0] != '#')
+            return true;
+    }
+    return false;
+}
+// -------------------------------------------------------------------------------------------------
+/** Name is the text before the first '=' and value the text after it, both trimmed.
+  \param name Receives the name. Never empty when true is returned.
+  \param value Receives the value. May be empty.
+*/
+bool
+c4s::line_tokenizer::next_pair(string_view& name, string_view& value)
+{
+    string_view line;
+    while (next_line(line)) {
+        const char* eq = (const char*)memchr(line.data(), '=', line.size());
+        if (!eq)
+            continue;
+        name = trim(line.data(), eq);
+        if (name.empty())
+            continue;
+        value = trim(eq + 1, line.data() + line.size());
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,65 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_LINE_TOKENIZER_HPP
+#define C4S_LINE_TOKENIZER_HPP
+
+#include <istream>
+#include <string>
+#include <string_view>
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Splits line oriented configuration files into lines and 'name = value' pairs.
+/*! The whole file is mapped into memory (or read in one go where mapping is not available) and
+  the tokens are returned as string views into it, so lines have no length limit and nothing is
+  copied. Views are valid as long as the tokenizer exists.<br>
+  Lines may end with LF or CRLF. White space around lines, names and values is trimmed. Blank lines
+  and lines whose first non-blank character is '#' are skipped.
+*/
+class line_tokenizer
+{
+  public:
+    //! Maps the file. Throws path_exception if the file cannot be opened.
+    explicit line_tokenizer(const std::string& file);
+    //! Reads the rest of the stream into memory.
+    explicit line_tokenizer(std::istream& input);
+    //! Tokenizes the given data. Data must stay valid while the tokenizer is used.
+    line_tokenizer(const char* data, size_t len);
+    ~line_tokenizer();
+    line_tokenizer(const line_tokenizer&) = delete;
+    line_tokenizer& operator=(const line_tokenizer&) = delete;
+
+    //! Returns the next line that is not blank or a comment. Returns false at the end.
+    bool next_line(std::string_view& line);
+    //! Returns the next line that has a name followed by '='. Other lines are skipped.
+    bool next_pair(std::string_view& name, std::string_view& value);
+    //! Number of the line returned last. First line is 1.
+    size_t get_line() const { return lineno; }
+    //! Starts again from the first line.
+    void rewind()
+    {
+        ptr = begin;
+        lineno = 0;
+    }
+
+  protected:
+    static std::string_view trim(const char* start, const char* stop);
+
+    std::string buffer; //!< Content when the file was read instead of mapped.
+    const char* begin;
+    const char* ptr;
+    const char* end;
+    size_t lineno;
+    void* map;
+    size_t map_len;
+};
+
+} // namespace c4s
+#endif
@@ -0,0 +1,186 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "user.hpp"
+#include "path.hpp"
+#include "logger.hpp"
+#include "settings.hpp"
+#include "live_configuration.hpp"
+
+using namespace std;
+using namespace c4s;
+
+// -------------------------------------------------------------------------------------------------
+/** Snapshot enters the rcu slot before reading the configuration pointer. The configuration is
+  deleted only after all snapshots of it have been released.
+*/
+c4s::live_configuration::snapshot::snapshot(live_configuration& _owner)
+  : owner(_owner)
+{
+    slot = owner.rcu.enter();
+    conf = owner.confs[slot];
+    generation = owner.generations[slot];
+}
+// -------------------------------------------------------------------------------------------------
+c4s::live_configuration::snapshot::~snapshot()
+{
+    owner.rcu.leave(slot);
+}
+// -------------------------------------------------------------------------------------------------
+c4s::live_configuration::live_configuration(const path& source, configuration::FORMAT _format,
+                                            validator _check)
+  : name(source.get_path())
+  , dir(source.get_dir().empty() ? string("./") : source.get_dir())
+  , base(source.get_base())
+  , format(_format)
+  , check(_check)
+{
+    string err;
+    configuration* first = load(err);
+    if (!first)
+        throw c4s_exception("live_configuration - unable to read " + name + ": " + err);
+    confs[0] = first;
+    confs[1] = 0;
+    generations[0] = 1;
+    generations[1] = 0;
+    generation.store(1);
+
+    // Directory is watched instead of the file so that the watch survives a replacing rename.
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd == -1 ||
+        inotify_add_watch(notify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        ostringstream sserr;
+        sserr << "live_configuration - unable to watch " << dir << ": (" << errno << ") "
+              << strerror(errno);
+        if (notify_fd != -1)
+            close(notify_fd);
+        delete first;
+        throw c4s_exception(sserr.str());
+    }
+    running.store(true);
+    worker = thread(&live_configuration::run, this);
+}
+// -------------------------------------------------------------------------------------------------
+c4s::live_configuration::~live_configuration()
+{
+    running.store(false);
+    worker.join();
+    close(notify_fd);
+    for (const configuration* conf : confs)
+        delete conf;
+}
+// -------------------------------------------------------------------------------------------------
+/** Reads and validates the file.
+  \param err Receives the reason of a failure.
+  \retval configuration* New indexed configuration or null on failure.
+*/
+configuration*
+c4s::live_configuration::load(std::string& err)
+{
+    ifstream input(name);
+    if (!input) {
+        err = "unable to open the file";
+        return 0;
+    }
+    configuration* conf = new configuration();
+    if (!conf->read(format, input)) {
+        err = conf->get_error();
+        delete conf;
+        return 0;
+    }
+    if (check && !check(*conf, err)) {
+        delete conf;
+        return 0;
+    }
+    // Readers share the configuration, so the lazy index must be ready before publishing.
+    conf->reindex();
+    return conf;
+}
+// -------------------------------------------------------------------------------------------------
+//! Switches the snapshots to the new configuration and deletes the previous one. Call under mtx.
+void
+c4s::live_configuration::publish(configuration* conf)
+{
+    unsigned int next = rcu.next();
+    confs[next] = conf;
+    generations[next] = generation.load() + 1;
+    unsigned int old = rcu.swap();
+    generation++;
+    delete confs[old];
+    confs[old] = 0;
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::live_configuration::reload()
+{
+    lock_guard<mutex> lg(mtx);
+    string err;
+    configuration* conf = load(err);
+    if (!conf) {
+        error = err;
+        CS_VAPRT_ERRO("live_configuration::reload - %s not taken into use: %s", name.c_str(),
+                      err.c_str());
+        return false;
+    }
+    error.clear();
+    publish(conf);
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+std::string
+c4s::live_configuration::get_error()
+{
+    lock_guard<mutex> lg(mtx);
+    return error;
+}
+// -------------------------------------------------------------------------------------------------
+/** Background thread. Waits for events on the directory and reloads the file when it has been
+  written or renamed into place. Events that arrive within a short while are handled with one
+  reload, since editors often write the file in several steps.
+*/
+void
+c4s::live_configuration::run()
+{
+    alignas(struct inotify_event) char events[4096];
+    struct pollfd pfd;
+    pfd.fd = notify_fd;
+    pfd.events = POLLIN;
+    while (running.load()) {
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        bool changed = false;
+        ssize_t len;
+        while ((len = read(notify_fd, events, sizeof(events))) > 0) {
+            for (char* ptr = events; ptr < events + len;) {
+                struct inotify_event* ev = (struct inotify_event*)ptr;
+                if (ev->len && !base.compare(ev->name))
+                    changed = true;
+                ptr += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        if (changed) {
+            // Let the burst settle. Events that arrive meanwhile are covered by this reload.
+            this_thread::sleep_for(chrono::milliseconds(50));
+            while (read(notify_fd, events, sizeof(events)) > 0)
+                ;
+        }
+        if (changed && running.load())
+            reload();
+    }
+}
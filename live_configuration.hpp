@@ -0,0 +1,110 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_LIVE_CONFIGURATION_HPP
+#define C4S_LIVE_CONFIGURATION_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "rcu_epoch.hpp"
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Configuration that is reloaded automatically when its file changes.
+/*! The directory of the file is watched with inotify, so both in-place writes and editors that
+  replace the file with a rename are noticed. A background thread parses the new file into a new
+  configuration, runs the optional validator on it and then publishes it. If parsing or
+  validation fails, the previous configuration stays in use and the error is logged.<br>
+  Readers take a snapshot, which pins the current configuration without locks. A replaced
+  configuration is deleted after the last snapshot of it is released, so keep snapshots short
+  lived: the background thread waits for them before it can publish the next version.
+  \code
+  live_configuration live(path("/etc/app/app.json"), configuration::FORMAT::JSON);
+  ...
+  {
+      live_configuration::snapshot conf = live.get();
+      conf->get_value("server", "port", port);
+  }
+  \endcode
+*/
+class live_configuration
+{
+  public:
+    //! Returns false and sets the message if the new configuration must not be taken into use.
+    typedef std::function<bool(const configuration&, std::string&)> validator;
+
+    //! Read guard for the current configuration.
+    class snapshot
+    {
+      public:
+        explicit snapshot(live_configuration& owner);
+        ~snapshot();
+        snapshot(const snapshot&) = delete;
+        snapshot& operator=(const snapshot&) = delete;
+
+        const configuration* operator->() const { return conf; }
+        const configuration& operator*() const { return *conf; }
+        //! Generation of the configuration. First read is generation 1.
+        size_t get_generation() const { return generation; }
+
+      private:
+        live_configuration& owner;
+        unsigned int slot;
+        const configuration* conf;
+        size_t generation;
+    };
+
+    //! Reads the file and starts watching it. Throws c4s_exception if the first read fails.
+    /*! \param source Configuration file.
+        \param format Format of the file.
+        \param check Optional validator for new versions. It is run also for the first read.*/
+    live_configuration(const path& source, configuration::FORMAT format,
+                       validator check = validator());
+    //! Stops the background thread.
+    ~live_configuration();
+
+    //! Returns the snapshot of the current configuration.
+    snapshot get() { return snapshot(*this); }
+    //! Reads the file now. Returns false if the file was not taken into use.
+    /*! Waits for the snapshots of the previous configuration, so the calling thread must not
+        hold one.*/
+    bool reload();
+    //! Number of published configurations.
+    size_t get_generation() const { return generation.load(); }
+    //! Returns the error of the latest failed reload or an empty string.
+    std::string get_error();
+
+  protected:
+    configuration* load(std::string& err);
+    void publish(configuration* conf);
+    void run();
+
+    std::string name;
+    std::string dir;
+    std::string base;
+    configuration::FORMAT format;
+    validator check;
+
+    const configuration* confs[2]; //!< Current and previous configuration. Index is the rcu slot.
+    size_t generations[2];         //!< Generations of the configurations in confs.
+    rcu_epoch rcu;                 //!< Snapshots of the configurations.
+    std::atomic<size_t> generation;
+
+    std::string error;
+    std::mutex mtx;                //!< Serializes reloads and guards error.
+    std::atomic<bool> running;
+    int notify_fd;
+    std::thread worker;
+};
+
+} // namespace c4s
+#endif
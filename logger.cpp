@@ -9,6 +9,7 @@
 #if defined(__linux) || defined(__APPLE__)
 #include <stdarg.h>
 #include <syslog.h>
+#include <sys/uio.h>
 #else
 #include <io.h>
 #endif
@@ -16,6 +17,8 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <atomic>
+#include <charconv>
 
 #include "config.hpp"
 #include "exception.hpp"
@@ -38,28 +41,157 @@ int c4s::lowio_sink::mode = 0;
 const char* g_level_names[c4s::LL_MAX] = { "NONE",   "TRACE",   "DEBUG", "INFO",
                                            "NOTICE", "WARNING", "ERROR", "CRITICAL" };
 
+//! Level part of the log line. All tags have the same length.
+static const char g_level_tags[c4s::LL_MAX][13] = {
+    " [NONE    ] ", " [TRACE   ] ", " [DEBUG   ] ", " [INFO    ] ",
+    " [NOTICE  ] ", " [WARNING ] ", " [ERROR   ] ", " [CRITICAL] "
+};
+const size_t LEVEL_TAG_LEN = 12;
+static std::atomic<int> g_ts_flags(LTS_LOCAL);
+static std::atomic<int> g_ts_precision(0);
+//! Incremented when the format changes so that the thread caches are rebuilt.
+static std::atomic<int> g_ts_generation(0);
+
+//! Per thread time stamp. Date and time up to seconds are formatted once a second.
+struct ts_cache
+{
+    time_t sec;
+    int generation;
+    size_t prefix_len; //!< Length of the date and time up to seconds.
+    char line[96];
+};
+// -------------------------------------------------------------------------------------------------
+/**
+  \param flags LTS_UTC and/or LTS_ISO8601.
+  \param precision Sub-second digits. Values other than 0, 3 and 6 are rounded down to these.
+*/
+void
+c4s::log_sink::set_timestamp(int flags, int precision)
+{
+    g_ts_flags.store(flags);
+    g_ts_precision.store(precision >= 6 ? 6 : (precision >= 3 ? 3 : 0));
+    g_ts_generation.fetch_add(1);
+}
+// -------------------------------------------------------------------------------------------------
+//! Formats the date and time up to seconds into the cache.
+static void
+ts_rebuild(ts_cache& tc, time_t sec, int flags)
+{
+    struct tm ltm;
+#if defined(__linux) || defined(__APPLE__)
+    struct tm* lt = flags & LTS_UTC ? gmtime_r(&sec, &ltm) : localtime_r(&sec, &ltm);
+#else
+    struct tm* lt = flags & LTS_UTC ? gmtime(&sec) : localtime(&sec);
+#endif
+    if (!lt) {
+        memset(&ltm, 0, sizeof(ltm));
+        lt = &ltm;
+    }
+    int len = sprintf(tc.line, "%d-%02d-%02d%c%02d:%02d:%02d", lt->tm_year + 1900, lt->tm_mon + 1,
+                      lt->tm_mday, flags & LTS_ISO8601 ? 'T' : ' ', lt->tm_hour, lt->tm_min,
+                      lt->tm_sec);
+    tc.prefix_len = len;
+    tc.sec = sec;
+#if defined(__linux) || defined(__APPLE__)
+    // Zone suffix does not change within a second. Kept at the end of the line buffer.
+    if ((flags & LTS_ISO8601) && !(flags & LTS_UTC)) {
+        long off = lt->tm_gmtoff / 60;
+        char sign = off < 0 ? '-' : '+';
+        if (off < 0)
+            off = -off;
+        sprintf(tc.line + 64, "%c%02ld:%02ld", sign, off / 60, off % 60);
+    } else
+#endif
+        strcpy(tc.line + 64, flags & LTS_ISO8601 ? "Z" : "");
+}
 // -------------------------------------------------------------------------------------------------
+/** Date and time are formatted only when the second changes. Otherwise only the sub-second digits
+  and the level are written. Coarse real time clock is used when there are no sub-second digits.
+  \param ll Log level for the level tag.
+  \param len If not null, length of the returned string is stored here.
+  \retval const char* Time stamp and level followed by a space.
+*/
 const char*
-c4s::log_sink::get_datetime(LOG_LEVEL ll)
+c4s::log_sink::get_datetime(LOG_LEVEL ll, size_t* len)
 {
-    static char datetime[64]; // 2013-01-01 23:30:30 [CRITICAL]
-    time_t now = time(0);
-    struct tm* lt = localtime(&now);
-    sprintf(datetime, "%d-%02d-%02d %02d:%02d:%02d [%-8s] ", lt->tm_year + 1900, lt->tm_mon + 1,
-            lt->tm_mday, lt->tm_hour, lt->tm_min, lt->tm_sec, g_level_names[ll]);
-    return datetime;
+    static thread_local ts_cache tc = { (time_t)-1, -1, 0, { 0 } };
+    int flags = g_ts_flags.load(memory_order_relaxed);
+    int precision = g_ts_precision.load(memory_order_relaxed);
+    int generation = g_ts_generation.load(memory_order_relaxed);
+    struct timespec now;
+#if defined(__linux) && defined(CLOCK_REALTIME_COARSE)
+    // Coarse clock ticks in milliseconds, so it is only good for whole seconds.
+    clock_gettime(precision ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE, &now);
+#elif defined(__linux) || defined(__APPLE__)
+    clock_gettime(CLOCK_REALTIME, &now);
+#else
+    now.tv_sec = time(0);
+    now.tv_nsec = 0;
+#endif
+    if (now.tv_sec != tc.sec || generation != tc.generation) {
+        ts_rebuild(tc, now.tv_sec, flags);
+        tc.generation = generation;
+    }
+    char* ptr = tc.line + tc.prefix_len;
+    if (precision) {
+        long frac = precision == 3 ? now.tv_nsec / 1000000 : now.tv_nsec / 1000;
+        *ptr++ = '.';
+        for (int ndx = precision - 1; ndx >= 0; ndx--) {
+            ptr[ndx] = '0' + frac % 10;
+            frac /= 10;
+        }
+        ptr += precision;
+    }
+    for (const char* zone = tc.line + 64; *zone; zone++)
+        *ptr++ = *zone;
+    ll = ll < LL_MAX ? ll : LL_NONE;
+    memcpy(ptr, g_level_tags[ll], LEVEL_TAG_LEN + 1);
+    if (len)
+        *len = ptr - tc.line + LEVEL_TAG_LEN;
+    return tc.line;
+}
+// -------------------------------------------------------------------------------------------------
+//! Registered CS_VAPRT formats. Index is the format id.
+static std::mutex g_format_mtx;
+static std::vector<const char*> g_formats(1, "%s");
+
+uint32_t
+c4s::log_format::register_format()
+{
+    lock_guard<mutex> lg(g_format_mtx);
+    uint32_t val = id.load(memory_order_relaxed);
+    if (!val) {
+        val = (uint32_t)g_formats.size();
+        g_formats.push_back(fmt);
+        id.store(val, memory_order_release);
+    }
+    return val;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param list Formats with ids from 'first' onwards are appended here.
+  \param first Id of the first format to return.
+  \retval uint32_t Total number of registered formats.
+*/
+uint32_t
+c4s::log_format::get_registered(vector<const char*>& list, uint32_t first)
+{
+    lock_guard<mutex> lg(g_format_mtx);
+    for (size_t ndx = first; ndx < g_formats.size(); ndx++)
+        list.push_back(g_formats[ndx]);
+    return (uint32_t)g_formats.size();
 }
 // -------------------------------------------------------------------------------------------------
 void
 c4s::logbase::vaprt(c4s::LOG_LEVEL ll, const char* str, ...)
 {
-    static char vabuffer[C4S_LOG_VABUFFER_SIZE];
+    static thread_local char vabuffer[C4S_LOG_VABUFFER_SIZE];
     va_list va;
     if (ll != LL_NONE && ll >= level) {
         va_start(va, str);
         vsnprintf(vabuffer, sizeof(vabuffer) - 1, str, va);
         va_end(va);
-        sink->print(ll, vabuffer);
+        emit(ll, vabuffer);
     }
 }
 
@@ -167,11 +299,19 @@ lowio_sink::~lowio_sink()
 void
 lowio_sink::print(c4s::LOG_LEVEL ll, const char* str)
 {
-    write(fid, get_datetime(ll), 31);
 #if defined(__linux) || defined(__APPLE__)
-    write(fid, str, strlen(str));
-    write(fid, "\n", 1);
+    // Single writev keeps the line together when several threads or processes share the file.
+    struct iovec iov[3];
+    iov[0].iov_base = (void*)get_datetime(ll, &iov[0].iov_len);
+    iov[1].iov_base = (void*)str;
+    iov[1].iov_len = strlen(str);
+    iov[2].iov_base = (void*)"\n";
+    iov[2].iov_len = 1;
+    writev(fid, iov, 3);
 #else
+    size_t dtlen;
+    const char* dt = get_datetime(ll, &dtlen);
+    _write(fid, dt, (unsigned int)dtlen);
     _write(fid, str, (unsigned int)strlen(str));
     _write(fid, "\n", 1);
 #endif
@@ -200,12 +340,77 @@ c4s::logbase::str2level(const string& name)
     return LL_NONE;
 }
 
+// -------------------------------------------------------------------------------------------------
+c4s::logger::line_buffer&
+c4s::logger::line()
+{
+    static thread_local line_buffer lb = { 0, { 0 } };
+    return lb;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::logger::append(const char* str, size_t len)
+{
+    line_buffer& lb = line();
+    size_t room = sizeof(lb.data) - 1 - lb.len;
+    if (len > room)
+        len = room;
+    memcpy(lb.data + lb.len, str, len);
+    lb.len += len;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::logger::append_num(long long val)
+{
+    char num[24];
+    to_chars_result res = to_chars(num, num + sizeof(num), val);
+    append(num, res.ptr - num);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::logger::append_num(unsigned long long val)
+{
+    char num[24];
+    to_chars_result res = to_chars(num, num + sizeof(num), val);
+    append(num, res.ptr - num);
+}
+// -------------------------------------------------------------------------------------------------
+//! Uses the same format as the default ostream output.
+void
+c4s::logger::append_num(double val)
+{
+    char num[32];
+    int len = snprintf(num, sizeof(num), "%g", val);
+    if (len > 0)
+        append(num, (size_t)len < sizeof(num) ? len : sizeof(num) - 1);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::logger::append_ptr(const void* val)
+{
+    char num[24] = { '0', 'x' };
+    to_chars_result res = to_chars(num + 2, num + sizeof(num), (uintptr_t)val, 16);
+    append(num, res.ptr - num);
+}
 // -------------------------------------------------------------------------------------------------
 c4s::logger&
 c4s::logger::operator<<(c4s::LOG_LEVEL ll)
 {
+    line_buffer& lb = line();
+    lb.data[lb.len] = 0;
     if (ll != LL_NONE && ll >= level)
-        sink->print(ll, buffer.str().c_str());
-    buffer.str("");
+        emit(ll, lb.data);
+    lb.len = 0;
     return *this;
 }
+// -------------------------------------------------------------------------------------------------
+/** Only the part written after the constructor is printed. The buffer is then returned to the
+  state it was in, so that an enclosing line can continue.
+*/
+c4s::log_line::~log_line()
+{
+    logger::line_buffer& lb = logger::line();
+    lb.data[lb.len] = 0;
+    logbase::get()->print(ll, lb.data + start);
+    lb.len = start;
+}
@@ -10,6 +10,15 @@
 #ifndef C4S_LOGGER_HPP
 #define C4S_LOGGER_HPP
 
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
 namespace c4s {
 
 class path;
@@ -29,6 +38,133 @@ enum LOG_LEVEL
     LL_MAX
 };
 
+/** \defgroup LogTimeStamp Time stamp options for log sinks
+    @{
+*/
+const int LTS_LOCAL = 0;      //!< Local time 'YYYY-MM-DD hh:mm:ss' (default).
+const int LTS_UTC = 0x1;      //!< Use UTC instead of local time.
+const int LTS_ISO8601 = 0x2;  //!< ISO-8601 format 'YYYY-MM-DDThh:mm:ss' with zone suffix.
+/**@}*/
+
+// -----------------------------------------------------------------------------------------------------------
+//! Format string of a CS_VAPRT call site.
+/*! Each CS_VAPRT macro with a string literal format has a constant initialized static log_format at
+  the call site. Binary sinks store only the format id with the raw arguments. The id is assigned
+  when the call site is used for the first time. Id zero is reserved for the "%s" format of plain
+  text messages. Formats given at run time, e.g. as a const char* variable, are formatted as text
+  on each call.*/
+class log_format
+{
+  public:
+    //! True for the type of a string literal, i.e. a reference to a const char array.
+    template<typename T>
+    struct is_literal : std::false_type
+    {};
+    template<size_t N>
+    struct is_literal<const char (&)[N]> : std::true_type
+    {};
+
+    constexpr log_format(const char* _fmt)
+      : fmt(_fmt)
+      , id(0)
+    {}
+    //! Returns the id of the format. Registers the format at the first call.
+    uint32_t get_id()
+    {
+        uint32_t val = id.load(std::memory_order_acquire);
+        return val ? val : register_format();
+    }
+    //! Appends the formats registered after 'first' into the list. Returns the number of formats.
+    static uint32_t get_registered(std::vector<const char*>& list, uint32_t first);
+
+    const char* fmt;
+
+  protected:
+    uint32_t register_format();
+    std::atomic<uint32_t> id;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Raw arguments of a CS_VAPRT message for binary sinks.
+/*! Each argument is stored as a type tag followed by the value: 'i' for signed and 'u' for unsigned
+  integers, 'd' for floating point numbers, 'p' for pointers and 's' for strings. Numbers are 8
+  bytes. Strings have a 16-bit length before the characters and are truncated to fit. Arguments
+  after the first one that does not fit are left out.*/
+struct log_args
+{
+    static const size_t MAX = 512;
+    log_args()
+      : len(0)
+      , count(0)
+      , full(false)
+    {}
+    //! True if values of the type can be stored. Other types are logged as formatted text.
+    template<typename T>
+    static constexpr bool is_supported()
+    {
+        return std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+               std::is_pointer<T>::value || std::is_null_pointer<T>::value;
+    }
+    template<typename T>
+    void put(T val)
+    {
+        static_assert(is_supported<T>(), "log_args::put - unsupported argument type.");
+        if constexpr (std::is_enum<T>::value) {
+            put((typename std::underlying_type<T>::type)val);
+        } else if constexpr (std::is_null_pointer<T>::value) {
+            uint64_t pv = 0;
+            put_raw('p', &pv, sizeof(pv));
+        } else if constexpr (std::is_floating_point<T>::value) {
+            double dv = val;
+            put_raw('d', &dv, sizeof(dv));
+        } else if constexpr (std::is_pointer<T>::value) {
+            uint64_t pv = (uintptr_t)val;
+            put_raw('p', &pv, sizeof(pv));
+        } else if constexpr (std::is_signed<T>::value) {
+            int64_t iv = val;
+            put_raw('i', &iv, sizeof(iv));
+        } else {
+            uint64_t uv = val;
+            put_raw('u', &uv, sizeof(uv));
+        }
+    }
+    void put(const char* str)
+    {
+        if (!str)
+            str = "(null)";
+        size_t slen = strlen(str);
+        if (full || len + 4 > MAX) {
+            full = true;
+            return;
+        }
+        if (slen > MAX - len - 3)
+            slen = MAX - len - 3;
+        uint16_t slen16 = (uint16_t)slen;
+        data[len] = 's';
+        memcpy(data + len + 1, &slen16, 2);
+        memcpy(data + len + 3, str, slen);
+        len += 3 + slen;
+        count++;
+    }
+    void put(char* str) { put((const char*)str); }
+    void put_raw(char tag, const void* val, size_t size)
+    {
+        if (full || len + 1 + size > MAX) {
+            full = true;
+            return;
+        }
+        data[len] = tag;
+        memcpy(data + len + 1, val, size);
+        len += 1 + size;
+        count++;
+    }
+
+    size_t len;
+    unsigned int count;
+    bool full;
+    char data[MAX];
+};
+
 // -----------------------------------------------------------------------------------------------------------
 //! Pure virtual base class for log sinks (appender in Log4j teminlogy)
 /*! Sink provides uniform interface to various log outputs. Please see the inherited sink classes
@@ -46,9 +182,23 @@ class log_sink
         \param ll Log level of this message.
         \param msg Message to be printed into output.*/
     virtual void print(LOG_LEVEL ll, const char* msg) = 0;
+    //! Writes possibly buffered messages to the output. Default does nothing.
+    virtual void flush() {}
+    //! Returns true if print can be called from several threads at the same time.
+    virtual bool is_thread_safe() const { return false; }
+    //! Returns true if the sink stores CS_VAPRT messages unformatted with print_record.
+    virtual bool is_binary() const { return false; }
+    //! Stores the format id and the raw arguments of a message. Called only for binary sinks.
+    virtual void print_record(LOG_LEVEL, log_format&, const log_args&) {}
+
+    //! Sets the time stamp format for all sinks.
+    /*! \param flags Combination of LogTimeStamp flags.
+        \param precision Number of sub-second digits: 0, 3 (milliseconds) or 6 (microseconds).*/
+    static void set_timestamp(int flags, int precision = 0);
 
   protected:
-    const char* get_datetime(LOG_LEVEL);
+    //! Returns time stamp and level as text. Buffer is thread local. Length is stored to 'len'.
+    const char* get_datetime(LOG_LEVEL, size_t* len = 0);
 };
 
 // ==========================================================================================
@@ -62,6 +212,7 @@ class syslog_sink : public log_sink
     //! Stops sendking messages to syslog.
     ~syslog_sink();
     void print(LOG_LEVEL, const char*);
+    bool is_thread_safe() const { return true; }
 
   protected:
     int levelmap[8];
@@ -78,6 +229,7 @@ class fstream_sink : public log_sink
     //! Destructor closes the file stream.
     ~fstream_sink();
     void print(LOG_LEVEL, const char*);
+    void flush() { log_file.flush(); }
 
   protected:
     std::ofstream log_file;
@@ -94,6 +246,7 @@ class lowio_sink : public log_sink
     ~lowio_sink();
     void print(LOG_LEVEL, const char*);
 #if defined(__linux) || defined(__APPLE__)
+    bool is_thread_safe() const { return true; }
     static int mode;
 #endif
   protected:
@@ -128,6 +281,7 @@ class logbase
     logbase(LOG_LEVEL ll, log_sink* sk)
       : sink(sk)
       , level(ll)
+      , binary(sk && sk->is_binary())
     {}
     //! Destroys the log engine by deleting the associated sink.
     ~logbase()
@@ -146,6 +300,7 @@ class logbase
     static void close_log()
     {
         if (thelog) {
+            thelog->flush();
             delete thelog;
             thelog = 0;
         }
@@ -157,13 +312,47 @@ class logbase
         return thelog;
     }
     static bool is_open() { return thelog ? true : false; }
+    //! Returns true if the global log would print a message of the given level.
+    static bool is_enabled(LOG_LEVEL ll)
+    {
+        return thelog && ll != LL_NONE && thelog->level != LL_NONE && ll >= thelog->level;
+    }
 
     void print(LOG_LEVEL ll, const char* str)
     {
         if (ll != LL_NONE && ll >= level)
-            sink->print(ll, str);
+            emit(ll, str);
     }
     void vaprt(LOG_LEVEL ll, const char*, ...);
+    //! Prints a message from the CS_VAPRT macros.
+    /*! Binary sinks receive the format id and the raw arguments. Others get the formatted text, as
+      do binary sinks when an argument type cannot be stored raw.*/
+    template<typename... ARGS>
+    void fmtprt(LOG_LEVEL ll, log_format& lf, ARGS... args)
+    {
+        if (ll == LL_NONE || ll < level)
+            return;
+        if constexpr ((log_args::is_supported<ARGS>() && ...)) {
+            if (binary) {
+                log_args la;
+                (la.put(args), ...);
+                if (sink->is_thread_safe())
+                    sink->print_record(ll, lf, la);
+                else {
+                    std::lock_guard<std::mutex> lg(print_mtx);
+                    sink->print_record(ll, lf, la);
+                }
+                return;
+            }
+        }
+        vaprt(ll, lf.fmt, args...);
+    }
+    //! Flushes the sink. Waits until queued messages of asynchronous sinks have been written.
+    void flush()
+    {
+        if (sink)
+            sink->flush();
+    }
 
     //! Changes the current logging level.
     void set_level(LOG_LEVEL ll) { level = ll; }
@@ -171,13 +360,31 @@ class logbase
     static LOG_LEVEL str2level(const std::string& name);
 
   protected:
+    //! Passes the message to the sink. Serializes the calls if the sink is not thread safe.
+    void emit(LOG_LEVEL ll, const char* str)
+    {
+        if (sink->is_thread_safe())
+            sink->print(ll, str);
+        else {
+            std::lock_guard<std::mutex> lg(print_mtx);
+            sink->print(ll, str);
+        }
+    }
+
     static logbase* thelog;
     log_sink* sink;
     LOG_LEVEL level;
+    bool binary;
+    std::mutex print_mtx;
 };
 
 // ==========================================================================================
 //! Log method that appears as STL stream and buffers log data to memory.
+/*! Each thread builds its line into its own fixed size buffer, so threads can log at the same
+  time without mixing their messages and no memory is allocated per message. The line is handed
+  to the sink as a whole when the log level is streamed. Lines longer than C4S_LOG_VABUFFER_SIZE
+  are truncated. The buffer is shared by all logger objects used in the same thread.
+*/
 class logger : public logbase
 {
   public:
@@ -196,6 +403,7 @@ class logger : public logbase
     static void close_log()
     {
         if (thelog) {
+            thelog->flush();
             delete thelog;
             thelog = 0;
         }
@@ -205,63 +413,129 @@ class logger : public logbase
     logger& operator<<(char val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append(&val, 1);
         return *this;
     }
     logger& operator<<(int val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append_num((long long)val);
         return *this;
     }
     logger& operator<<(long val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append_num((long long)val);
         return *this;
     }
     logger& operator<<(double val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append_num(val);
         return *this;
     }
     logger& operator<<(unsigned int val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append_num((unsigned long long)val);
         return *this;
     }
     logger& operator<<(unsigned long val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append_num((unsigned long long)val);
         return *this;
     }
 #ifdef _WIN64
     logger& operator<<(size_t val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append_num((unsigned long long)val);
         return *this;
     }
 #endif
     logger& operator<<(const char* val)
     {
-        if (level != LL_NONE)
-            buffer << val;
+        if (level != LL_NONE && val)
+            append(val, strlen(val));
         return *this;
     }
     logger& operator<<(const std::string& val)
     {
         if (level != LL_NONE)
-            buffer << val;
+            append(val.data(), val.size());
         return *this;
     }
     logger& operator<<(LOG_LEVEL LL);
 
   protected:
-    std::ostringstream buffer;
+    friend class log_line;
+    //! Line under construction in the current thread.
+    struct line_buffer
+    {
+        size_t len;
+        char data[C4S_LOG_VABUFFER_SIZE];
+    };
+    static line_buffer& line();
+    static void append(const char* str, size_t len);
+    static void append_num(long long val);
+    static void append_num(unsigned long long val);
+    static void append_num(double val);
+    static void append_ptr(const void* val);
+};
+
+// ==========================================================================================
+//! One log line of the C4S_LOG macro.
+/*! The macro creates the line only when the level is enabled, so the operands of filtered messages
+  are not evaluated at all. Values are formatted into the line buffer of the thread without memory
+  allocation and the line is printed by the destructor at the end of the statement. Unsupported
+  types are rejected at compile time. Lines can be nested, i.e. a function called in an operand may
+  log its own lines.
+*/
+class log_line
+{
+  public:
+    log_line(LOG_LEVEL _ll)
+      : ll(_ll)
+      , start(logger::line().len)
+    {}
+    //! Prints the line to the global log.
+    ~log_line();
+
+    template<typename T>
+    log_line& operator<<(const T& val)
+    {
+        typedef typename std::decay<T>::type VT;
+        if constexpr (std::is_same<VT, bool>::value)
+            val ? logger::append("true", 4) : logger::append("false", 5);
+        else if constexpr (std::is_same<VT, char>::value)
+            logger::append(&val, 1);
+        else if constexpr (std::is_array<T>::value)
+            logger::append(val, strlen(val));
+        else if constexpr (std::is_same<VT, const char*>::value || std::is_same<VT, char*>::value) {
+            if (val)
+                logger::append(val, strlen(val));
+        } else if constexpr (std::is_same<VT, std::string>::value ||
+                             std::is_same<VT, std::string_view>::value)
+            logger::append(val.data(), val.size());
+        else if constexpr (std::is_enum<VT>::value)
+            *this << (typename std::underlying_type<VT>::type)val;
+        else if constexpr (std::is_integral<VT>::value && std::is_signed<VT>::value)
+            logger::append_num((long long)val);
+        else if constexpr (std::is_integral<VT>::value)
+            logger::append_num((unsigned long long)val);
+        else if constexpr (std::is_floating_point<VT>::value)
+            logger::append_num((double)val);
+        else if constexpr (std::is_pointer<VT>::value)
+            logger::append_ptr((const void*)val);
+        else
+            static_assert(std::is_void<T>::value, "C4S_LOG does not support this type.");
+        return *this;
+    }
+
+  protected:
+    LOG_LEVEL ll;
+    size_t start; //!< Length of the enclosing line when this one was started.
 };
 }
 
@@ -276,6 +550,15 @@ class logger : public logbase
 
 #define _C(x) x.c_str()
 
+//! Stream style logging that evaluates the operands only if the level is enabled.
+/*! Example: C4S_LOG(DEBU) << "value " << val; Levels below C4S_LOG_LEVEL are removed at compile time.
+  The line is printed at the end of the statement.*/
+#define C4S_LOG(lvl)                                                                               \
+    if constexpr (CS_##lvl < C4S_LOG_LEVEL) {                                                      \
+    } else if (!c4s::logbase::is_enabled(CS_##lvl)) {                                              \
+    } else                                                                                         \
+        c4s::log_line(CS_##lvl)
+
 #if C4S_LOG_LEVEL <= 1
 #define CS_PRINT_TRCE(x) c4s::logbase::get()->print(CS_TRCE, x)
 #else
@@ -327,49 +610,98 @@ class logger : public logbase
 #endif
 
 #if C4S_LOG_LEVEL <= 1
-#define CS_VAPRT_TRCE(x, ...) c4s::logbase::get()->vaprt(CS_TRCE, x, __VA_ARGS__)
+#define CS_VAPRT_TRCE(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_TRCE, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_TRCE, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_TRCE(x, ...)                                                                      \
     do {                                                                                           \
     } while (0)
 #endif
 #if C4S_LOG_LEVEL <= 2
-#define CS_VAPRT_DEBU(x, ...) c4s::logbase::get()->vaprt(CS_DEBU, x, __VA_ARGS__)
+#define CS_VAPRT_DEBU(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_DEBU, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_DEBU, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_DEBU(x, ...)                                                                      \
     do {                                                                                           \
     } while (0)
 #endif
 #if C4S_LOG_LEVEL <= 3
-#define CS_VAPRT_INFO(x, ...) c4s::logbase::get()->vaprt(CS_INFO, x, __VA_ARGS__)
+#define CS_VAPRT_INFO(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_INFO, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_INFO, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_INFO(x, ...)                                                                      \
     do {                                                                                           \
     } while (0)
 #endif
 #if C4S_LOG_LEVEL <= 4
-#define CS_VAPRT_NOTE(x, ...) c4s::logbase::get()->vaprt(CS_NOTE, x, __VA_ARGS__)
+#define CS_VAPRT_NOTE(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_NOTE, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_NOTE, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_NOTE(x, ...)                                                                      \
     do {                                                                                           \
     } while (0)
 #endif
 #if C4S_LOG_LEVEL <= 5
-#define CS_VAPRT_WARN(x, ...) c4s::logbase::get()->vaprt(CS_WARN, x, __VA_ARGS__)
+#define CS_VAPRT_WARN(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_WARN, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_WARN, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_WARN(x, ...)                                                                      \
     do {                                                                                           \
     } while (0)
 #endif
 #if C4S_LOG_LEVEL <= 6
-#define CS_VAPRT_ERRO(x, ...) c4s::logbase::get()->vaprt(CS_ERRO, x, __VA_ARGS__)
+#define CS_VAPRT_ERRO(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_ERRO, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_ERRO, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_ERRO(x, ...)                                                                      \
     do {                                                                                           \
     } while (0)
 #endif
 #if C4S_LOG_LEVEL <= 7
-#define CS_VAPRT_CRIT(x, ...) c4s::logbase::get()->vaprt(CS_CRIT, x, __VA_ARGS__)
+#define CS_VAPRT_CRIT(x, ...)                                                                      \
+    do {                                                                                           \
+        if constexpr (c4s::log_format::is_literal<decltype((x))>::value) {                         \
+            static c4s::log_format c4s_lf(x);                                                      \
+            c4s::logbase::get()->fmtprt(CS_CRIT, c4s_lf, __VA_ARGS__);                             \
+        } else                                                                                     \
+            c4s::logbase::get()->vaprt(CS_CRIT, x, __VA_ARGS__);                                   \
+    } while (0)
 #else
 #define CS_VAPRT_CRIT(x, ...)                                                                      \
     do {                                                                                           \
@@ -74,7 +74,8 @@ main(int argc, char** argv)
     args += argument("-c4s", true, "Path where Cpp4Scripts is installed. '/usr/local/cpp4scripts' is default");
     args += argument("-inc", true, "External include file to add to the build.");
     args += argument("-lib", true, "External library to add to the link command");
-    args += argument("-hash", true, "Calculate FNV hash for named file.");
+    args += argument("-hash", true, "Calculate hash for named file.");
+    args += argument("-halg", true, "Hash algorithm for -hash: fnv (default), xxh64 or sha256.");
     args += argument("-t", false, "Enable C4S_DEBUGTRACE define for tracing the cpp4scripts code.");
     args += argument("-v", false, "Prints the version number.");
     args += argument("-V", false, "Verbose mode. Prints more messages, including build command.");
@@ -108,7 +109,18 @@ main(int argc, char** argv)
     }
     if (args.is_set("-hash")) {
         path target(args.get_value("-hash"));
-        cout << "FNV hash: " << hex << target.fnv_hash64() << "\n";
+        try {
+            HASH_ALG alg = HASH_FNV64;
+            if (args.is_set("-halg"))
+                alg = hasher::parse_algorithm(args.get_value("-halg"));
+            if (alg == HASH_FNV64)
+                cout << "FNV hash: " << hex << target.fnv_hash64() << "\n";
+            else
+                cout << hasher::algorithm_name(alg) << ": " << target.hash(alg) << "\n";
+        } catch (const c4s_exception& ce) {
+            cout << ce.what() << '\n';
+            return 1;
+        }
         return 0;
     }
     if (args.is_set("-V"))
@@ -0,0 +1,219 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <list>
+#include <sstream>
+#include <thread>
+#include "ntbs/ntbs.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "atomic_writer.hpp"
+#include "hash.hpp"
+#include "path.hpp"
+#include "path_list.hpp"
+#include "stat_cache.hpp"
+#include "util.hpp"
+#include "manifest.hpp"
+
+using namespace std;
+using namespace c4s;
+
+// -------------------------------------------------------------------------------------------------
+unsigned int
+c4s::hash_manifest::default_threads()
+{
+    unsigned int hw = thread::hardware_concurrency();
+    return hw * 2 < 4 ? 4 : hw * 2;
+}
+// -------------------------------------------------------------------------------------------------
+//! Stats and hashes a single file into the entry.
+static void
+manifest_hash_one(manifest_entry& me, HASH_ALG alg)
+{
+    file_meta meta;
+    if (!stat_cache::read_meta(me.name.c_str(), true, meta) || !S_ISREG(meta.mode)) {
+        ostringstream os;
+        os << "hash_manifest - not a regular file: " << me.name;
+        throw path_exception(os.str());
+    }
+    me.size = meta.size;
+    me.mtime = meta.mtime;
+    me.hash = hash_file(me.name.c_str(), alg);
+}
+// -------------------------------------------------------------------------------------------------
+/** Files that are not in the manifest yet are added. Entries for files that are not in the list
+  are kept. Throws path_exception if a file cannot be read.
+  \param list List of files to hash.
+  \param threads Number of threads. Zero uses default_threads().
+  \retval size_t Number of files that were actually read and hashed.
+*/
+size_t
+c4s::hash_manifest::update(path_list& list, unsigned int threads)
+{
+    vector<size_t> work;
+    for (path_iterator pi = list.begin(); pi != list.end(); pi++) {
+        string name = pi->get_path();
+        auto it = index.find(name);
+        size_t ndx;
+        if (it == index.end()) {
+            ndx = entries.size();
+            entries.push_back({ name, -1, { 0, 0 }, string() });
+            index[name] = ndx;
+        } else
+            ndx = it->second;
+        // Skip files whose size and modification time did not change.
+        manifest_entry& me = entries[ndx];
+        file_meta meta;
+        if (!me.hash.empty() && stat_cache::read_meta(name.c_str(), true, meta) &&
+            meta.size == me.size && meta.mtime.tv_sec == me.mtime.tv_sec &&
+            meta.mtime.tv_nsec == me.mtime.tv_nsec)
+            continue;
+        work.push_back(ndx);
+    }
+    if (!threads)
+        threads = default_threads();
+    parallel_for(work.size(), threads, [this, &work](size_t ndx) {
+        manifest_hash_one(entries[work[ndx]], alg);
+    });
+    return work.size();
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param changed Names of the files that are missing or whose content differs are appended here.
+  \param quick If true, files with unchanged size and modification time are not read.
+  \param threads Number of threads. Zero uses default_threads().
+  \retval size_t Number of mismatching files.
+*/
+size_t
+c4s::hash_manifest::verify(vector<string>& changed, bool quick, unsigned int threads)
+{
+    vector<char> bad(entries.size(), 0);
+    if (!threads)
+        threads = default_threads();
+    parallel_for(entries.size(), threads, [this, &bad, quick](size_t ndx) {
+        const manifest_entry& me = entries[ndx];
+        file_meta meta;
+        if (!stat_cache::read_meta(me.name.c_str(), true, meta) || meta.size != me.size) {
+            bad[ndx] = 1;
+            return;
+        }
+        if (quick && meta.mtime.tv_sec == me.mtime.tv_sec &&
+            meta.mtime.tv_nsec == me.mtime.tv_nsec)
+            return;
+        try {
+            if (hash_file(me.name.c_str(), alg) != me.hash)
+                bad[ndx] = 1;
+        } catch (const path_exception&) {
+            bad[ndx] = 1;
+        }
+    });
+    size_t count = 0;
+    for (size_t ndx = 0; ndx < entries.size(); ndx++) {
+        if (bad[ndx]) {
+            changed.push_back(entries[ndx].name);
+            count++;
+        }
+    }
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+/** Current entries are replaced. Algorithm is taken from the file header. Throws c4s_exception if
+  the file is not a valid manifest.
+  \param file Manifest file.
+  \retval bool False if the file does not exist.
+*/
+bool
+c4s::hash_manifest::read(const path& file)
+{
+    ifstream mf(file.get_path().c_str());
+    if (!mf)
+        return false;
+    clear();
+    string line;
+    if (!getline(mf, line) || line.compare(0, 15, "# c4s-manifest ")) {
+        ostringstream os;
+        os << "hash_manifest::read - missing manifest header in " << file.get_path();
+        throw c4s_exception(os.str());
+    }
+    alg = hasher::parse_algorithm(line.substr(15));
+    int lineno = 1;
+    while (getline(mf, line)) {
+        lineno++;
+        if (line.empty())
+            continue;
+        manifest_entry me;
+        char* end;
+        size_t sp = line.find(' ');
+        if (sp == string::npos)
+            goto MANIFEST_SYNTAX;
+        me.hash = line.substr(0, sp);
+        me.size = (off_t)strtoll(line.c_str() + sp + 1, &end, 10);
+        if (*end != ' ')
+            goto MANIFEST_SYNTAX;
+        me.mtime.tv_sec = (time_t)strtoll(end + 1, &end, 10);
+        if (*end != '.')
+            goto MANIFEST_SYNTAX;
+        me.mtime.tv_nsec = strtol(end + 1, &end, 10);
+        if (*end != ' ' || !end[1])
+            goto MANIFEST_SYNTAX;
+        me.name = end + 1;
+        index[me.name] = entries.size();
+        entries.push_back(me);
+    }
+    return true;
+
+MANIFEST_SYNTAX:
+    ostringstream os;
+    os << "hash_manifest::read - syntax error in " << file.get_path() << " line " << lineno;
+    clear();
+    throw c4s_exception(os.str());
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param file Manifest file. Previous file is replaced only after the new one has been written.
+*/
+void
+c4s::hash_manifest::write(const path& file) const
+{
+    atomic_writer aw(file.get_path());
+    aw.write(string("# c4s-manifest ") + hasher::algorithm_name(alg) + '\n');
+    char num[64];
+    for (const manifest_entry& me : entries) {
+        if (me.hash.empty())
+            continue;
+        aw.write(me.hash);
+        int len = snprintf(num, sizeof(num), " %lld %lld.%09ld ", (long long)me.size,
+                           (long long)me.mtime.tv_sec, (long)me.mtime.tv_nsec);
+        aw.write(num, len);
+        aw.write(me.name);
+        aw.write("\n", 1);
+    }
+    aw.commit();
+    stat_cache::forget(file);
+}
+// -------------------------------------------------------------------------------------------------
+const manifest_entry*
+c4s::hash_manifest::find(const string& name) const
+{
+    auto it = index.find(name);
+    return it == index.end() ? 0 : &entries[it->second];
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::hash_manifest::clear()
+{
+    entries.clear();
+    index.clear();
+}
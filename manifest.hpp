@@ -0,0 +1,80 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_MANIFEST_HPP
+#define C4S_MANIFEST_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include <time.h>
+
+namespace c4s {
+
+class path;
+class path_list;
+
+//! One file in the hash manifest.
+struct manifest_entry
+{
+    std::string name;      //!< Path of the file as it was given in the path list.
+    off_t size;            //!< File size in bytes.
+    struct timespec mtime; //!< Modification time when the file was hashed.
+    std::string hash;      //!< Hex digest of the file content.
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Checksum manifest for a set of files.
+/*! Files are hashed in parallel with a pool of threads. Each thread hashes whole files so large
+  files are read sequentially with the kernel read ahead while the other threads keep more requests
+  in flight.<br>
+  Manifest can be saved to a text file and read back. When a manifest is updated, files whose size
+  and modification time match the previous entry keep their old hash and are not read at all.<br>
+  File format is one line per file: 'hash size seconds.nanoseconds name' preceded by a header line
+  '# c4s-manifest algorithm'.
+*/
+class hash_manifest
+{
+  public:
+    //! Creates an empty manifest for the given hash algorithm.
+    hash_manifest(HASH_ALG _alg = HASH_XXH64)
+      : alg(_alg)
+    {}
+
+    //! Hashes the files in the list. Unchanged files are skipped. Returns number of hashed files.
+    size_t update(path_list& list, unsigned int threads = 0);
+    //! Re-hashes all entries. Returns number of mismatches, names of them are stored to 'changed'.
+    size_t verify(std::vector<std::string>& changed, bool quick = false, unsigned int threads = 0);
+    //! Reads the manifest from a file. Returns false if the file does not exist.
+    bool read(const path& file);
+    //! Writes the manifest to a file atomically.
+    void write(const path& file) const;
+
+    //! Returns the entry for a file or null if it is not in the manifest.
+    const manifest_entry* find(const std::string& name) const;
+    //! Returns all entries in the order they were added.
+    const std::vector<manifest_entry>& get_entries() const { return entries; }
+    //! Returns the number of entries.
+    size_t size() const { return entries.size(); }
+    //! Returns the hash algorithm.
+    HASH_ALG get_algorithm() const { return alg; }
+    //! Removes all entries.
+    void clear();
+
+    //! Default number of threads for hashing. Hashing is I/O bound so this exceeds the core count.
+    static unsigned int default_threads();
+
+  protected:
+    HASH_ALG alg;
+    std::vector<manifest_entry> entries;
+    std::unordered_map<std::string, size_t> index;
+};
+
+} // namespace c4s
+#endif
@@ -15,8 +15,11 @@
 #include "ntbs/ntbs.hpp"
 #include "config.hpp"
 #include "exception.hpp"
+#include "atomic_writer.hpp"
 #include "path.hpp"
 #include "path_list.hpp"
+#include "replacer.hpp"
+#include "stat_cache.hpp"
 #include "user.hpp"
 #include "util.hpp"
 
@@ -28,6 +31,7 @@ void
 c4s::path::init_common()
 {
     change_time = 0;
+    change_nsec = 0;
     flag = false;
     owner = 0;
     mode = -1;
@@ -122,6 +126,7 @@ void c4s::path::operator=(const path& p)
     dir = p.dir;
     base = p.base;
     change_time = p.change_time;
+    change_nsec = p.change_nsec;
     flag = p.flag;
     owner = p.owner;
     mode = p.mode;
@@ -373,6 +378,8 @@ c4s::path::cd(const char* to)
         os << "Unable chdir to:" << to << " Error:" << strerror(errno);
         throw path_exception(os.str());
     }
+    // Relative names in stat cache are no longer valid.
+    stat_cache::forget_all();
 }
 // -------------------------------------------------------------------------------------------------
 void
@@ -615,9 +622,9 @@ c4s::path::merge(const path& append)
 bool
 c4s::path::dirname_exists() const
 {
-    struct stat file_stat;
-    if (!stat(get_dir_plain().c_str(), &file_stat)) {
-        if (S_ISDIR(file_stat.st_mode))
+    file_meta meta;
+    if (stat_cache::lookup(get_dir_plain(), true, meta)) {
+        if (S_ISDIR(meta.mode))
             return true;
     }
     return false;
@@ -667,6 +674,7 @@ c4s::path::mkdir(c4s::user* l_owner, int l_mode) const
         offset = fullpath.find(C4S_DSEP, offset + 1);
         mkpath.dir = (offset == string::npos) ? fullpath : fullpath.substr(0, offset + 1);
         if (!mkpath.dirname_exists()) {
+            stat_cache::forget(mkpath);
             if (::mkdir(mkpath.get_dir().c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
                 {
                     ostringstream os;
@@ -702,6 +710,10 @@ c4s::path::mkdir(c4s::user* l_owner, int l_mode) const
 void
 c4s::path::rmdir(bool recursive) const
 {
+    if (recursive)
+        stat_cache::forget_all();
+    else
+        stat_cache::forget(*this);
     if (!::rmdir(dir.c_str()))
         return;
     if (errno == ENOENT)
@@ -764,9 +776,9 @@ c4s::path::exists() const
     if (base.empty())
         return dirname_exists();
     // Simply stat the file
-    struct stat target;
-    if (!lstat(get_path().c_str(), &target)) {
-        if (S_ISREG(target.st_mode) || S_ISLNK(target.st_mode)) {
+    file_meta target;
+    if (stat_cache::lookup(get_path(), false, target)) {
+        if (S_ISREG(target.mode) || S_ISLNK(target.mode)) {
             return true;
         }
     }
@@ -849,7 +861,7 @@ c4s::path::outdated(path_list& lst)
     return false;
 }
 // -------------------------------------------------------------------------------------------------
-/**
+/** Times are compared with nanosecond resolution when the file system provides it.
   \param target Path to target file
   \retval int 0 if the file modification times are equal, -1 if this file is older than target and
    1 if this file is newer than target.
@@ -863,6 +875,10 @@ c4s::path::compare_times(path& target) const
         return -1;
     if (change_time > target.change_time)
         return 1;
+    if (change_nsec < target.change_nsec)
+        return -1;
+    if (change_nsec > target.change_nsec)
+        return 1;
     return 0;
 }
 // -------------------------------------------------------------------------------------------------
@@ -872,19 +888,35 @@ c4s::path::fnv_hash64() const
     if (base.empty() || !exists())
         return 0;
     // magic 64bit salt for fnv
-    return fnv_hash64_file(get_pp(), FNV_1_PRIME);
+    fnv64_hasher hs(FNV_1_PRIME);
+    hash_file(get_pp(), hs);
+    return hs.value();
+}
+// -------------------------------------------------------------------------------------------------
+/** File is memory mapped or read in large blocks. Throws path_exception on read errors.
+  \param alg Hash algorithm.
+  \retval string Hex digest of the file content. Empty if this is a directory or file does not
+  exist.
+*/
+string
+c4s::path::hash(HASH_ALG alg) const
+{
+    if (base.empty() || !exists())
+        return string();
+    return hash_file(get_pp(), alg);
 }
 // -------------------------------------------------------------------------------------------------
 TIME_T
 c4s::path::read_changetime()
 {
-    struct stat statBuffer;
-    if (stat(get_path().c_str(), &statBuffer)) {
+    file_meta meta;
+    if (!stat_cache::lookup(get_path(), true, meta)) {
         ostringstream os;
         os << "path::read_changetime - Unable to find source file:" << get_path().c_str();
         throw path_exception(os.str());
     }
-    change_time = statBuffer.st_mtime;
+    change_time = meta.mtime.tv_sec;
+    change_nsec = meta.mtime.tv_nsec;
     return change_time;
 }
 // -------------------------------------------------------------------------------------------------
@@ -966,6 +998,7 @@ c4s::path::cp(const path& to, int flags) const
     else
         out_mode = "wb";
 
+    stat_cache::forget(tmp_to);
     // Open source file
     f_from = fopen(get_path().c_str(), "rb");
     if (!f_from) {
@@ -1020,6 +1053,7 @@ c4s::path::cp(const path& to, int flags) const
     // If this was a move operation, remove the source file.
     if (IS(PCF_MOVE))
         rm();
+    stat_cache::forget(tmp_to);
     return 1;
 }
 // -------------------------------------------------------------------------------------------------
@@ -1063,6 +1097,7 @@ c4s::path::cat(const path& tail) const
     // Close the files
     target.close();
     tfil.close();
+    stat_cache::forget(*this);
 }
 // -------------------------------------------------------------------------------------------------
 /**  In Windos this only copies file time-attributes only.
@@ -1171,6 +1206,8 @@ c4s::path::ren(const string& new_base, bool force)
             throw path_exception("path::ren - target already exist.");
         }
     }
+    stat_cache::forget(old);
+    stat_cache::forget(nw);
     if (rename(old.c_str(), nw.c_str()) == -1) {
         set_base(old_base);
         ostringstream ss;
@@ -1188,6 +1225,7 @@ bool
 c4s::path::rm() const
 {
     string name = base.empty() ? get_dir_plain() : get_path();
+    stat_cache::forget(name);
     if (unlink(name.c_str()) < 0) {
         if (errno == ENOENT)
             return true;
@@ -1227,6 +1265,7 @@ c4s::path::symlink(const path& link) const
         source = get_path();
     }
     string linkname = link.base.empty() ? link.get_dir_plain() : link.get_path();
+    stat_cache::forget(linkname);
     if (::symlink(source.c_str(), linkname.c_str())) {
         ostringstream os;
         os << "path::symlink - Unable to create link '" << linkname << "' to '" << source << "' - "
@@ -1253,6 +1292,7 @@ c4s::path::chmod(int mode_in)
     } else if (mode < 0)
         mode = mode_in;
     mode_t final = hex2mode(mode_in);
+    stat_cache::forget(*this);
     if (::chmod(get_path().c_str(), final) == -1) {
         os << "path::chmod failed - " << get_path() << " - Error:" << strerror(errno);
         throw path_exception(os.str());
@@ -1298,8 +1338,9 @@ c4s::path::dump(ostream& out)
         out << "owner: NULL;\n";
 }
 // -------------------------------------------------------------------------------------------------
-/** All instances of the search text are replaced. Thows an exception if files cannot be opened or
-  written.
+/** All instances of the search text are replaced. File is memory mapped and scanned in a single
+  pass. Original is replaced atomically with rename only if there were matches. Thows an exception
+  if files cannot be opened or written.
   \param search String to search for
   \param replace Text that will be written instead of search string.
   \param backup If true the original file will be backed up.
@@ -1308,58 +1349,38 @@ c4s::path::dump(ostream& out)
 int
 c4s::path::search_replace(const string& search, const string& replace, bool backup)
 {
-    char *btr, buffer[0x800];
-    int count = 0;
-    SIZE_T reread = 0, find_pos;
-    streamsize br;
-    fstream src(get_path().c_str());
-    if (!src)
-        throw path_exception("path::search_replace - Unable to open file.");
-    path target(dir, base, ".~c4s");
-    ofstream tgt(target.get_path().c_str());
-    if (!tgt) {
-        src.close();
-        throw path_exception("path::search_replace - Unable to open temporary file.");
+    if (search.empty())
+        throw path_exception("path::search_replace - Search string cannot be empty.");
+    replacer rpl(search, replace);
+    int count = (int)rpl.file(get_path(), backup);
+    if (count) {
+        stat_cache::forget(*this);
+        stat_cache::forget(get_path() + "~");
     }
-    if (search.size() > sizeof(buffer))
-        throw path_exception(
-            "path::search_replace - Search string size exceeds the internal buffer size.");
-
-    do {
-        src.read(buffer + reread, sizeof(buffer) - reread);
-        br = src.gcount();
-        btr = buffer;
-        do {
-            if (search_bmh((unsigned char*)btr, (SIZE_T)br, (unsigned char*)search.c_str(),
-                           search.size(), &find_pos)) {
-                count++;
-                tgt.write(btr, find_pos);
-                tgt.write(replace.c_str(), replace.size());
-                btr += find_pos + search.size();
-                br -= find_pos + search.size();
-            } else {
-                tgt.write(btr, br);
-                br = 0;
-            }
-        } while (br > 0);
-    } while (!src.eof());
-    src.close();
-    tgt.close();
-
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+/** Each search string is replaced with its pair. All strings are searched at the same time so
+  that replaced text is never searched again. If two search strings match at the same position the
+  longer one wins.
+  \param pairs List of search and replace strings.
+  \param backup If true the original file will be backed up.
+  \retval int Number of replacements done.
+ */
+int
+c4s::path::search_replace(const vector<pair<string, string>>& pairs, bool backup)
+{
+    for (const auto& sp : pairs) {
+        if (sp.first.empty())
+            throw path_exception("path::search_replace - Search string cannot be empty.");
+    }
+    if (pairs.empty())
+        return 0;
+    replacer rpl(pairs);
+    int count = (int)rpl.file(get_path(), backup);
     if (count) {
-        // Rename the source (to make backup) and target as source.
-        try {
-            string sbase_old = base;
-            if (backup) {
-                string sbase_backup(base + "~");
-                ren(sbase_backup, true);
-            } else
-                rm();
-            target.ren(sbase_old, true);
-            (*this) = target;
-        } catch (const c4s_exception&) {
-            throw path_exception("path::search_replace - temp file rename error.");
-        }
+        stat_cache::forget(*this);
+        stat_cache::forget(get_path() + "~");
     }
     return count;
 }
@@ -1369,7 +1390,7 @@ c4s::path::search_replace(const string& search, const string& replace, bool back
   exception if file cannot be opened or written and other read/write errors. \param start_tag Start
   tag. \param end_tag End tag. \param rpl_txt Replacemnt text. \param backup If true then original
   file is backed up. \retval bool True if replacement was done. False if start or end tag was not
-  found. */
+  found. Original file is replaced atomically with atomic_writer. */
 bool
 c4s::path::replace_block(const string& start_tag,
                          const string& end_tag,
@@ -1404,36 +1425,21 @@ c4s::path::replace_block(const string& start_tag,
     }
     eoffset = src.tellg();
 
-    // Do the replacing
+    // Do the replacing. Original file is replaced only after the new content has been synced.
     src.seekg(0, ios_base::beg);
-    path target(dir, base, ".~c4s");
-    ofstream tgt(target.get_path().c_str(), ios_base::out | ios_base::binary);
-    if (!tgt) {
-        src.close();
-        throw path_exception("path::replace_block - Unable to open temporary file.");
-    }
+    atomic_writer tgt(get_path(), backup ? AWF_BACKUP : AWF_NONE);
     // Copy until replacement start
-    for (SIZE_T ndx = 0; ndx < soffset / sizeof(buffer); ndx++) {
-        src.read(buffer, sizeof(buffer));
-        if (src.gcount() != sizeof(buffer)) {
-            src.close();
-            tgt.close();
-            target.rm();
+    streamsize left = soffset;
+    while (left > 0) {
+        src.read(buffer, left < (streamsize)sizeof(buffer) ? left : sizeof(buffer));
+        br = src.gcount();
+        if (br <= 0)
             throw path_exception("path::replace_block - Read size mismatch. Aborting replace.");
-        }
-        tgt.write(buffer, sizeof(buffer));
-    }
-    src.read(buffer, soffset % sizeof(buffer));
-    if ((SIZE_T)src.gcount() != soffset % sizeof(buffer)) {
-        src.close();
-        tgt.close();
-        target.rm();
-        throw path_exception("path::replace_block - Read size mismatch(2). Aborting replace.");
+        tgt.write(buffer, br);
+        left -= br;
     }
-    tgt.write(buffer, soffset % sizeof(buffer));
-
-    // Copy rpl_txtment and write the rest.
-    tgt.write(rpl_txt.c_str(), rpl_txt.size());
+    // Copy replacement and write the rest.
+    tgt.write(rpl_txt);
     src.seekg(eoffset, ios_base::beg);
     while (!src.eof()) {
         src.read(buffer, sizeof(buffer));
@@ -1441,20 +1447,9 @@ c4s::path::replace_block(const string& start_tag,
         tgt.write(buffer, br);
     }
     src.close();
-    tgt.close();
-
-    // Rename the source (to make backup) and target as source.
-    try {
-        string sbase_old = base;
-        if (backup) {
-            string sbase_backup(base + "~");
-            ren(sbase_backup, true);
-        } else
-            rm();
-        target.ren(sbase_old, true);
-        (*this) = target;
-    } catch (const c4s_exception&) {
-        throw path_exception("path::replace_block - temp file rename error.");
-    }
+    tgt.commit();
+    stat_cache::forget(*this);
+    if (backup)
+        stat_cache::forget(get_path() + "~");
     return true;
 }
@@ -16,6 +16,7 @@
 #endif
 
 #include <vector>
+#include "hash.hpp"
 
 namespace c4s {
 
@@ -98,6 +99,7 @@ class path
     void clear()
     {
         change_time = 0;
+        change_nsec = 0;
         dir.clear();
         base.clear();
     }
@@ -256,12 +258,19 @@ class path
     int compare_times(path&) const;
     //! Calculates FNV-hash for the file.
     uint64_t fnv_hash64() const;
+    //! Calculates hash for the file with given algorithm. Returns hex digest or empty string.
+    std::string hash(HASH_ALG alg = HASH_XXH64) const;
     //! Changes all directory separators from unix '/' to dos '\'.
     void unix2dos();
     //! Changes all directory separators from dos '\' to unix '/'.
     void dos2unix();
     //! Performs a search-replace for a file pointed by this path
     int search_replace(const std::string& search, const std::string& replace, bool bu = false);
+#if defined(__linux) || defined(__APPLE__)
+    //! Replaces several search strings in a single pass.
+    int search_replace(const std::vector<std::pair<std::string, std::string>>& pairs,
+                       bool bu = false);
+#endif
     //! Performs a single block replacement in a file pointed by this path.
     bool replace_block(const std::string&, const std::string&, const std::string&, bool bu = false);
     // SIZE_T search_text(const std::string &needle);
@@ -279,6 +288,7 @@ class path
     int mode;           //!< Path/file access mode.
     TIME_T change_time; //!< Time that the file was last changed. Zero until internal function
                         //!< update_time has been called.
+    long change_nsec;   //!< Nanosecond part of the change time.
     std::string dir;    //!< directory part of the path. Directory needs to end at the directory separator.
     std::string base;   //!< Base name (file name) part of the path.
     bool flag;          //!< General purpose flag for application use.
@@ -19,6 +19,11 @@
 #include "path.hpp"
 #include "path_list.hpp"
 #include "util.hpp"
+#if defined(__linux) || defined(__APPLE__)
+#include "stat_cache.hpp"
+#include "batch_executor.hpp"
+#include "manifest.hpp"
+#endif
 
 using namespace std;
 using namespace c4s;
@@ -322,6 +327,22 @@ c4s::path_list::copy_to(const path& target, int flags)
     return copy_count;
 }
 
+#if defined(__linux) || defined(__APPLE__)
+// -------------------------------------------------------------------------------------------------
+/*! Same as copy_to above but files are copied in parallel by batch_executor. Copying continues
+  after failures.
+  \param target path to target directory
+  \param flags copy flags.
+  \param results Result for each path in the list.
+  \retval size_t Number of failed copies.
+*/
+size_t
+c4s::path_list::copy_to(const path& target, int flags, vector<batch_result>& results)
+{
+    batch_executor be;
+    return be.copy(*this, target, flags, results);
+}
+#endif
 // -------------------------------------------------------------------------------------------------
 /*!  \param mod Mode to set. \see path::chmod
  */
@@ -333,6 +354,19 @@ c4s::path_list::chmod(int mod)
         pi->chmod(mod);
 }
 
+#if defined(__linux) || defined(__APPLE__)
+// -------------------------------------------------------------------------------------------------
+/*!  \param mod Mode to set. \see path::chmod
+     \param results Result for each path in the list.
+     \retval size_t Number of failures.
+ */
+size_t
+c4s::path_list::chmod(int mod, vector<batch_result>& results)
+{
+    batch_executor be;
+    return be.chmod(*this, mod, results);
+}
+#endif
 // -------------------------------------------------------------------------------------------------
 /*! \param dir Directory to set.
  */
@@ -365,6 +399,18 @@ c4s::path_list::set_usermode(user* uptr, const int mode)
     for (pi = plist.begin(); pi != plist.end(); pi++)
         pi->ch_owner_mode(uptr, mode);
 }
+// -------------------------------------------------------------------------------------------------
+/*! \param uptr Pointer to the owner of the paths
+    \param mode Mode that should be used for the paths.
+    \param results Result for each path in the list.
+    \retval size_t Number of failures.
+*/
+size_t
+c4s::path_list::set_usermode(user* uptr, const int mode, vector<batch_result>& results)
+{
+    batch_executor be;
+    return be.set_usermode(*this, uptr, mode, results);
+}
 #endif
 // -------------------------------------------------------------------------------------------------
 /*!  If there are plain directories (i.e. no base defined) then the directory is removed
@@ -386,6 +432,34 @@ c4s::path_list::rm_all()
     }
 }
 
+#if defined(__linux) || defined(__APPLE__)
+// -------------------------------------------------------------------------------------------------
+/*! Files are removed with batch_executor, i.e. with io_uring when available. Unlike rm_all()
+  above, failures do not stop the operation. USE WITH CARE!!!
+  \param results Result for each path in the list.
+  \retval size_t Number of failures.
+ */
+size_t
+c4s::path_list::rm_all(vector<batch_result>& results)
+{
+    batch_executor be;
+    return be.rm(*this, results);
+}
+// -------------------------------------------------------------------------------------------------
+/*! Files are hashed in parallel. Files already in the manifest with unchanged size and
+  modification time are not read again, so a manifest read from the previous run makes this an
+  incremental update.
+  \param manifest Manifest to update.
+  \param threads Number of threads. Zero uses hash_manifest::default_threads().
+  \retval size_t Number of files that were hashed.
+ */
+size_t
+c4s::path_list::hash_all(hash_manifest& manifest, unsigned int threads)
+{
+    return manifest.update(*this, threads);
+}
+#endif
+
 // -------------------------------------------------------------------------------------------------
 /*! This function supposes that this object is a list of source files and makes corresponding
   target paths (for a compiler) by taking the given dir, base name from this list and appending a
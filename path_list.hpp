@@ -11,6 +11,9 @@
 
 namespace c4s {
 
+struct batch_result;
+class hash_manifest;
+
 typedef std::list<path>::iterator path_iterator;
 /** \defgroup PathListFlags Flags for adding files into the list
     @{
@@ -86,8 +89,16 @@ class path_list
     bool discard_matching(const std::string&);
     //! Copies this list of files to given target directory.
     int copy_to(const path&, int flag = PCF_NONE);
+#if defined(__linux) || defined(__APPLE__)
+    //! Copies files in parallel and reports errors per file. Returns number of failures.
+    size_t copy_to(const path&, int flag, std::vector<batch_result>& results);
+#endif
     //! Changes the given mode to all paths.
     void chmod(int mod);
+#if defined(__linux) || defined(__APPLE__)
+    //! Changes the mode in parallel and reports errors per path. Returns number of failures.
+    size_t chmod(int mod, std::vector<batch_result>& results);
+#endif
     //! Copies the given string to as directory to all paths in the list.
     void set_dir(path& p) { set_dir(p.get_dir()); }
     //! Copies the given string to as directory to all paths in the list.
@@ -97,9 +108,17 @@ class path_list
 #if defined(__linux) || defined(__APPLE__)
     //! Sets the same user and mode to all paths in the list. Note, will not commit changes to disk.
     void set_usermode(user*, const int);
+    //! Sets user and mode in parallel and reports errors per path. Returns number of failures.
+    size_t set_usermode(user*, const int, std::vector<batch_result>& results);
 #endif
     //! Deletes all files specified in this list from the disk.
     void rm_all();
+#if defined(__linux) || defined(__APPLE__)
+    //! Deletes all files as a batch and reports errors per path. Returns number of failures.
+    size_t rm_all(std::vector<batch_result>& results);
+    //! Hashes all files in parallel into the manifest. Returns number of files read.
+    size_t hash_all(hash_manifest& manifest, unsigned int threads = 0);
+#endif
     //! Creates a list of compilation targets from this source list.
     void create_targets(path_list& target, const std::string& dir, const char* ext);
     //! Returns the paths as a string separating them with given separator.
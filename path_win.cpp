@@ -32,6 +32,7 @@ void
 c4s::path::init_common()
 {
     change_time = 0;
+    change_nsec = 0;
     flag = false;
 #if defined(__linux) || defined(__APPLE__)
     owner = 0;
@@ -132,6 +133,7 @@ void c4s::path::operator=(const path& p)
     dir = p.dir;
     base = p.base;
     change_time = p.change_time;
+    change_nsec = p.change_nsec;
     flag = p.flag;
 #if defined(__linux) || defined(__APPLE__)
     owner = p.owner;
@@ -0,0 +1,285 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#if defined(__linux)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+#include <fstream>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "proc_profile.hpp"
+
+using namespace std;
+
+string c4s::proc_profile::cgroup_root;
+
+// -------------------------------------------------------------------------------------------------
+c4s::proc_profile::proc_profile()
+  : cg_memory(0)
+  , cg_cpu(0)
+  , nice(0)
+  , ioprio(0)
+  , has_nice(false)
+{}
+// -------------------------------------------------------------------------------------------------
+/** Setting the same resource again replaces the earlier limit.
+  \param resource Resource as for setrlimit.
+  \param limit New soft and hard limit.
+*/
+void
+c4s::proc_profile::set_rlimit(int resource, unsigned long long limit)
+{
+    for (auto& rl : rlimits) {
+        if (rl.first == resource) {
+            rl.second = limit;
+            return;
+        }
+    }
+    rlimits.emplace_back(resource, limit);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::set_memory(unsigned long long bytes)
+{
+    set_rlimit(RLIMIT_AS, bytes);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::set_cpu_time(unsigned long long seconds)
+{
+    set_rlimit(RLIMIT_CPU, seconds);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::set_files(unsigned long long count)
+{
+    set_rlimit(RLIMIT_NOFILE, count);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::set_ionice(IOCLASS io_class, int level)
+{
+    if (level < 0 || level > 7)
+        throw process_exception("proc_profile::set_ionice - level must be between 0 and 7.");
+    // IOPRIO_PRIO_VALUE from linux/ioprio.h.
+    ioprio = io_class == IOCLASS::NONE ? 0 : ((int)io_class << 13) | level;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::set_cpus(const vector<int>& list)
+{
+#if defined(__linux)
+    for (int cpu : list) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            ostringstream os;
+            os << "proc_profile::set_cpus - invalid CPU number " << cpu << '.';
+            throw process_exception(os.str());
+        }
+    }
+#endif
+    cpus = list;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::set_cgroup(const string& name, unsigned long long memory_max,
+                              unsigned int cpu_percent)
+{
+    if (name.find('/') != string::npos || name == "." || name == "..")
+        throw process_exception("proc_profile::set_cgroup - invalid group name.");
+    cgroup = name;
+    cg_memory = memory_max;
+    cg_cpu = cpu_percent;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_profile::clear()
+{
+    rlimits.clear();
+    cpus.clear();
+    cgroup.clear();
+    cg_memory = 0;
+    cg_cpu = 0;
+    ioprio = 0;
+    has_nice = false;
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::proc_profile::empty() const
+{
+    return rlimits.empty() && cpus.empty() && cgroup.empty() && !ioprio && !has_nice;
+}
+// -------------------------------------------------------------------------------------------------
+/** The root is looked up from the '0::' line of /proc/self/cgroup when cgroup v2 is mounted on
+  /sys/fs/cgroup. Creating controllers for the groups needs that the root is delegated to the
+  user and has no processes of its own, e.g. a systemd unit with Delegate=yes.
+  \retval string Directory or empty if cgroup v2 is not in use.
+*/
+string
+c4s::proc_profile::get_cgroup_root()
+{
+    if (!cgroup_root.empty())
+        return cgroup_root;
+#if defined(__linux)
+    struct stat sb;
+    if (stat("/sys/fs/cgroup/cgroup.controllers", &sb))
+        return string();
+    ifstream cg("/proc/self/cgroup");
+    string line;
+    while (getline(cg, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            string dir("/sys/fs/cgroup");
+            if (line.size() > 4)
+                dir += line.substr(3);
+            return dir;
+        }
+    }
+#endif
+    return string();
+}
+// -------------------------------------------------------------------------------------------------
+string
+c4s::proc_profile::cgroup_dir() const
+{
+    string root = get_cgroup_root();
+    if (root.empty())
+        throw process_exception("proc_profile - cgroup v2 is not available.");
+    return root + '/' + cgroup;
+}
+// -------------------------------------------------------------------------------------------------
+//! Writes the value into a cgroup file. Returns false on failure.
+static bool
+cg_write(const string& file, const string& value)
+{
+    int fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool ok = write(fd, value.data(), value.size()) == (ssize_t)value.size();
+    int er = errno;
+    close(fd);
+    errno = er;
+    return ok;
+}
+// -------------------------------------------------------------------------------------------------
+/** Controllers are enabled in the root if they are not yet. Limit files are written also when
+  the limit is not set, so that a group created earlier with other limits is reset.
+  \retval int Descriptor to the cgroup.procs of the group or -1 if there is no group.
+*/
+int
+c4s::proc_profile::prepare() const
+{
+#if defined(__linux)
+    if (cgroup.empty())
+        return -1;
+    ostringstream os;
+    string root = get_cgroup_root();
+    string dir = cgroup_dir();
+    if (mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+        os << "proc_profile - unable to create cgroup " << dir << ": " << strerror(errno);
+        throw process_exception(os.str());
+    }
+    struct limit
+    {
+        const char* controller;
+        const char* file;
+        string value;
+        bool set;
+    };
+    string cpu_max("max 100000");
+    if (cg_cpu)
+        cpu_max = to_string(cg_cpu * 1000ULL) + " 100000";
+    const limit limits[] = {
+        { "+memory", "/memory.max", cg_memory ? to_string(cg_memory) : string("max"), cg_memory > 0 },
+        { "+cpu", "/cpu.max", cpu_max, cg_cpu > 0 },
+    };
+    struct stat sb;
+    for (const limit& lim : limits) {
+        string file = dir + lim.file;
+        if (stat(file.c_str(), &sb)) {
+            if (!lim.set)
+                continue;
+            cg_write(root + "/cgroup.subtree_control", lim.controller);
+        }
+        if (!cg_write(file, lim.value) && lim.set) {
+            os << "proc_profile - unable to write " << file << ": " << strerror(errno)
+               << ". Is the controller enabled in " << root << "/cgroup.subtree_control?";
+            throw process_exception(os.str());
+        }
+    }
+    string procs = dir + "/cgroup.procs";
+    int fd = open(procs.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        os << "proc_profile - unable to open " << procs << ": " << strerror(errno);
+        throw process_exception(os.str());
+    }
+    return fd;
+#else
+    if (!cpus.empty() || ioprio || !cgroup.empty())
+        throw process_exception(
+          "proc_profile - affinity, I/O priority and cgroups are supported only on Linux.");
+    return -1;
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+/** Called between fork and exec, so nothing here may allocate or take locks. The group is joined
+  first so that everything after it is accounted to the group.
+*/
+bool
+c4s::proc_profile::apply(int cgroup_fd, const char** what) const
+{
+#if defined(__linux)
+    if (cgroup_fd >= 0 && write(cgroup_fd, "0", 1) != 1) {
+        *what = "cgroup";
+        return false;
+    }
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+            CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            *what = "CPU affinity";
+            return false;
+        }
+    }
+    // IOPRIO_WHO_PROCESS is 1.
+    if (ioprio && syscall(SYS_ioprio_set, 1, 0, ioprio) == -1) {
+        *what = "I/O priority";
+        return false;
+    }
+#endif
+    for (auto& rl : rlimits) {
+        struct rlimit lim;
+        lim.rlim_cur = lim.rlim_max = (rlim_t)rl.second;
+        if (setrlimit(rl.first, &lim)) {
+            *what = "resource limit";
+            return false;
+        }
+    }
+    if (has_nice && setpriority(PRIO_PROCESS, 0, nice)) {
+        *what = "nice";
+        return false;
+    }
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::proc_profile::remove_cgroup() const
+{
+    if (cgroup.empty() || get_cgroup_root().empty())
+        return false;
+    return rmdir(cgroup_dir().c_str()) == 0;
+}
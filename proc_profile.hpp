@@ -0,0 +1,108 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_PROC_PROFILE_HPP
+#define C4S_PROC_PROFILE_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Resource constraints for a child process.
+/*! Profile is given to process::set_profile and applied in the child after fork, before the command
+  is executed: resource limits, nice value, I/O priority, CPU affinity and an optional cgroup v2
+  group. If any of them cannot be applied the child exits with failure and the reason is written
+  to stderr.<br>
+  The cgroup is created under cgroup_root when a process with the profile is started, and its
+  memory.max and cpu.max are written each time. Processes that share the cgroup name share the
+  limits, which allows bounding a set of concurrent jobs as a whole:
+  \code
+  proc_profile jobs;
+  jobs.set_memory(2UL << 30);          // Each job 2 GiB address space.
+  jobs.set_nice(10);
+  jobs.set_cpus({ 2, 3, 4, 5 });
+  jobs.set_cgroup("c4s-build", 8UL << 30, 400); // All jobs together 8 GiB and four CPUs.
+  builder.set_profile(jobs);
+  \endcode
+  Affinity, I/O priority and cgroups are Linux only.
+*/
+class proc_profile
+{
+  public:
+    //! I/O scheduling classes for set_ionice.
+    enum class IOCLASS { NONE = 0, REALTIME = 1, BEST_EFFORT = 2, IDLE = 3 };
+
+    proc_profile();
+
+    //! Limits a resource, e.g. RLIMIT_AS, RLIMIT_CPU or RLIMIT_NOFILE. Sets soft and hard limit.
+    void set_rlimit(int resource, unsigned long long limit);
+    //! Limits the address space in bytes (RLIMIT_AS).
+    void set_memory(unsigned long long bytes);
+    //! Limits the CPU time in seconds (RLIMIT_CPU). Child gets SIGXCPU when it is exceeded.
+    void set_cpu_time(unsigned long long seconds);
+    //! Limits the number of open files (RLIMIT_NOFILE).
+    void set_files(unsigned long long count);
+    //! Sets the nice value of the child. Values below the current one need privileges.
+    void set_nice(int value)
+    {
+        nice = value;
+        has_nice = true;
+    }
+    //! Sets the I/O scheduling class and level 0-7 (lower is higher priority).
+    void set_ionice(IOCLASS io_class, int level = 4);
+    //! Restricts the child to the given CPUs. Throws process_exception for invalid numbers.
+    void set_cpus(const std::vector<int>& list);
+    //! Places the child into a cgroup v2 group under cgroup_root.
+    /*! \param name Name of the group. Must not contain '/'.
+        \param memory_max Value for memory.max in bytes. 0 for no limit.
+        \param cpu_percent Value for cpu.max in percents of one CPU. 0 for no limit.*/
+    void set_cgroup(const std::string& name, unsigned long long memory_max = 0,
+                    unsigned int cpu_percent = 0);
+    //! Removes the resource limits.
+    void clear_rlimits() { rlimits.clear(); }
+    //! Removes all constraints.
+    void clear();
+    //! True if nothing has been set.
+    bool empty() const;
+    //! Removes the cgroup. Returns false if it does not exist or still has processes.
+    bool remove_cgroup() const;
+
+    //! Returns the root of the cgroups: the cgroup of this process unless set explicitly.
+    /*! Returns an empty string if cgroup v2 is not available.*/
+    static std::string get_cgroup_root();
+    //! Sets the parent directory for the groups, e.g. a delegated systemd scope.
+    static void set_cgroup_root(const std::string& dir) { cgroup_root = dir; }
+
+  protected:
+    friend class process;
+    //! Parent side: creates the cgroup and writes its limits. Returns cgroup.procs descriptor or -1.
+    int prepare() const;
+    //! Child side: applies the profile. Uses only async-signal-safe calls.
+    /*! \param cgroup_fd Descriptor from prepare.
+        \param what Set to the name of the setting that failed.
+        \retval bool False on failure, errno tells the reason.*/
+    bool apply(int cgroup_fd, const char** what) const;
+    std::string cgroup_dir() const;
+
+    std::vector<std::pair<int, unsigned long long>> rlimits;
+    std::vector<int> cpus;
+    std::string cgroup;
+    unsigned long long cg_memory;
+    unsigned int cg_cpu;
+    int nice;
+    int ioprio;          //!< Value for ioprio_set or 0 when not set.
+    bool has_nice;
+
+    static std::string cgroup_root;
+};
+
+} // namespace c4s
+#endif
@@ -0,0 +1,383 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "path.hpp"
+#include "RingBuffer.hpp"
+#include "process.hpp"
+#include "proc_reactor.hpp"
+
+using namespace std;
+using namespace c4s;
+
+// -------------------------------------------------------------------------------------------------
+c4s::proc_reactor::proc_reactor()
+  : active(0)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        ostringstream os;
+        os << "proc_reactor - unable to create epoll instance: " << strerror(errno);
+        throw process_exception(os.str());
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Processes that are still running are left alone. Their own destructors stop them.
+ */
+c4s::proc_reactor::~proc_reactor()
+{
+    for (auto& it : entries) {
+        if (it.second->src[SRC_EXIT].fd >= 0)
+            close(it.second->src[SRC_EXIT].fd);
+    }
+    close(epoll_fd);
+}
+// -------------------------------------------------------------------------------------------------
+c4s::proc_reactor::entry*
+c4s::proc_reactor::find(process& proc)
+{
+    auto it = entries.find(&proc);
+    return it == entries.end() ? 0 : it->second.get();
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_reactor::watch(source& src)
+{
+    if (src.fd < 0)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &src;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, src.fd, &ev) == -1) {
+        ostringstream os;
+        os << "proc_reactor - unable to watch descriptor " << src.fd << ": " << strerror(errno);
+        throw process_exception(os.str());
+    }
+}
+// -------------------------------------------------------------------------------------------------
+//! Removes the source from epoll. Pipes are closed by the process, the pidfd here.
+void
+c4s::proc_reactor::unwatch(source& src)
+{
+    if (src.fd < 0)
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, src.fd, 0);
+    if (src.kind == SRC_EXIT)
+        close(src.fd);
+    src.fd = -1;
+}
+// -------------------------------------------------------------------------------------------------
+/** The process is started right away. If it is still registered from an earlier run, the old
+  entry is dropped first.
+*/
+void
+c4s::proc_reactor::start(process& proc, exit_handler done, line_handler on_line)
+{
+    auto it = entries.find(&proc);
+    if (it != entries.end()) {
+        if (!it->second->exited)
+            throw process_exception("proc_reactor::start - process is already running.");
+        entries.erase(it);
+    }
+    proc.start();
+
+    unique_ptr<entry> e(new entry());
+    e->proc = &proc;
+    e->done = done;
+    e->on_line = on_line;
+    e->has_deadline = false;
+    e->timed_out = false;
+    e->exited = false;
+    e->reader = false;
+    e->exit_waiter.frame = 0;
+    e->line_waiter.frame = 0;
+    for (int kind = SRC_OUT; kind <= SRC_EXIT; kind++) {
+        e->src[kind].owner = e.get();
+        e->src[kind].kind = kind;
+        e->src[kind].fd = -1;
+    }
+    if (!proc.pid) {
+        // Dry run. Nothing was started.
+        e->exited = true;
+        finished.push_back(&proc);
+        entries.emplace(&proc, std::move(e));
+        return;
+    }
+    if (proc.pipes) {
+        e->src[SRC_OUT].fd = proc.pipes->fd_out[0] > 0 ? proc.pipes->fd_out[0] : -1;
+        e->src[SRC_ERR].fd = proc.pipes->fd_err[0] > 0 ? proc.pipes->fd_err[0] : -1;
+    }
+#if defined(SYS_pidfd_open)
+    e->src[SRC_EXIT].fd = (int)syscall(SYS_pidfd_open, proc.pid, 0);
+#endif
+    if (proc.timeout) {
+        e->has_deadline = true;
+        e->deadline = chrono::steady_clock::now() + chrono::seconds(proc.timeout);
+    }
+    for (source& src : e->src)
+        watch(src);
+    entries.emplace(&proc, std::move(e));
+    active++;
+}
+// -------------------------------------------------------------------------------------------------
+/** Reads until the pipe is empty, closed or a fair share has been read. Level triggered epoll
+  reports the rest on the next round so one busy child cannot starve the others.
+*/
+void
+c4s::proc_reactor::read_output(entry& e, source& src)
+{
+    char buffer[0x4000];
+    for (int round = 0; round < 16; round++) {
+        ssize_t br = read(src.fd, buffer, sizeof(buffer));
+        if (br > 0) {
+            deliver(e, src.kind, buffer, br);
+            continue;
+        }
+        if (br == -1 && errno == EINTR)
+            continue;
+        if (br == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        // End of file or error.
+        if (src.kind == SRC_OUT && !e.partial.empty()) {
+            push_line(e, e.partial);
+            e.partial.clear();
+        }
+        unwatch(src);
+        if (src.kind == SRC_OUT)
+            wake(e.line_waiter);
+        return;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_reactor::deliver(entry& e, int kind, const char* data, size_t len)
+{
+    if (kind != SRC_OUT || (!e.on_line && !e.reader)) {
+        RingBuffer& rb = kind == SRC_OUT ? e.proc->rb_out : e.proc->rb_err;
+        if (rb.max_size())
+            rb.write(data, len);
+        return;
+    }
+    const char* end = data + len;
+    while (data < end) {
+        const char* nl = (const char*)memchr(data, '\n', end - data);
+        if (!nl) {
+            e.partial.append(data, end - data);
+            return;
+        }
+        if (e.partial.empty()) {
+            push_line(e, string_view(data, nl - data));
+        } else {
+            e.partial.append(data, nl - data);
+            push_line(e, e.partial);
+            e.partial.clear();
+        }
+        data = nl + 1;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_reactor::push_line(entry& e, std::string_view line)
+{
+    if (e.on_line) {
+        e.on_line(*e.proc, line);
+        return;
+    }
+    e.lines.emplace_back(line);
+    wake(e.line_waiter);
+}
+// -------------------------------------------------------------------------------------------------
+/** Collects the exit status if the child has exited. Output still in the pipes is read first.
+  \retval bool True if the process has completed.
+*/
+bool
+c4s::proc_reactor::reap(entry& e)
+{
+    process& proc = *e.proc;
+    int status = 0;
+    pid_t rv = waitpid(proc.pid, &status, WNOHANG);
+    if (rv == 0 || (rv == -1 && errno == EINTR))
+        return false;
+    for (int kind = SRC_OUT; kind <= SRC_ERR; kind++) {
+        if (e.src[kind].fd >= 0)
+            read_output(e, e.src[kind]);
+    }
+    if (!e.partial.empty()) {
+        push_line(e, e.partial);
+        e.partial.clear();
+    }
+    for (source& src : e.src)
+        unwatch(src);
+    // ECHILD: the child was waited for elsewhere and its status is lost.
+    if (rv == -1 || e.timed_out)
+        proc.last_ret_val = -1;
+    else
+        proc.last_ret_val = proc.interpret_process_status(status);
+    proc.pid = 0;
+    proc.stop();
+    e.exited = true;
+    active--;
+    finished.push_back(&proc);
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+//! Runs the completion handlers and resumes the coroutines. Returns the number of completions.
+size_t
+c4s::proc_reactor::complete()
+{
+    vector<process*> done_list;
+    done_list.swap(finished);
+    for (process* proc : done_list) {
+        auto it = entries.find(proc);
+        if (it == entries.end())
+            continue;
+        entry* e = it->second.get();
+        wake(e->line_waiter);
+        // Entries of coroutines are released by wait.
+        if (e->exit_waiter.frame) {
+            wake(e->exit_waiter);
+            continue;
+        }
+        if (e->reader)
+            continue;
+        // Handler may start the same process again, so the entry is released first.
+        unique_ptr<entry> hold(std::move(it->second));
+        entries.erase(it);
+        if (hold->done)
+            hold->done(*proc, proc->last_ret_val);
+    }
+    // Resumed coroutines may wake others, which are appended to the list.
+    for (size_t ndx = 0; ndx < ready.size(); ndx++) {
+        waiter w = ready[ndx];
+        w.resume(w.frame);
+    }
+    ready.clear();
+    return done_list.size();
+}
+// -------------------------------------------------------------------------------------------------
+//! Returns the epoll timeout: the nearest process deadline or the waitpid interval.
+int
+c4s::proc_reactor::next_timeout(int timeout_ms)
+{
+    if (!finished.empty() || !ready.empty())
+        return 0;
+    int wait = timeout_ms;
+    auto now = chrono::steady_clock::now();
+    for (auto& it : entries) {
+        entry& e = *it.second;
+        if (e.exited)
+            continue;
+        int limit = -1;
+        if (e.src[SRC_EXIT].fd < 0)
+            limit = 50;
+        if (e.has_deadline) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(e.deadline - now).count() + 1;
+            if (left < 0)
+                left = 0;
+            if (limit < 0 || left < limit)
+                limit = (int)left;
+        }
+        if (limit >= 0 && (wait < 0 || limit < wait))
+            wait = limit;
+    }
+    return wait;
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::proc_reactor::run_once(int timeout_ms)
+{
+    if (!active && finished.empty() && ready.empty())
+        return 0;
+    if (active) {
+        struct epoll_event events[64];
+        int count = epoll_wait(epoll_fd, events, 64, next_timeout(timeout_ms));
+        if (count == -1 && errno != EINTR) {
+            ostringstream os;
+            os << "proc_reactor::run_once - epoll_wait failed: " << strerror(errno);
+            throw process_exception(os.str());
+        }
+        for (int ndx = 0; ndx < count; ndx++) {
+            source* src = (source*)events[ndx].data.ptr;
+            entry& e = *src->owner;
+            // An earlier event of this round may have completed the process.
+            if (e.exited || src->fd < 0)
+                continue;
+            if (src->kind == SRC_EXIT)
+                reap(e);
+            else
+                read_output(e, *src);
+        }
+        // Deadlines and children without pidfd. Line handlers may start new processes, so the
+        // entries are collected before they are handled.
+        vector<entry*> check;
+        auto now = chrono::steady_clock::now();
+        for (auto& it : entries) {
+            entry& e = *it.second;
+            if (e.exited)
+                continue;
+            if (e.has_deadline && now >= e.deadline) {
+                kill(e.proc->pid, SIGKILL);
+                e.timed_out = true;
+                e.has_deadline = false;
+            }
+            if (e.src[SRC_EXIT].fd < 0)
+                check.push_back(&e);
+        }
+        for (entry* e : check)
+            reap(*e);
+    }
+    return complete();
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::proc_reactor::run()
+{
+    size_t total = 0;
+    while (active || !finished.empty())
+        total += run_once(-1);
+    return total;
+}
+
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_reactor::wake(waiter& w)
+{
+    if (!w.frame)
+        return;
+    ready.push_back(w);
+    w.frame = 0;
+}
+// -------------------------------------------------------------------------------------------------
+//! Drops the entry of a completed process. Returns its return value.
+int
+c4s::proc_reactor::release(process& proc)
+{
+    auto it = entries.find(&proc);
+    if (it != entries.end() && it->second->exited)
+        entries.erase(it);
+    return proc.last_return_value();
+}
+// -------------------------------------------------------------------------------------------------
+//! Throws process_exception if there is nothing that could resume a waiting coroutine.
+void
+c4s::proc_reactor::expect_work() const
+{
+    if (!active && finished.empty() && ready.empty())
+        throw process_exception("proc_reactor::sync_wait - task waits but nothing is running.");
+}
@@ -0,0 +1,399 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_PROC_REACTOR_HPP
+#define C4S_PROC_REACTOR_HPP
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <exception>
+#include <optional>
+#endif
+
+namespace c4s {
+
+class process;
+#if defined(__cpp_impl_coroutine)
+class proc_task;
+#endif
+
+// -----------------------------------------------------------------------------------------------------------
+//! Runs many processes concurrently from a single thread.
+/*! The reactor owns one epoll instance that waits for the output pipes and the pidfds of all
+  processes started through it, so the calling thread sleeps until something actually happens
+  instead of polling each process with is_running(). Where pidfd is not available, exits are
+  checked with waitpid every 50 ms.<br>
+  Output is read as it arrives. Standard output is split into lines for the line handler or for
+  read_line. Without those, output goes into the rb_out and rb_err buffers of the process when
+  they have been sized; otherwise it is discarded so that children never block on a full pipe.
+  Process timeouts are honored: child that runs past its timeout is killed and completes with -1.
+  \code
+  proc_reactor reactor;
+  std::vector<std::unique_ptr<process>> jobs;
+  ...
+  for (auto& job : jobs)
+      reactor.start(*job, [](process& p, int rv) { if (rv) failed++; });
+  reactor.run();
+  \endcode
+  Processes must outlive the reactor's use of them and must not be waited for with the process'
+  own functions while the reactor manages them.
+*/
+class proc_reactor
+{
+  public:
+    //! Called when the process has completed. Second argument is the return value.
+    typedef std::function<void(process&, int)> exit_handler;
+    //! Called for each line of standard output. Line feed is not included.
+    typedef std::function<void(process&, std::string_view)> line_handler;
+
+    //! Creates the epoll instance. Throws process_exception on failure.
+    proc_reactor();
+    ~proc_reactor();
+    proc_reactor(const proc_reactor&) = delete;
+    proc_reactor& operator=(const proc_reactor&) = delete;
+
+    //! Starts the process and adds it to the reactor.
+    /*! \param proc Process with command and arguments set. It must not be running.
+        \param done Optional completion handler.
+        \param on_line Optional handler for standard output lines.*/
+    void start(process& proc, exit_handler done = exit_handler(), line_handler on_line = line_handler());
+    //! Handles events until all processes have completed. Returns the number of completed processes.
+    size_t run();
+    //! Waits for events once and handles them.
+    /*! \param timeout_ms Maximum time to wait. -1 waits until something happens.
+        \retval size_t Number of processes that completed.*/
+    size_t run_once(int timeout_ms = -1);
+    //! Number of processes that are still running.
+    size_t running() const { return active; }
+
+#if defined(__cpp_impl_coroutine)
+    //! Awaitable that completes with the return value of the process.
+    class exit_awaiter
+    {
+      public:
+        exit_awaiter(proc_reactor& _owner, process& _proc, bool _start)
+          : owner(_owner)
+          , proc(_proc)
+          , start(_start)
+        {}
+        bool await_ready()
+        {
+            if (start)
+                owner.start(proc);
+            entry* e = owner.find(proc);
+            return !e || e->exited;
+        }
+        void await_suspend(std::coroutine_handle<> waiter)
+        {
+            owner.find(proc)->exit_waiter = make_waiter(waiter);
+        }
+        int await_resume() { return owner.release(proc); }
+
+      private:
+        proc_reactor& owner;
+        process& proc;
+        bool start;
+    };
+    //! Awaitable that completes with the next line of standard output or nullopt at the end.
+    class line_awaiter
+    {
+      public:
+        line_awaiter(proc_reactor& _owner, process& _proc)
+          : owner(_owner)
+          , proc(_proc)
+        {}
+        bool await_ready()
+        {
+            entry* e = owner.find(proc);
+            if (!e)
+                return true;
+            e->reader = true;
+            return !e->lines.empty() || e->src[SRC_OUT].fd < 0;
+        }
+        void await_suspend(std::coroutine_handle<> waiter)
+        {
+            owner.find(proc)->line_waiter = make_waiter(waiter);
+        }
+        std::optional<std::string> await_resume()
+        {
+            entry* e = owner.find(proc);
+            if (!e || e->lines.empty())
+                return std::nullopt;
+            std::optional<std::string> line(std::move(e->lines.front()));
+            e->lines.pop_front();
+            return line;
+        }
+
+      private:
+        proc_reactor& owner;
+        process& proc;
+    };
+
+    //! Starts the process and waits for it: int rv = co_await reactor.execute(proc);
+    exit_awaiter execute(process& proc) { return exit_awaiter(*this, proc, true); }
+    //! Waits for a process started earlier with start().
+    exit_awaiter wait(process& proc) { return exit_awaiter(*this, proc, false); }
+    //! Returns the next output line of a process started with start().
+    /*! Lines are queued for read_line after its first call. Call it right after start, before the
+        reactor runs again, to receive all lines.*/
+    line_awaiter read_line(process& proc) { return line_awaiter(*this, proc); }
+    //! Runs the task and the event loop until the task has completed. Rethrows its exception.
+    void sync_wait(proc_task& task);
+#endif
+
+  protected:
+    //! Suspended coroutine. Kept as plain pointers so that the layout of the reactor does not
+    //! depend on whether the library was compiled with coroutine support.
+    struct waiter
+    {
+        void (*resume)(void*);
+        void* frame;
+    };
+    struct entry;
+    //! Event source registered to epoll.
+    struct source
+    {
+        entry* owner;
+        int kind;   //!< SRC_OUT, SRC_ERR or SRC_EXIT.
+        int fd;     //!< -1 when closed.
+    };
+    struct entry
+    {
+        process* proc;
+        source src[3];
+        exit_handler done;
+        line_handler on_line;
+        std::string partial;                 //!< Incomplete last line of standard output.
+        std::chrono::steady_clock::time_point deadline;
+        bool has_deadline;
+        bool timed_out;
+        bool exited;
+        bool reader;                         //!< Lines are read with read_line.
+        std::deque<std::string> lines;       //!< Lines waiting for read_line.
+        waiter exit_waiter;
+        waiter line_waiter;
+    };
+    static const int SRC_OUT = 0;
+    static const int SRC_ERR = 1;
+    static const int SRC_EXIT = 2;
+
+    entry* find(process& proc);
+    void watch(source& src);
+    void unwatch(source& src);
+    void read_output(entry& e, source& src);
+    void deliver(entry& e, int kind, const char* data, size_t len);
+    void push_line(entry& e, std::string_view line);
+    bool reap(entry& e);
+    size_t complete();
+    int next_timeout(int timeout_ms);
+    void wake(waiter& w);
+    int release(process& proc);
+    void expect_work() const;
+#if defined(__cpp_impl_coroutine)
+    static waiter make_waiter(std::coroutine_handle<> handle)
+    {
+        waiter w;
+        w.resume = [](void* frame) { std::coroutine_handle<>::from_address(frame).resume(); };
+        w.frame = handle.address();
+        return w;
+    }
+#endif
+
+    int epoll_fd;
+    size_t active;                          //!< Entries that have not exited.
+    std::unordered_map<process*, std::unique_ptr<entry>> entries;
+    std::vector<process*> finished;         //!< Exited entries waiting for their handlers.
+    std::vector<waiter> ready;              //!< Coroutines to resume after the events.
+};
+
+#if defined(__cpp_impl_coroutine)
+// -----------------------------------------------------------------------------------------------------------
+//! Coroutine type for scripts that drive processes with a proc_reactor.
+/*! Task starts when it is awaited or given to proc_reactor::sync_wait or when_all. Exceptions
+  thrown inside the task are rethrown to the awaiter.
+  \code
+  proc_task compile(proc_reactor& reactor, process& cc)
+  {
+      reactor.start(cc);
+      while (auto line = co_await reactor.read_line(cc))
+          std::cout << *line << '\n';
+      if (co_await reactor.wait(cc))
+          throw c4s_exception("compile failed");
+  }
+  \endcode
+*/
+class proc_task
+{
+  public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> handle;
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle task) noexcept
+        {
+            std::coroutine_handle<> next = task.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    struct promise_type
+    {
+        proc_task get_return_object() { return proc_task(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+        final_awaiter final_suspend() noexcept { return final_awaiter(); }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+    };
+
+    proc_task()
+      : coro()
+    {}
+    explicit proc_task(handle h)
+      : coro(h)
+    {}
+    proc_task(proc_task&& other) noexcept
+      : coro(other.coro)
+    {
+        other.coro = handle();
+    }
+    proc_task& operator=(proc_task&& other) noexcept
+    {
+        if (this != &other) {
+            if (coro)
+                coro.destroy();
+            coro = other.coro;
+            other.coro = handle();
+        }
+        return *this;
+    }
+    ~proc_task()
+    {
+        if (coro)
+            coro.destroy();
+    }
+    proc_task(const proc_task&) = delete;
+    proc_task& operator=(const proc_task&) = delete;
+
+    //! True when the task has run to its end.
+    bool done() const { return !coro || coro.done(); }
+
+    bool await_ready() const { return done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter)
+    {
+        coro.promise().continuation = waiter;
+        return coro;
+    }
+    void await_resume()
+    {
+        if (coro && coro.promise().error)
+            std::rethrow_exception(coro.promise().error);
+    }
+
+  protected:
+    friend class proc_reactor;
+    friend class when_all_awaiter;
+    handle coro;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Awaitable that runs the tasks concurrently and completes when all of them have completed.
+/*! The first exception thrown by the tasks is rethrown after all tasks have completed.*/
+class when_all_awaiter
+{
+  public:
+    explicit when_all_awaiter(std::vector<proc_task>&& _tasks)
+      : tasks(std::move(_tasks))
+      , left(0)
+    {}
+    bool await_ready() const { return tasks.empty(); }
+    //! Tasks are started one after another and each runs until its first suspension. Counter
+    //! has one extra so that tasks that complete at once cannot resume the waiter too early.
+    bool await_suspend(std::coroutine_handle<> waiter)
+    {
+        parent = waiter;
+        left = tasks.size() + 1;
+        trackers.reserve(tasks.size());
+        for (proc_task& task : tasks) {
+            trackers.push_back(track(task, this));
+            trackers.back().coro.resume();
+        }
+        return --left != 0;
+    }
+    void await_resume()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+  protected:
+    struct join
+    {
+        when_all_awaiter* all;
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept
+        {
+            return --all->left ? std::coroutine_handle<>(std::noop_coroutine()) : all->parent;
+        }
+        void await_resume() noexcept {}
+    };
+    static proc_task track(proc_task& task, when_all_awaiter* all)
+    {
+        try {
+            co_await task;
+        } catch (...) {
+            if (!all->error)
+                all->error = std::current_exception();
+        }
+        co_await join{ all };
+    }
+
+    std::vector<proc_task> tasks;
+    std::vector<proc_task> trackers;
+    size_t left;
+    std::coroutine_handle<> parent;
+    std::exception_ptr error;
+};
+
+//! Runs the tasks concurrently: co_await when_all(std::move(tasks));
+inline when_all_awaiter
+when_all(std::vector<proc_task>&& tasks)
+{
+    return when_all_awaiter(std::move(tasks));
+}
+
+// -----------------------------------------------------------------------------------------------------------
+inline void
+proc_reactor::sync_wait(proc_task& task)
+{
+    if (task.done())
+        return;
+    task.coro.resume();
+    while (!task.done()) {
+        expect_work();
+        run_once(-1);
+    }
+    task.await_resume();
+}
+#endif
+
+} // namespace c4s
+#endif
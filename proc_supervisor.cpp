@@ -0,0 +1,327 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "path.hpp"
+#include "RingBuffer.hpp"
+#include "process.hpp"
+#include "proc_reactor.hpp"
+#include "proc_supervisor.hpp"
+
+using namespace std;
+using namespace c4s;
+
+// -------------------------------------------------------------------------------------------------
+c4s::proc_supervisor::proc_supervisor()
+  : reactor(new proc_reactor())
+{}
+// -------------------------------------------------------------------------------------------------
+c4s::proc_supervisor::~proc_supervisor()
+{
+    try {
+        stop_all();
+    } catch (const c4s_exception&) {
+        // Remaining children are killed by the process destructors.
+    }
+}
+// -------------------------------------------------------------------------------------------------
+c4s::proc_supervisor::unit*
+c4s::proc_supervisor::find(const string& name) const
+{
+    for (auto& u : units) {
+        if (u->spec.name == name)
+            return u.get();
+    }
+    return 0;
+}
+// -------------------------------------------------------------------------------------------------
+/** Process is created before the service is added, so that a missing command is reported to the
+  caller. Failures after that, e.g. in fork, are handled as exits and retried.
+  \param spec Service description.
+*/
+void
+c4s::proc_supervisor::add(const service& spec)
+{
+    if (spec.name.empty() || find(spec.name)) {
+        ostringstream os;
+        os << "proc_supervisor::add - service name '" << spec.name << "' is empty or already in use.";
+        throw c4s_exception(os.str());
+    }
+    unique_ptr<unit> u(new unit());
+    u->spec = spec;
+    u->proc.reset(new process(spec.command, spec.args));
+    u->proc->set_timeout(0);
+    u->proc->set_profile(spec.profile);
+    if (spec.max_memory)
+        u->proc->set_rlimit(RLIMIT_AS, spec.max_memory);
+    if (spec.max_cpu)
+        u->proc->set_rlimit(RLIMIT_CPU, spec.max_cpu);
+    u->delay = spec.backoff_min;
+    u->attempts = 0;
+    u->killed = false;
+    units.push_back(std::move(u));
+    launch(*units.back());
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_supervisor::launch(unit& u)
+{
+    unit* up = &u;
+    u.started = chrono::steady_clock::now();
+    u.killed = false;
+    u.stat.state = STATE::RUNNING;
+    try {
+        reactor->start(*u.proc, [this, up](process&, int rv) { exited(*up, rv); });
+    } catch (const process_exception&) {
+        exited(u, -1);
+        return;
+    }
+    u.stat.starts++;
+    if (u.attempts)
+        u.stat.restarts++;
+    u.stat.pid = u.proc->get_pid();
+}
+// -------------------------------------------------------------------------------------------------
+/** Decides whether and when the service is restarted.
+  \param u Unit whose process has exited.
+  \param rv Return value of the process. Signals give -1.
+*/
+void
+c4s::proc_supervisor::exited(unit& u, int rv)
+{
+    auto now = chrono::steady_clock::now();
+    u.stat.pid = 0;
+    u.stat.last_rv = rv;
+    if (u.stat.state == STATE::STOPPING) {
+        u.stat.state = STATE::STOPPED;
+        return;
+    }
+    bool failed = rv != 0;
+    if (failed)
+        u.stat.failures++;
+    if (now - u.started >= chrono::milliseconds(u.spec.stable_after)) {
+        u.delay = u.spec.backoff_min;
+        u.attempts = 0;
+    }
+    if (u.spec.restart == RESTART::NEVER || (u.spec.restart == RESTART::ON_FAILURE && !failed)) {
+        u.stat.state = STATE::STOPPED;
+        return;
+    }
+    if (u.spec.max_restarts && u.attempts >= u.spec.max_restarts) {
+        u.stat.state = STATE::FAILED;
+        return;
+    }
+    u.attempts++;
+    u.stat.state = STATE::BACKOFF;
+    u.next_start = now + chrono::milliseconds(u.delay);
+    u.delay = u.delay > u.spec.backoff_max / 2 ? u.spec.backoff_max : u.delay * 2;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_supervisor::start(const string& name)
+{
+    unit* u = find(name);
+    if (!u) {
+        ostringstream os;
+        os << "proc_supervisor::start - unknown service '" << name << "'.";
+        throw c4s_exception(os.str());
+    }
+    if (u->stat.state != STATE::STOPPED && u->stat.state != STATE::FAILED)
+        return;
+    u->delay = u->spec.backoff_min;
+    u->attempts = 0;
+    launch(*u);
+}
+// -------------------------------------------------------------------------------------------------
+//! Sends SIGTERM to a running unit. Pending restart is cancelled.
+void
+c4s::proc_supervisor::terminate(unit& u)
+{
+    if (u.stat.state == STATE::BACKOFF) {
+        u.stat.state = STATE::STOPPED;
+        return;
+    }
+    if (u.stat.state != STATE::RUNNING)
+        return;
+    u.stat.state = STATE::STOPPING;
+    u.killed = false;
+    u.deadline = chrono::steady_clock::now() + chrono::milliseconds(u.spec.grace);
+    if (u.stat.pid > 0)
+        kill(u.stat.pid, SIGTERM);
+}
+// -------------------------------------------------------------------------------------------------
+/** Sleeps in the reactor until the stopping units have exited. Exits wake it through the pidfds,
+  and the timeout is the nearest SIGKILL deadline.
+*/
+void
+c4s::proc_supervisor::wait_stopped()
+{
+    for (;;) {
+        bool stopping = false;
+        auto now = chrono::steady_clock::now();
+        for (auto& u : units) {
+            if (u->stat.state != STATE::STOPPING)
+                continue;
+            stopping = true;
+            if (!u->killed && now >= u->deadline && u->stat.pid > 0) {
+                kill(u->stat.pid, SIGKILL);
+                u->killed = true;
+                u->stat.kills++;
+            }
+        }
+        if (!stopping)
+            return;
+        reactor->run_once(next_timeout(-1, false));
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_supervisor::stop(const string& name)
+{
+    unit* u = find(name);
+    if (!u)
+        return;
+    terminate(*u);
+    wait_stopped();
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_supervisor::stop_all()
+{
+    for (auto& u : units)
+        terminate(*u);
+    wait_stopped();
+}
+// -------------------------------------------------------------------------------------------------
+/** \param timeout_ms Upper limit. -1 for none.
+  \param restarts If false, pending restarts are not considered.
+  \retval int Time to the nearest restart or SIGKILL deadline in ms.
+*/
+int
+c4s::proc_supervisor::next_timeout(int timeout_ms, bool restarts) const
+{
+    int wait = timeout_ms;
+    auto now = chrono::steady_clock::now();
+    for (auto& u : units) {
+        chrono::steady_clock::time_point at;
+        if (u->stat.state == STATE::BACKOFF && restarts)
+            at = u->next_start;
+        else if (u->stat.state == STATE::STOPPING && !u->killed)
+            at = u->deadline;
+        else
+            continue;
+        auto left = chrono::duration_cast<chrono::milliseconds>(at - now).count() + 1;
+        if (left < 0)
+            left = 0;
+        if (wait < 0 || left < wait)
+            wait = (int)left;
+    }
+    return wait;
+}
+// -------------------------------------------------------------------------------------------------
+/** Restarts are done before and after waiting so that due restarts are never delayed by the wait.
+  If nothing is running nor waiting for restart, returns at once.
+*/
+void
+c4s::proc_supervisor::run_once(int timeout_ms)
+{
+    auto launch_due = [this]() {
+        auto now = chrono::steady_clock::now();
+        for (auto& u : units) {
+            if (u->stat.state == STATE::BACKOFF && now >= u->next_start)
+                launch(*u);
+        }
+    };
+    launch_due();
+    int wait = next_timeout(timeout_ms, true);
+    if (reactor->running())
+        reactor->run_once(wait);
+    else if (wait > 0)
+        poll(0, 0, wait);
+    launch_due();
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::proc_supervisor::run_for(chrono::milliseconds duration)
+{
+    auto end = chrono::steady_clock::now() + duration;
+    for (;;) {
+        auto left = chrono::duration_cast<chrono::milliseconds>(end - chrono::steady_clock::now());
+        if (left.count() <= 0)
+            return;
+        run_once((int)left.count());
+    }
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::proc_supervisor::get_counters(const string& name, counters& out) const
+{
+    unit* u = find(name);
+    if (!u)
+        return false;
+    out = u->stat;
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+const char*
+c4s::proc_supervisor::state_name(STATE st)
+{
+    switch (st) {
+    case STATE::STOPPED:
+        return "stopped";
+    case STATE::RUNNING:
+        return "running";
+    case STATE::BACKOFF:
+        return "backoff";
+    case STATE::STOPPING:
+        return "stopping";
+    case STATE::FAILED:
+        return "failed";
+    }
+    return "unknown";
+}
+// -------------------------------------------------------------------------------------------------
+/** Each service is labeled with its name, e.g. c4s_service_restarts_total{service="web"} 2.
+  \param os Stream to write to.
+*/
+void
+c4s::proc_supervisor::export_counters(ostream& os) const
+{
+    auto emit = [&](const char* name, const char* type, const char* help, auto value) {
+        os << "# HELP " << name << ' ' << help << '\n';
+        os << "# TYPE " << name << ' ' << type << '\n';
+        for (auto& u : units) {
+            os << name << "{service=\"";
+            for (char ch : u->spec.name) {
+                if (ch == '"' || ch == '\\')
+                    os << '\\';
+                os << (ch == '\n' ? ' ' : ch);
+            }
+            os << "\"} " << value(u->stat) << '\n';
+        }
+    };
+    emit("c4s_service_starts_total", "counter", "Number of times the service was started.",
+         [](const counters& c) { return c.starts; });
+    emit("c4s_service_restarts_total", "counter", "Number of starts after an exit.",
+         [](const counters& c) { return c.restarts; });
+    emit("c4s_service_failures_total", "counter", "Exits with non-zero value or by a signal.",
+         [](const counters& c) { return c.failures; });
+    emit("c4s_service_kills_total", "counter", "Stops that needed SIGKILL.",
+         [](const counters& c) { return c.kills; });
+    emit("c4s_service_up", "gauge", "1 if the service is running.",
+         [](const counters& c) { return c.state == STATE::RUNNING ? 1 : 0; });
+    emit("c4s_service_last_exit", "gauge", "Return value of the latest exit.",
+         [](const counters& c) { return c.last_rv; });
+}
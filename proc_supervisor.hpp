@@ -0,0 +1,135 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_PROC_SUPERVISOR_HPP
+#define C4S_PROC_SUPERVISOR_HPP
+
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "proc_profile.hpp"
+
+namespace c4s {
+
+class process;
+class proc_reactor;
+
+// -----------------------------------------------------------------------------------------------------------
+//! Keeps a set of long running child processes alive.
+/*! Services are started through a proc_reactor, so exits are noticed from the pidfds as soon as
+  they happen. A service that exits is restarted according to its policy after a delay that starts
+  from backoff_min and doubles on each consecutive failure up to backoff_max. The delay is reset
+  once the service has stayed up for stable_after milliseconds.<br>
+  Stopping sends SIGTERM and waits for the exit at most for the grace period of the service, after
+  which SIGKILL is sent. Memory and CPU time limits are set with setrlimit in the child. Other
+  constraints, including a cgroup, are given with the profile of the service.
+  \code
+  proc_supervisor sup;
+  proc_supervisor::service web;
+  web.name = "web";
+  web.command = "/usr/local/bin/webd";
+  web.args = "--port 8080";
+  web.profile.set_cgroup("webd", 512 << 20, 200);
+  sup.add(web);
+  while (running)
+      sup.run_once(1000);
+  sup.stop_all();
+  \endcode
+  The supervisor is driven by the calling thread. Use it from one thread only.
+*/
+class proc_supervisor
+{
+  public:
+    enum class RESTART { NEVER, ON_FAILURE, ALWAYS };
+    enum class STATE { STOPPED, RUNNING, BACKOFF, STOPPING, FAILED };
+
+    //! Description of a supervised process.
+    struct service
+    {
+        std::string name;                  //!< Unique name of the service.
+        std::string command;               //!< Command, searched from PATH if not a path.
+        std::string args;                  //!< Arguments as for process::set_args.
+        RESTART restart = RESTART::ON_FAILURE;
+        unsigned int backoff_min = 500;    //!< First restart delay in ms.
+        unsigned int backoff_max = 60000;  //!< Longest restart delay in ms.
+        unsigned int stable_after = 10000; //!< Run time in ms after which the delay is reset.
+        unsigned int max_restarts = 0;     //!< Consecutive restarts before giving up. 0: no limit.
+        unsigned int grace = 5000;         //!< Time in ms between SIGTERM and SIGKILL.
+        unsigned long long max_memory = 0; //!< Address space limit in bytes. 0: no limit.
+        unsigned long long max_cpu = 0;    //!< CPU time limit in seconds. 0: no limit.
+        proc_profile profile;              //!< Other resource constraints of the process.
+    };
+    //! Health counters of a service.
+    struct counters
+    {
+        size_t starts = 0;    //!< Successful starts.
+        size_t restarts = 0;  //!< Starts after an exit.
+        size_t failures = 0;  //!< Exits with non-zero value or by a signal.
+        size_t kills = 0;     //!< Stops that needed SIGKILL.
+        int last_rv = 0;      //!< Return value of the latest exit.
+        int pid = 0;          //!< Current pid or 0.
+        STATE state = STATE::STOPPED;
+    };
+
+    proc_supervisor();
+    //! Stops all services.
+    ~proc_supervisor();
+    proc_supervisor(const proc_supervisor&) = delete;
+    proc_supervisor& operator=(const proc_supervisor&) = delete;
+
+    //! Adds the service and starts it. Throws c4s_exception if the name is already in use.
+    /*! If the command cannot be found, process_exception is thrown and the service is not added.*/
+    void add(const service& spec);
+    //! Starts a stopped or failed service again.
+    void start(const std::string& name);
+    //! Stops the service and waits until it has exited. Service is not restarted.
+    void stop(const std::string& name);
+    //! Stops all services in parallel and waits until they have exited.
+    void stop_all();
+    //! Handles exits and due restarts.
+    /*! \param timeout_ms Longest time to wait for something to happen. -1 waits forever.*/
+    void run_once(int timeout_ms = -1);
+    //! Runs the supervisor for the given time.
+    void run_for(std::chrono::milliseconds duration);
+
+    //! Copies the counters of the service. Returns false if there is no such service.
+    bool get_counters(const std::string& name, counters& out) const;
+    //! Writes the counters of all services in the Prometheus text format.
+    void export_counters(std::ostream& os) const;
+    //! Returns the name of the state.
+    static const char* state_name(STATE st);
+
+  protected:
+    struct unit
+    {
+        service spec;
+        counters stat;
+        std::unique_ptr<process> proc;
+        unsigned int delay;                                //!< Next restart delay in ms.
+        unsigned int attempts;                             //!< Restarts since the last stable run.
+        bool killed;                                       //!< SIGKILL has been sent.
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point next_start;  //!< When in BACKOFF.
+        std::chrono::steady_clock::time_point deadline;    //!< SIGKILL time when STOPPING.
+    };
+
+    unit* find(const std::string& name) const;
+    void launch(unit& u);
+    void exited(unit& u, int rv);
+    void terminate(unit& u);
+    void wait_stopped();
+    int next_timeout(int timeout_ms, bool restarts) const;
+
+    std::unique_ptr<proc_reactor> reactor;
+    std::vector<std::unique_ptr<unit>> units;
+};
+
+} // namespace c4s
+#endif
@@ -10,13 +10,22 @@
 #include <string.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <time.h>
+#if defined(__linux)
+#include <sys/inotify.h>
+#endif
+#include <mutex>
+#include <unordered_map>
 
 #include "config.hpp"
 #include "exception.hpp"
@@ -75,6 +84,8 @@ proc_pipes::proc_pipes()
     fcntl(fd_err[0], F_SETFL, fflag | O_NONBLOCK);
     br_in = 0;
     send_ctrlZ = false;
+    out_open = true;
+    err_open = true;
 }
 // -------------------------------------------------------------------------------------------------
 void
@@ -138,9 +149,12 @@ proc_pipes::init_child()
 void
 proc_pipes::init_parent()
 {
-    // Close the input read side
+    // Close the input read side. Write side is nonblocking so that the output can be read
+    // while the child is not reading its input.
     close(fd_in[0]);
     fd_in[0] = 0;
+    int fflag = fcntl(fd_in[1], F_GETFL, 0);
+    fcntl(fd_in[1], F_SETFL, fflag | O_NONBLOCK);
     // Close the output write sides
     close(fd_out[1]);
     close(fd_err[1]);
@@ -179,53 +193,354 @@ proc_pipes::read_child_stderr(RingBuffer* rbuf)
 }
 // -------------------------------------------------------------------------------------------------
 /*!
-  Writes the RingBuffer content into the child input.
-  \param input String to write.
+  Writes the RingBuffer content into the child input. While the child is not reading, its output
+  is read into the given buffers so that it cannot block on a full output pipe.
+  \param data Data to write.
+  \param out Buffer for the standard output. Output is dropped if null or without size.
+  \param err Buffer for the standard error. Errors are dropped if null or without size.
+  \param timeout_ms Longest time to wait without progress. -1 waits forever.
+  \retval size_t Bytes written.
 */
 size_t
-proc_pipes::write_child_input(RingBuffer* data)
+proc_pipes::write_child_input(RingBuffer* data, RingBuffer* out, RingBuffer* err, int timeout_ms)
 {
-    size_t cnt = 0, ss;
     if (!data || !fd_in[1])
         return 0;
-    do {
-        ss = data->read_into(fd_in[1], data->size());
-        cnt += ss;
-    } while (ss > 0);
+    RingBuffer discard(0);
+    pipe_sink out_sink = { 0, out ? out : &discard };
+    pipe_sink err_sink = { 0, err ? err : &discard };
+    char chunk[0x4000];
+    size_t cnt = 0, len;
+    while ((len = data->read_data(chunk, sizeof(chunk))) > 0) {
+        size_t bw = pump_input(chunk, len, out_sink, err_sink, timeout_ms);
+        cnt += bw;
+        if (bw < len)
+            break;
+    }
 #ifdef C4S_DEBUGTRACE
     c4slog << "proc_pipes::write_child_input - " << cnt << " bytes to child stdin\n";
 #endif
     return cnt;
 }
 // -------------------------------------------------------------------------------------------------
+//! Writes the string into the child input. See the RingBuffer version for the parameters.
 size_t
-proc_pipes::write_child_input(ntbs* data)
+proc_pipes::write_child_input(ntbs* data, RingBuffer* out, RingBuffer* err, int timeout_ms)
 {
     if (!data || !fd_in[1])
         return 0;
-    ssize_t bw = 0;
-    size_t cnt = 0;
-    size_t max = data->len();
-    char *ptr = data->get();
-    int retry_count = 0;
-    while (retry_count < 10 && bw < (ssize_t) max) {
-        bw = ::write(fd_in[1], ptr, max);
-        if (bw == -1) {
-            if (errno == EAGAIN)
-                retry_count++;
-            else
-                return 0;
-        } else {
-            max -= (size_t) bw;
-            ptr += bw;
-            cnt += bw;
-        }
-    }
+    RingBuffer discard(0);
+    pipe_sink out_sink = { 0, out ? out : &discard };
+    pipe_sink err_sink = { 0, err ? err : &discard };
+    size_t cnt = pump_input(data->get(), data->len(), out_sink, err_sink, timeout_ms);
 #ifdef C4S_DEBUGTRACE
     c4slog << "proc_pipes::write_child_input (ntbs) - Wrote " << cnt << " bytes to child stdin\n";
 #endif
     return cnt;
 }
+// -------------------------------------------------------------------------------------------------
+void
+pipe_sink::put(const char* data, size_t len)
+{
+    if (stream)
+        stream->write(data, len);
+    else if (rb && rb->max_size())
+        rb->write(data, len);
+}
+// -------------------------------------------------------------------------------------------------
+//! Blocks SIGPIPE for the calling thread so that writing into a closed pipe fails with EPIPE
+//! instead of terminating the program.
+class proc_sigpipe_block
+{
+  public:
+    proc_sigpipe_block()
+    {
+        sigemptyset(&pipe_set);
+        sigaddset(&pipe_set, SIGPIPE);
+        sigset_t pending;
+        sigpending(&pending);
+        was_pending = sigismember(&pending, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    }
+    ~proc_sigpipe_block()
+    {
+        // Consume the signals raised meanwhile, but not one that was already pending.
+        if (!was_pending) {
+            struct timespec zero = { 0, 0 };
+            while (sigtimedwait(&pipe_set, 0, &zero) > 0)
+                ;
+        }
+        pthread_sigmask(SIG_SETMASK, &old_set, 0);
+    }
+
+  private:
+    sigset_t pipe_set;
+    sigset_t old_set;
+    bool was_pending;
+};
+// -------------------------------------------------------------------------------------------------
+/** Reads what is available.
+  \retval bool False when the pipe has been closed.
+*/
+bool
+proc_pipes::read_to_sink(int fd, pipe_sink& sink)
+{
+    char buffer[0x10000];
+    for (int round = 0; round < 4; round++) {
+        ssize_t br = ::read(fd, buffer, sizeof(buffer));
+        if (br > 0) {
+            sink.put(buffer, br);
+            continue;
+        }
+        if (br == -1 && errno == EINTR)
+            continue;
+        return br == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+/** Waits until the input can be written or output can be read, and reads the output.
+  \param input Wait for the input as well.
+  \retval bool False on timeout or if there is nothing to wait for.
+*/
+bool
+proc_pipes::wait_pipes(bool input, pipe_sink& out, pipe_sink& err, int timeout_ms)
+{
+    struct pollfd pfd[3];
+    pipe_sink* sinks[3];
+    bool* open[3];
+    nfds_t count = 0;
+    if (input && fd_in[1]) {
+        pfd[count].fd = fd_in[1];
+        pfd[count].events = POLLOUT;
+        open[count] = 0;
+        sinks[count++] = 0;
+    }
+    if (out_open && (out.stream || out.rb)) {
+        pfd[count].fd = fd_out[0];
+        pfd[count].events = POLLIN;
+        open[count] = &out_open;
+        sinks[count++] = &out;
+    }
+    if (err_open && (err.stream || err.rb)) {
+        pfd[count].fd = fd_err[0];
+        pfd[count].events = POLLIN;
+        open[count] = &err_open;
+        sinks[count++] = &err;
+    }
+    if (!count)
+        return false;
+    int rv;
+    do {
+        rv = poll(pfd, count, timeout_ms);
+    } while (rv == -1 && errno == EINTR);
+    if (rv <= 0)
+        return false;
+    for (nfds_t ndx = 0; ndx < count; ndx++) {
+        if (sinks[ndx] && pfd[ndx].revents && !read_to_sink(pfd[ndx].fd, *sinks[ndx]))
+            *open[ndx] = false;
+    }
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+proc_pipes::pump_input(const char* data, size_t len, pipe_sink& out, pipe_sink& err,
+                       int timeout_ms)
+{
+    proc_sigpipe_block block;
+    size_t written = 0;
+    while (written < len && fd_in[1]) {
+        ssize_t bw = ::write(fd_in[1], data + written, len - written);
+        if (bw > 0) {
+            written += bw;
+            continue;
+        }
+        if (bw == -1 && errno == EINTR)
+            continue;
+        if (bw == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            // EPIPE: the child does not read its input anymore.
+            close_child_input();
+            break;
+        }
+        if (!wait_pipes(true, out, err, timeout_ms))
+            break;
+    }
+    return written;
+}
+// -------------------------------------------------------------------------------------------------
+bool
+proc_pipes::pump_output(pipe_sink& out, pipe_sink& err, int timeout_ms)
+{
+    while (out_open || err_open) {
+        if (!wait_pipes(false, out, err, timeout_ms))
+            return false;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+//! Returns the number of bytes available for the command and its arguments in execv.
+static size_t
+proc_arg_limit()
+{
+    long max = sysconf(_SC_ARG_MAX);
+    if (max <= 0)
+        max = 0x20000;
+    // Environment is passed in the same space.
+    size_t reserved = 0x1000;
+    for (char** env = environ; *env; env++)
+        reserved += strlen(*env) + 1 + sizeof(char*);
+    return (size_t)max > reserved ? max - reserved : 0;
+}
+// -------------------------------------------------------------------------------------------------
+//! Returns the longest single argument execv accepts. Linux limits each one to 32 pages.
+static size_t
+proc_arg_strlen()
+{
+#if defined(__linux)
+    long page = sysconf(_SC_PAGESIZE);
+    return 32 * (size_t)(page > 0 ? page : 0x1000) - 1;
+#else
+    return (size_t)-1;
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+// ###############################  PROC_ARGS ######################################################
+// -------------------------------------------------------------------------------------------------
+void
+proc_args::add(std::string_view arg)
+{
+    offsets.push_back(arena.size());
+    arena.append(arg.data(), arg.size());
+    arena.push_back(0);
+}
+// -------------------------------------------------------------------------------------------------
+void
+proc_args::add(path_list& list)
+{
+    for (path_iterator pi = list.begin(); pi != list.end(); pi++)
+        add(pi->get_path());
+}
+// -------------------------------------------------------------------------------------------------
+/** Characters are copied straight into the arena. An argument ends at an unquoted space.
+  \param str String to parse. Null is ignored.
+*/
+void
+proc_args::parse(const char* str)
+{
+    if (!str)
+        return;
+    size_t first = offsets.size();
+    bool in_arg = false;
+    char quote = 0;
+    for (const char* ch = str; *ch; ch++) {
+        if (!quote && *ch == ' ') {
+            if (in_arg) {
+                arena.push_back(0);
+                in_arg = false;
+            }
+            continue;
+        }
+        if (!in_arg) {
+            offsets.push_back(arena.size());
+            in_arg = true;
+        }
+        if (*ch == '\\' && (ch[1] == '\'' || ch[1] == '"')) {
+            arena.push_back(*++ch);
+        } else if (quote) {
+            if (*ch == quote)
+                quote = 0;
+            else
+                arena.push_back(*ch);
+        } else if (*ch == '\'' || *ch == '"') {
+            quote = *ch;
+        } else
+            arena.push_back(*ch);
+    }
+    if (in_arg)
+        arena.push_back(0);
+    if (quote) {
+        truncate(first);
+        throw process_exception("process::start - Unmatched quote marks in arguments.");
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+proc_args::truncate(size_t count)
+{
+    if (count >= offsets.size())
+        return;
+    arena.resize(offsets[count]);
+    offsets.resize(count);
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+proc_args::longest() const
+{
+    size_t max = 0;
+    for (size_t ndx = 0; ndx < offsets.size(); ndx++) {
+        size_t end = ndx + 1 < offsets.size() ? offsets[ndx + 1] : arena.size();
+        if (end - offsets[ndx] - 1 > max)
+            max = end - offsets[ndx] - 1;
+    }
+    return max;
+}
+// -------------------------------------------------------------------------------------------------
+std::string
+proc_args::str() const
+{
+    string out;
+    for (size_t ndx = 0; ndx < offsets.size(); ndx++) {
+        const char* arg = (*this)[ndx];
+        if (ndx)
+            out += ' ';
+        if (*arg && !strpbrk(arg, " \t\n'\"")) {
+            out += arg;
+            continue;
+        }
+        out += '\'';
+        for (; *arg; arg++) {
+            if (*arg == '\'')
+                out += '\\';
+            out += *arg;
+        }
+        out += '\'';
+    }
+    return out;
+}
+// -------------------------------------------------------------------------------------------------
+/** Format is the one gcc and binutils use: white space separates arguments, backslash escapes the
+  next character and quotes group characters. Empty argument is written as "".
+*/
+std::string
+proc_args::response() const
+{
+    string out;
+    out.reserve(arena.size() + arena.size() / 16);
+    for (size_t ndx = 0; ndx < offsets.size(); ndx++) {
+        const char* arg = (*this)[ndx];
+        if (!*arg)
+            out += "\"\"";
+        for (; *arg; arg++) {
+            if (strchr(" \t\n\r\v\f'\"\\", *arg))
+                out += '\\';
+            out += *arg;
+        }
+        out += '\n';
+    }
+    return out;
+}
+// -------------------------------------------------------------------------------------------------
+char**
+proc_args::build(const char* cmd, std::vector<char*>& argv)
+{
+    argv.resize(offsets.size() + 2);
+    argv[0] = (char*)cmd;
+    for (size_t ndx = 0; ndx < offsets.size(); ndx++)
+        argv[ndx + 1] = &arena[offsets[ndx]];
+    argv[offsets.size() + 1] = 0;
+    return argv.data();
+}
 
 // -------------------------------------------------------------------------------------------------
 // ###############################  PROCESS ########################################################
@@ -248,6 +563,9 @@ process::init_member_vars()
     echo = false;
     owner = 0;
     daemon = false;
+    respfile = false;
+    sink_out = 0;
+    sink_err = 0;
     timeout = general_timeout;
 }
 
@@ -301,7 +619,7 @@ process::process(const string& cmd, const string& args, PIPE pipe, user* _owner)
     init_member_vars();
     set_command(cmd.c_str());
     if (!args.empty())
-        arguments << args;
+        arguments.parse(args.c_str());
     if (_owner && _owner->status() > 0) {
         throw process_exception("process::process - Invalid process owner.");
         owner = _owner;
@@ -331,7 +649,7 @@ process::process(const path& bin, const char* args):
         throw process_exception("process::process - given command path is not executable.");
     }
     if (args)
-        arguments << args;
+        arguments.parse(args);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -345,6 +663,7 @@ process::~process()
 #endif
     if (pid && !daemon)
         stop();
+    remove_response();
 
     if (pipes) {
         delete pipes;
@@ -352,8 +671,158 @@ process::~process()
     }
 }
 // -------------------------------------------------------------------------------------------------
+//! Commands resolved from PATH. See process::resolve_command.
+struct proc_command_cache
+{
+    proc_command_cache()
+      : notify_fd(-1)
+    {}
+    ~proc_command_cache()
+    {
+        if (notify_fd >= 0)
+            close(notify_fd);
+    }
+    void check();
+    void reset(const char* env);
+
+    std::mutex mtx;
+    std::string path_env;                                  //!< PATH the entries were resolved with.
+    std::unordered_map<std::string, std::string> resolved;
+    int notify_fd;                                         //!< Watches the PATH directories.
+};
+// -------------------------------------------------------------------------------------------------
+static proc_command_cache&
+proc_get_command_cache()
+{
+    static proc_command_cache cache;
+    return cache;
+}
+// -------------------------------------------------------------------------------------------------
+//! Empties the cache and starts watching the directories of the new PATH. Call under mtx.
+void
+proc_command_cache::reset(const char* env)
+{
+    resolved.clear();
+    path_env = env;
+#if defined(__linux)
+    if (notify_fd >= 0)
+        close(notify_fd);
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd < 0)
+        return;
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                          IN_DELETE_SELF | IN_MOVE_SELF;
+    size_t start = 0, end;
+    do {
+        end = path_env.find(C4S_PSEP, start);
+        string dir = path_env.substr(start, end == string::npos ? string::npos : end - start);
+        // Missing directories are not watched. Creating one later does not invalidate the cache.
+        inotify_add_watch(notify_fd, dir.empty() ? "." : dir.c_str(), mask);
+        start = end + 1;
+    } while (end != string::npos);
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+//! Drops the entries if PATH or the PATH directories have changed. Call under mtx.
+void
+proc_command_cache::check()
+{
+    const char* env = getenv("PATH");
+    if (!env)
+        env = "";
+    if (path_env.compare(env) || (resolved.empty() && notify_fd < 0)) {
+        reset(env);
+        return;
+    }
+#if defined(__linux)
+    char events[4096];
+    bool changed = false;
+    while (notify_fd >= 0 && read(notify_fd, events, sizeof(events)) > 0)
+        changed = true;
+    if (changed)
+        resolved.clear();
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+/** Directories are searched in PATH order. Only executable regular files are accepted. Empty
+  and relative PATH elements are taken relative to the current directory. The result is always an
+  absolute path. Results are cached, misses are not. A match is not cached if an empty or relative
+  element was searched before it, since the outcome then depends on the current directory.
+*/
+bool
+process::resolve_command(const std::string& name, std::string& full)
+{
+    proc_command_cache& cache = proc_get_command_cache();
+    lock_guard<mutex> lg(cache.mtx);
+    cache.check();
+    auto ri = cache.resolved.find(name);
+    if (ri != cache.resolved.end()) {
+        full = ri->second;
+        return true;
+    }
+    struct stat sbuf;
+    string candidate;
+    bool cwd_relative = false;
+    size_t start = 0, end;
+    do {
+        end = cache.path_env.find(C4S_PSEP, start);
+        size_t len = end == string::npos ? cache.path_env.size() - start : end - start;
+        if (!len || cache.path_env[start] != C4S_DSEP) {
+            char cwd[PATH_MAX];
+            if (!getcwd(cwd, sizeof(cwd))) {
+                start = end + 1;
+                continue;
+            }
+            candidate = cwd;
+            if (len) {
+                candidate += C4S_DSEP;
+                candidate.append(cache.path_env, start, len);
+            }
+            cwd_relative = true;
+        } else
+            candidate.assign(cache.path_env, start, len);
+        if (candidate.back() != C4S_DSEP)
+            candidate += C4S_DSEP;
+        candidate += name;
+        if (!stat(candidate.c_str(), &sbuf) && S_ISREG(sbuf.st_mode) &&
+            has_anybits(sbuf.st_mode, S_IXUSR | S_IXGRP | S_IXOTH)) {
+            if (!cwd_relative)
+                cache.resolved.emplace(name, candidate);
+            full = candidate;
+            return true;
+        }
+        start = end + 1;
+    } while (end != string::npos);
+    return false;
+}
+// -------------------------------------------------------------------------------------------------
+/** Resolving the commands a script uses at its start moves the PATH search out of the loops that
+  create processes.
+  \param commands Names of the commands.
+*/
+size_t
+process::prewarm(const std::vector<std::string>& commands)
+{
+    size_t found = 0;
+    string full;
+    for (const string& cmd : commands) {
+        if (resolve_command(cmd, full))
+            found++;
+    }
+    return found;
+}
+// -------------------------------------------------------------------------------------------------
+void
+process::flush_command_cache()
+{
+    proc_command_cache& cache = proc_get_command_cache();
+    lock_guard<mutex> lg(cache.mtx);
+    cache.resolved.clear();
+}
+// -------------------------------------------------------------------------------------------------
 /*!  Finds the command from current directory or path. If not found throws process
-  exception. In windows .exe-is appended automatically if not specified in command.
+  exception. In windows .exe-is appended automatically if not specified in command. Commands found
+  from path are cached, see resolve_command.
   \param cmd Name of the command.
 */
 void
@@ -367,14 +836,14 @@ process::set_command(const char* cmd)
     // Check the user provided path first. This includes current directory.
     if (stat(command.get_path().c_str(), &sbuf) == -1 ||
         !has_anybits(sbuf.st_mode, S_IXUSR | S_IXGRP | S_IXOTH)) {
-        // c4slog << "DEBUG - set_command:"<<command.get_path()<<";
-        // st_mode="<<hex<<sbuf.st_mode<<dec<<'\n';
-        if (!command.exists_in_env_path("PATH", true)) {
+        string full;
+        if (!resolve_command(command.get_base(), full)) {
             ostringstream ss;
             command.clear();
             ss << "process::set_command - Command not found: " << cmd;
             throw process_exception(ss.str());
         }
+        command = full;
     }
 }
 // -------------------------------------------------------------------------------------------------
@@ -387,8 +856,9 @@ process::operator=(const process& source)
 {
     command = source.command;
     pid = 0;
-    arguments.str("");
-    arguments << source.arguments.str();
+    arguments = source.arguments;
+    respfile = source.respfile;
+    profile = source.profile;
     timeout = source.timeout;
     if (source.owner)
         owner = source.owner;
@@ -414,91 +884,43 @@ process::dump(ostream& os)
 void
 process::start(const char* args)
 {
-    streamsize max;
-    char tmp_argbuf[512];
-    char tmp_cmdbuf[128];
-    char *arg_buffer, *dynamic_buffer = 0;
-    const char* arg_ptr[MAX_PROCESS_ARGS];
-    int ptr_count;
-
     if (command.empty())
         throw process_exception("process::start - Unable to start process. No command specified.");
     if (pid)
         stop();
     if (args) {
-        arguments.str("");
-        arguments << args;
+        arguments.clear();
+        arguments.parse(args);
     }
     last_ret_val = 0;
     if (no_run)
         return;
 
-    memset(arg_ptr, 0, sizeof(arg_ptr));
-    // convention requires the first argument to be the path to command itself
-    strcpy(tmp_cmdbuf, command.get_path().c_str());
-    arg_ptr[0] = tmp_cmdbuf;
-    ptr_count = 1;
-    // These need to be in *argv[]. Copy from argumetn streamd to static buffer and
-    // change spaces to zeros and at the same time make pointers to args.
-    max = arguments.tellp();
-    if (max > 0) {
-        size_t arg_buffer_length = max;
-        if (arg_buffer_length > sizeof(tmp_argbuf)) {
-            dynamic_buffer = new char[arg_buffer_length + 1];
-            arg_buffer = dynamic_buffer;
-            arg_buffer_length++;
-        } else {
-            arg_buffer = tmp_argbuf;
-            arg_buffer_length = sizeof(tmp_argbuf);
-        }
-        memset(arg_buffer, 0, arg_buffer_length);
-        arg_ptr[ptr_count++] = arg_buffer;
-
-        int ch, prev = ' ', quote = 0;
-        stringbuf* argsb = arguments.rdbuf();
-        argsb->pubseekpos(0, ios_base::in);
-        for (ch = argsb->sgetc(); ch != EOF && max > 0; ch = argsb->snextc()) {
-            if (quote) {
-                if (quote == ch) {
-                    if (prev != '\\')
-                        quote = 0;
-                    else
-                        arg_buffer--;
-                } else
-                    *arg_buffer++ = (char)(ch & 0xff);
-            } else if (ch == '\'' || ch == '\"') {
-                if (prev == '\\')
-                    *(arg_buffer - 1) = (char)(ch & 0xff);
-                else
-                    quote = ch;
-            } else if (ch == ' ') {
-                if (prev != ' ') {
-                    *arg_buffer++ = 0;
-                    arg_ptr[ptr_count++] = arg_buffer;
-                    if (ptr_count >= MAX_PROCESS_ARGS - 1)
-                        throw process_exception(
-                            "process::start - Too many arguments. Use response file.");
-                }
-            } else
-                *arg_buffer++ = (char)(ch & 0xff);
-            prev = ch;
-            max--;
+    // Convention requires the first argument to be the path to command itself.
+    string cmd_path(command.get_path());
+    proc_args spill;
+    proc_args* exec_args = &arguments;
+    size_t longest = arguments.longest();
+    if (cmd_path.size() + 1 + arguments.bytes() > proc_arg_limit() ||
+        longest > proc_arg_strlen()) {
+        if (!respfile) {
+            ostringstream os;
+            os << "process::start - " << command.get_base() << ": ";
+            if (longest > proc_arg_strlen())
+                os << "argument of " << longest << " bytes exceeds the system limit of "
+                   << proc_arg_strlen() << " bytes for one argument. Use response file.";
+            else
+                os << arguments.size() << " arguments exceed the system limit. Use response file.";
+            throw process_exception(os.str());
         }
-        *arg_buffer = 0;
-        if (quote)
-            throw process_exception("process::start - Unmatched quote marks in arguments.");
-    } // if arguments.tellp()
-    else {
-        arg_buffer = 0;
+        spill.add('@' + write_response());
+        exec_args = &spill;
     }
-
-    // Finalize argument pointer array
-    arg_ptr[ptr_count] = 0;
-    if (arg_ptr[ptr_count - 1][0] == 0)
-        arg_ptr[ptr_count - 1] = 0;
+    vector<char*> argv;
+    char** arg_ptr = exec_args->build(cmd_path.c_str(), argv);
 
 #ifdef C4S_DEBUGTRACE
-    c4slog << "process::start - " << command.get_path() << '(' << tmp_cmdbuf << "):\n";
+    c4slog << "process::start - " << cmd_path << ":\n";
     for (int i = 0; arg_ptr[i]; i++)
         c4slog << " [" << i << "] " << arg_ptr[i] << '\n';
     c4slog << " About to fork from parent: " <<getpid() << '\n';
@@ -518,6 +940,8 @@ process::start(const char* args)
     if (pipes)
         delete pipes;
     pipes = new proc_pipes();
+    // Cgroup is set up before the fork so that errors are reported here.
+    int cg_fd = profile.prepare();
     if (rb_err.max_size())
         rb_err.clear();
     if (rb_out.max_size())
@@ -530,6 +954,12 @@ process::start(const char* args)
     if (!pid) {
         pipes->init_child();
         delete pipes;
+        const char* what = "";
+        if (!profile.apply(cg_fd, &what)) {
+            cerr << "process::start - child-process: Unable to apply " << what
+                 << ".\nError (" << errno << ") " << strerror(errno) << '\n';
+            _exit(EXIT_FAILURE);
+        }
         if (owner) {
             if (initgroups(owner->get_name().c_str(), owner->get_gid()) != 0 ||
                 setuid(owner->get_uid()) != 0) {
@@ -540,20 +970,69 @@ process::start(const char* args)
                 _exit(EXIT_FAILURE);
             }
         }
-        if (execv(tmp_cmdbuf, (char**)arg_ptr) == -1) {
-            cerr << "process::start - child-process: Unable to start process:" << tmp_cmdbuf
+        if (execv(arg_ptr[0], arg_ptr) == -1) {
+            cerr << "process::start - child-process: Unable to start process:" << arg_ptr[0]
                  << "\nError (" << errno << ") " << strerror(errno) << '\n';
         }
         _exit(EXIT_FAILURE);
     }
+    if (cg_fd >= 0)
+        close(cg_fd);
     pipes->init_parent();
-    if (dynamic_buffer)
-        delete[] dynamic_buffer;
 #ifdef C4S_DEBUGTRACE
     c4slog << "process::start - created child: " << pid << '\n';
 #endif
 }
 // -------------------------------------------------------------------------------------------------
+/** Creates a unique file into TMPDIR or /tmp.
+  \retval string Name of the file.
+*/
+std::string
+process::write_response()
+{
+    remove_response();
+    const char* tmp = getenv("TMPDIR");
+    string name(tmp && *tmp ? tmp : "/tmp");
+    name += "/c4s_args_XXXXXX";
+    int fd = mkstemp(&name[0]);
+    if (fd == -1) {
+        ostringstream os;
+        os << "process::start - unable to create response file " << name << ": "
+           << strerror(errno);
+        throw process_exception(os.str());
+    }
+    string content(arguments.response());
+    const char* ptr = content.data();
+    size_t left = content.size();
+    while (left) {
+        ssize_t bw = write(fd, ptr, left);
+        if (bw == -1 && errno == EINTR)
+            continue;
+        if (bw <= 0) {
+            ostringstream os;
+            os << "process::start - unable to write response file " << name << ": "
+               << strerror(errno);
+            close(fd);
+            unlink(name.c_str());
+            throw process_exception(os.str());
+        }
+        ptr += bw;
+        left -= bw;
+    }
+    close(fd);
+    resp_name = name;
+    return name;
+}
+// -------------------------------------------------------------------------------------------------
+void
+process::remove_response()
+{
+    if (resp_name.empty())
+        return;
+    unlink(resp_name.c_str());
+    resp_name.clear();
+}
+// -------------------------------------------------------------------------------------------------
 void
 process::set_user(user* _owner)
 {
@@ -612,6 +1091,120 @@ process::attach(const path& pid_file)
     return false;
 }
 // -------------------------------------------------------------------------------------------------
+void
+process::write_stdin(RingBuffer* data)
+{
+    if (!data)
+        return;
+    char chunk[0x4000];
+    size_t len;
+    while ((len = data->read_data(chunk, sizeof(chunk))) > 0) {
+        if (write_stdin(chunk, len) < len)
+            break;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** \param data Data to write.
+  \param len Length of the data.
+  \retval size_t Bytes written. Less than len if the child closed its input.
+*/
+size_t
+process::write_stdin(const void* data, size_t len)
+{
+    if (!pid || !pipes)
+        return 0;
+    pipe_sink out = { sink_out, &rb_out };
+    pipe_sink err = { sink_err, &rb_err };
+    size_t written = pipes->pump_input((const char*)data, len, out, err,
+                                       timeout ? (int)timeout * 1000 : -1);
+    if (written < len && !pipes->is_input_closed()) {
+        stop();
+        ostringstream es;
+        es << "process::write_stdin - " << command.get_base() << "; timeout " << timeout;
+        throw process_timeout(es.str());
+    }
+    return written;
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+process::write_stdin(std::istream& input)
+{
+    char chunk[0x10000];
+    size_t total = 0;
+    while (input.read(chunk, sizeof(chunk)) || input.gcount()) {
+        size_t len = input.gcount();
+        size_t written = write_stdin(chunk, len);
+        total += written;
+        if (written < len)
+            break;
+    }
+    return total;
+}
+// -------------------------------------------------------------------------------------------------
+/** Output is read until both pipes close. If the child has exited but something it started still
+  keeps the pipes open, the rest is not waited for.
+  \retval int Return value of the process.
+*/
+int
+process::drain()
+{
+    if (!pid)
+        return last_ret_val;
+    close_stdin();
+    pipe_sink out = { sink_out, &rb_out };
+    pipe_sink err = { sink_err, &rb_err };
+    int status = 0;
+    pid_t rv = 0;
+    time_t drain_start = time(0);
+    while (pipes && !pipes->pump_output(out, err, 200)) {
+        rv = waitpid(pid, &status, WNOHANG);
+        if (rv == pid)
+            break;
+        if (timeout && time(0) - drain_start > (time_t)timeout) {
+            stop();
+            ostringstream es;
+            es << "process::drain - " << command.get_base() << "; timeout " << timeout;
+            throw process_timeout(es.str());
+        }
+    }
+    while (rv != pid) {
+        rv = waitpid(pid, &status, 0);
+        if (rv == -1 && errno != EINTR)
+            break;
+    }
+    last_ret_val = rv == pid ? interpret_process_status(status) : -1;
+    pid = 0;
+    stop();
+    if (nzrv_exception && last_ret_val != 0) {
+        ostringstream os;
+        os << "Process: '" << command.get_base() << ' ' << arguments.str()
+           << "' retured:" << last_ret_val;
+        throw process_exception(os.str());
+    }
+    return last_ret_val;
+}
+// -------------------------------------------------------------------------------------------------
+/** \param input Stream to write into stdin.
+  \param output Stream for stdout. Stderr goes into rb_err or the error sink.
+  \retval int Return value of the process.
+*/
+int
+process::pump(std::istream& input, std::ostream& output)
+{
+    std::ostream* prev = sink_out;
+    sink_out = &output;
+    try {
+        start();
+        write_stdin(input);
+        drain();
+    } catch (...) {
+        sink_out = prev;
+        throw;
+    }
+    sink_out = prev;
+    return last_ret_val;
+}
+// -------------------------------------------------------------------------------------------------
 int
 process::query(ntbs* question, ntbs* answer, int _timeout)
 {
@@ -756,11 +1349,11 @@ process::wait_for_exit()
 int
 process::execa(const char* plus)
 {
-    streampos end = arguments.tellp();
-    arguments << ' ' << plus;
+    size_t count = arguments.size();
+    arguments.parse(plus);
     start();
     int rv = wait_for_exit();
-    arguments.seekp(end);
+    arguments.truncate(count);
     return rv;
 }
 
@@ -810,6 +1403,47 @@ process::operator()(const std::string& args, std::ostream& os)
     return last_ret_val;
 }
 
+// -------------------------------------------------------------------------------------------------
+/** Waits on a pidfd so that the exit is noticed as soon as it happens. Without pidfd the process
+  is probed every 100 ms. Own children are reaped.
+  \param pid Process to wait for.
+  \param timeout_ms Longest time to wait.
+  \retval bool True if the process has exited.
+*/
+static bool
+proc_wait_gone(pid_t pid, int timeout_ms)
+{
+#if defined(SYS_pidfd_open)
+    int pfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pfd >= 0) {
+        struct pollfd pf;
+        pf.fd = pfd;
+        pf.events = POLLIN;
+        pf.revents = 0;
+        int rv;
+        do {
+            rv = poll(&pf, 1, timeout_ms);
+        } while (rv == -1 && errno == EINTR);
+        close(pfd);
+        if (rv <= 0)
+            return false;
+        waitpid(pid, 0, WNOHANG);
+        return true;
+    }
+    if (errno == ESRCH)
+        return true;
+#endif
+    struct timespec ts_delay;
+    ts_delay.tv_sec = 0;
+    ts_delay.tv_nsec = 100000000L;
+    for (int left = timeout_ms;; left -= 100) {
+        if (waitpid(pid, 0, WNOHANG) == pid || (kill(pid, 0) == -1 && errno == ESRCH))
+            return true;
+        if (left <= 0)
+            return false;
+        nanosleep(&ts_delay, 0);
+    }
+}
 // -------------------------------------------------------------------------------------------------
 void
 process::stop_daemon()
@@ -829,46 +1463,17 @@ process::stop_daemon()
 #endif
         throw process_exception(os.str());
     }
-    // Lets wait for a while:
-    struct timespec ts_delay, ts_remain;
-    ts_delay.tv_sec = 0;
-    ts_delay.tv_nsec = 400000000L;
-    int rv, count = 20;
-    do {
-        nanosleep(&ts_delay, &ts_remain);
-        rv = kill(pid, 0);
-        count--;
-    } while (count > 0 && rv == 0);
-    if (proc_started)
-        proc_ended = clock();
+    // Wait for the exit. SIGKILL if it does not happen within the grace period.
+    if (!proc_wait_gone(pid, 8000)) {
 #ifdef C4S_DEBUGTRACE
-    c4slog << "process::stop_daemon - term result:" << rv
-        << "; count=" << count
-        << "; errno=" << errno
-        << "; runtime=" << duration()
-        << '\n';
+        c4slog << "process::stop_daemon - no exit after SIGTERM, runtime=" << duration() << '\n';
 #endif
-    if (count == 0) {
-        count = 10;
         kill(pid, SIGKILL);
-        do {
-            nanosleep(&ts_delay, &ts_remain);
-            rv = kill(pid, 0);
-            count--;
-        } while (count > 0 && rv == 0);
-#ifdef C4S_DEBUGTRACE
-        c4slog << "process::stop_daemon - kill result:" << rv << "; count=" << count
-             << "; errno=" << errno << '\n';
-#endif
-        if (count == 0)
+        if (!proc_wait_gone(pid, 4000))
             throw process_exception("process::stop_daemon - Failed, daemon sill running.");
     }
-    if (errno != ESRCH) {
-#ifdef C4S_DEBUGTRACE
-        c4slog << "process::stop_daemon - error stopping daemon\n";
-#endif
-        throw process_exception("process::stop_daemon - error stopping daemon");
-    }
+    if (proc_started)
+        proc_ended = clock();
     pid = 0;
     last_ret_val = 0;
 }
@@ -952,6 +1557,7 @@ process::stop()
     } // if(pid)
 
     proc_ended = clock();
+    remove_response();
 #ifdef C4S_DEBUGTRACE
     c4slog << "process::stop - name=" << command.get_base()
         << "; runtime= " << duration() << endl;
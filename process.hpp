@@ -10,15 +10,31 @@
 #define C4S_PROCESS_HPP
 
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "ntbs/ntbs.hpp"
 #include "RingBuffer.hpp"
+#include "proc_profile.hpp"
 
 namespace c4s {
 
 class compiled_file;
+class path_list;
 class program_arguments;
 class variables;
 class user;
+// -------------------------------------------------------------------------------------------------
+//! Destination of the child output while its input is being written.
+struct pipe_sink
+{
+    std::ostream* stream; //!< Output is written here if set.
+    RingBuffer* rb;       //!< Otherwise here if it has a size. Output that does not fit is dropped.
+                          //!< If neither is set the output is left in the pipe.
+
+    void put(const char* data, size_t len);
+};
+
 // -------------------------------------------------------------------------------------------------
 //! Process pipes wraps three pipes needed to communicate with child programs / binaries
 class proc_pipes
@@ -32,20 +48,94 @@ class proc_pipes
     void init_parent();
     bool read_child_stdout(RingBuffer*);
     bool read_child_stderr(RingBuffer*);
-    size_t write_child_input(RingBuffer*);
-    size_t write_child_input(ntbs*);
+    //! Writes the data into the child input. Child output is read into out and err meanwhile.
+    size_t write_child_input(RingBuffer* data, RingBuffer* out, RingBuffer* err, int timeout_ms = -1);
+    //! Writes the string into the child input. Child output is read into out and err meanwhile.
+    size_t write_child_input(ntbs* data, RingBuffer* out, RingBuffer* err, int timeout_ms = -1);
     void close_child_input();
+    //! Writes the data into the child input. While the pipe is full the child output is read.
+    /*! Child cannot block on its own output, so large inputs do not deadlock.
+        \param data Data to write.
+        \param len Length of the data.
+        \param out Sink for the standard output.
+        \param err Sink for the standard error.
+        \param timeout_ms Longest time to wait without progress. -1 waits forever.
+        \retval size_t Bytes written. Less than len if the child closed its input or the time ran
+        out. Input is closed in the first case.*/
+    size_t pump_input(const char* data, size_t len, pipe_sink& out, pipe_sink& err,
+                      int timeout_ms);
+    //! Reads the child output into the sinks until both pipes close.
+    /*! \retval bool False if nothing happened within timeout_ms.*/
+    bool pump_output(pipe_sink& out, pipe_sink& err, int timeout_ms);
+    //! True if the input has been closed.
+    bool is_input_closed() const { return !fd_in[1]; }
 
   protected:
+    friend class proc_reactor;
+    bool wait_pipes(bool input, pipe_sink& out, pipe_sink& err, int timeout_ms);
+    bool read_to_sink(int fd, pipe_sink& sink);
+
     bool send_ctrlZ;
     int fd_out[2];
     int fd_err[2];
     int fd_in[2];
     size_t br_in;
+    bool out_open;  //!< False after the end of the standard output has been read.
+    bool err_open;  //!< False after the end of the standard error has been read.
 };
 
 enum class PIPE { NONE, SM, LG };
 
+// -------------------------------------------------------------------------------------------------
+//! Argument vector of a process.
+/*! Arguments are stored one after another, each terminated with a zero, into a single buffer and
+  located by offsets. The argument array given to execv points directly into the buffer, so the
+  arguments are neither parsed again nor copied when the process is started. The number of
+  arguments is not limited.
+*/
+class proc_args
+{
+  public:
+    //! Removes all arguments. Buffer capacity is kept.
+    void clear()
+    {
+        arena.clear();
+        offsets.clear();
+    }
+    //! Appends one argument as is.
+    void add(std::string_view arg);
+    //! Appends the paths of the list as separate arguments.
+    void add(path_list& list);
+    //! Splits the string at spaces and appends the parts.
+    /*! Single or double quotes group words into one argument. Backslash before a quote makes
+        it a normal character. Throws process_exception if quotes are not matched.*/
+    void parse(const char* str);
+    //! Drops the arguments after the first 'count'.
+    void truncate(size_t count);
+    //! Number of arguments.
+    size_t size() const { return offsets.size(); }
+    //! Returns the argument at the index.
+    const char* operator[](size_t ndx) const { return arena.data() + offsets[ndx]; }
+    //! Length of the longest argument.
+    size_t longest() const;
+    //! Number of bytes the arguments take from the execv limit, pointer array included.
+    size_t bytes() const { return arena.size() + (offsets.size() + 2) * sizeof(char*); }
+    //! Returns the arguments as a single string. Arguments with white space or quotes are quoted.
+    std::string str() const;
+    //! Writes the arguments into response file format: one argument per line, special characters
+    //! escaped with backslash.
+    std::string response() const;
+    //! Fills the execv argument array. Pointers are valid until the arguments are changed.
+    /*! \param cmd First argument, i.e. the command.
+        \param argv Receives the pointers. Last one is null.
+        \retval char** Pointer to the array.*/
+    char** build(const char* cmd, std::vector<char*>& argv);
+
+  protected:
+    std::string arena;           //!< Zero terminated arguments.
+    std::vector<size_t> offsets; //!< Start of each argument in the arena.
+};
+
 // -------------------------------------------------------------------------------------------------
 //! Class encapsulates an executable process.
 /*! Class manages single executable process and its parameters. Process can be executed multiple
@@ -74,6 +164,18 @@ class process
     void set_command(const char*);
     path get_command() { return command; }
 
+    //! Finds the command from PATH using the command cache.
+    /*! Resolved commands are remembered per PATH value. The cache is emptied when PATH changes
+        or, on Linux, when something is added to or removed from a PATH directory.
+        \param name Name of the command.
+        \param full Receives the absolute path of the command.
+        \retval bool False if the command was not found.*/
+    static bool resolve_command(const std::string& name, std::string& full);
+    //! Resolves the commands into the command cache. Returns the number of commands found.
+    static size_t prewarm(const std::vector<std::string>& commands);
+    //! Empties the command cache.
+    static void flush_command_cache();
+
     //! Operator= override for process.
     void operator=(const process& p);
     //! Operator= override for process.
@@ -82,31 +184,60 @@ class process
     //! Sets the given string as single argument string for this process.
     void set_args(const char* arg)
     {
-        arguments.str("");
-        arguments << arg;
+        arguments.clear();
+        arguments.parse(arg);
     }
     //! Sets the given string as single argument string for this process.
     void set_args(const std::string& arg)
     {
-        arguments.str("");
-        arguments << arg;
+        arguments.clear();
+        arguments.parse(arg.c_str());
     }
     //! Adds given string into argument list as quoted string
-    void add_quoted_args(const std::string& arg) { arguments << " '" << arg << '\''; }
+    void add_quoted_args(const std::string& arg) { arguments.add(arg); }
     //! Adds the given string into argument list.
-    void operator+=(const char* arg) { arguments << ' ' << arg; }
+    void operator+=(const char* arg) { arguments.parse(arg); }
     //! Adds the given string into argument list.
-    void operator+=(const std::string& arg) { arguments << ' ' << arg; }
+    void operator+=(const std::string& arg) { arguments.parse(arg.c_str()); }
+    //! Adds a single argument as is. Spaces and quotes are not interpreted.
+    void add_arg(std::string_view arg) { arguments.add(arg); }
+    //! Adds each path in the list as an argument.
+    void add_args(path_list& list) { arguments.add(list); }
+    //! Removes all arguments.
+    void clear_args() { arguments.clear(); }
+    //! Returns the current arguments.
+    const proc_args& get_args() const { return arguments; }
+    //! Allows passing the arguments in a response file when they exceed the system limits.
+    /*! Limits are for the total size and, in Linux, 32 pages for a single argument. The process
+        is then started with a single '@file' argument. Use only with programs that
+        read response files, e.g. gcc, g++, ld and ar. The file is removed when the process ends.*/
+    void set_response_file(bool rf) { respfile = rf; }
 
     //! Forward content from given buffer into process' stdin
-    void write_stdin(RingBuffer *data) {
-        if (pipes)
-            pipes->write_child_input(data);
-    }
+    void write_stdin(RingBuffer *data);
     //! Forward content from given string into process' stdin
     void write_stdin(ntbs *data) {
-        if (pipes)
-            pipes->write_child_input(data);
+        if (data)
+            write_stdin(data->get(), data->len());
+    }
+    //! Writes the data into stdin. Returns the number of bytes the child accepted.
+    /*! Blocks only while the child is not reading its input, and meanwhile reads the child's
+        output into the sinks (see set_sinks), so that the child cannot block on a full output
+        pipe. Throws process_timeout if there is no progress within the process timeout.*/
+    size_t write_stdin(const void* data, size_t len);
+    //! Copies the stream into stdin until the end of the stream or until the child closes stdin.
+    size_t write_stdin(std::istream& input);
+    //! Closes stdin, reads the rest of the output into the sinks and waits for the exit.
+    int drain();
+    //! Runs the process with the input stream as stdin and writes its stdout into output.
+    /*! Input and output are streamed, so their size is not limited by memory.*/
+    int pump(std::istream& input, std::ostream& output);
+    //! Sets the streams for the output read by write_stdin and drain.
+    /*! Without a stream the output goes into rb_out and rb_err. What does not fit is dropped.*/
+    void set_sinks(std::ostream* out, std::ostream* err = nullptr)
+    {
+        sink_out = out;
+        sink_err = err;
     }
     //! Closes the send pipe to client.
     void close_stdin() {
@@ -116,6 +247,14 @@ class process
 
     //! Sets the effective owner for the process. (Linux only)
     void set_user(user*);
+    //! Sets the resource constraints that are applied in the child before the command is executed.
+    void set_profile(const proc_profile& prof) { profile = prof; }
+    //! Returns the resource constraints of the process for modification.
+    proc_profile& get_profile() { return profile; }
+    //! Limits a resource of the child, e.g. RLIMIT_AS or RLIMIT_CPU. See proc_profile::set_rlimit.
+    void set_rlimit(int resource, unsigned long long limit) { profile.set_rlimit(resource, limit); }
+    //! Removes the limits set with set_rlimit.
+    void clear_rlimits() { profile.clear_rlimits(); }
     //! Set the timeout for this process overriding general timeout value.
     void set_timeout(unsigned int to) { timeout = to; }
     //! Enables or disables command echoing before execution.
@@ -140,8 +279,8 @@ class process
     */
     void start(const char* args=nullptr);
     void start(const std::string &opts) {
-        arguments.str("");
-        arguments << opts;
+        arguments.clear();
+        arguments.parse(opts.c_str());
         start(nullptr);
     }
     //! Stops the process i.e. terminates it if it is sill running and closes files.
@@ -188,18 +327,28 @@ class process
     static unsigned int general_timeout;
 
   protected:
+    friend class proc_reactor;
     //! Initializes process member variables. Called by constructors.
     void init_member_vars();
     //! Stops a deamon i.e. process started with another process object earlier.
     void stop_daemon();
+    //! Writes the arguments into a response file. Returns the name of the file.
+    std::string write_response();
+    //! Removes the response file of the previous run.
+    void remove_response();
 
     path command;                //!< Full path to a command that should be executed.
-    std::stringstream arguments; //!< Stream of process arguments. Must not contain variables.
+    proc_args arguments;         //!< Process arguments. Must not contain variables.
+    bool respfile;               //!< If true too long argument lists are passed in a response file.
+    std::ostream* sink_out;      //!< Stream for the output read while writing stdin.
+    std::ostream* sink_err;      //!< Stream for the errors read while writing stdin.
+    std::string resp_name;       //!< Response file of the running process.
 
     int interpret_process_status(int);
     int wait_with_stream(std::ostream* log=0);
 
     user* owner;                //!< If defined, process will be executed with user's credentials.
+    proc_profile profile;       //!< Resource constraints for the child.
     pid_t pid;
     int last_ret_val;
     bool daemon;                //!< If true then the process is to be run as daemon and should not be terminated
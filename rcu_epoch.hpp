@@ -0,0 +1,69 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_RCU_EPOCH_HPP
+#define C4S_RCU_EPOCH_HPP
+
+#include <atomic>
+#include <thread>
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Read-copy-update of a value kept in two slots. Internal to the library.
+/*! Readers enter the current slot before they use its value and leave it afterwards. The writer
+  stores the new value into the next slot and swaps. Swap moves the epoch on and waits until the
+  readers of the old slot have left, after which the old value can be released. Reader announces
+  itself for the epoch and then checks that the epoch did not change in between. Together with
+  the sequentially consistent order of the atomics this guarantees that no reader is left in a
+  released slot. There must be only one writer at a time.
+*/
+class rcu_epoch
+{
+  public:
+    rcu_epoch()
+      : epoch(0)
+    {
+        users[0].store(0);
+        users[1].store(0);
+    }
+    //! Pins the current slot and returns its index.
+    unsigned int enter()
+    {
+        for (;;) {
+            unsigned int ep = epoch.load();
+            users[ep & 1]++;
+            if (epoch.load() == ep)
+                return ep & 1;
+            users[ep & 1]--;
+        }
+    }
+    //! Releases the slot returned by enter.
+    void leave(unsigned int slot) { users[slot]--; }
+    //! Returns the slot of the current value.
+    unsigned int current() const { return epoch.load() & 1; }
+    //! Returns the slot for the next value. Only the writer may use it.
+    unsigned int next() const { return (epoch.load() + 1) & 1; }
+    //! Makes the next slot current and waits until the old one is no longer used.
+    /*! \retval unsigned int Index of the old slot.*/
+    unsigned int swap()
+    {
+        unsigned int ep = epoch.load();
+        epoch.store(ep + 1);
+        while (users[ep & 1].load())
+            std::this_thread::yield();
+        return ep & 1;
+    }
+
+  protected:
+    std::atomic<unsigned int> epoch;
+    std::atomic<int> users[2]; //!< Readers in the slot.
+};
+
+} // namespace c4s
+#endif
@@ -0,0 +1,363 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <deque>
+#include <sstream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "fd_io.hpp"
+#include "atomic_writer.hpp"
+#include "replacer.hpp"
+
+using namespace std;
+using namespace c4s;
+
+//! Number of iovec entries collected before writev is called.
+const int RPL_IOV_BATCH = 256;
+
+// -------------------------------------------------------------------------------------------------
+//! Collects spans into an iovec array and writes them with writev.
+class iov_sink : public replacer_span_sink
+{
+  public:
+    iov_sink(int _fd)
+      : fd(_fd)
+      , aw(0)
+      , count(0)
+    {}
+    iov_sink(atomic_writer* _aw)
+      : fd(-1)
+      , aw(_aw)
+      , count(0)
+    {}
+    void put(const char* ptr, size_t len) override
+    {
+        if (count == RPL_IOV_BATCH)
+            flush();
+        iov[count].iov_base = (void*)ptr;
+        iov[count].iov_len = len;
+        count++;
+    }
+    void flush()
+    {
+        if (aw)
+            aw->writev(iov, count);
+        else
+            writev_all(fd, iov, count);
+        count = 0;
+    }
+
+  private:
+    int fd;
+    atomic_writer* aw;
+    int count;
+    struct iovec iov[RPL_IOV_BATCH];
+};
+// -------------------------------------------------------------------------------------------------
+class string_sink : public replacer_span_sink
+{
+  public:
+    string_sink(string& _out)
+      : out(_out)
+    {}
+    void put(const char* ptr, size_t len) override { out.append(ptr, len); }
+
+  private:
+    string& out;
+};
+
+// -------------------------------------------------------------------------------------------------
+c4s::replacer::replacer(const string& search, const string& replace)
+  : first_byte(-1)
+  , compiled(false)
+{
+    add(search, replace);
+}
+// -------------------------------------------------------------------------------------------------
+c4s::replacer::replacer(const replace_pairs& pairs)
+  : first_byte(-1)
+  , compiled(false)
+{
+    for (const auto& rp : pairs)
+        add(rp.first, rp.second);
+}
+// -------------------------------------------------------------------------------------------------
+/** If the same search string is added twice, the first replacement is used.
+  \param search Text to search for. Must not be empty.
+  \param replace Replacement text. May be empty.
+*/
+void
+c4s::replacer::add(const string& search, const string& replace)
+{
+    if (search.empty())
+        throw c4s_exception("replacer::add - search string cannot be empty.");
+    needles.push_back({ search, replace });
+    compiled = false;
+}
+// -------------------------------------------------------------------------------------------------
+/** Builds a trie of the needles and converts it to a dense DFA with the failure links resolved so
+  that the scan loop does a single table lookup per input byte.
+*/
+void
+c4s::replacer::compile()
+{
+    const uint32_t NONE = 0xffffffff;
+    if (needles.empty())
+        throw c4s_exception("replacer::compile - no search strings defined.");
+    delta.assign(256, NONE);
+    output.assign(1, 0);
+    vector<uint32_t> fail(1, 0);
+
+    // Build the trie.
+    first_byte = (unsigned char)needles[0].search[0];
+    for (size_t ndx = 0; ndx < needles.size(); ndx++) {
+        const string& str = needles[ndx].search;
+        if ((unsigned char)str[0] != first_byte)
+            first_byte = -1;
+        uint32_t state = 0;
+        for (size_t ci = 0; ci < str.size(); ci++) {
+            uint32_t& next = delta[state * 256 + (unsigned char)str[ci]];
+            if (next == NONE) {
+                next = output.size();
+                output.push_back(0);
+                fail.push_back(0);
+                delta.resize(delta.size() + 256, NONE);
+            }
+            state = delta[state * 256 + (unsigned char)str[ci]];
+        }
+        if (!output[state])
+            output[state] = ndx + 1;
+    }
+    // Resolve failure links breadth first.
+    deque<uint32_t> queue;
+    for (int ch = 0; ch < 256; ch++) {
+        uint32_t& next = delta[ch];
+        if (next == NONE)
+            next = 0;
+        else
+            queue.push_back(next);
+    }
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        if (!output[state])
+            output[state] = output[fail[state]];
+        for (int ch = 0; ch < 256; ch++) {
+            uint32_t next = delta[state * 256 + ch];
+            uint32_t fallback = delta[fail[state] * 256 + ch];
+            if (next == NONE)
+                delta[state * 256 + ch] = fallback;
+            else {
+                fail[next] = fallback;
+                queue.push_back(next);
+            }
+        }
+    }
+    if (needles.size() == 1)
+        single.compile(needles[0].search.data(), needles[0].search.size());
+    else
+        single.compile(0, 0);
+    compiled = true;
+}
+// -------------------------------------------------------------------------------------------------
+/** Sink is called only if there is at least one match. Then the unchanged spans and replacements
+  are given in order and together they form the complete output.
+  \param data Data to scan.
+  \param len Length of data.
+  \param sink Receiver for the output spans. If null only matches are counted.
+  \retval size_t Number of matches.
+*/
+size_t
+c4s::replacer::scan(const char* data, size_t len, replacer_span_sink* sink)
+{
+    if (!compiled)
+        compile();
+    const uint32_t* dt = delta.data();
+    const uint32_t* out = output.data();
+    size_t matches = 0, last = 0;
+    if (single.size()) {
+        const needle& nd = needles[0];
+        size_t pos;
+        while ((pos = single.find(data, len, last)) != searcher::npos) {
+            if (sink) {
+                if (pos > last)
+                    sink->put(data + last, pos - last);
+                if (!nd.replace.empty())
+                    sink->put(nd.replace.data(), nd.replace.size());
+            }
+            matches++;
+            last = pos + nd.search.size();
+        }
+        if (sink && matches && last < len)
+            sink->put(data + last, len - last);
+        return matches;
+    }
+    uint32_t state = 0;
+    for (size_t ndx = 0; ndx < len; ndx++) {
+        if (state == 0 && first_byte >= 0) {
+            const char* next = (const char*)memchr(data + ndx, first_byte, len - ndx);
+            if (!next)
+                break;
+            ndx = next - data;
+        }
+        state = dt[state * 256 + (unsigned char)data[ndx]];
+        if (out[state]) {
+            const needle& nd = needles[out[state] - 1];
+            size_t start = ndx + 1 - nd.search.size();
+            if (sink) {
+                if (start > last)
+                    sink->put(data + last, start - last);
+                if (!nd.replace.empty())
+                    sink->put(nd.replace.data(), nd.replace.size());
+            }
+            matches++;
+            last = ndx + 1;
+            state = 0;
+        }
+    }
+    if (sink && matches && last < len)
+        sink->put(data + last, len - last);
+    return matches;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param data Data to process.
+  \param len Length of data.
+  \param cnt If not null, number of replacements is stored here.
+  \retval string Data with replacements.
+*/
+string
+c4s::replacer::apply(const char* data, size_t len, size_t* cnt)
+{
+    string result;
+    string_sink ss(result);
+    size_t matches = scan(data, len, &ss);
+    if (!matches)
+        result.assign(data, len);
+    if (cnt)
+        *cnt = matches;
+    return result;
+}
+// -------------------------------------------------------------------------------------------------
+/** Data is written even if there are no matches.
+  \param data Data to process.
+  \param len Length of data.
+  \param fd File descriptor for the output.
+  \retval size_t Number of replacements.
+*/
+size_t
+c4s::replacer::write(const char* data, size_t len, int fd)
+{
+    iov_sink is(fd);
+    size_t matches = scan(data, len, &is);
+    if (!matches && len)
+        is.put(data, len);
+    is.flush();
+    return matches;
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::replacer::count(const char* data, size_t len)
+{
+    return scan(data, len, 0);
+}
+// -------------------------------------------------------------------------------------------------
+//! Opens the atomic writer on the first span so that nothing is written if there are no matches.
+class lazy_file_sink : public replacer_span_sink
+{
+  public:
+    lazy_file_sink(const string& _name, int _flags, const struct stat* _meta)
+      : name(_name)
+      , flags(_flags)
+      , meta(_meta)
+      , aw(0)
+      , out(0)
+    {}
+    ~lazy_file_sink()
+    {
+        delete out;
+        delete aw;
+    }
+    void put(const char* ptr, size_t len) override
+    {
+        if (!out) {
+            aw = new atomic_writer(name, flags, meta);
+            out = new iov_sink(aw);
+        }
+        out->put(ptr, len);
+    }
+    //! Writes the rest of the spans and replaces the original file.
+    void commit()
+    {
+        out->flush();
+        aw->commit();
+    }
+
+  private:
+    string name;
+    int flags;
+    const struct stat* meta;
+    atomic_writer* aw;
+    iov_sink* out;
+};
+// -------------------------------------------------------------------------------------------------
+/** File is memory mapped and scanned in one pass. If there are matches, output is written with
+  atomic_writer which replaces the original only after all data has been written and synced. The
+  original file is left untouched if there are no matches.
+  \param name Name of the file.
+  \param backup If true the original file is kept with '~' appended to its name.
+  \retval size_t Number of replacements.
+*/
+size_t
+c4s::replacer::file(const string& name, bool backup)
+{
+    ostringstream os;
+    int src = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+        os << "replacer::file - Unable to open file " << name << ": " << strerror(errno);
+        throw path_exception(os.str());
+    }
+    struct stat sb;
+    if (fstat(src, &sb) || !S_ISREG(sb.st_mode)) {
+        close(src);
+        os << "replacer::file - Not a regular file: " << name;
+        throw path_exception(os.str());
+    }
+    if (sb.st_size == 0) {
+        close(src);
+        return 0;
+    }
+    void* map = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, src, 0);
+    close(src);
+    if (map == MAP_FAILED) {
+        os << "replacer::file - Unable to map file " << name << ": " << strerror(errno);
+        throw path_exception(os.str());
+    }
+    madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+    size_t matches;
+    try {
+        lazy_file_sink lfs(name, backup ? AWF_BACKUP : AWF_NONE, &sb);
+        matches = scan((const char*)map, sb.st_size, &lfs);
+        if (matches)
+            lfs.commit();
+    } catch (...) {
+        munmap(map, sb.st_size);
+        throw;
+    }
+    munmap(map, sb.st_size);
+    return matches;
+}
@@ -0,0 +1,97 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_REPLACER_HPP
+#define C4S_REPLACER_HPP
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "searcher.hpp"
+
+namespace c4s {
+
+//! List of search - replace pairs.
+typedef std::vector<std::pair<std::string, std::string>> replace_pairs;
+
+//! Receiver for the output spans of the replacer.
+class replacer_span_sink
+{
+  public:
+    virtual ~replacer_span_sink() {}
+    //! Called for each unchanged span and replacement in output order.
+    virtual void put(const char* ptr, size_t len) = 0;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Multi-needle search and replace engine.
+/*! Needles are compiled once into an Aho-Corasick automaton after which any number of buffers or
+  files can be processed in a single pass regardless of the number of needles. Matches do not
+  overlap: the match that ends first wins and if several needles end at the same position the
+  longest one is used. Scanning continues after the replaced text.<br>
+  Files are memory mapped and the output is written with writev so that unchanged spans of the
+  input are never copied into intermediate buffers.
+*/
+class replacer
+{
+  public:
+    //! Creates an empty replacer. Add needles with add().
+    replacer()
+      : first_byte(-1)
+      , compiled(false)
+    {}
+    //! Creates a replacer for a single search-replace pair.
+    replacer(const std::string& search, const std::string& replace);
+    //! Creates a replacer for given search-replace pairs.
+    replacer(const replace_pairs& pairs);
+
+    //! Adds a search-replace pair. Invalidates the compiled automaton.
+    void add(const std::string& search, const std::string& replace);
+    //! Builds the automaton. Called automatically by the replace functions if needed.
+    void compile();
+    //! Returns the number of needles.
+    size_t size() const { return needles.size(); }
+
+    //! Replaces all matches from the buffer and returns the result.
+    std::string apply(const char* data, size_t len, size_t* count = 0);
+    //! Replaces all matches from the string and returns the result.
+    std::string apply(const std::string& str, size_t* count = 0)
+    {
+        return apply(str.c_str(), str.size(), count);
+    }
+    //! Replaces matches from the buffer and writes the result to the file descriptor.
+    size_t write(const char* data, size_t len, int fd);
+    //! Counts the matches in the buffer without writing anything.
+    size_t count(const char* data, size_t len);
+    //! Replaces matches in the named file. Returns number of replacements.
+    size_t file(const std::string& name, bool backup = false);
+
+  protected:
+    //! Scans the buffer. Calls sink for each span. Returns number of matches.
+    size_t scan(const char* data, size_t len, replacer_span_sink* sink);
+
+    struct needle
+    {
+        std::string search;
+        std::string replace;
+    };
+    std::vector<needle> needles;
+    //! Dense transition table, 256 entries per state.
+    std::vector<uint32_t> delta;
+    //! Index + 1 of the longest needle that ends at the state. Zero if none.
+    std::vector<uint32_t> output;
+    //! Non-zero if all needles start with the same byte. Used to skip with memchr.
+    int first_byte;
+    //! Used instead of the automaton when there is only one needle.
+    searcher single;
+    bool compiled;
+};
+
+} // namespace c4s
+#endif
@@ -0,0 +1,198 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "ntbs/ntbs.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "user.hpp"
+#include "path.hpp"
+#include "logger.hpp"
+#include "process.hpp"
+#include "rotating_sink.hpp"
+
+using namespace std;
+using namespace c4s;
+
+// -------------------------------------------------------------------------------------------------
+c4s::rotating_sink::rotating_sink(const path& ph, size_t _max_size, time_t _max_age,
+                                  unsigned int _keep, bool _compress)
+  : name(ph.get_path())
+  , max_size(_max_size)
+  , max_age(_max_age)
+  , keep(_keep ? _keep : 1)
+  , compress(_compress)
+{
+    fids[0] = open_log();
+    fids[1] = -1;
+    running.store(true);
+    requested.store(false);
+    rotations.store(0);
+    worker = thread(&rotating_sink::run, this);
+}
+// -------------------------------------------------------------------------------------------------
+c4s::rotating_sink::~rotating_sink()
+{
+    running.store(false);
+    {
+        lock_guard<mutex> lg(mtx);
+        wake.notify_one();
+    }
+    worker.join();
+    for (int fid : fids) {
+        if (fid >= 0)
+            close(fid);
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Opens the file for appending and resets the size and age. Throws c4s_exception on failure.
+  \retval int File descriptor.
+*/
+int
+c4s::rotating_sink::open_log()
+{
+    int fid = open(name.c_str(), O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fid == -1) {
+        ostringstream sserr;
+        sserr << "rotating_sink - unable to open " << name << " for logging: (" << errno << ") "
+              << strerror(errno);
+        throw c4s_exception(sserr.str());
+    }
+    struct stat sb;
+    size.store(fstat(fid, &sb) ? 0 : sb.st_size);
+    opened = time(0);
+    return fid;
+}
+// -------------------------------------------------------------------------------------------------
+/** Writer enters the rcu slot of the descriptor, so the background thread does not close a
+  descriptor that is in use.
+*/
+void
+c4s::rotating_sink::print(LOG_LEVEL ll, const char* str)
+{
+    struct iovec iov[3];
+    iov[0].iov_base = (void*)get_datetime(ll, &iov[0].iov_len);
+    iov[1].iov_base = (void*)str;
+    iov[1].iov_len = strlen(str);
+    iov[2].iov_base = (void*)"\n";
+    iov[2].iov_len = 1;
+    size_t len = iov[0].iov_len + iov[1].iov_len + 1;
+    unsigned int slot = rcu.enter();
+    writev(fids[slot], iov, 3);
+    rcu.leave(slot);
+
+    size_t total = size.fetch_add(len) + len;
+    if (max_size && total > max_size && total - len <= max_size) {
+        // Only the writer that crosses the limit wakes the background thread.
+        requested.store(true);
+        wake.notify_one();
+    }
+}
+// -------------------------------------------------------------------------------------------------
+//! Gives up after ten seconds if the new file cannot be opened.
+void
+c4s::rotating_sink::rotate()
+{
+    unique_lock<mutex> lk(mtx);
+    size_t target = rotations.load() + 1;
+    requested.store(true);
+    wake.notify_one();
+    rotated.wait_for(lk, chrono::seconds(10),
+                     [this, target]() { return rotations.load() >= target || !running.load(); });
+}
+// -------------------------------------------------------------------------------------------------
+//! Returns true if the path no longer refers to the file that is being written.
+bool
+c4s::rotating_sink::is_replaced()
+{
+    struct stat by_name, by_fid;
+    if (stat(name.c_str(), &by_name))
+        return true;
+    if (fstat(fids[rcu.current()], &by_fid))
+        return false;
+    return by_name.st_ino != by_fid.st_ino || by_name.st_dev != by_fid.st_dev;
+}
+// -------------------------------------------------------------------------------------------------
+/** Runs in the background thread. Segments are renamed before the new file is opened, so writers
+  keep appending to the renamed segment until they are switched over.
+*/
+void
+c4s::rotating_sink::do_rotate()
+{
+    const char* exts[2] = { "", ".gz" };
+    bool replaced = is_replaced();
+    if (!replaced) {
+        for (const char* ext : exts)
+            unlink((name + '.' + to_string(keep) + ext).c_str());
+        for (unsigned int ndx = keep - 1; ndx >= 1; ndx--) {
+            for (const char* ext : exts) {
+                string from = name + '.' + to_string(ndx) + ext;
+                rename(from.c_str(), (name + '.' + to_string(ndx + 1) + ext).c_str());
+            }
+        }
+        rename(name.c_str(), (name + ".1").c_str());
+    }
+    int fid;
+    try {
+        fid = open_log();
+    } catch (const c4s_exception&) {
+        // Keep writing to the old file. Next attempt is made at the next check.
+        return;
+    }
+    // Switch the writers to the new file and wait until the old one is no longer used.
+    fids[rcu.next()] = fid;
+    unsigned int old = rcu.swap();
+    close(fids[old]);
+    fids[old] = -1;
+    rotations++;
+    {
+        lock_guard<mutex> lg(mtx);
+        rotated.notify_all();
+    }
+    if (compress && !replaced) {
+        // Uncompressed segment is kept if gzip is not available.
+        try {
+            process gz("gzip", "-f \"" + name + ".1\"");
+            gz();
+        } catch (const c4s_exception&) {
+        }
+    }
+}
+// -------------------------------------------------------------------------------------------------
+//! Background thread. Checks the limits and the file identity once a second.
+void
+c4s::rotating_sink::run()
+{
+    while (running.load()) {
+        {
+            unique_lock<mutex> lk(mtx);
+            wake.wait_for(lk, chrono::seconds(1),
+                          [this]() { return requested.load() || !running.load(); });
+        }
+        if (!running.load())
+            break;
+        bool due = requested.exchange(false);
+        if (max_age && time(0) - opened >= max_age)
+            due = true;
+        if (due || is_replaced())
+            do_rotate();
+    }
+    lock_guard<mutex> lg(mtx);
+    rotated.notify_all();
+}
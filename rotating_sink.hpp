@@ -0,0 +1,82 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_ROTATING_SINK_HPP
+#define C4S_ROTATING_SINK_HPP
+
+#include <time.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "rcu_epoch.hpp"
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Unbuffered file log that rotates itself when the file grows too large or too old.
+/*! Lines are written with a single writev like in lowio_sink. Rotation is done by a background
+  thread: it renames 'name' to 'name.1' (older segments are shifted up to 'name.keep'), opens a new
+  file and switches the writers to it. The old descriptor is closed only after the writers that
+  were using it have finished, so no line is lost or split. Rotated segments are compressed with
+  gzip in a child process started from the background thread.<br>
+  The background thread also reopens the file if it has been renamed or removed by someone else,
+  e.g. by an external logrotate.<br>
+  The logging call only adds the line length to a counter and wakes the background thread when
+  the size limit is crossed. It never waits for the rotation.
+*/
+class rotating_sink : public log_sink
+{
+  public:
+    //! Opens the log file for appending and starts the background thread.
+    /*! \param ph Path to the log file.
+        \param max_size File is rotated when it grows over this size. Zero disables the limit.
+        \param max_age File is rotated when it is older than this many seconds. Zero disables.
+        \param keep Number of rotated segments to keep.
+        \param compress If true, rotated segments are compressed with gzip.*/
+    rotating_sink(const path& ph, size_t max_size = 0x4000000, time_t max_age = 0,
+                  unsigned int keep = 5, bool compress = true);
+    //! Stops the background thread and closes the file.
+    ~rotating_sink();
+
+    void print(LOG_LEVEL, const char*) override;
+    bool is_thread_safe() const override { return true; }
+    //! Rotates the file now. Returns after the new file is in use.
+    void rotate();
+    //! Returns the number of rotations done by this sink.
+    size_t get_rotations() const { return rotations.load(); }
+
+  protected:
+    int open_log();
+    void run();
+    void do_rotate();
+    bool is_replaced();
+
+    std::string name;
+    size_t max_size;
+    time_t max_age;
+    unsigned int keep;
+    bool compress;
+
+    int fids[2];                    //!< Current and previous file. Index is the rcu slot.
+    rcu_epoch rcu;                  //!< Writers using the files.
+    std::atomic<size_t> size;       //!< Size of the current file.
+    time_t opened;
+
+    std::atomic<bool> running;
+    std::atomic<bool> requested;    //!< Size limit crossed or rotate() called.
+    std::atomic<size_t> rotations;
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::condition_variable rotated;
+    std::thread worker;
+};
+
+} // namespace c4s
+#endif
@@ -94,22 +94,337 @@ void test3()
     logger::close_log();
     cout << "Logging completed\n";
 }
+// -------------------------------------------------------------------------------------------------
+void test4()
+{
+    const int THREADS = 4;
+    const int COUNT = 10000;
+    cout << "Asynchronous file log from " << THREADS << " threads\n";
+    path lfile(args.get_value("-f"));
+    try {
+        LOG_LEVEL ll = args.is_set("-l") ? logbase::str2level(args.get_value("-l").c_str()) : LL_INFO;
+        logbase::init_log(ll, new async_sink(lfile, 1024, async_sink::AS_BLOCK));
+    }catch(c4s_exception ce) {
+        cout << "Unable to open log: "<<ce.what()<<'\n';
+        return;
+    }
+    vector<thread> writers;
+    for (int tn = 0; tn < THREADS; tn++) {
+        writers.emplace_back([tn]() {
+            for (int ndx = 0; ndx < COUNT; ndx++)
+                CS_VAPRT_ERRO("thread %d message %d", tn, ndx);
+        });
+    }
+    for (auto& wt : writers)
+        wt.join();
+    // close_log flushes the queue before the sink is closed.
+    logbase::close_log();
+    cout << "Logging completed. Log should have " << THREADS * COUNT << " lines.\n";
+}
+// -------------------------------------------------------------------------------------------------
+//! Logs from several threads with the stream interface and checks that every line is intact.
+void test5()
+{
+    const int THREADS = 8;
+    const int COUNT = 20000;
+    path lfile(args.is_set("-f") ? args.get_value("-f") : string("c4s-logger-stress.log"));
+    if (lfile.exists())
+        lfile.rm();
+    cout << "Stream logging from " << THREADS << " threads into " << lfile.get_path() << '\n';
+    logger::init_log(LL_INFO, new fstream_sink(lfile));
+    vector<thread> writers;
+    for (int tn = 0; tn < THREADS; tn++) {
+        writers.emplace_back([tn]() {
+            for (int ndx = 0; ndx < COUNT; ndx++)
+                CSLOG << "stress thread " << tn << " line " << ndx << " value " << ndx * 0.5
+                      << " end" << CS_INFO;
+        });
+    }
+    for (auto& wt : writers)
+        wt.join();
+    logger::close_log();
+
+    // Every line must be complete and each thread's lines must be in order.
+    vector<int> next(THREADS, 0);
+    int bad = 0;
+    ifstream lf(lfile.get_path().c_str());
+    string line;
+    while (getline(lf, line)) {
+        size_t pos = line.find("stress thread ");
+        if (pos == string::npos)
+            continue;
+        int tn, ndx;
+        double value;
+        char tail[8];
+        if (sscanf(line.c_str() + pos, "stress thread %d line %d value %lf %7s", &tn, &ndx, &value,
+                   tail) != 4 ||
+            tn < 0 || tn >= THREADS || ndx != next[tn] || value != ndx * 0.5 ||
+            strcmp(tail, "end")) {
+            bad++;
+            continue;
+        }
+        next[tn]++;
+    }
+    int missing = 0;
+    for (int tn = 0; tn < THREADS; tn++)
+        missing += COUNT - next[tn];
+    cout << (bad || missing ? "FAILED" : "OK") << ": " << bad << " corrupted, " << missing
+         << " missing lines.\n";
+}
+// -------------------------------------------------------------------------------------------------
+//! Measures the stream interface throughput with different sinks.
+void test6()
+{
+    const int THREADS = 4;
+    const int COUNT = 200000;
+    path lfile(args.is_set("-f") ? args.get_value("-f") : string("c4s-logger-bench.log"));
+    const char* names[] = { "fstream_sink", "lowio_sink", "async_sink" };
+    for (int sn = 0; sn < 3; sn++) {
+        if (lfile.exists())
+            lfile.rm();
+        log_sink* sink;
+        if (sn == 0)
+            sink = new fstream_sink(lfile);
+        else if (sn == 1)
+            sink = new lowio_sink(lfile);
+        else
+            sink = new async_sink(lfile, 8192);
+        logger log(LL_INFO, sink);
+        auto start = chrono::steady_clock::now();
+        vector<thread> writers;
+        for (int tn = 0; tn < THREADS; tn++) {
+            writers.emplace_back([tn, &log]() {
+                for (int ndx = 0; ndx < COUNT; ndx++)
+                    log << "bench thread " << tn << " message " << ndx << CS_INFO;
+            });
+        }
+        for (auto& wt : writers)
+            wt.join();
+        log.flush();
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << names[sn] << ": " << (int)(THREADS * COUNT / secs) << " messages/s\n";
+    }
+    lfile.rm();
+}
+// -------------------------------------------------------------------------------------------------
+//! Sink that only formats the time stamp. Used to measure the formatting cost.
+class stamp_sink : public log_sink
+{
+  public:
+    void print(LOG_LEVEL ll, const char*) override {
+        size_t len;
+        get_datetime(ll, &len);
+        total += len;
+    }
+    size_t total = 0;
+};
+//! Shows the time stamp formats and measures the time stamp formatting speed.
+void test7()
+{
+    const int COUNT = 2000000;
+    const int formats[][2] = { { LTS_LOCAL, 0 }, { LTS_LOCAL, 3 }, { LTS_ISO8601, 6 },
+                               { LTS_ISO8601 | LTS_UTC, 3 } };
+    for (auto& fmt : formats) {
+        log_sink::set_timestamp(fmt[0], fmt[1]);
+        {
+            logger log(LL_INFO, new stderr_sink());
+            log << "time stamp flags " << fmt[0] << " precision " << fmt[1] << CS_INFO;
+        }
+        stamp_sink* sink = new stamp_sink();
+        logger bench(LL_INFO, sink);
+        auto start = chrono::steady_clock::now();
+        for (int ndx = 0; ndx < COUNT; ndx++)
+            sink->print(LL_INFO, "");
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "  " << (int)(secs * 1e9 / COUNT) << " ns per time stamp\n";
+    }
+    log_sink::set_timestamp(LTS_LOCAL);
+}
+// -------------------------------------------------------------------------------------------------
+//! Binary log from several threads. Decodes the ring and checks the latest lines.
+void test8()
+{
+    const int THREADS = 4;
+    const int COUNT = 100000;
+    path base(args.is_set("-f") ? args.get_value("-f") : string("c4s-logger-bin"));
+    cout << "Binary log from " << THREADS << " threads into " << base.get_path() << ".*\n";
+    logbase::init_log(LL_INFO, new binlog_sink(base, 0x400000, 3));
+    auto start = chrono::steady_clock::now();
+    vector<thread> writers;
+    for (int tn = 0; tn < THREADS; tn++) {
+        writers.emplace_back([tn]() {
+            for (int ndx = 0; ndx < COUNT; ndx++)
+                CS_VAPRT_INFO("thread %d line %d value %.1f %s", tn, ndx, ndx * 0.5, "end");
+        });
+    }
+    for (auto& wt : writers)
+        wt.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    CS_PRINT_INFO("binary log test completed");
+    logbase::close_log();
+    cout << (int)(secs * 1e9 / (THREADS * COUNT)) << " ns per message\n";
+
+    // Files wrap around, so only the lines of the last files remain. They must be intact and in
+    // order within each thread.
+    ostringstream text;
+    binlog_reader reader(base);
+    size_t records = reader.dump(text);
+    istringstream lines(text.str());
+    string line;
+    int last[THREADS] = { -1, -1, -1, -1 };
+    int bad = 0;
+    bool done = false;
+    while (getline(lines, line)) {
+        if (line.find("binary log test completed") != string::npos) {
+            done = true;
+            continue;
+        }
+        size_t pos = line.find("thread ");
+        int tn, ndx;
+        double value;
+        char tail[8];
+        if (pos == string::npos ||
+            sscanf(line.c_str() + pos, "thread %d line %d value %lf %7s", &tn, &ndx, &value,
+                   tail) != 4 ||
+            tn < 0 || tn >= THREADS || ndx <= last[tn] || value != ndx * 0.5 ||
+            strcmp(tail, "end")) {
+            bad++;
+            continue;
+        }
+        last[tn] = ndx;
+    }
+    bool complete = done;
+    for (int tn = 0; tn < THREADS; tn++)
+        complete = complete && last[tn] == COUNT - 1;
+    cout << (bad || !complete ? "FAILED" : "OK") << ": " << records << " records decoded, " << bad
+         << " corrupted.\n";
+}
+// -------------------------------------------------------------------------------------------------
+//! Rotating log from several threads. Checks that the lines in the kept segments are intact.
+void test9()
+{
+    const int THREADS = 4;
+    const int COUNT = 20000;
+    const unsigned int KEEP = 3;
+    path lfile(args.is_set("-f") ? args.get_value("-f") : string("c4s-logger-rotate.log"));
+    cout << "Rotating log from " << THREADS << " threads into " << lfile.get_path() << '\n';
+    rotating_sink* sink = new rotating_sink(lfile, 0x40000, 0, KEEP, false);
+    logger::init_log(LL_INFO, sink);
+    vector<thread> writers;
+    for (int tn = 0; tn < THREADS; tn++) {
+        writers.emplace_back([tn]() {
+            for (int ndx = 0; ndx < COUNT; ndx++)
+                CSLOG << "rotate thread " << tn << " line " << ndx << " end" << CS_INFO;
+        });
+    }
+    for (auto& wt : writers)
+        wt.join();
+    sink->rotate();
+    size_t rotations = sink->get_rotations();
+    logger::close_log();
+
+    int bad = 0, lines = 0;
+    for (unsigned int seg = 1; seg <= KEEP; seg++) {
+        ifstream lf(lfile.get_path() + '.' + to_string(seg));
+        string line;
+        while (getline(lf, line)) {
+            int tn, ndx;
+            char tail[8];
+            size_t pos = line.find("rotate thread ");
+            if (pos == string::npos)
+                continue;
+            lines++;
+            if (sscanf(line.c_str() + pos, "rotate thread %d line %d %7s", &tn, &ndx, tail) != 3 ||
+                strcmp(tail, "end"))
+                bad++;
+        }
+    }
+    cout << (bad || rotations < 2 ? "FAILED" : "OK") << ": " << rotations << " rotations, "
+         << lines << " lines in kept segments, " << bad << " corrupted.\n";
+}
+// -------------------------------------------------------------------------------------------------
+static int g_evaluated = 0;
+//! Operand with a side effect. Logs a line of its own to show nesting.
+static int counted(int val)
+{
+    g_evaluated++;
+    C4S_LOG(NOTE) << "nested line for " << val;
+    return val;
+}
+//! C4S_LOG macro: operands are evaluated only for enabled levels.
+void test10()
+{
+    logger::init_log(LL_INFO, new stderr_sink());
+    C4S_LOG(DEBU) << "filtered " << counted(1);
+    bool lazy = g_evaluated == 0;
+    C4S_LOG(INFO) << "value " << counted(2) << ", " << 2.5 << ", " << string("text") << ", "
+                  << true << ", " << 'c' << ", " << LL_ERROR << ", " << (void*)0x1234;
+    lazy = lazy && g_evaluated == 1;
+
+    const int COUNT = 10000000;
+    auto start = chrono::steady_clock::now();
+    for (int ndx = 0; ndx < COUNT; ndx++)
+        C4S_LOG(DEBU) << "filtered message " << ndx << ' ' << ndx * 0.5;
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "C4S_LOG filtered: " << secs * 1e9 / COUNT << " ns per message\n";
+    start = chrono::steady_clock::now();
+    for (int ndx = 0; ndx < COUNT; ndx++)
+        CSLOG << "filtered message " << ndx << ' ' << ndx * 0.5 << CS_DEBU;
+    secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "CSLOG filtered:   " << secs * 1e9 / COUNT << " ns per message\n";
+    logger::close_log();
+    cout << (lazy ? "OK" : "FAILED") << ": operands evaluated only for enabled level.\n";
+}
+
+// -------------------------------------------------------------------------------------------------
+enum class color { RED = 1, GREEN = 2 };
+//! CS_VAPRT with run time formats and argument types that binary sinks do not store.
+void test11()
+{
+    path base(args.is_set("-f") ? args.get_value("-f") : string("c4s-logger-fmt"));
+    logbase::init_log(LL_INFO, new binlog_sink(base, 0x100000, 1));
+    const char* formats[] = { "first format %d", "second format %d" };
+    for (int ndx = 0; ndx < 2; ndx++) {
+        const char* fmt = formats[ndx];
+        CS_VAPRT_INFO(fmt, ndx);
+    }
+    CS_VAPRT_INFO("color %d pointer %p", color::GREEN, nullptr);
+    logbase::close_log();
+
+    ostringstream text;
+    binlog_reader reader(base);
+    reader.dump(text);
+    string out = text.str();
+    bool ok = out.find("first format 0") != string::npos &&
+              out.find("second format 1") != string::npos && out.find("color 2") != string::npos;
+    cout << out << (ok ? "OK" : "FAILED") << ": run time formats and enum arguments.\n";
+}
 
 typedef void (*tfptr)();
 // ==========================================================================================
 int main(int argc, char **argv)
 {
-    const int TMAX=3;
-    tfptr tfunc[TMAX] = { &test1, &test2, &test3 };
+    const int TMAX=11;
+    tfptr tfunc[TMAX] = { &test1, &test2, &test3, &test4, &test5,
+                          &test6, &test7, &test8, &test9, &test10,
+                          &test11 };
 
     const char *info = "Following tests have been defined:\n"\
         " 1 = Std file stream logging using log macros.\n"\
         " 2 = Low level io with direct interface.\n"\
-        " 3 = Buffered log to stderr.\n";
+        " 3 = Buffered log to stderr.\n"\
+        " 4 = Asynchronous file log from several threads.\n"\
+        " 5 = Multi-threaded stress test for the stream interface.\n"\
+        " 6 = Stream interface throughput with different sinks.\n"\
+        " 7 = Time stamp formats and formatting speed.\n"\
+        " 8 = Binary log from several threads and decoding.\n"\
+        " 9 = Rotating log from several threads.\n"\
+        "10 = C4S_LOG macro with lazy operands.\n"\
+        "11 = CS_VAPRT with run time formats into a binary log.\n";
 
     args += argument("-t",  true, "Sets VALUE as the test to run.");
     args += argument("-l",  true, "Sets VALUE as log level [TRACE|DEBUG|INFO|NOTICE|WARNING|ERROR|CRIT] for application.");
-    args += argument("-f",  true, "Sets VALUE as log file name. Use with test 1");
+    args += argument("-f",  true, "Sets VALUE as log file name. Use with tests 1, 2 and 4");
 
     cout << "Cpp4Scripts - logger sample and test program\n";
     try{
@@ -284,6 +284,180 @@ void test13()
     for(path_iterator pi=cpp.begin(); pi!=cpp.end(); pi++)
         cout << pi->get_path() << '\n';
 }
+// -------------------------------------------------------------------------------------------------
+void test14()
+{
+    stat_cache_scope scope;
+    path_list cpp(path("./"), ".*cpp$");
+    scope.get().prefetch(cpp);
+    cout << "Prefetched " << scope.get().size() << " entries.\n";
+    path_iterator pi;
+    for (pi = cpp.begin(); pi != cpp.end(); pi++) {
+        if (!pi->exists()) {
+            cout << "Prefetched file not found: " << pi->get_path() << '\n';
+            return;
+        }
+    }
+    path tmp("c4s-stat.tmp");
+    ofstream tf(tmp.get_path().c_str());
+    tf.close();
+    if (!tmp.exists()) {
+        cout << "Failed to see new file.\n";
+        return;
+    }
+    tmp.rm();
+    if (tmp.exists()) {
+        cout << "Cache was not invalidated by rm.\n";
+        return;
+    }
+    cout << "OK\n";
+}
+// -------------------------------------------------------------------------------------------------
+void test15()
+{
+    path dir("c4stest-batch/");
+    if (!dir.dirname_exists())
+        dir.mkdir();
+    path_list files;
+    for (int ndx = 0; ndx < 20; ndx++) {
+        ostringstream oss;
+        oss << "batch_" << ndx << ".txt";
+        path tmp(dir.get_dir(), oss.str());
+        ofstream tf(tmp.get_path().c_str());
+        tf << "batch test " << ndx;
+        tf.close();
+        files += tmp;
+    }
+    batch_executor be;
+    batch_results results;
+    cout << "io_uring in use: " << (be.uses_uring() ? "yes" : "no") << '\n';
+    if (be.stat(files, results) || results.size() != files.size()) {
+        cout << "Batch stat failed.\n";
+        return;
+    }
+    // Exceptions other than c4s_exception are recorded per entry as well.
+    size_t failed = be.for_each(files, [](path& p) {
+        if (p.get_base().find("_1") != string::npos)
+            throw runtime_error("odd one");
+        if (p.get_base() == "batch_2.txt")
+            throw 42;
+    }, results);
+    if (failed != 12 || results[1].message != "odd one" || results[2].ok()) {
+        cout << "Batch for_each failed: " << failed << '\n';
+        return;
+    }
+    if (files.rm_all(results)) {
+        for (batch_result& br : results) {
+            if (!br.ok())
+                cout << br.target.get_path() << ": " << br.message << '\n';
+        }
+        return;
+    }
+    dir.rmdir();
+    cout << "OK\n";
+}
+// -------------------------------------------------------------------------------------------------
+void test16()
+{
+    path tmp("c4s-replace.tmp");
+    ofstream tf(tmp.get_path().c_str());
+    tf << "alpha beta gamma\nbeta alpha\n";
+    tf.close();
+    vector<pair<string, string>> pairs = { { "alpha", "beta" }, { "beta", "alpha" } };
+    int count = tmp.search_replace(pairs);
+    ifstream rf(tmp.get_path().c_str());
+    string first, second;
+    getline(rf, first);
+    getline(rf, second);
+    rf.close();
+    tmp.rm();
+    if (count != 4 || first != "beta alpha gamma" || second != "alpha beta") {
+        cout << "Multi-replace failed: " << count << " - " << first << " / " << second << '\n';
+        return;
+    }
+    cout << "OK\n";
+}
+void test17()
+{
+    path tmp("c4s-atomic.tmp");
+    ofstream tf(tmp.get_path().c_str());
+    tf << "original\n";
+    tf.close();
+    tmp.chmod(0x640);
+    {
+        // Writer that is not committed must leave the file untouched.
+        atomic_writer aw(tmp.get_path());
+        aw.write("discarded\n");
+    }
+    atomic_writer aw(tmp.get_path(), AWF_BACKUP);
+    aw.write("replaced\n");
+    aw.commit();
+    path backup(tmp.get_path() + "~");
+    ifstream rf(tmp.get_path().c_str());
+    ifstream bf(backup.get_path().c_str());
+    string content, old;
+    getline(rf, content);
+    getline(bf, old);
+    rf.close();
+    bf.close();
+    struct stat sb;
+    bool mode_ok = !stat(tmp.get_path().c_str(), &sb) && (sb.st_mode & 0777) == 0640;
+    backup.rm();
+    // Backup that cannot be created fails the commit and keeps the target as it was.
+    path backup_dir(tmp.get_path() + "~/");
+    backup_dir.mkdir();
+    bool thrown = false;
+    try {
+        atomic_writer fw(tmp.get_path(), AWF_BACKUP);
+        fw.write("lost\n");
+        fw.commit();
+    } catch (const path_exception&) {
+        thrown = true;
+    }
+    backup_dir.rmdir();
+    rf.open(tmp.get_path().c_str());
+    string kept;
+    getline(rf, kept);
+    rf.close();
+    tmp.rm();
+    if (content != "replaced" || old != "original" || !mode_ok || !thrown || kept != "replaced") {
+        cout << "Atomic write failed: " << content << " / " << old << " mode:" << mode_ok
+             << " backup failure:" << thrown << ' ' << kept << '\n';
+        return;
+    }
+    cout << "OK\n";
+}
+void test18()
+{
+    path dir("c4s-manifest/");
+    dir.mkdir();
+    for (int ndx = 0; ndx < 10; ndx++) {
+        ofstream tf((dir.get_dir() + "file" + to_string(ndx) + ".tmp").c_str());
+        tf << "content " << ndx << '\n';
+    }
+    path_list files(dir, "\\.tmp$");
+    path mfile("c4s-manifest.txt");
+    hash_manifest first;
+    size_t hashed = files.hash_all(first);
+    first.write(mfile);
+
+    // Second run reads the previous manifest and hashes only the changed file.
+    ofstream tf((dir.get_dir() + "file3.tmp").c_str(), ios_base::app);
+    tf << "more\n";
+    tf.close();
+    hash_manifest second;
+    second.read(mfile);
+    size_t rehashed = files.hash_all(second);
+    vector<string> changed;
+    size_t mismatches = second.verify(changed);
+    dir.rmdir(true);
+    mfile.rm();
+    if (hashed != 10 || rehashed != 1 || mismatches != 0) {
+        cout << "Manifest failed: " << hashed << " / " << rehashed << " / " << mismatches << '\n';
+        return;
+    }
+    cout << "OK\n";
+}
 // ==========================================================================================
 int main(int argc, char **argv)
 {
@@ -301,6 +475,11 @@ int main(int argc, char **argv)
         { &test11, "Replace block within custom tags."},
         { &test12, "Path construction with const char* and const string&."},
         { &test13, "path_list: test exclude regex. (-s search regex; -e exclude regex)."},
+        { &test14, "stat_cache: prefetch and invalidation."},
+        { &test15, "batch_executor: stat and remove a list of files."},
+        { &test16, "search_replace: swap two words in one pass."},
+        { &test17, "atomic_writer: abort, commit with backup and mode preservation."},
+        { &test18, "hash_manifest: parallel hashing and incremental update."},
         { 0, 0}
     };
 
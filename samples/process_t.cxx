@@ -16,14 +16,26 @@ Copyright (c) Menacon Ltd
 #include <iostream>
 #include <stdexcept>
 #include <time.h>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 // #include "../cpp4scripts.hpp"
 #include "../ntbs.cpp"
 #include "../path.hpp"
 #include "../RingBuffer.hpp"
 #include "../RingBuffer.cpp"
+#include "../proc_profile.hpp"
+#include "../proc_profile.cpp"
 #include "../process.hpp"
 #include "../process.cpp"
+#include "../proc_reactor.hpp"
+#include "../proc_reactor.cpp"
+#include "../proc_supervisor.hpp"
+#include "../proc_supervisor.cpp"
 
 using namespace c4s;
 using namespace std;
@@ -97,6 +109,388 @@ bool test5()
     return true;
 }
 
+bool test12()
+{
+    // Command is first found from the second directory. Adding it to the first directory must
+    // invalidate the cached path.
+    const char* cmd = "c4s_cache_t";
+    string dir_a = "/tmp/c4s_cache_a", dir_b = "/tmp/c4s_cache_b";
+    mkdir(dir_a.c_str(), 0755);
+    mkdir(dir_b.c_str(), 0755);
+    string old_path = getenv("PATH");
+    setenv("PATH", (dir_a + ':' + dir_b + ':' + old_path).c_str(), 1);
+    auto make_exec = [cmd](const string& dir) {
+        string name = dir + '/' + cmd;
+        ofstream script(name);
+        script << "#!/bin/sh\nexit 0\n";
+        script.close();
+        chmod(name.c_str(), 0755);
+    };
+    auto cleanup = [&]() {
+        unlink((dir_a + '/' + cmd).c_str());
+        unlink((dir_b + '/' + cmd).c_str());
+        rmdir(dir_a.c_str());
+        rmdir(dir_b.c_str());
+        setenv("PATH", old_path.c_str(), 1);
+    };
+    make_exec(dir_b);
+    string full;
+    bool ok = true;
+    if (process::prewarm({ "sh", "ls", cmd, "c4s_not_a_command" }) != 3) {
+        cout << "  Failed - prewarm\n";
+        ok = false;
+    }
+    if (ok && (!process::resolve_command(cmd, full) || full != dir_b + '/' + cmd)) {
+        cout << "  Failed - first resolve: " << full << '\n';
+        ok = false;
+    }
+    make_exec(dir_a);
+    if (ok && (!process::resolve_command(cmd, full) || full != dir_a + '/' + cmd)) {
+        cout << "  Failed - cache was not invalidated: " << full << '\n';
+        ok = false;
+    }
+    if (ok) {
+        process proc(cmd, 0);
+        if (proc.get_command().get_path() != dir_a + '/' + cmd) {
+            cout << "  Failed - set_command: " << proc.get_command().get_path() << '\n';
+            ok = false;
+        }
+    }
+    clock_t start = clock();
+    for (int i = 0; i < 10000; i++)
+        process::resolve_command("ls", full);
+    cout << "  10000 cached lookups: " << (clock() - start) * 1000 / CLOCKS_PER_SEC << " ms\n";
+    // Match from a relative PATH element is absolute and depends on the current directory.
+    char cwd[PATH_MAX];
+    string rel_dir = dir_a + "/rel", rel_cmd = rel_dir + '/' + cmd;
+    mkdir(rel_dir.c_str(), 0755);
+    rename((dir_a + '/' + cmd).c_str(), rel_cmd.c_str());
+    setenv("PATH", ("rel:" + dir_b + ':' + old_path).c_str(), 1);
+    if (ok && getcwd(cwd, sizeof(cwd)) && !chdir(dir_a.c_str())) {
+        if (!process::resolve_command(cmd, full) || full != rel_cmd) {
+            cout << "  Failed - relative element: " << full << '\n';
+            ok = false;
+        }
+        if (ok && (chdir("/") || !process::resolve_command(cmd, full) || full != dir_b + '/' + cmd)) {
+            cout << "  Failed - relative match was cached: " << full << '\n';
+            ok = false;
+        }
+        chdir(cwd);
+    }
+    unlink(rel_cmd.c_str());
+    rmdir(rel_dir.c_str());
+    cleanup();
+    return ok;
+}
+
+bool test13()
+{
+    // Arguments added one by one are passed as is, spaces and quotes included.
+    process sh("sh", 0);
+    sh.add_arg("-c");
+    sh.add_arg("test \"$1\" = \"a 'b'\" && test \"$2\" = \"c d\" && exit $#");
+    sh.add_arg("sh");
+    sh.add_arg("a 'b'");
+    sh += "\"c d\"";
+    int rv = sh();
+    if (rv != 2) {
+        cout << "  Failed - rv = " << rv << '\n';
+        return false;
+    }
+    // 300000 symbol definitions do not fit into ARG_MAX. Linker gets them in a response file.
+    if (process("gcc", "-c -x c -o /tmp/c4s_args_t.o /dev/null")()) {
+        cout << "  Failed - unable to compile test object\n";
+        return false;
+    }
+    process ld("ld", "-r -o /tmp/c4s_args_t2.o /tmp/c4s_args_t.o");
+    ld.set_response_file(true);
+    char def[48];
+    clock_t start = clock();
+    for (int i = 0; i < 300000; i++) {
+        snprintf(def, sizeof(def), "--defsym=C4S_ARG_%d=%d", i, i);
+        ld.add_arg(def);
+    }
+    cout << "  300000 arguments added in " << (clock() - start) * 1000 / CLOCKS_PER_SEC
+         << " ms, " << ld.get_args().bytes() / 1024 << " KiB\n";
+    rv = ld();
+    unlink("/tmp/c4s_args_t.o");
+    unlink("/tmp/c4s_args_t2.o");
+    if (rv != 0) {
+        cout << "  Failed - ld with response file rv = " << rv << '\n';
+        return false;
+    }
+    ld.set_response_file(false);
+    try {
+        ld();
+        cout << "  Failed - expected too many arguments\n";
+        return false;
+    } catch (const process_exception& pe) {
+        cout << "  " << pe.what() << '\n';
+    }
+    // A single argument over 32 pages fits into ARG_MAX but not into one execv string.
+    process echo("echo", 0);
+    echo.add_arg(string(0x30000, 'x'));
+    try {
+        echo();
+        cout << "  Failed - expected too long argument\n";
+        return false;
+    } catch (const process_exception& pe) {
+        cout << "  " << pe.what() << '\n';
+    }
+    return true;
+}
+
+bool test14()
+{
+    // 50 children that sleep 0.3 s each. Run concurrently they complete in well under a second.
+    proc_reactor reactor;
+    vector<unique_ptr<process>> jobs;
+    int lines = 0, failed = 0, completed = 0;
+    char args[80];
+    for (int i = 0; i < 50; i++) {
+        snprintf(args, sizeof(args), "-c 'echo job %d; sleep 0.3; echo done; exit %d'", i, i % 2);
+        jobs.emplace_back(new process("sh", args));
+    }
+    auto start = chrono::steady_clock::now();
+    for (auto& job : jobs) {
+        reactor.start(
+            *job,
+            [&](process&, int rv) {
+                completed++;
+                if (rv)
+                    failed++;
+            },
+            [&](process&, string_view line) {
+                if (line.substr(0, 3) == "job" || line == "done")
+                    lines++;
+            });
+    }
+    reactor.run();
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "  50 processes in " << ms.count() << " ms\n";
+    if (completed != 50 || failed != 25 || lines != 100) {
+        cout << "  Failed - completed=" << completed << " failed=" << failed << " lines=" << lines
+             << '\n';
+        return false;
+    }
+    // Timeout kills the child.
+    process slow("sleep", "10");
+    slow.set_timeout(1);
+    int rv = 0;
+    reactor.start(slow, [&](process&, int r) { rv = r; });
+    reactor.run();
+    if (rv != -1) {
+        cout << "  Failed - timeout rv=" << rv << '\n';
+        return false;
+    }
+    return true;
+}
+
+#if defined(__cpp_impl_coroutine)
+proc_task test15_count(proc_reactor& reactor, process& proc, int& lines)
+{
+    reactor.start(proc);
+    while (auto line = co_await reactor.read_line(proc))
+        lines++;
+    if (co_await reactor.wait(proc))
+        throw process_exception("test15 - unexpected return value");
+}
+
+proc_task test15_main(proc_reactor& reactor, int& lines, int& rv)
+{
+    process p1("seq", "1000"), p2("seq", "2000"), p3("sh", "-c 'exit 3'");
+    vector<proc_task> tasks;
+    tasks.push_back(test15_count(reactor, p1, lines));
+    tasks.push_back(test15_count(reactor, p2, lines));
+    co_await when_all(std::move(tasks));
+    rv = co_await reactor.execute(p3);
+}
+
+bool test15()
+{
+    proc_reactor reactor;
+    int lines = 0, rv = 0;
+    proc_task task = test15_main(reactor, lines, rv);
+    reactor.sync_wait(task);
+    if (lines != 3000 || rv != 3) {
+        cout << "  Failed - lines=" << lines << " rv=" << rv << '\n';
+        return false;
+    }
+    return true;
+}
+#endif
+
+//! Counts the bytes written into it.
+class count_buf : public streambuf
+{
+  public:
+    size_t count = 0;
+
+  protected:
+    streamsize xsputn(const char*, streamsize n) override
+    {
+        count += n;
+        return n;
+    }
+    int overflow(int ch) override
+    {
+        count++;
+        return ch;
+    }
+};
+
+bool test16()
+{
+    // 64 MiB through cat. Writing all of stdin before reading stdout would deadlock.
+    string block(0x100000, 'x');
+    stringstream input;
+    for (int i = 0; i < 64; i++)
+        input << block;
+    count_buf counter;
+    ostream output(&counter);
+    process cat("cat", 0);
+    auto start = chrono::steady_clock::now();
+    int rv = cat.pump(input, output);
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "  64 MiB through cat in " << ms.count() << " ms\n";
+    if (rv || counter.count != 64 * block.size()) {
+        cout << "  Failed - rv=" << rv << " bytes=" << counter.count << '\n';
+        return false;
+    }
+    // Round trip through gzip using the streaming writer.
+    stringstream packed, unpacked;
+    process gz("gzip", "-c1");
+    gz.set_sinks(&packed);
+    gz.start();
+    for (int i = 0; i < 16; i++)
+        gz.write_stdin(block.data(), block.size());
+    if (gz.drain()) {
+        cout << "  Failed - gzip\n";
+        return false;
+    }
+    process gunzip("gzip", "-dc");
+    if (gunzip.pump(packed, unpacked) || unpacked.str().size() != 16 * block.size()) {
+        cout << "  Failed - gunzip size " << unpacked.str().size() << '\n';
+        return false;
+    }
+    // Child that stops reading early must not kill us with SIGPIPE.
+    stringstream head_out;
+    process head("head", "-c 10");
+    head.set_sinks(&head_out);
+    head.start();
+    size_t written = 0;
+    for (int i = 0; i < 64; i++)
+        written += head.write_stdin(block.data(), block.size());
+    head.drain();
+    if (head_out.str() != "xxxxxxxxxx" || written >= 64 * block.size()) {
+        cout << "  Failed - head: '" << head_out.str() << "' written=" << written << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool test17()
+{
+    proc_supervisor sup;
+    proc_supervisor::counters cnt;
+    // Crashing service is restarted with backoff 20, 40 and 80 ms and then given up.
+    proc_supervisor::service crash;
+    crash.name = "crash";
+    crash.command = "sh";
+    crash.args = "-c 'exit 1'";
+    crash.backoff_min = 20;
+    crash.backoff_max = 80;
+    crash.max_restarts = 3;
+    sup.add(crash);
+    // Limits are visible to the child.
+    proc_supervisor::service limited;
+    limited.name = "limited";
+    limited.command = "sh";
+    limited.args = "-c 'test \"$(ulimit -v)\" = 65536 && test \"$(ulimit -t)\" = 5'";
+    limited.restart = proc_supervisor::RESTART::NEVER;
+    limited.max_memory = 64 << 20;
+    limited.max_cpu = 5;
+    sup.add(limited);
+    sup.run_for(chrono::milliseconds(500));
+    sup.get_counters("crash", cnt);
+    if (cnt.state != proc_supervisor::STATE::FAILED || cnt.starts != 4 || cnt.restarts != 3 ||
+        cnt.failures != 4) {
+        cout << "  Failed - crash: state=" << proc_supervisor::state_name(cnt.state)
+             << " starts=" << cnt.starts << " failures=" << cnt.failures << '\n';
+        return false;
+    }
+    sup.get_counters("limited", cnt);
+    if (cnt.state != proc_supervisor::STATE::STOPPED || cnt.last_rv != 0) {
+        cout << "  Failed - limits not applied, rv=" << cnt.last_rv << '\n';
+        return false;
+    }
+    // SIGTERM stops the polite service at once, the stubborn one is killed after the grace period.
+    proc_supervisor::service polite, stubborn;
+    polite.name = "polite";
+    polite.command = "sleep";
+    polite.args = "30";
+    sup.add(polite);
+    stubborn.name = "stubborn";
+    stubborn.command = "sh";
+    stubborn.args = "-c 'trap \"\" TERM; while :; do sleep 0.05; done'";
+    stubborn.grace = 300;
+    sup.add(stubborn);
+    sup.run_for(chrono::milliseconds(100));
+    auto start = chrono::steady_clock::now();
+    sup.stop("polite");
+    auto polite_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    start = chrono::steady_clock::now();
+    sup.stop_all();
+    auto stubborn_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "  stop: polite " << polite_ms.count() << " ms, stubborn " << stubborn_ms.count() << " ms\n";
+    sup.get_counters("stubborn", cnt);
+    if (polite_ms.count() > 200 || stubborn_ms.count() < 300 || cnt.kills != 1 ||
+        cnt.state != proc_supervisor::STATE::STOPPED) {
+        cout << "  Failed - stop\n";
+        return false;
+    }
+    ostringstream metrics;
+    sup.export_counters(metrics);
+    if (metrics.str().find("c4s_service_kills_total{service=\"stubborn\"} 1\n") == string::npos) {
+        cout << "  Failed - metrics:\n" << metrics.str();
+        return false;
+    }
+    return true;
+}
+
+bool test18()
+{
+    proc_profile prof;
+    prof.set_files(64);
+    prof.set_nice(5);
+    prof.set_cpus({ 0 });
+    prof.set_ionice(proc_profile::IOCLASS::IDLE);
+    process sh("sh", "-c 'ulimit -n; nice; grep Cpus_allowed_list /proc/self/status'", PIPE::SM);
+    sh.set_profile(prof);
+    ostringstream out;
+    int rv = sh(out);
+    if (rv || out.str() != "64\n5\nCpus_allowed_list:\t0\n") {
+        cout << "  Failed - rv=" << rv << " output:\n" << out.str();
+        return false;
+    }
+    // Without cgroup v2 or a delegated root the start fails before the fork.
+    prof.set_cgroup("c4s-test18", 64 << 20, 50);
+    process cg("sh", "-c 'cat /proc/self/cgroup'", PIPE::SM);
+    cg.set_profile(prof);
+    try {
+        ostringstream groups;
+        cg(groups);
+        if (groups.str().find("/c4s-test18\n") == string::npos) {
+            cout << "  Failed - not in the group:\n" << groups.str();
+            return false;
+        }
+        prof.remove_cgroup();
+    } catch (const process_exception& pe) {
+        cout << "  cgroup: " << pe.what() << '\n';
+    }
+    return true;
+}
+
 #if 0
 
 bool test5()
@@ -209,6 +603,15 @@ int main(int argc, char **argv)
         { &test3, "Run test client with several parameters. Testing parameter parsing."},
         { &test4, "Run test client with couple of simple params. Pipe to stdout."},
         { &test5, "Static process::query."},
+        { &test12, "Command cache: prewarm and invalidation."},
+        { &test13, "Argument vector and response file spill."},
+        { &test14, "Reactor runs processes concurrently."},
+        { &test16, "Full duplex stdin and stdout pump."},
+        { &test17, "Supervisor restarts, limits and stops services."},
+        { &test18, "Resource profile is applied in the child."},
+#if defined(__cpp_impl_coroutine)
+        { &test15, "Coroutines with the reactor."},
+#endif
         // { &test3, "Create [user].tmp file into current directory by running touch as VALUE user."},
         // { &test6, "Test the use of execa - running same process with varied arguments."},
         // { &test7, "Test the use of process user (linux only)"},
@@ -1,7 +1,11 @@
 /** Unit test / sample file for settings
  *  Compilation: makec4s --dev -deb -s settings.cpp
  */
+#include <fstream>
 #include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "../cpp4scripts.hpp"
 
 using namespace std;
@@ -111,7 +115,7 @@ bool test3(const std::string& arg)
     }
     try {
         configuration conf(configuration::FORMAT::JSON, json);
-        settings::section *ssn = conf.get_section("Section2");
+        settings::section *ssn = conf.get_section("Section 2");
 
         vector<string> skeys;
         ssn->get_subkeys("top.*", skeys);
@@ -130,7 +134,7 @@ bool test3(const std::string& arg)
             cout<<"array.[*] values not found\n";
             return false;
         }
-        cout<<"Values for Section2.array:\n";
+        cout<<"Values for Section 2.array:\n";
         for(auto val : values) {
             cout<<val<<'\n';
         }
@@ -142,11 +146,283 @@ bool test3(const std::string& arg)
     return true;
 }
 // ==========================================================================================
+bool test4(const std::string& arg)
+{
+    cout<<"Testing flat store lookups\n";
+    ifstream json(arg.empty() ? "settings.json" : arg.c_str());
+    if(!json) {
+        cout<<"Unable to open json file\n";
+        return false;
+    }
+    try {
+        configuration conf(configuration::FORMAT::JSON, json);
+        string_view sv;
+        uint64_t num = 0;
+        bool flag = false;
+        float flt = 0;
+        if(!conf.get_value("Section 1", "item1_str", sv) || sv != "name of item 1" ||
+           !conf.get_value("Section 1", "item2_int", num) || num != 100 ||
+           !conf.get_value("Section 1", "item3_bool", flag) || !flag ||
+           !conf.get_value("Section 1", "item4_float", flt) || flt < 110 ||
+           !conf.get_value("Section 2", "top.sub1", sv) || sv != "Hello" ||
+           conf.get_value("Section 1", "item2_int", sv) || conf.get_value("Section1.item1_str", "", sv)) {
+            cout<<"FAIL: unexpected lookup result\n";
+            return false;
+        }
+        // New section is visible after the index is rebuilt automatically.
+        settings::section *ss = conf.create_section("added");
+        ss->items["key"] = new settings::str_item("new value");
+        if(conf.get_string("added", "key").compare("new value")) {
+            cout<<"FAIL: added value not found\n";
+            return false;
+        }
+        const int COUNT = 1000000;
+        auto start = chrono::steady_clock::now();
+        size_t found = 0;
+        for(int ndx=0; ndx<COUNT; ndx++)
+            found += conf.get_value("Section 2", "top.sub1", sv) ? 1 : 0;
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout<<"OK: "<<(int)(secs*1e9/COUNT)<<" ns per lookup ("<<found<<" found)\n";
+    }
+    catch(const c4s_exception &ce) {
+        cout<<"failed: "<<ce.what()<<'\n';
+        return false;
+    }
+    return true;
+}
+// ==========================================================================================
+bool test5(const std::string&)
+{
+    cout<<"Testing nested JSON structures and syntax errors\n";
+    istringstream nested(R"({
+  "net": {
+    "hosts": [ { "name": "alpha", "ports": [ 80, 443 ] }, { "name": "beta\u00e4\n" } ],
+    "matrix": [ [ 1, 2 ], [ true, null, -1.5e2 ] ],
+    "empty": { }, "none": [ ]
+  }
+})");
+    try {
+        configuration conf(configuration::FORMAT::JSON, nested);
+        uint64_t num = 0;
+        bool flag = false;
+        float flt = 0;
+        if(conf.get_string("net", "hosts.[0].name").compare("alpha") ||
+           !conf.get_value("net", "hosts.[0].ports.[1]", num) || num != 443 ||
+           conf.get_string("net", "hosts.[1].name").compare("beta\xc3\xa4\n") ||
+           !conf.get_value("net", "matrix.[1].[0]", flag) || !flag ||
+           !conf.get_value("net", "matrix.[1].[2]", flt) || flt != -150 ||
+           conf.is("net", "matrix.[1].[1]")) {
+            cout<<"FAIL: nested values not found\n";
+            return false;
+        }
+    }
+    catch(const c4s_exception &ce) {
+        cout<<"failed: "<<ce.what()<<'\n';
+        return false;
+    }
+    const char* broken[] = {
+        "{\n  \"s\": {\n    \"a\": 1,\n    \"b\" 2\n  }\n}", "line 4 column 9",
+        "{ \"s\": { \"a\": \"open", "line 1 column 20",
+        "{ \"s\": { \"a\": tru } }", "line 1 column 15",
+        0, 0 };
+    for(int ndx=0; broken[ndx]; ndx+=2) {
+        istringstream bad(broken[ndx]);
+        configuration conf;
+        if(conf.read(configuration::FORMAT::JSON, bad) ||
+           conf.get_error().find(broken[ndx+1]) == string::npos) {
+            cout<<"FAIL: expected error at "<<broken[ndx+1]<<", got '"<<conf.get_error()<<"'\n";
+            return false;
+        }
+    }
+    cout<<"OK\n";
+    return true;
+}
+// ==========================================================================================
+static bool write_live(const char* name, const char* json)
+{
+    // Written aside and renamed into place like editors do.
+    string tmp = string(name) + ".tmp";
+    ofstream out(tmp);
+    out << json;
+    out.close();
+    return rename(tmp.c_str(), name) == 0;
+}
+static bool wait_generation(live_configuration &live, size_t gen)
+{
+    for(int ndx=0; ndx<300 && live.get_generation() < gen; ndx++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    return live.get_generation() >= gen;
+}
+bool test6(const std::string&)
+{
+    cout<<"Testing live configuration reload\n";
+    const char* name = "/tmp/c4s_live.json";
+    write_live(name, R"({ "app": { "port": 1000, "name": "first" } })");
+    try {
+        live_configuration live(path(name), configuration::FORMAT::JSON,
+            [](const configuration &conf, string &err) {
+                uint64_t port;
+                if(!conf.get_value("app", "port", port) || port == 0) {
+                    err = "app.port must be a positive number";
+                    return false;
+                }
+                return true;
+            });
+        atomic<bool> reading(true);
+        atomic<size_t> reads(0), torn(0);
+        thread reader([&]() {
+            while(reading.load()) {
+                live_configuration::snapshot conf = live.get();
+                uint64_t port = 0;
+                string pname;
+                conf->get_value("app", "port", port);
+                conf->get_value("app", "name", pname);
+                // Port and name are always updated together.
+                if((port == 1000) != (pname == "first"))
+                    torn++;
+                reads++;
+            }
+        });
+        bool ok = write_live(name, R"({ "app": { "port": 2000, "name": "second" } })") &&
+            wait_generation(live, 2);
+        uint64_t port = 0;
+        if(ok) {
+            live_configuration::snapshot conf = live.get();
+            ok = conf->get_value("app", "port", port) && port == 2000 &&
+                conf.get_generation() == 2;
+        }
+        // Syntax error and failed validation keep the previous version.
+        write_live(name, R"({ "app": { "port": 3000, } })");
+        this_thread::sleep_for(chrono::milliseconds(300));
+        if(ok)
+            ok = live.get_generation() == 2 && !live.get_error().empty();
+        write_live(name, R"({ "app": { "port": 0, "name": "zero" } })");
+        this_thread::sleep_for(chrono::milliseconds(300));
+        if(ok)
+            ok = live.get_generation() == 2 && live.get_error().find("positive") != string::npos;
+        for(int ndx=0; ok && ndx<20; ndx++) {
+            ostringstream json;
+            json << "{ \"app\": { \"port\": " << (ndx % 2 ? 1000 : 4000)
+                 << ", \"name\": \"" << (ndx % 2 ? "first" : "other") << "\" } }";
+            write_live(name, json.str().c_str());
+            ok = live.reload();
+        }
+        reading.store(false);
+        reader.join();
+        unlink(name);
+        if(!ok || torn.load()) {
+            cout<<"FAIL: generation "<<live.get_generation()<<", torn reads "<<torn.load()<<'\n';
+            return false;
+        }
+        cout<<"OK: "<<live.get_generation()<<" generations, "<<reads.load()<<" reads\n";
+    }
+    catch(const c4s_exception &ce) {
+        cout<<"failed: "<<ce.what()<<'\n';
+        return false;
+    }
+    return true;
+}
+// ==========================================================================================
+bool test7(const std::string&)
+{
+    cout<<"Testing compiled settings image\n";
+    const char* name = "/tmp/c4s_cache.json";
+    const char* image = "/tmp/c4s_cache.json.c4sc";
+    unlink(image);
+    ostringstream json;
+    json << "{\n";
+    for(int sec=0; sec<100; sec++) {
+        json << " \"Section " << sec << "\": {\n";
+        for(int key=0; key<500; key++)
+            json << "  \"key" << key << "\": { \"name\": \"value " << sec << '.' << key
+                 << "\", \"num\": " << key << ", \"on\": " << (key % 2 ? "true" : "false")
+                 << " },\n";
+        json << "  \"last\": 1.5 }" << (sec < 99 ? ",\n" : "\n");
+    }
+    json << "}\n";
+    write_live(name, json.str().c_str());
+    try {
+        auto start = chrono::steady_clock::now();
+        configuration parsed;
+        bool ok = parsed.read(configuration::FORMAT::JSON, path(name)) && !parsed.is_cached();
+        double parse_ms = chrono::duration<double>(chrono::steady_clock::now() - start).count()*1e3;
+        start = chrono::steady_clock::now();
+        configuration cached;
+        ok = ok && cached.read(configuration::FORMAT::JSON, path(name)) && cached.is_cached();
+        double cache_ms = chrono::duration<double>(chrono::steady_clock::now() - start).count()*1e3;
+        uint64_t num = 0;
+        bool flag = false;
+        float flt = 0;
+        if(ok)
+            ok = !cached.get_string("Section 42", "key17.name").compare("value 42.17") &&
+                cached.get_value("Section 42", "key17.num", num) && num == 17 &&
+                cached.get_value("Section 99", "key3.on", flag) && flag &&
+                cached.get_value("Section 0", "last", flt) && flt == 1.5f;
+        // Sections are created when asked for. Index stays in the image.
+        settings::section *ss = cached.get_section("Section 7");
+        if(ok)
+            ok = ss && ss->items.size() == 1501 && cached.is_cached();
+        // New modification time with the same content still uses the image.
+        write_live(name, json.str().c_str());
+        configuration touched;
+        if(ok)
+            ok = touched.read(configuration::FORMAT::JSON, path(name)) && touched.is_cached();
+        // Image now records the new time, so the next read does not hash the source again.
+        settings::flat_image head;
+        struct stat sb;
+        ifstream hf(image, ios::binary);
+        if(ok)
+            ok = hf.read((char*)&head, sizeof(head)) && !stat(name, &sb) &&
+                head.src_mtime == (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+        hf.close();
+        // Changed content is parsed again and the image is replaced.
+        write_live(name, R"({ "Section 42": { "key17": { "name": "changed" } } })");
+        configuration changed;
+        if(ok)
+            ok = changed.read(configuration::FORMAT::JSON, path(name)) && !changed.is_cached() &&
+                !changed.get_string("Section 42", "key17.name").compare("changed");
+        // Image with an unknown item type is ignored.
+        if(ok) {
+            fstream bf(image, ios::in | ios::out | ios::binary);
+            settings::flat_item fi;
+            bf.seekg(sizeof(settings::flat_image));
+            while(bf.read((char*)&fi, sizeof(fi)) && !fi.hash)
+                ;
+            fi.type = (settings::TYPE)77;
+            bf.seekp(-(streamoff)sizeof(fi), ios::cur);
+            ok = bf.write((char*)&fi, sizeof(fi)).good();
+        }
+        configuration badtype;
+        if(ok)
+            ok = badtype.read(configuration::FORMAT::JSON, path(name)) && !badtype.is_cached() &&
+                !badtype.get_string("Section 42", "key17.name").compare("changed");
+        // Damaged image is ignored.
+        if(ok)
+            ok = truncate(image, 100) == 0;
+        configuration damaged;
+        if(ok)
+            ok = damaged.read(configuration::FORMAT::JSON, path(name)) && !damaged.is_cached() &&
+                !damaged.get_string("Section 42", "key17.name").compare("changed");
+        unlink(name);
+        unlink(image);
+        if(!ok) {
+            cout<<"FAIL: image was not used as expected\n";
+            return false;
+        }
+        cout<<"OK: parse "<<parse_ms<<" ms, image "<<cache_ms<<" ms\n";
+    }
+    catch(const c4s_exception &ce) {
+        cout<<"failed: "<<ce.what()<<'\n';
+        return false;
+    }
+    return true;
+}
+// ==========================================================================================
 int main(int argc, char **argv)
 {
     string param;
-    const int tmax=3;
-    tfptr tfunc[] = { &test1, &test2, &test3, 0 };
+    const int tmax=7;
+    tfptr tfunc[] = { &test1, &test2, &test3, &test4, &test5, &test6, &test7, 0 };
 
     args += argument("-t",  true, "Sets VALUE as the test to run.");
     args += argument("-p",  true, "Send VALUE as parameter to test(s)");
@@ -9,6 +9,8 @@ Copyright (c) Menacon Ltd, Finland
 
 #include <sstream>
 #include <fstream>
+#include <chrono>
+#include <random>
 #include <unordered_map>
 
 #include "../cpp4scripts.hpp"
@@ -117,11 +119,219 @@ test5()
     }
     cout << "Parsing " << (rv ? "OK" : "Failed")  << '\n';
 }
+// -------------------------------------------------------------------------------------------------
+//! Counts the needles with search_bmh. Table is rebuilt on each call as in the original usage.
+size_t
+count_bmh(const string& corpus, const string& needle)
+{
+    size_t count = 0, pos = 0;
+    SIZE_T offset;
+    while (search_bmh((const unsigned char*)corpus.data() + pos, corpus.size() - pos,
+                      (const unsigned char*)needle.data(), needle.size(), &offset)) {
+        count++;
+        pos += offset + needle.size();
+    }
+    return count;
+}
+// -------------------------------------------------------------------------------------------------
+void
+test6()
+{
+    const size_t CORPUS_SIZE = 64 * 1024 * 1024;
+    const char* words[] = { "lorem ", "ipsum ", "dolor ", "sit ", "amet, ", "consectetur ",
+                            "adipiscing ", "elit\n", "sed ", "do ", "eiusmod ", "tempor " };
+    mt19937 rng(4);
+    string corpus;
+    corpus.reserve(CORPUS_SIZE + 32);
+    while (corpus.size() < CORPUS_SIZE)
+        corpus += words[rng() % (sizeof(words) / sizeof(char*))];
+
+    vector<string> needles = { "\n", "sit a", "tempor elit\nsed", "do do do do", "" };
+    if (args.is_set("-s"))
+        needles.back() = args.get_value("-s");
+    else {
+        needles.back() = "consectetur adipiscing elit\nsed do eiusmod tempor lorem ipsum dolor ";
+        needles.back() += needles.back();
+    }
+    cout << "Corpus size " << corpus.size() / (1024 * 1024) << " MB\n";
+    for (const string& nd : needles) {
+        auto start = chrono::steady_clock::now();
+        size_t bmh_count = count_bmh(corpus, nd);
+        auto bmh_time = chrono::steady_clock::now() - start;
+
+        searcher srch(nd);
+        vector<size_t> offsets;
+        start = chrono::steady_clock::now();
+        size_t srch_count = srch.find_all(corpus.data(), corpus.size(), offsets);
+        auto srch_time = chrono::steady_clock::now() - start;
+
+        double bmh_ms = chrono::duration<double, milli>(bmh_time).count();
+        double srch_ms = chrono::duration<double, milli>(srch_time).count();
+        cout << "needle " << nd.size() << " bytes, kernel " << srch.kernel_name() << ": "
+             << srch_count << " matches " << srch_ms << " ms; search_bmh " << bmh_ms << " ms";
+        if (srch_ms > 0)
+            cout << " (x" << bmh_ms / srch_ms << ")";
+        cout << (bmh_count == srch_count ? "\n" : " - COUNT MISMATCH\n");
+    }
+}
+// -------------------------------------------------------------------------------------------------
+void
+test7()
+{
+    struct
+    {
+        HASH_ALG alg;
+        const char* data;
+        const char* expect;
+    } vectors[] = {
+        { HASH_XXH64, "", "ef46db3751d8e999" },
+        { HASH_XXH64, "abc", "44bc2cf5ad770999" },
+        { HASH_SHA256, "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { HASH_SHA256, "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    };
+    bool ok = true;
+    for (const auto& vc : vectors) {
+        hasher* hs = hasher::create(vc.alg);
+        hs->update(vc.data, strlen(vc.data));
+        string hx = hs->hex();
+        delete hs;
+        cout << hasher::algorithm_name(vc.alg) << "(\"" << vc.data << "\") = " << hx;
+        if (hx != vc.expect) {
+            cout << " - expected " << vc.expect;
+            ok = false;
+        }
+        cout << '\n';
+    }
+    // Short inputs must depend on the salt so that chained calls are consistent.
+    uint64_t chained = fnv_hash64_str("cd", 2, fnv_hash64_str("ab", 2, FNV_1_PRIME));
+    if (chained != fnv_hash64_str("abcd", 4, FNV_1_PRIME)) {
+        cout << "Chained FNV hash differs from single call.\n";
+        ok = false;
+    }
+    if (args.is_set("-s")) {
+        path target(args.get_value("-s"));
+        for (int alg = HASH_FNV64; alg <= HASH_SHA256; alg++)
+            cout << hasher::algorithm_name((HASH_ALG)alg) << ": " << target.hash((HASH_ALG)alg)
+                 << '\n';
+    }
+    cout << (ok ? "OK\n" : "FAILED\n");
+}
+// -------------------------------------------------------------------------------------------------
+void
+test8()
+{
+    variables vars;
+    vars.push_back("ARCH", "x86_64");
+    vars.push_back("CFLAGS_x86_64", "-march=x86-64-v2 $(OPT)");
+    vars.push_back("OPT", "-O2");
+    vars.push_back("SELF", "a $(SELF)");
+    setenv("C4S_TEMPLATE_TEST", "from env", 1);
+    struct
+    {
+        const char* source;
+        const char* expect;
+        bool se;
+    } cases[] = {
+        { "plain text", "plain text", false },
+        { "$(ARCH)", "x86_64", false },
+        { "gcc $(CFLAGS_$(ARCH)) -c", "gcc -march=x86-64-v2 -O2 -c", false },
+        { "$(MISSING:-default value)", "default value", false },
+        { "$(MISSING:-$(ARCH)-gcc)", "x86_64-gcc", false },
+        { "$(OPT:-unused)", "-O2", false },
+        { "[$(C4S_TEMPLATE_TEST)]", "[from env]", true },
+        { "$ and ) stay", "$ and ) stay", false },
+    };
+    bool ok = true;
+    for (const auto& tc : cases) {
+        string result;
+        try {
+            result = compiled_template(tc.source).render(vars, tc.se);
+        } catch (const c4s_exception& ce) {
+            result = ce.what();
+        }
+        if (result != tc.expect || vars.expand(tc.source, tc.se) != result) {
+            cout << tc.source << " -> '" << result << "' expected '" << tc.expect << "'\n";
+            ok = false;
+        }
+    }
+    const char* errors[] = { "$(ARCH", "$()", "$(SELF)", "$(MISSING)", 0 };
+    for (int ndx = 0; errors[ndx]; ndx++) {
+        try {
+            vars.expand(errors[ndx]);
+            cout << errors[ndx] << " did not throw\n";
+            ok = false;
+        } catch (const c4s_exception& ce) {
+            cout << errors[ndx] << ": " << ce.what() << '\n';
+        }
+    }
+    // Compiled once, rendered repeatedly into the same buffer.
+    string options;
+    for (int ndx = 0; ndx < 200; ndx++)
+        options += "-I/usr/include/lib" + to_string(ndx) + " $(CFLAGS_$(ARCH)) ";
+    const int COUNT = 10000;
+    compiled_template tmpl(options);
+    string out;
+    auto start = chrono::steady_clock::now();
+    for (int ndx = 0; ndx < COUNT; ndx++)
+        tmpl.render(vars, out);
+    double tmpl_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    cout << "Template render " << tmpl_us / COUNT << " us for " << out.size() << " bytes\n";
+    cout << (ok ? "OK\n" : "FAILED\n");
+}
+// -------------------------------------------------------------------------------------------------
+void
+test9()
+{
+    const char* name = "/tmp/c4s_vars.txt";
+    string long_value;
+    for (int ndx = 0; ndx < 5000; ndx++)
+        long_value += "-I/opt/include/dir" + to_string(ndx) + ' ';
+    long_value.pop_back();
+    {
+        ofstream out(name, ios::binary);
+        out << "# generated flags\n\nCC = gcc\r\nFLAGS := " << long_value << "\n"
+            << "  INDENTED\t=  yes  \n= no name\nno equal sign\nEMPTY =\nLAST=1";
+    }
+    bool ok = true;
+    path vars_file(name);
+    try {
+        variables vars(vars_file);
+        ok = vars.expand("$(CC)") == "gcc" && vars.expand("$(FLAGS)") == long_value &&
+             vars.expand("$(INDENTED)") == "yes" && vars.expand("$(LAST)") == "1" &&
+             vars.expand("$(EMPTY:-unset)") == "unset";
+    } catch (const c4s_exception& ce) {
+        cout << "Include failed: " << ce.what() << '\n';
+        ok = false;
+    }
+    line_tokenizer lt(name);
+    string_view line;
+    size_t count = 0;
+    while (lt.next_line(line))
+        count++;
+    if (count != 7 || lt.get_line() != 9) {
+        cout << "Unexpected line count " << count << " / " << lt.get_line() << '\n';
+        ok = false;
+    }
+    // Large generated file.
+    {
+        ofstream out(name);
+        for (int ndx = 0; ndx < 100000; ndx++)
+            out << "VAR_" << ndx << " = /usr/lib/path/number/" << ndx << '\n';
+    }
+    auto start = chrono::steady_clock::now();
+    variables big(vars_file);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (big.expand("$(VAR_99999)") != "/usr/lib/path/number/99999")
+        ok = false;
+    cout << "Included 100000 variables in " << ms << " ms\n";
+    unlink(name);
+    cout << (ok ? "OK\n" : "FAILED\n");
+}
 // =================================================================================================
 int
 main(int argc, char** argv)
 {
-    tfptr tfunc[] = { &test1, &test2, &test3, &test4, &test5, 0 };
+    tfptr tfunc[] = { &test1, &test2, &test3, &test4, &test5, &test6, &test7, &test8, &test9, 0 };
 
     args += argument("-t", true, "Sets VALUE as the test to run.");
     args += argument("-s", true, "Sets the text to search for.");
@@ -137,6 +347,11 @@ main(int argc, char** argv)
         cout << " 2 = Tests various wild card matchings\n";
         cout << " 3 = Generate next file index.\n";
         cout << " 4 = BUILD flags.\n";
+        cout << " 5 = Parse key values.\n";
+        cout << " 6 = Benchmark searcher against search_bmh (-s for custom needle).\n";
+        cout << " 7 = Hash test vectors (-s to hash a file with all algorithms).\n";
+        cout << " 8 = Variable templates.\n";
+        cout << " 9 = Variable files with long lines.\n";
         return 1;
     }
     int tmax = 0;
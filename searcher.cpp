@@ -0,0 +1,255 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define C4S_SEARCH_X86 1
+#else
+#define C4S_SEARCH_X86 0
+#endif
+#include "searcher.hpp"
+
+using namespace std;
+using namespace c4s;
+
+//! Longest needle handled by the SIMD kernels. Longer needles benefit more from Horspool skips.
+const size_t SEARCH_SIMD_MAX = 64;
+
+// -------------------------------------------------------------------------------------------------
+//! Scalar search for the positions that SIMD kernels leave at the end of the haystack.
+static size_t
+search_tail(const unsigned char* hs,
+            size_t start,
+            size_t hlen,
+            const unsigned char* nd,
+            size_t nlen)
+{
+    if (hlen < nlen)
+        return searcher::npos;
+    size_t last = hlen - nlen;
+    while (start <= last) {
+        const unsigned char* fp =
+            (const unsigned char*)memchr(hs + start, nd[0], last - start + 1);
+        if (!fp)
+            return searcher::npos;
+        start = fp - hs;
+        if (!memcmp(fp + 1, nd + 1, nlen - 1))
+            return start;
+        start++;
+    }
+    return searcher::npos;
+}
+
+#if C4S_SEARCH_X86
+// -------------------------------------------------------------------------------------------------
+//! Compares the first and the last needle byte at 16 positions. Verifies candidates with memcmp.
+static size_t
+search_sse2(const unsigned char* hs, size_t hlen, const unsigned char* nd, size_t nlen)
+{
+    const __m128i first = _mm_set1_epi8((char)nd[0]);
+    const __m128i last = _mm_set1_epi8((char)nd[nlen - 1]);
+    size_t pos = 0;
+    if (hlen >= nlen + 15) {
+        size_t end = hlen - nlen - 15;
+        for (; pos <= end; pos += 16) {
+            __m128i bf = _mm_loadu_si128((const __m128i*)(hs + pos));
+            __m128i bl = _mm_loadu_si128((const __m128i*)(hs + pos + nlen - 1));
+            unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+            while (mask) {
+                unsigned int bit = __builtin_ctz(mask);
+                if (!memcmp(hs + pos + bit + 1, nd + 1, nlen - 2))
+                    return pos + bit;
+                mask &= mask - 1;
+            }
+        }
+    }
+    return search_tail(hs, pos, hlen, nd, nlen);
+}
+// -------------------------------------------------------------------------------------------------
+//! AVX2 version of the first and last byte filter. 32 positions per step.
+__attribute__((target("avx2"))) static size_t
+search_avx2(const unsigned char* hs, size_t hlen, const unsigned char* nd, size_t nlen)
+{
+    const __m256i first = _mm256_set1_epi8((char)nd[0]);
+    const __m256i last = _mm256_set1_epi8((char)nd[nlen - 1]);
+    size_t pos = 0;
+    if (hlen >= nlen + 31) {
+        size_t end = hlen - nlen - 31;
+        for (; pos <= end; pos += 32) {
+            __m256i bf = _mm256_loadu_si256((const __m256i*)(hs + pos));
+            __m256i bl = _mm256_loadu_si256((const __m256i*)(hs + pos + nlen - 1));
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+            while (mask) {
+                unsigned int bit = __builtin_ctz(mask);
+                if (!memcmp(hs + pos + bit + 1, nd + 1, nlen - 2))
+                    return pos + bit;
+                mask &= mask - 1;
+            }
+        }
+    }
+    return search_tail(hs, pos, hlen, nd, nlen);
+}
+#endif
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::searcher::has_avx2()
+{
+#if C4S_SEARCH_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param nd Pointer to needle.
+  \param len Length of the needle. Zero length needle never matches.
+*/
+void
+c4s::searcher::compile(const void* nd, size_t len)
+{
+    needle.assign((const char*)nd, len);
+    if (len == 0)
+        kernel = KRN_NONE;
+    else if (len == 1)
+        kernel = KRN_MEMCHR;
+#if C4S_SEARCH_X86
+    else if (len <= SEARCH_SIMD_MAX)
+        kernel = has_avx2() ? KRN_AVX2 : KRN_SSE2;
+#endif
+    else
+        kernel = KRN_HORSPOOL;
+
+    // Skip table is always built so that the kernel can be forced to Horspool.
+    for (int ndx = 0; ndx < 256; ndx++)
+        skip[ndx] = len;
+    const unsigned char* un = (const unsigned char*)needle.data();
+    for (size_t ndx = 0; len && ndx < len - 1; ndx++)
+        skip[un[ndx]] = len - 1 - ndx;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param krn Kernel to use.
+  \retval bool True if kernel was changed, false if it is not usable for this needle or CPU.
+*/
+bool
+c4s::searcher::set_kernel(KERNEL krn)
+{
+    if (needle.empty() || krn == KRN_NONE)
+        return false;
+    if (krn == KRN_MEMCHR && needle.size() != 1)
+        return false;
+    if (krn == KRN_SSE2 || krn == KRN_AVX2) {
+#if C4S_SEARCH_X86
+        if (needle.size() < 2 || (krn == KRN_AVX2 && !has_avx2()))
+            return false;
+#else
+        return false;
+#endif
+    }
+    kernel = krn;
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+const char*
+c4s::searcher::kernel_name() const
+{
+    switch (kernel) {
+    case KRN_MEMCHR:
+        return "memchr";
+    case KRN_SSE2:
+        return "sse2";
+    case KRN_AVX2:
+        return "avx2";
+    case KRN_HORSPOOL:
+        return "horspool";
+    default:
+        return "none";
+    }
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::searcher::find_horspool(const unsigned char* hs, size_t hlen) const
+{
+    const unsigned char* nd = (const unsigned char*)needle.data();
+    size_t nlen = needle.size();
+    size_t last = nlen - 1;
+    size_t pos = 0;
+    while (pos + nlen <= hlen) {
+        unsigned char lc = hs[pos + last];
+        if (lc == nd[last] && !memcmp(hs + pos, nd, last))
+            return pos;
+        pos += skip[lc];
+    }
+    return npos;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param haystack Data to search from.
+  \param hlen Length of the haystack.
+  \param from Offset where the search starts.
+  \retval size_t Offset of the match from the beginning of haystack or npos.
+*/
+size_t
+c4s::searcher::find(const void* haystack, size_t hlen, size_t from) const
+{
+    size_t nlen = needle.size();
+    if (kernel == KRN_NONE || from >= hlen || hlen - from < nlen)
+        return npos;
+    const unsigned char* hs = (const unsigned char*)haystack + from;
+    size_t len = hlen - from;
+    size_t pos;
+    switch (kernel) {
+    case KRN_MEMCHR: {
+        const void* fp = memchr(hs, needle[0], len);
+        pos = fp ? (const unsigned char*)fp - hs : npos;
+        break;
+    }
+#if C4S_SEARCH_X86
+    case KRN_SSE2:
+        pos = search_sse2(hs, len, (const unsigned char*)needle.data(), nlen);
+        break;
+    case KRN_AVX2:
+        pos = search_avx2(hs, len, (const unsigned char*)needle.data(), nlen);
+        break;
+#endif
+    default:
+        pos = find_horspool(hs, len);
+        break;
+    }
+    return pos == npos ? npos : pos + from;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param haystack Data to search from.
+  \param hlen Length of the haystack.
+  \param offsets Offsets of the matches are appended here.
+  \param overlap If true, matches may overlap. Otherwise search continues after each match.
+  \retval size_t Number of matches found.
+*/
+size_t
+c4s::searcher::find_all(const void* haystack,
+                        size_t hlen,
+                        vector<size_t>& offsets,
+                        bool overlap) const
+{
+    size_t count = 0;
+    size_t step = overlap ? 1 : needle.size();
+    size_t pos = find(haystack, hlen, 0);
+    while (pos != npos) {
+        offsets.push_back(pos);
+        count++;
+        pos = find(haystack, hlen, pos + step);
+    }
+    return count;
+}
@@ -0,0 +1,90 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_SEARCHER_HPP
+#define C4S_SEARCHER_HPP
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace c4s {
+
+// -----------------------------------------------------------------------------------------------------------
+//! Precompiled substring search.
+/*! Needle is analyzed once when the searcher is created and the fastest search kernel for the
+  needle length and the running CPU is selected:
+  - one byte needles use memchr.
+  - needles up to 64 bytes use a SIMD filter that compares the first and the last byte of the
+    needle at 16 (SSE2) or 32 (AVX2) haystack positions at a time. AVX2 is selected at run time
+    if the CPU supports it.
+  - longer needles use Boyer-Moore-Horspool with the skip table built at compile time.
+
+  Same searcher can be used from several threads at the same time.
+*/
+class searcher
+{
+  public:
+    //! Search kernels.
+    enum KERNEL
+    {
+        KRN_NONE,     //!< Needle not set.
+        KRN_MEMCHR,   //!< Single byte search.
+        KRN_SSE2,     //!< First + last byte filter, 16 positions per step.
+        KRN_AVX2,     //!< First + last byte filter, 32 positions per step.
+        KRN_HORSPOOL  //!< Boyer-Moore-Horspool.
+    };
+    //! Returned by find when there is no match.
+    static const size_t npos = (size_t)-1;
+
+    //! Creates an empty searcher. Use compile() to set the needle.
+    searcher()
+      : kernel(KRN_NONE)
+    {}
+    //! Creates a searcher for given needle.
+    searcher(const std::string& n) { compile(n.data(), n.size()); }
+    //! Creates a searcher for given needle.
+    searcher(const void* n, size_t len) { compile(n, len); }
+
+    //! Sets the needle and selects the kernel.
+    void compile(const void* needle, size_t len);
+    //! Forces the kernel. Used for testing and benchmarking. Unsupported kernels are ignored.
+    bool set_kernel(KERNEL krn);
+    //! Returns the selected kernel.
+    KERNEL get_kernel() const { return kernel; }
+    //! Returns the name of the selected kernel.
+    const char* kernel_name() const;
+    //! Returns the needle length.
+    size_t size() const { return needle.size(); }
+
+    //! Returns offset of the first match at or after 'from', or npos if there is none.
+    size_t find(const void* haystack, size_t hlen, size_t from = 0) const;
+    //! Finds the needle from the string.
+    size_t find(const std::string& haystack, size_t from = 0) const
+    {
+        return find(haystack.data(), haystack.size(), from);
+    }
+    //! Finds all matches from the haystack. Returns the number of matches.
+    size_t find_all(const void* haystack,
+                    size_t hlen,
+                    std::vector<size_t>& offsets,
+                    bool overlap = false) const;
+
+    //! Returns true if AVX2 kernel is available on this CPU.
+    static bool has_avx2();
+
+  protected:
+    size_t find_horspool(const unsigned char* hs, size_t hlen) const;
+
+    std::string needle;
+    KERNEL kernel;
+    size_t skip[256]; //!< Horspool bad character shifts.
+};
+
+} // namespace c4s
+#endif
@@ -7,8 +7,29 @@
  * any kind
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(__linux) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <fstream>
 #include "config.hpp"
 #include "exception.hpp"
+#include "hash.hpp"
+#include "line_tokenizer.hpp"
+#if defined(__linux) || defined(__APPLE__)
+#include "user.hpp"
+#include "atomic_writer.hpp"
+#endif
+#include "path.hpp"
 #include "logger.hpp"
 #include "settings.hpp"
 
@@ -103,185 +124,482 @@ section::get_values(const std::string& name, std::vector<std::string>& values)
     } while (si != items.end());
 }
 // -------------------------------------------------------------------------------------------------
+//! Reads 'name = value' lines. Lines without '=' and comment lines starting with '#' are ignored.
 bool
-section::read_flat(std::istream& input)
+section::read_flat(line_tokenizer& input)
 {
-    char line[256];
-    do {
-        input.getline(line, sizeof(line));
-        char* es = strchr(line, '=');
-        if (es) {
-            *es = 0;
-            // Trim name
-            char* end = es - 1;
-            while (*end == ' ' || *end == '\t') {
-                *end = 0;
-                end--;
-            }
-            // Trim value
-            es++;
-            while (*es == ' ' || *es == '\t') {
-                es++;
-            }
-            items[string(line)] = new str_item(es);
-        }
-    } while (!input.eof());
+    string_view key, value;
+    while (input.next_pair(key, value)) {
+        string name(key);
+        auto it = items.find(name);
+        if (it != items.end())
+            delete it->second;
+        items[name] = new str_item(string(value));
+    }
     return true;
 }
 // -------------------------------------------------------------------------------------------------
-bool
-section::read_json(std::istream& input, json_parse_data& pd)
+//! Reads the rest of the stream into the buffer.
+static void
+json_slurp(std::istream& input, std::string& buffer)
 {
-    enum
-    {
-        START,
-        KEY,
-        VALUE,
-        VSTR,
-        VNUM,
-        KEYWORD,
-        END
-    } state;
-    enum
+    char chunk[0x10000];
+    while (input.read(chunk, sizeof(chunk)) || input.gcount())
+        buffer.append(chunk, input.gcount());
+}
+// -------------------------------------------------------------------------------------------------
+/** Finds the end of the plain run of characters in a string value. With SSE2 sixteen bytes are
+  checked at a time. Strings in settings are usually longer than the structure around them, so
+  this is where the parser spends most of its time.
+  \param ptr First character after the opening quote or after an escape sequence.
+  \retval const char* Next quote, backslash or control character, or end.
+*/
+static const char*
+json_scan_string(const char* ptr, const char* end)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    while (end - ptr >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)ptr);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, bslash));
+        // Unsigned byte <= 0x1f when the minimum with 0x1f equals the byte itself.
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(chunk, ctrl), chunk));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+        ptr += 16;
+    }
+#endif
+    while (ptr < end && *ptr != '"' && *ptr != '\\' && (unsigned char)*ptr >= 0x20)
+        ptr++;
+    return ptr;
+}
+// -------------------------------------------------------------------------------------------------
+//! Single pass JSON parser over a memory buffer.
+/*! Values are flattened into section items: object member names are joined with '.' and array
+  elements are named 'name.[n]'. Null values are skipped. The parser never moves backwards, so the
+  line and column of an error are counted only when one is found.*/
+class json_reader
+{
+  public:
+    json_reader(const char* data, size_t len)
+      : begin(data)
+      , ptr(data)
+      , end(data + len)
+      , depth(0)
+    {}
+    bool parse_config(std::list<section*>& sections);
+    bool parse_section(section* ss);
+
+    std::string error;
+
+  protected:
+    bool parse_value(section* ss, std::string& key);
+    bool parse_object(section* ss, std::string& key);
+    bool parse_array(section* ss, std::string& key);
+    bool parse_string(std::string& out);
+    bool parse_number(section* ss, const std::string& key);
+    bool parse_keyword(section* ss, const std::string& key);
+    void set_item(section* ss, const std::string& key, item* im);
+    bool fail(const char* msg);
+    void skip_ws()
     {
-        LONG,
-        FLOAT
-    } numtype;
-    char ch;
-    string original_read_key(pd.read_key);
-    string value;
+        while (ptr < end && (*ptr == ' ' || *ptr == '\n' || *ptr == '\t' || *ptr == '\r'))
+            ptr++;
+    }
 
-    state = pd.is_array() ? VALUE : START;
-    while (!input.eof()) {
-        input.read(&ch, 1);
-        switch (state) {
-        case START:
-            if (ch == '"')
-                state = KEY;
-            else if (ch == '}') {
-                CS_VAPRT_ERRO("section::read_json - expected key at %ld", pd.pos);
+    static const int MAX_DEPTH = 256;
+    const char* begin;
+    const char* ptr;
+    const char* end;
+    int depth;
+};
+// -------------------------------------------------------------------------------------------------
+//! Records the error with its position. Always returns false.
+bool
+json_reader::fail(const char* msg)
+{
+    if (!error.empty())
+        return false;
+    int line = 1;
+    const char* bol = begin;
+    for (const char* nl = begin; nl < ptr; nl++) {
+        if (*nl == '\n') {
+            line++;
+            bol = nl + 1;
+        }
+    }
+    ostringstream os;
+    os << "line " << line << " column " << (ptr - bol + 1) << ": " << msg;
+    error = os.str();
+    return false;
+}
+// -------------------------------------------------------------------------------------------------
+void
+json_reader::set_item(section* ss, const std::string& key, item* im)
+{
+    auto it = ss->items.find(key);
+    if (it == ss->items.end()) {
+        ss->items.emplace(key, im);
+    } else {
+        delete it->second;
+        it->second = im;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/** Top level members with object values become sections. Other top level values are checked for
+  syntax but otherwise ignored.
+  \param sections List that receives the new sections. Caller owns them also on failure.
+*/
+bool
+json_reader::parse_config(std::list<section*>& sections)
+{
+    string key;
+    if (end - ptr >= 3 && !memcmp(ptr, "\xEF\xBB\xBF", 3))
+        ptr += 3;
+    skip_ws();
+    if (ptr == end || *ptr != '{')
+        return fail("expected '{' at the start of the configuration");
+    ptr++;
+    skip_ws();
+    if (ptr < end && *ptr == '}') {
+        ptr++;
+    } else {
+        for (;;) {
+            skip_ws();
+            if (ptr == end || *ptr != '"')
+                return fail("expected section name");
+            string sname;
+            if (!parse_string(sname))
                 return false;
-            }
-            break;
-        case KEY:
-            if (ch == '"') {
-                state = VALUE;
-                value.clear();
-            } else
-                pd.read_key += ch;
-            break;
-        case VALUE:
-            if (ch == '"')
-                state = VSTR;
-            else if ((ch >= '0' && ch <= '9') || ch == '-') {
-                numtype = LONG;
-                state = VNUM;
-                input.seekg(-1, ios_base::cur);
-            } else if (ch == 'n' || ch == 't' || ch == 'f') {
-                if (pd.is_array()) {
-                    CS_PRINT_ERRO("section::read_json - arrays of true/false, null not supported.");
+            skip_ws();
+            if (ptr == end || *ptr != ':')
+                return fail("expected ':' after section name");
+            ptr++;
+            skip_ws();
+            if (ptr < end && *ptr == '{') {
+                section* ss = new section(sname);
+                sections.push_back(ss);
+                if (!parse_object(ss, key))
                     return false;
-                }
-                state = KEYWORD;
-                input.seekg(-1, ios_base::cur);
-            } else if (ch == '[') {
-                if (pd.is_array()) {
-                    CS_PRINT_ERRO("section::read_json - nested arrays not supported.");
-                    return false;
-                }
-                pd.array_item = 0;
-                pd.level_up();
-                if (!read_json(input, pd))
-                    return false;
-                state = END;
-            } else if (ch == '{') {
-                if (pd.is_array()) {
-                    CS_PRINT_ERRO("section::read_json - objects within array not supported.");
+            } else {
+                section ignored;
+                if (!parse_value(&ignored, key))
                     return false;
-                }
-                pd.level_up();
-                if (!read_json(input, pd))
-                    return false;
-                state = END;
-            } else if (ch == '}') {
-                CS_VAPRT_ERRO("section::read_json - expected value for key %s",
-                              pd.read_key.c_str());
-                return false;
             }
+            skip_ws();
+            if (ptr < end && *ptr == ',') {
+                ptr++;
+                continue;
+            }
+            if (ptr < end && *ptr == '}') {
+                ptr++;
+                break;
+            }
+            return fail("expected ',' or '}' after section");
+        }
+    }
+    skip_ws();
+    if (ptr != end)
+        return fail("unexpected data after the configuration");
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+//! Reads one object into the given section.
+bool
+json_reader::parse_section(section* ss)
+{
+    string key;
+    skip_ws();
+    if (ptr == end || *ptr != '{')
+        return fail("expected '{' at the start of the section");
+    return parse_object(ss, key);
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param key Name of the value. Nested names are appended during the call and removed before it
+  returns, so one string serves the whole parse.
+*/
+bool
+json_reader::parse_value(section* ss, std::string& key)
+{
+    skip_ws();
+    if (ptr == end)
+        return fail("unexpected end of input");
+    switch (*ptr) {
+    case '{':
+        return parse_object(ss, key);
+    case '[':
+        return parse_array(ss, key);
+    case '"': {
+        string value;
+        if (!parse_string(value))
+            return false;
+        set_item(ss, key, new str_item(value));
+        return true;
+    }
+    case 't':
+    case 'f':
+    case 'n':
+        return parse_keyword(ss, key);
+    default:
+        if (*ptr == '-' || (*ptr >= '0' && *ptr <= '9'))
+            return parse_number(ss, key);
+    }
+    return fail("unexpected character, expected a value");
+}
+// -------------------------------------------------------------------------------------------------
+bool
+json_reader::parse_object(section* ss, std::string& key)
+{
+    if (++depth > MAX_DEPTH)
+        return fail("nesting too deep");
+    ptr++;
+    skip_ws();
+    if (ptr < end && *ptr == '}') {
+        ptr++;
+        depth--;
+        return true;
+    }
+    size_t base = key.size();
+    for (;;) {
+        skip_ws();
+        if (ptr == end || *ptr != '"')
+            return fail("expected member name");
+        if (base)
+            key += '.';
+        if (!parse_string(key))
+            return false;
+        skip_ws();
+        if (ptr == end || *ptr != ':')
+            return fail("expected ':' after member name");
+        ptr++;
+        if (!parse_value(ss, key))
+            return false;
+        key.resize(base);
+        skip_ws();
+        if (ptr < end && *ptr == ',') {
+            ptr++;
+            continue;
+        }
+        if (ptr < end && *ptr == '}') {
+            ptr++;
             break;
-        case VSTR:
-            if (ch == '"') {
-                items[pd.get_key()] = new str_item(value);
-                state = END;
-            } else
-                value += ch;
+        }
+        return fail("expected ',' or '}' after member value");
+    }
+    depth--;
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+bool
+json_reader::parse_array(section* ss, std::string& key)
+{
+    if (++depth > MAX_DEPTH)
+        return fail("nesting too deep");
+    ptr++;
+    skip_ws();
+    if (ptr < end && *ptr == ']') {
+        ptr++;
+        depth--;
+        return true;
+    }
+    size_t base = key.size();
+    for (size_t ndx = 0;; ndx++) {
+        key += ".[";
+        key += to_string(ndx);
+        key += ']';
+        if (!parse_value(ss, key))
+            return false;
+        key.resize(base);
+        skip_ws();
+        if (ptr < end && *ptr == ',') {
+            ptr++;
+            continue;
+        }
+        if (ptr < end && *ptr == ']') {
+            ptr++;
             break;
-        case VNUM:
-            if (ch == ',' || ch == '}' || ch == '\t' || ch == ' ' || ch == '\n' || ch == ']') {
-                try {
-                    if (numtype == LONG) {
-                        items[pd.get_key()] = new integer_item(stoul(value));
-                    } else
-                        items[pd.get_key()] = new float_item(stof(value));
-                    if (ch == ']') {
-                        pd.level_down();
-                        pd.array_item = -1;
-                        return true;
-                    }
-                    if (ch == ',' || ch == '}')
-                        input.seekg(-1, ios_base::cur);
-                    state = END;
-                } catch (const std::invalid_argument& ia) {
-                    CS_VAPRT_ERRO("section::read_json - number format failed for: '%s'",
-                                  value.c_str());
-                    return false;
-                } catch (const std::out_of_range& oor) {
-                    CS_VAPRT_ERRO("section::read_json - number out of range: '%s'", value.c_str());
-                    return false;
-                }
-            } else if (ch == '.') {
-                numtype = FLOAT;
-                value += ch;
-            } else
-                value += ch;
+        }
+        return fail("expected ',' or ']' after array value");
+    }
+    depth--;
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+/** Appends the decoded string to out. Escapes, including \\u surrogate pairs, are converted to
+  UTF-8.
+*/
+bool
+json_reader::parse_string(std::string& out)
+{
+    ptr++;
+    for (;;) {
+        const char* stop = json_scan_string(ptr, end);
+        out.append(ptr, stop - ptr);
+        ptr = stop;
+        if (ptr == end)
+            return fail("unterminated string");
+        if (*ptr == '"') {
+            ptr++;
+            return true;
+        }
+        if (*ptr != '\\')
+            return fail("control character in string");
+        if (++ptr == end)
+            return fail("unterminated string");
+        switch (*ptr++) {
+        case '"':
+            out += '"';
             break;
-        case KEYWORD:
-            if (ch == ',' || ch == '}') {
-                if (!value.compare("true"))
-                    items[pd.read_key] = new bool_item(true);
-                else if (!value.compare("false"))
-                    items[pd.read_key] = new bool_item(false);
-                else if (value.compare("null")) {
-                    CS_VAPRT_ERRO("section::read - unknown json keyword: %s", value.c_str());
-                    return false;
-                }
-                input.seekg(-1, ios_base::cur);
-                state = END;
-            } else if (ch != '\t' && ch != ' ' && ch != '\n')
-                value += ch;
+        case '\\':
+            out += '\\';
+            break;
+        case '/':
+            out += '/';
+            break;
+        case 'b':
+            out += '\b';
             break;
-        case END:
-            if (ch == ',') {
-                if (pd.is_array()) {
-                    state = VALUE;
-                    value.clear();
+        case 'f':
+            out += '\f';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'r':
+            out += '\r';
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'u': {
+            uint32_t cp = 0;
+            for (int round = 0; round < 2; round++) {
+                uint32_t unit = 0;
+                for (int ndx = 0; ndx < 4; ndx++, ptr++) {
+                    if (ptr == end || !isxdigit((unsigned char)*ptr))
+                        return fail("invalid \\u escape");
+                    unit = unit * 16 + (*ptr <= '9' ? *ptr - '0' : (*ptr | 0x20) - 'a' + 10);
+                }
+                if (round == 0) {
+                    cp = unit;
+                    if (unit < 0xD800 || unit > 0xDBFF)
+                        break;
+                    if (end - ptr < 2 || ptr[0] != '\\' || ptr[1] != 'u')
+                        return fail("missing low surrogate after \\u escape");
+                    ptr += 2;
                 } else {
-                    state = START;
-                    pd.read_key = original_read_key;
+                    if (unit < 0xDC00 || unit > 0xDFFF)
+                        return fail("invalid low surrogate in \\u escape");
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (unit - 0xDC00);
                 }
-            } else if (ch == '}') {
-                pd.level_down();
-                pd.read_key = original_read_key;
-                return true;
-            } else if (ch == ']') {
-                pd.level_down();
-                pd.array_item = -1;
-                return true;
+            }
+            if (cp < 0x80) {
+                out += (char)cp;
+            } else if (cp < 0x800) {
+                out += (char)(0xC0 | (cp >> 6));
+                out += (char)(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                out += (char)(0xE0 | (cp >> 12));
+                out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                out += (char)(0x80 | (cp & 0x3F));
+            } else {
+                out += (char)(0xF0 | (cp >> 18));
+                out += (char)(0x80 | ((cp >> 12) & 0x3F));
+                out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                out += (char)(0x80 | (cp & 0x3F));
             }
             break;
         }
-        pd.pos++;
+        default:
+            ptr--;
+            return fail("invalid escape in string");
+        }
     }
+}
+// -------------------------------------------------------------------------------------------------
+/** Numbers without fraction or exponent are stored as integer_item. Negative integers are stored
+  in two's complement as before.
+*/
+bool
+json_reader::parse_number(section* ss, const std::string& key)
+{
+    const char* start = ptr;
+    bool is_float = false;
+    if (*ptr == '-')
+        ptr++;
+    if (ptr == end || *ptr < '0' || *ptr > '9')
+        return fail("invalid number");
+    while (ptr < end && *ptr >= '0' && *ptr <= '9')
+        ptr++;
+    if (ptr < end && *ptr == '.') {
+        is_float = true;
+        ptr++;
+        if (ptr == end || *ptr < '0' || *ptr > '9')
+            return fail("expected digits after decimal point");
+        while (ptr < end && *ptr >= '0' && *ptr <= '9')
+            ptr++;
+    }
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+        is_float = true;
+        ptr++;
+        if (ptr < end && (*ptr == '+' || *ptr == '-'))
+            ptr++;
+        if (ptr == end || *ptr < '0' || *ptr > '9')
+            return fail("expected digits in exponent");
+        while (ptr < end && *ptr >= '0' && *ptr <= '9')
+            ptr++;
+    }
+    char num[64];
+    size_t len = ptr - start;
+    if (len >= sizeof(num)) {
+        ptr = start;
+        return fail("number is too long");
+    }
+    memcpy(num, start, len);
+    num[len] = 0;
+    errno = 0;
+    char* num_end;
+    if (is_float) {
+        float val = strtof(num, &num_end);
+        if (errno == ERANGE && (val > 1 || val < -1)) {
+            ptr = start;
+            return fail("number out of range");
+        }
+        set_item(ss, key, new float_item(val));
+        return true;
+    }
+    uint64_t val;
+    if (*num == '-') {
+        long long sval = strtoll(num, &num_end, 10);
+        val = (uint64_t)sval;
+    } else
+        val = strtoull(num, &num_end, 10);
+    if (errno == ERANGE) {
+        ptr = start;
+        return fail("number out of range");
+    }
+    set_item(ss, key, new integer_item(val));
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+bool
+json_reader::parse_keyword(section* ss, const std::string& key)
+{
+    size_t left = end - ptr;
+    if (left >= 4 && !memcmp(ptr, "true", 4)) {
+        ptr += 4;
+        set_item(ss, key, new bool_item(true));
+    } else if (left >= 5 && !memcmp(ptr, "false", 5)) {
+        ptr += 5;
+        set_item(ss, key, new bool_item(false));
+    } else if (left >= 4 && !memcmp(ptr, "null", 4)) {
+        ptr += 4;
+    } else
+        return fail("unknown keyword");
     return true;
 }
 // -------------------------------------------------------------------------------------------------
@@ -289,27 +607,198 @@ bool
 section::read(configuration::FORMAT format, std::istream& input)
 {
     if (format == configuration::FORMAT::FLAT) {
-        return read_flat(input);
+        line_tokenizer lt(input);
+        return read_flat(lt);
     } else if (format == configuration::FORMAT::JSON) {
-        json_parse_data pd;
-        return read_json(input, pd);
+        string buffer;
+        json_slurp(input, buffer);
+        json_reader jr(buffer.data(), buffer.size());
+        if (!jr.parse_section(this)) {
+            CS_VAPRT_ERRO("section::read - %s", jr.error.c_str());
+            return false;
+        }
+        return true;
     }
     CS_PRINT_ERRO("section::read - unsupported format");
     return false;
 }
 
+// -------------------------------------------------------------------------------------------------
+//! Hash of 'section.name' without building the key. Never returns zero.
+uint64_t
+flat_store::hash(std::string_view section, std::string_view name)
+{
+    fnv64_hasher fh;
+    fh.update(section.data(), section.size());
+    fh.update(".", 1);
+    fh.update(name.data(), name.size());
+    uint64_t val = fh.value();
+    return val ? val : 1;
+}
+// -------------------------------------------------------------------------------------------------
+flat_store::flat_store()
+  : slots(0)
+  , strings(0)
+  , strings_len(0)
+  , mask(0)
+  , count(0)
+  , image(0)
+  , image_len(0)
+{}
+// -------------------------------------------------------------------------------------------------
+uint32_t
+flat_store::add_string(const std::string& str)
+{
+    uint32_t off = (uint32_t)arena.size();
+    arena += str;
+    strings = arena.data();
+    strings_len = arena.size();
+    return off;
+}
+// -------------------------------------------------------------------------------------------------
+void
+flat_store::clear()
+{
+#if defined(__linux) || defined(__APPLE__)
+    if (image)
+        munmap(image, image_len);
+#endif
+    image = 0;
+    image_len = 0;
+    table.clear();
+    arena.clear();
+    slots = 0;
+    strings = 0;
+    strings_len = 0;
+    mask = 0;
+    count = 0;
+}
+// -------------------------------------------------------------------------------------------------
+/** Checks that the table and the arena fit into the image and that every entry has a known type
+  and points inside the arena, so that a truncated or damaged file cannot cause reads outside of
+  the mapping.
+  \param mem Image mapped with mmap. Store takes ownership only if true is returned.
+  \param len Size of the mapping.
+*/
+bool
+flat_store::attach(void* mem, size_t len)
+{
+    const flat_image* head = (const flat_image*)mem;
+    if (len < sizeof(flat_image) || head->slots < 8 || (head->slots & (head->slots - 1)) ||
+        head->slots > (len - sizeof(flat_image)) / sizeof(flat_item) ||
+        head->strings_len != len - sizeof(flat_image) - head->slots * sizeof(flat_item))
+        return false;
+    const flat_item* tbl = (const flat_item*)((const char*)mem + sizeof(flat_image));
+    size_t used = 0;
+    for (size_t ndx = 0; ndx < head->slots; ndx++) {
+        const flat_item& fi = tbl[ndx];
+        if (!fi.hash)
+            continue;
+        used++;
+        if (fi.type != TYPE::STR && fi.type != TYPE::LONG && fi.type != TYPE::FLOAT &&
+            fi.type != TYPE::BOOL)
+            return false;
+        if ((uint64_t)fi.key + fi.sec_len + fi.name_len > head->strings_len ||
+            (fi.type == TYPE::STR && (uint64_t)fi.val.str.off + fi.val.str.len > head->strings_len))
+            return false;
+    }
+    if (used != head->count || used * 2 > head->slots)
+        return false;
+    clear();
+    image = mem;
+    image_len = len;
+    slots = tbl;
+    strings = (const char*)(tbl + head->slots);
+    strings_len = head->strings_len;
+    mask = head->slots - 1;
+    count = used;
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param sections Sections to copy. Sections are searched in list order, so the first section with
+  a given name wins like in configuration::get_section.
+*/
+void
+flat_store::build(const std::list<section*>& sections)
+{
+    clear();
+    size_t total = 0;
+    for (section* ss : sections)
+        total += ss->items.size();
+    size_t capacity = 8;
+    while (capacity < total * 2)
+        capacity <<= 1;
+    table.assign(capacity, flat_item());
+    slots = table.data();
+    mask = capacity - 1;
+    for (section* ss : sections) {
+        for (auto& si : ss->items) {
+            uint64_t hv = hash(ss->name, si.first);
+            if (find(ss->name, si.first))
+                continue;
+            size_t ndx = hv & mask;
+            while (table[ndx].hash)
+                ndx = (ndx + 1) & mask;
+            flat_item& fi = table[ndx];
+            fi.hash = hv;
+            fi.key = add_string(ss->name);
+            add_string(si.first);
+            fi.sec_len = (uint32_t)ss->name.size();
+            fi.name_len = (uint32_t)si.first.size();
+            fi.type = si.second->get_type();
+            switch (fi.type) {
+            case TYPE::STR: {
+                const string& str = static_cast<str_item*>(si.second)->value;
+                fi.val.str.off = add_string(str);
+                fi.val.str.len = (uint32_t)str.size();
+                break;
+            }
+            case TYPE::LONG:
+                fi.val.num = static_cast<integer_item*>(si.second)->value;
+                break;
+            case TYPE::FLOAT:
+                fi.val.flt = static_cast<float_item*>(si.second)->value;
+                break;
+            case TYPE::BOOL:
+                fi.val.flag = static_cast<bool_item*>(si.second)->value;
+                break;
+            }
+            count++;
+        }
+    }
+}
+// -------------------------------------------------------------------------------------------------
+const flat_item*
+flat_store::find(std::string_view section, std::string_view name) const
+{
+    if (!slots)
+        return 0;
+    uint64_t hv = hash(section, name);
+    for (size_t ndx = hv & mask; slots[ndx].hash; ndx = (ndx + 1) & mask) {
+        const flat_item& fi = slots[ndx];
+        if (fi.hash == hv && fi.sec_len == section.size() && fi.name_len == name.size() &&
+            !section.compare(0, fi.sec_len, strings + fi.key, fi.sec_len) &&
+            !name.compare(0, fi.name_len, strings + fi.key + fi.sec_len, fi.name_len))
+            return &fi;
+    }
+    return 0;
+}
+
 }; // c4s::settings namespace
 
 // =================================================================================================
 configuration::configuration()
+  : indexed(false)
 {
     // Intentionally empty
 }
 
 configuration::configuration(configuration::FORMAT format, std::istream& input)
+  : indexed(false)
 {
     if (!read(format, input))
-        throw c4s_exception("configuration::configuration - syntax or read failure.");
+        throw c4s_exception("configuration::configuration - syntax or read failure: " + error);
 }
 configuration::~configuration()
 {
@@ -321,142 +810,315 @@ configuration::~configuration()
 bool
 configuration::read(configuration::FORMAT format, std::istream& input)
 {
-    settings::section* ss;
-
+    unpack();
+    error.clear();
     if (format == configuration::FORMAT::FLAT) {
-        ss = new settings::section("general");
-        if (!ss->read(format, input))
+        settings::section* ss = new settings::section("general");
+        if (!ss->read(format, input)) {
+            delete ss;
+            error = "unable to read flat configuration";
             return false;
+        }
+        sections.push_back(ss);
+        reindex();
+        return true;
+    }
+    string buffer;
+    settings::json_slurp(input, buffer);
+    return parse(format, buffer.data(), buffer.size());
+}
+// -------------------------------------------------------------------------------------------------
+//! Parses the source that has been read into memory. Configuration is left unchanged on failure.
+bool
+configuration::parse(configuration::FORMAT format, const char* data, size_t len)
+{
+    if (format == configuration::FORMAT::FLAT) {
+        line_tokenizer lt(data, len);
+        settings::section* ss = new settings::section("general");
+        ss->read_flat(lt);
         sections.push_back(ss);
     } else if (format == configuration::FORMAT::JSON) {
-        enum
-        {
-            START,
-            L0,
-            SNAME,
-            L1
-        } state = START;
-        char ch;
-        string sname;
-        while (!input.eof()) {
-            input >> ch;
-            switch (state) {
-            case START:
-                if (ch == '{')
-                    state = L0;
-                break;
-            case L0:
-                if (ch == '"') {
-                    sname.clear();
-                    state = SNAME;
+        list<settings::section*> parsed;
+        settings::json_reader jr(data, len);
+        if (!jr.parse_config(parsed)) {
+            for (settings::section* ps : parsed)
+                delete ps;
+            error = jr.error;
+            CS_VAPRT_ERRO("configuration::read - %s", error.c_str());
+            return false;
+        }
+        sections.splice(sections.end(), parsed);
+    } else {
+        error = "unknown format";
+        CS_PRINT_ERRO("configuration::read - Unknown format.");
+        return false;
+    }
+    reindex();
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+#if defined(__linux) || defined(__APPLE__)
+static int64_t
+settings_mtime(const struct stat& sb)
+{
+#if defined(__APPLE__)
+    return (int64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec;
+#else
+    return (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+#endif
+}
+#endif
+// -------------------------------------------------------------------------------------------------
+/** Image can only be used when the configuration is empty. When there already are values, the
+  file is parsed and merged like with the stream version.
+  \param format Format of the source. Image records it, so a file read in both formats gets the
+  right values.
+  \param source Path to the configuration file.
+  \param cache If true, image is used and updated. If false, file is always parsed.
+*/
+bool
+configuration::read(configuration::FORMAT format, const path& source, bool cache)
+{
+    unpack();
+    error.clear();
+    string name = source.get_path();
+    string content;
+    bool have_content = false;
+#if defined(__linux) || defined(__APPLE__)
+    struct stat sb;
+    if (stat(name.c_str(), &sb)) {
+        error = "unable to open " + name + ": " + strerror(errno);
+        return false;
+    }
+    string image_name = name + ".c4sc";
+    if (cache && sections.empty() && !index.size()) {
+        int fd = open(image_name.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat ib;
+        if (fd >= 0 && !fstat(fd, &ib) && (size_t)ib.st_size >= sizeof(settings::flat_image)) {
+            void* mem = mmap(0, ib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mem != MAP_FAILED) {
+                const settings::flat_image* head = (const settings::flat_image*)mem;
+                bool valid = !memcmp(head->magic, "C4SCONF1", 8) &&
+                             head->item_size == sizeof(settings::flat_item) &&
+                             head->byte_order == 0x01020304 && head->format == (uint64_t)format &&
+                             head->src_size == (uint64_t)sb.st_size;
+                bool touched = valid && head->src_mtime != settings_mtime(sb);
+                if (touched) {
+                    // Touched but possibly unchanged, e.g. after a checkout. Compare content.
+                    ifstream input(name, ios::binary);
+                    settings::json_slurp(input, content);
+                    have_content = true;
+                    valid = xxh64(content.data(), content.size()) == head->src_hash;
                 }
-                break;
-            case SNAME:
-                if (ch == '"')
-                    state = L1;
-                else
-                    sname += ch;
-                break;
-            case L1:
-                if (ch == '{') {
-                    ss = new settings::section(sname);
-                    sections.push_back(ss);
-                    if (!ss->read(format, input)) {
-                        delete ss;
-                        return false;
+                settings::flat_image renewed = *head;
+                if (valid && index.attach(mem, ib.st_size)) {
+                    close(fd);
+                    indexed = true;
+                    // Record the new time so that the next read does not hash the source again.
+                    if (touched) {
+                        renewed.src_mtime = settings_mtime(sb);
+                        write_image(image_name, renewed);
                     }
-                    state = L0;
+                    return true;
                 }
-                break;
+                munmap(mem, ib.st_size);
             }
         }
-    } else {
-        CS_PRINT_ERRO("configuration::read - Unknown format.");
+        if (fd >= 0)
+            close(fd);
+    }
+#endif
+    if (!have_content) {
+        ifstream input(name, ios::binary);
+        if (!input) {
+            error = "unable to open " + name;
+            return false;
+        }
+        settings::json_slurp(input, content);
+    }
+    if (!parse(format, content.data(), content.size()))
         return false;
+#if defined(__linux) || defined(__APPLE__)
+    if (cache) {
+        settings::flat_image head;
+        head.src_mtime = settings_mtime(sb);
+        head.src_size = sb.st_size;
+        head.src_hash = xxh64(content.data(), content.size());
+        head.format = (uint64_t)format;
+        write_image(image_name, head);
     }
+#endif
     return true;
 }
-
+// -------------------------------------------------------------------------------------------------
+/** Writes the image of the current values. Errors are ignored since the image is only a cache.
+  \param head Header with the source fields filled in.
+*/
+void
+configuration::write_image(const std::string& name, const settings::flat_image& head) const
+{
+#if defined(__linux) || defined(__APPLE__)
+    settings::flat_image out = head;
+    memcpy(out.magic, "C4SCONF1", 8);
+    out.item_size = sizeof(settings::flat_item);
+    out.byte_order = 0x01020304;
+    out.slots = index.get_slots();
+    out.count = index.size();
+    out.strings_len = index.get_strings().size();
+    if (!out.slots)
+        return;
+    try {
+        atomic_writer aw(name, AWF_NOSYNC);
+        aw.write(&out, sizeof(out));
+        aw.write(index.get_table(), out.slots * sizeof(settings::flat_item));
+        aw.write(index.get_strings().data(), out.strings_len);
+        aw.commit();
+    } catch (const c4s_exception& ce) {
+        CS_VAPRT_WARN("configuration::read - unable to write %s: %s", name.c_str(), ce.what());
+    }
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+/** Recreates sections and items from the mapped image. Entries are created in the order their
+  keys were stored, which is the section order of the configuration that wrote the image. Index
+  stays mapped until the sections are changed.
+*/
+void
+configuration::unpack_image()
+{
+    vector<const settings::flat_item*> entries;
+    entries.reserve(index.size());
+    const settings::flat_item* tbl = index.get_table();
+    for (size_t ndx = 0; ndx < index.get_slots(); ndx++) {
+        if (tbl[ndx].hash)
+            entries.push_back(tbl + ndx);
+    }
+    sort(entries.begin(), entries.end(),
+         [](const settings::flat_item* a, const settings::flat_item* b) {
+             return a->key < b->key;
+         });
+    settings::section* ss = 0;
+    for (const settings::flat_item* fi : entries) {
+        string_view sname = index.get_section(fi);
+        if (!ss || sname != ss->name) {
+            ss = new settings::section(string(sname));
+            sections.push_back(ss);
+        }
+        settings::item* im = 0;
+        switch (fi->type) {
+        case settings::TYPE::STR:
+            im = new settings::str_item(string(index.get_str(fi)));
+            break;
+        case settings::TYPE::LONG:
+            im = new settings::integer_item(fi->val.num);
+            break;
+        case settings::TYPE::FLOAT:
+            im = new settings::float_item(fi->val.flt);
+            break;
+        case settings::TYPE::BOOL:
+            im = new settings::bool_item(fi->val.flag);
+            break;
+        }
+        ss->items[string(index.get_name(fi))] = im;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+settings::section*
+configuration::create_section(const std::string name)
+{
+    unpack();
+    settings::section* ss = new settings::section(name);
+    sections.push_back(ss);
+    indexed = false;
+    return ss;
+}
+// -------------------------------------------------------------------------------------------------
 settings::section*
-configuration::get_section(const std::string& name)
+configuration::get_section(std::string_view name)
 {
+    unpack();
     list<settings::section*>::iterator ss;
     for (ss = sections.begin(); ss != sections.end(); ss++) {
-        if ((*ss)->is_name(name))
+        if (name == (*ss)->name)
             return *ss;
     }
     return 0;
 }
 
-settings::item*
-configuration::find(const std::string& section, const std::string& name)
+void
+configuration::reindex() const
 {
-    // find sections
-    list<settings::section*>::iterator ss;
-    for (ss = sections.begin(); ss != sections.end(); ss++) {
-        if ((*ss)->is_name(section))
-            break;
-    }
-    if (ss == sections.end())
-        return 0;
-    // Find item
-    auto si = (*ss)->items.find(name);
-    if (si == (*ss)->items.end())
-        return 0;
-    return si->second;
+    index.build(sections);
+    indexed = true;
+}
+
+const settings::flat_item*
+configuration::find(std::string_view section, std::string_view name,
+                    settings::TYPE type) const
+{
+    if (!indexed)
+        reindex();
+    const settings::flat_item* fi = index.find(section, name);
+    return fi && fi->type == type ? fi : 0;
 }
 
 std::string
-configuration::get_string(const std::string& section, const std::string& name)
+configuration::get_string(std::string_view section, std::string_view name) const
 {
-    settings::item* si = find(section, name);
-    if (!si || si->get_type() != settings::TYPE::STR)
-        return string();
-    return static_cast<settings::str_item*>(si)->value;
+    const settings::flat_item* fi = find(section, name, settings::TYPE::STR);
+    return fi ? string(index.get_str(fi)) : string();
 }
 bool
-configuration::get_value(const std::string& section, const std::string& name, std::string& val)
+configuration::get_value(std::string_view section, std::string_view name, std::string& val) const
 {
-    settings::item* si = find(section, name);
-    if (!si || si->get_type() != settings::TYPE::STR)
+    const settings::flat_item* fi = find(section, name, settings::TYPE::STR);
+    if (!fi)
         return false;
-    val = static_cast<settings::str_item*>(si)->value;
+    val.assign(index.get_str(fi));
     return true;
 }
 bool
-configuration::get_value(const std::string& section, const std::string& name, uint64_t& val)
+configuration::get_value(std::string_view section, std::string_view name,
+                         std::string_view& val) const
 {
-    settings::item* si = find(section, name);
-    if (!si || si->get_type() != settings::TYPE::LONG)
+    const settings::flat_item* fi = find(section, name, settings::TYPE::STR);
+    if (!fi)
         return false;
-    val = static_cast<settings::integer_item*>(si)->value;
+    val = index.get_str(fi);
     return true;
 }
 bool
-configuration::get_value(const std::string& section, const std::string& name, float& val)
+configuration::get_value(std::string_view section, std::string_view name, uint64_t& val) const
 {
-    settings::item* si = find(section, name);
-    if (!si || si->get_type() != settings::TYPE::FLOAT)
+    const settings::flat_item* fi = find(section, name, settings::TYPE::LONG);
+    if (!fi)
         return false;
-    val = static_cast<settings::float_item*>(si)->value;
+    val = fi->val.num;
     return true;
 }
 bool
-configuration::get_value(const std::string& section, const std::string& name, bool& val)
+configuration::get_value(std::string_view section, std::string_view name, float& val) const
 {
-    settings::item* si = find(section, name);
-    if (!si || si->get_type() != settings::TYPE::BOOL)
+    const settings::flat_item* fi = find(section, name, settings::TYPE::FLOAT);
+    if (!fi)
         return false;
-    val = static_cast<settings::bool_item*>(si)->value;
+    val = fi->val.flt;
     return true;
 }
 bool
-configuration::is(const std::string& section, const std::string& name)
+configuration::get_value(std::string_view section, std::string_view name, bool& val) const
 {
-    settings::item* si = find(section, name);
-    if (!si || si->get_type() != settings::TYPE::BOOL)
+    const settings::flat_item* fi = find(section, name, settings::TYPE::BOOL);
+    if (!fi)
         return false;
-    return static_cast<settings::bool_item*>(si)->value;
+    val = fi->val.flag;
+    return true;
+}
+bool
+configuration::is(std::string_view section, std::string_view name) const
+{
+    const settings::flat_item* fi = find(section, name, settings::TYPE::BOOL);
+    return fi ? fi->val.flag : false;
 }
 
 }; // c4s namespace
@@ -10,16 +10,129 @@
 #ifndef C4S_SETTINGS_HPP
 #define C4S_SETTINGS_HPP
 
+#include <list>
 #include <sstream>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 #include <cstdint>
 
 namespace c4s {
 
+class path;
+class line_tokenizer;
+
 namespace settings {
 class section;
 class item;
+
+enum class TYPE
+{
+    STR,
+    LONG,
+    FLOAT,
+    BOOL
+};
+
+// ...............................................
+//! Entry in the flat_store hash table.
+struct flat_item
+{
+    uint64_t hash;     //!< Hash of 'section.name'. Zero marks an empty slot.
+    uint32_t key;      //!< Offset of 'section.name' in the string arena.
+    uint32_t sec_len;  //!< Length of the section part of the key.
+    uint32_t name_len; //!< Length of the name part of the key.
+    TYPE type;
+    union
+    {
+        uint64_t num;
+        float flt;
+        bool flag;
+        struct
+        {
+            uint32_t off;
+            uint32_t len;
+        } str; //!< String value in the arena.
+    } val;
+};
+
+// ...............................................
+//! Header of the compiled configuration image.
+/*! Image is the header followed by the flat_store table ('slots' entries) and the string arena.
+  It is only valid on a machine with the same byte order and structure layout.*/
+struct flat_image
+{
+    char magic[8];        //!< "C4SCONF1". Last character is the version.
+    uint32_t item_size;   //!< sizeof(flat_item).
+    uint32_t byte_order;  //!< 0x01020304 in the byte order of the writer.
+    int64_t src_mtime;    //!< Modification time of the source in nanoseconds.
+    uint64_t src_size;    //!< Size of the source.
+    uint64_t src_hash;    //!< XXH64 of the source content.
+    uint64_t format;      //!< Format the source was read with.
+    uint64_t slots;       //!< Number of table entries.
+    uint64_t count;       //!< Number of values.
+    uint64_t strings_len; //!< Size of the string arena.
+};
+
+// ...............................................
+//! Read optimized copy of all configuration values.
+/*! Values of all sections are stored in one table with open addressing and a single hash index
+  on 'section.name'. Strings (keys and values) are kept in one arena. Table is kept at most half
+  full, so a lookup usually takes one probe. Lookups take string views and do not allocate.<br>
+  The table and arena can also be used in place from a memory mapped flat_image.*/
+class flat_store
+{
+  public:
+    flat_store();
+    ~flat_store() { clear(); }
+    flat_store(const flat_store&) = delete;
+    flat_store& operator=(const flat_store&) = delete;
+
+    //! Copies the values of the sections into the store. First value wins for duplicate keys.
+    void build(const std::list<section*>& sections);
+    //! Uses the mapped image. On success the store owns the mapping and unmaps it in clear().
+    bool attach(void* image, size_t len);
+    //! Returns the value or null if not found.
+    const flat_item* find(std::string_view section, std::string_view name) const;
+    //! Returns the string value of the item.
+    std::string_view get_str(const flat_item* fi) const
+    {
+        return std::string_view(strings + fi->val.str.off, fi->val.str.len);
+    }
+    //! Returns the section part of the item key.
+    std::string_view get_section(const flat_item* fi) const
+    {
+        return std::string_view(strings + fi->key, fi->sec_len);
+    }
+    //! Returns the name part of the item key.
+    std::string_view get_name(const flat_item* fi) const
+    {
+        return std::string_view(strings + fi->key + fi->sec_len, fi->name_len);
+    }
+    //! Number of values in the store.
+    size_t size() const { return count; }
+    //! Number of entries in the table including the empty ones.
+    size_t get_slots() const { return slots ? mask + 1 : 0; }
+    const flat_item* get_table() const { return slots; }
+    std::string_view get_strings() const { return std::string_view(strings, strings_len); }
+    bool is_mapped() const { return image != 0; }
+    void clear();
+
+  protected:
+    static uint64_t hash(std::string_view section, std::string_view name);
+    uint32_t add_string(const std::string& str);
+
+    std::vector<flat_item> table;
+    std::string arena;
+    const flat_item* slots; //!< Table in use: 'table' or the mapped image.
+    const char* strings;    //!< Arena in use.
+    size_t strings_len;
+    size_t mask;
+    size_t count;
+    void* image;            //!< Mapped image or null.
+    size_t image_len;
+};
 };
 
 // ...............................................
@@ -36,35 +149,66 @@ class configuration
     configuration(FORMAT type, std::istream& input);
     ~configuration();
 
+    //! Reads the sections from the input. On failure the configuration is left unchanged.
+    /*! JSON input is read into memory in one go and parsed in a single pass. Nested objects and
+        arrays are flattened into item names, e.g. 'top.sub1', 'array.[0]' or 'list.[1].name'.*/
     bool read(FORMAT type, std::istream& input);
+    //! Reads the configuration file, using its compiled image when it is up to date.
+    /*! The image is kept next to the source with the '.c4sc' extension appended. It is used when
+        the size and modification time of the source match the ones recorded in it, or when the
+        content hash matches after the time has changed. The image is then mapped into memory
+        and used as is: values are not copied and sections are created only if they are asked
+        for. Otherwise the source is parsed and, if 'cache' is true, a new image is written.
+        Failing to write the image is not an error.*/
+    bool read(FORMAT type, const path& source, bool cache = true);
+    //! Returns the description of the last read failure with the line and column of the error.
+    const std::string& get_error() const { return error; }
     settings::section* create_section(const std::string name);
-    settings::section* get_section(const std::string& name);
+    settings::section* get_section(std::string_view name);
+    //! Rebuilds the lookup index. Call after changing section items directly.
+    /*! Getters rebuild the index automatically after read and create_section. When the
+        configuration is shared between threads, call this before the readers start.*/
+    void reindex() const;
+
+    std::string get_string(std::string_view section, std::string_view name) const;
+    bool get_value(std::string_view section, std::string_view name, std::string& val) const;
+    //! Returns a view to the string value. View is valid until the configuration changes.
+    bool get_value(std::string_view section, std::string_view name, std::string_view& val) const;
+    bool get_value(std::string_view section, std::string_view name, uint64_t& val) const;
+    bool get_value(std::string_view section, std::string_view name, float& val) const;
+    bool get_value(std::string_view section, std::string_view name, bool& val) const;
+    bool is(std::string_view section, std::string_view name) const;
 
-    std::string get_string(const std::string& section, const std::string& name);
-    bool get_value(const std::string& section, const std::string& name, std::string& val);
-    bool get_value(const std::string& section, const std::string& name, uint64_t& val);
-    bool get_value(const std::string& section, const std::string& name, float& val);
-    bool get_value(const std::string& section, const std::string& name, bool& val);
-    bool is(const std::string& section, const std::string& name);
+    //! True if the values are used directly from a compiled image.
+    bool is_cached() const { return index.is_mapped(); }
 
-    std::list<settings::section*>::iterator begin() { return sections.begin(); }
+    std::list<settings::section*>::iterator begin()
+    {
+        unpack();
+        return sections.begin();
+    }
     std::list<settings::section*>::iterator end() { return sections.end(); }
 
   protected:
-    settings::item* find(const std::string& section, const std::string& name);
+    //! Creates the sections from a mapped image when they are needed the first time.
+    void unpack()
+    {
+        if (index.is_mapped() && sections.empty() && index.size())
+            unpack_image();
+    }
+    void unpack_image();
+    bool parse(FORMAT type, const char* data, size_t len);
+    void write_image(const std::string& name, const settings::flat_image& head) const;
+    const settings::flat_item* find(std::string_view section, std::string_view name,
+                                    settings::TYPE type) const;
     std::list<settings::section*> sections;
+    mutable settings::flat_store index; //!< Rebuilt lazily by the getters.
+    std::string error;
+    mutable bool indexed;
 };
 
 namespace settings {
 
-enum class TYPE
-{
-    STR,
-    LONG,
-    FLOAT,
-    BOOL
-};
-
 class item
 {
     friend class section;
@@ -148,46 +292,12 @@ class bool_item : public item
     bool value;
 };
 
-// ...............................................
-//! Parse time data structure
-struct json_parse_data
-{
-    json_parse_data()
-    {
-        pos = 0;
-        read_level = 0;
-        array_item = -1;
-    }
-    void level_up()
-    {
-        read_key += '.';
-        read_level++;
-    }
-    void level_down()
-    {
-        read_key.pop_back();
-        read_level--;
-    }
-    bool is_array() { return array_item >= 0 ? true : false; }
-    std::string get_key()
-    {
-        if (array_item >= 0) {
-            std::ostringstream ss;
-            ss << read_key << '[' << array_item << ']';
-            array_item++;
-            return ss.str();
-        } else
-            return read_key;
-    }
-    size_t pos;
-    std::string read_key;
-    int read_level;
-    int array_item;
-};
 // ...............................................
 class section
 {
     friend class c4s::configuration;
+    friend class flat_store;
+    friend class json_reader;
 
   public:
     ~section();
@@ -205,8 +315,7 @@ class section
     section(const std::string& name);
     section(const std::string& name, configuration::FORMAT type, std::istream& input);
 
-    bool read_flat(std::istream& input);
-    bool read_json(std::istream& input, json_parse_data& pd);
+    bool read_flat(line_tokenizer& input);
 
     std::string name;
 };
@@ -0,0 +1,253 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(__linux)
+#include <sys/sysmacros.h>
+#endif
+#include <list>
+#include <vector>
+#include "ntbs/ntbs.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "path.hpp"
+#include "path_list.hpp"
+#include "util.hpp"
+#include "stat_cache.hpp"
+
+using namespace std;
+using namespace c4s;
+
+std::atomic<stat_cache*> c4s::stat_cache::current(nullptr);
+
+// -------------------------------------------------------------------------------------------------
+static stat_cache&
+process_stat_cache()
+{
+    static stat_cache process_cache;
+    return process_cache;
+}
+// -------------------------------------------------------------------------------------------------
+static void
+stat2meta(const struct stat& sb, file_meta& meta)
+{
+    meta.exists = true;
+    meta.mode = sb.st_mode;
+    meta.size = sb.st_size;
+    meta.ino = sb.st_ino;
+    meta.dev = sb.st_dev;
+#if defined(__APPLE__)
+    meta.mtime = sb.st_mtimespec;
+#else
+    meta.mtime = sb.st_mtim;
+#endif
+}
+// -------------------------------------------------------------------------------------------------
+/** Metadata is read with statx when available since it allows asking only for the fields that
+  the cache stores. Otherwise stat / lstat is used.
+  \param name Name of the file.
+  \param follow If true symbolic links are followed (stat), otherwise link itself is read (lstat).
+  \param meta Metadata is written here. On failure meta.exists is set to false.
+  \retval bool True if the file exists.
+*/
+bool
+c4s::stat_cache::read_meta(const char* name, bool follow, file_meta& meta)
+{
+    memset(&meta, 0, sizeof(meta));
+#if defined(__linux) && defined(STATX_BASIC_STATS)
+    struct statx sx;
+    if (!statx(AT_FDCWD, name, follow ? 0 : AT_SYMLINK_NOFOLLOW,
+               STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME, &sx)) {
+        meta.exists = true;
+        meta.mode = sx.stx_mode;
+        meta.size = sx.stx_size;
+        meta.ino = sx.stx_ino;
+        meta.dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+        meta.mtime.tv_sec = sx.stx_mtime.tv_sec;
+        meta.mtime.tv_nsec = sx.stx_mtime.tv_nsec;
+        return true;
+    }
+    if (errno != ENOSYS)
+        return false;
+#endif
+    struct stat sb;
+    if ((follow ? stat(name, &sb) : lstat(name, &sb)) == 0) {
+        stat2meta(sb, meta);
+        return true;
+    }
+    return false;
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::store(const string& name, const file_meta& lmeta, const file_meta* smeta)
+{
+    lock_guard<mutex> lg(mtx);
+    entry& ent = entries[name];
+    ent.lst = lmeta;
+    ent.has_lstat = true;
+    if (smeta) {
+        ent.st = *smeta;
+        ent.has_stat = true;
+    }
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param name Name of the file as it would be given to stat.
+  \param follow If true returns the stat-result, otherwise lstat-result.
+  \param meta Metadata is copied here.
+  \retval bool True if the file exists.
+*/
+bool
+c4s::stat_cache::get(const string& name, bool follow, file_meta& meta)
+{
+    {
+        lock_guard<mutex> lg(mtx);
+        auto it = entries.find(name);
+        if (it != entries.end()) {
+            if (follow && it->second.has_stat) {
+                meta = it->second.st;
+                return meta.exists;
+            }
+            if (!follow && it->second.has_lstat) {
+                meta = it->second.lst;
+                return meta.exists;
+            }
+        }
+    }
+    read_meta(name.c_str(), follow, meta);
+    lock_guard<mutex> lg(mtx);
+    entry& ent = entries[name];
+    if (follow) {
+        ent.st = meta;
+        ent.has_stat = true;
+    } else {
+        ent.lst = meta;
+        ent.has_lstat = true;
+    }
+    return meta.exists;
+}
+// -------------------------------------------------------------------------------------------------
+/** Reads the link-metadata and if the path is not a symbolic link stores the same result for
+  the followed metadata as well. Symbolic links are followed with a second call.
+  \param p Path to read.
+*/
+void
+c4s::stat_cache::prefetch(const path& p)
+{
+    file_meta lmeta, smeta;
+    string name = p.get_path();
+    if (name.empty())
+        return;
+    read_meta(name.c_str(), false, lmeta);
+    if (lmeta.exists && S_ISLNK(lmeta.mode)) {
+        read_meta(name.c_str(), true, smeta);
+        store(name, lmeta, &smeta);
+    } else
+        store(name, lmeta, &lmeta);
+}
+// -------------------------------------------------------------------------------------------------
+/** Metadata queries are split among given number of threads. For small lists the work is done
+  in the calling thread.
+  \param list List of paths to read.
+  \param threads Number of threads to use. If zero, uses hardware concurrency.
+*/
+void
+c4s::stat_cache::prefetch(path_list& list, unsigned int threads)
+{
+    vector<const path*> targets;
+    targets.reserve(list.size());
+    for (path_iterator pi = list.begin(); pi != list.end(); pi++)
+        targets.push_back(&(*pi));
+    if (targets.size() < 32)
+        threads = 1;
+    parallel_for(targets.size(), threads, [this, &targets](size_t ndx) {
+        prefetch(*targets[ndx]);
+    });
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::invalidate(const string& name)
+{
+    lock_guard<mutex> lg(mtx);
+    entries.erase(name);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::invalidate(const path& p)
+{
+    invalidate(p.get_path());
+    if (p.is_base())
+        return;
+    // Directories are queried without the trailing separator.
+    invalidate(p.get_dir_plain());
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::clear()
+{
+    lock_guard<mutex> lg(mtx);
+    entries.clear();
+}
+// -------------------------------------------------------------------------------------------------
+size_t
+c4s::stat_cache::size()
+{
+    lock_guard<mutex> lg(mtx);
+    return entries.size();
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::enable()
+{
+    current.store(&process_stat_cache(), memory_order_release);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::disable()
+{
+    stat_cache* sc = &process_stat_cache();
+    stat_cache* expected = sc;
+    current.compare_exchange_strong(expected, nullptr);
+    sc->clear();
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::stat_cache::lookup(const string& name, bool follow, file_meta& meta)
+{
+    stat_cache* sc = active();
+    if (sc)
+        return sc->get(name, follow, meta);
+    return read_meta(name.c_str(), follow, meta);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::forget(const string& name)
+{
+    stat_cache* sc = active();
+    if (sc)
+        sc->invalidate(name);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::forget(const path& p)
+{
+    stat_cache* sc = active();
+    if (sc)
+        sc->invalidate(p);
+}
+// -------------------------------------------------------------------------------------------------
+void
+c4s::stat_cache::forget_all()
+{
+    stat_cache* sc = active();
+    if (sc)
+        sc->clear();
+}
@@ -0,0 +1,131 @@
+/* This file is part of 'CPP for Scripts' C++ library (libc4s)
+ * https://github.com/jaaskelainen-aj/cpp4scripts
+ *
+ * Copyright (c) 2021: Antti Jääskeläinen
+ * License: http://www.gnu.org/licenses/lgpl-2.1.html
+ * Disclaimer of Warranty: Work is provided on an "as is" basis, without warranties or conditions of
+ * any kind
+ */
+#ifndef C4S_STAT_CACHE_HPP
+#define C4S_STAT_CACHE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+#include <time.h>
+
+namespace c4s {
+
+class path;
+class path_list;
+
+//! File system metadata as stored by the stat_cache.
+struct file_meta
+{
+    bool exists;           //!< False if the stat call failed for the path.
+    mode_t mode;           //!< File type and permission bits.
+    off_t size;            //!< File size in bytes.
+    ino_t ino;             //!< Inode number.
+    dev_t dev;             //!< Device id of the file system.
+    struct timespec mtime; //!< Last modification time with nanoseconds.
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Cache for file system metadata queries.
+/*! Path functions exists(), dirname_exists(), read_changetime(), outdated() and compare_times()
+  consult the active cache before they stat the file system. There is no active cache by
+  default, in which case each query goes straight to the file system as before.<br>
+  Cache can be activated process wide with enable() or for a limited scope with
+  stat_cache_scope. Entries are kept until they are explicitly invalidated. Path's own file
+  operations (cp, rm, ren, mkdir, ...) invalidate the entries they change, but changes made by
+  other means (e.g. child processes) need to be invalidated by the application. Keys are the
+  path strings as given, so relative entries are dropped when the directory is changed with
+  path::cd().
+*/
+class stat_cache
+{
+  public:
+    stat_cache() {}
+
+    //! Returns the metadata for the named file. Reads the file system on a cache miss.
+    bool get(const std::string& name, bool follow, file_meta& meta);
+    //! Reads metadata for all paths in the list into the cache using parallel threads.
+    void prefetch(path_list& list, unsigned int threads = 0);
+    //! Reads metadata for a single path into the cache.
+    void prefetch(const path& p);
+    //! Removes the named file from the cache.
+    void invalidate(const std::string& name);
+    //! Removes the file pointed by the path from the cache.
+    void invalidate(const path& p);
+    //! Removes all entries from the cache.
+    void clear();
+    //! Returns the number of cached paths.
+    size_t size();
+
+    //! Activates the process wide cache.
+    static void enable();
+    //! Deactivates the process wide cache and clears it.
+    static void disable();
+    //! Returns pointer to the active cache or null if caching is not active.
+    static stat_cache* active() { return current.load(std::memory_order_acquire); }
+    //! Returns metadata from the active cache or directly from the file system.
+    static bool lookup(const std::string& name, bool follow, file_meta& meta);
+    //! Invalidates the named file from the active cache if there is one.
+    static void forget(const std::string& name);
+    //! Invalidates the file pointed by the path from the active cache if there is one.
+    static void forget(const path& p);
+    //! Clears the active cache if there is one.
+    static void forget_all();
+    //! Reads the metadata directly from the file system without caching.
+    static bool read_meta(const char* name, bool follow, file_meta& meta);
+
+  protected:
+    //! Cached results for stat (followed) and lstat.
+    struct entry
+    {
+        entry()
+          : has_stat(false)
+          , has_lstat(false)
+        {}
+        file_meta st;
+        file_meta lst;
+        bool has_stat;
+        bool has_lstat;
+    };
+    void store(const std::string& name, const file_meta& lmeta, const file_meta* smeta);
+
+    std::unordered_map<std::string, entry> entries;
+    std::mutex mtx;
+
+    static std::atomic<stat_cache*> current;
+    friend class stat_cache_scope;
+};
+
+// -----------------------------------------------------------------------------------------------------------
+//! Activates a private stat cache for the lifetime of this object.
+/*! Previously active cache is restored when the scope ends. Scopes can be nested but they are
+  not meant to be shared between threads that start and end scopes independently.
+*/
+class stat_cache_scope
+{
+  public:
+    stat_cache_scope()
+      : previous(stat_cache::current.exchange(&cache))
+    {}
+    ~stat_cache_scope() { stat_cache::current.store(previous); }
+
+    //! Returns the cache owned by this scope.
+    stat_cache& get() { return cache; }
+
+  private:
+    stat_cache_scope(const stat_cache_scope&) = delete;
+    stat_cache_scope& operator=(const stat_cache_scope&) = delete;
+
+    stat_cache cache;
+    stat_cache* previous;
+};
+
+} // namespace c4s
+#endif
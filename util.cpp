@@ -12,11 +12,18 @@
 #include <string.h>
 #include <time.h>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 #if defined(__linux) || defined(__APPLE__)
 #include <dirent.h>
 #include <grp.h>
 #include <poll.h>
 #include <pwd.h>
+#include <limits.h>
 #include <sys/stat.h>
 #endif
 #ifdef _WIN32
@@ -30,6 +37,8 @@
 #include "path_list.hpp"
 #include "user.hpp"
 #include "util.hpp"
+#include "fd_io.hpp"
+#include "searcher.hpp"
 
 using namespace std;
 
@@ -239,9 +248,10 @@ search_bmh(const unsigned char* haystack,
 }
 
 // -------------------------------------------------------------------------------------------------
-/**  Uses Boyer-Moore algorithm to search for a text in a given stream. Stream needs to be
+/**  Uses precompiled searcher to search for a text in a given stream. Stream needs to be
   opened before this function is called. Search begins from the current position. If match is found
-  the file pointer is positioned to the start of the next needle.
+  the file pointer is positioned to the start of the next needle. Consecutive reads overlap by the
+  needle length so that matches crossing the read boundaries are found.
   On error an exception is thrown.
 
   \param target Opened file stream to search for.
@@ -251,34 +261,32 @@ search_bmh(const unsigned char* haystack,
 bool
 search_file(fstream& target, const string& needle)
 {
-    const SIZE_T BMAX = 0x1000;
-    char buffer[BMAX];
-    streamsize tg;
-    SIZE_T br, boffset, total_offset, overlap = 0;
     SIZE_T nsize = needle.size();
+    if (!nsize)
+        return false;
     if (!target.good())
         throw c4s_exception("search_file: given stream does not have 'good' status.");
-    if (nsize >= BMAX)
-        throw c4s_exception("search_file: size of search text exceeds internal read buffer size.");
-    tg = target.tellg();
+    streamsize tg = target.tellg();
     if (tg < 0)
         throw c4s_exception("search_file: unable to get file position information.");
-    total_offset = SIZE_T(tg);
+    searcher srch(needle);
+    // Buffer offset zero is always at file position 'buffer_pos'.
+    vector<char> buffer(nsize > 0x8000 ? 2 * nsize : 0x10000);
+    SIZE_T buffer_pos = SIZE_T(tg);
+    SIZE_T keep = 0, found;
     do {
-        target.read(buffer + overlap, BMAX - overlap);
-        br = SIZE_T(target.gcount());
-        if (search_bmh((unsigned char*)buffer, br + overlap, (unsigned char*)needle.c_str(), nsize,
-                       &boffset)) {
+        target.read(buffer.data() + keep, buffer.size() - keep);
+        SIZE_T filled = keep + SIZE_T(target.gcount());
+        found = srch.find(buffer.data(), filled);
+        if (found != searcher::npos) {
             target.clear();
-            target.seekg(total_offset + boffset, ios_base::beg);
+            target.seekg(buffer_pos + found, ios_base::beg);
             return true;
         }
-        total_offset += br;
-        memcpy(buffer, buffer + BMAX - nsize, nsize);
-        if (!overlap) {
-            overlap = nsize;
-            total_offset -= nsize;
-        }
+        // Keep the last nsize-1 bytes since a match may start there.
+        keep = filled < nsize ? filled : nsize - 1;
+        memmove(buffer.data(), buffer.data() + filled - keep, keep);
+        buffer_pos += filled - keep;
     } while (!target.eof());
     return false;
 }
@@ -575,35 +583,52 @@ SET_OWNER_MODE_FAIL : {
     throw c4s_exception(os.str().c_str());
 }
 }
+// -------------------------------------------------------------------------------------------------
+/** Throws path_exception if the write fails.
+  \param fd Descriptor to write to.
+  \param iov Array of vectors.
+  \param count Number of vectors.
+*/
+void
+writev_all(int fd, struct iovec* iov, int count)
+{
+    while (count > 0) {
+        ssize_t bw = ::writev(fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (bw < 0) {
+            if (errno == EINTR)
+                continue;
+            ostringstream os;
+            os << "c4s::writev_all - write error: " << strerror(errno);
+            throw path_exception(os.str());
+        }
+        // Skip the fully written vectors and adjust the partially written one.
+        while (count > 0 && (size_t)bw >= iov->iov_len) {
+            bw -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + bw;
+            iov->iov_len -= bw;
+        }
+    }
+}
 #endif // __linux || __APPLE__
 
 // -------------------------------------------------------------------------------------------------
 // http://www.isthe.com/chongo/src/fnv/hash_64.c
+/** FNV-1 hash. Salt is the previous hash value when the data is hashed in several parts.
+  \param str Data to hash.
+  \param len Length of data.
+  \param salt Initial hash value.
+  \retval uint64_t Hash value.
+*/
 uint64_t
 fnv_hash64_str(const char* str, size_t len, uint64_t salt)
 {
-    union
-    {
-        char ch[8];
-        uint64_t key;
-    } pack;
-    uint64_t hash = salt;
-    unsigned char* s = (unsigned char*)str;
-    if (len < 9) {
-        for (size_t ndx = 0; ndx < 8; ndx++) {
-            if (ndx < len)
-                pack.ch[ndx] = str[ndx];
-            else
-                pack.ch[ndx] = 0;
-        }
-        return pack.key;
-    }
-    while (len) {
-        hash += (hash << 1) + (hash << 4) + (hash << 5) + (hash << 7) + (hash << 8) + (hash << 40);
-        hash ^= (uint64_t)*s++;
-        len--;
-    }
-    return hash;
+    fnv64_hasher hs(salt);
+    hs.update(str, len);
+    return hs.value();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -686,4 +711,51 @@ parse_key_values(const char* str,
     return true;
 }
 
+// -------------------------------------------------------------------------------------------------
+/** Indexes are handed out to worker threads one at a time so uneven work items balance
+  themselves. Calling thread participates in the work. If any call throws, remaining indexes are
+  skipped and the first exception is rethrown after all threads have finished.
+  \param count Number of work items.
+  \param threads Maximum number of threads to use. Zero means hardware concurrency.
+  \param fn Function called for each index in range [0, count).
+*/
+void
+parallel_for(size_t count, unsigned int threads, const std::function<void(size_t)>& fn)
+{
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    if (threads > count)
+        threads = count;
+    if (threads <= 1) {
+        for (size_t ndx = 0; ndx < count; ndx++)
+            fn(ndx);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    std::exception_ptr first_error;
+    std::mutex error_mtx;
+    auto worker = [&]() {
+        size_t ndx;
+        while ((ndx = next.fetch_add(1)) < count) {
+            try {
+                fn(ndx);
+            } catch (...) {
+                std::lock_guard<std::mutex> lg(error_mtx);
+                if (!first_error)
+                    first_error = std::current_exception();
+                next.store(count);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned int ti = 1; ti < threads; ti++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool)
+        th.join();
+    if (first_error)
+        std::rethrow_exception(first_error);
+}
+
 } // namespace c4s
\ No newline at end of file
@@ -9,6 +9,7 @@
 #ifndef C4S_UTIL_HPP
 #define C4S_UTIL_HPP
 
+#include <functional>
 #include <string>
 #include <unordered_map>
 #include <stdint.h>
@@ -59,7 +60,7 @@ const char* get_host_name();
 //! Searches needle in the target file.
 bool search_file(std::fstream& target, const std::string& needle);
 
-//! Efficient string search function.
+//! String search function. Use searcher for repeated searches with the same needle.
 bool search_bmh(const unsigned char* haystack,
            SSIZE_T hlen,
            const unsigned char* needle,
@@ -94,6 +95,9 @@ uint64_t fnv_hash64_file(const char* path, uint64_t salt);
 bool has_anybits(uint32_t target, uint32_t bits);
 bool has_allbits(uint32_t target, uint32_t bits);
 
+//! Runs the function for each index in range [0, count) using a pool of threads.
+void parallel_for(size_t count, unsigned int threads, const std::function<void(size_t)>& fn);
+
 //! Two sided trim
 void trim(std::string&);
 
@@ -10,6 +10,7 @@
 
 #include "config.hpp"
 #include "exception.hpp"
+#include "line_tokenizer.hpp"
 #include "variables.hpp"
 #include "path.hpp"
 #include "path_list.hpp"
@@ -24,9 +25,9 @@ using namespace std;
 // -------------------------------------------------------------------------------------------------
 /**
   Reads the given include file and adds variable definitions from it to the given variable list.
-  Variables have following syntax: "name = value". Anything before equal-sign is taken as name of
-  the variable. Anything following the equal sign is taken as the value of variable. Any whitespace
-  around the equal sign is discarded.
+  Variables have following syntax: "name = value" or "name := value". Anything before equal-sign
+  is taken as name of the variable. Anything following the equal sign is taken as the value of
+  variable. Any whitespace around the equal sign is discarded. Lines have no length limit.
 
   In Windows variable values are searched for $$-marks. These are replaced with current build
   architecture's word length i.e. 32 or 64.
@@ -36,77 +37,30 @@ using namespace std;
 void
 c4s::variables::include(const path& inc_file)
 {
-    char *eq, *ptr, line[MAX_LINE];
-    string key;
-    int lineno = 0;
-
-    ifstream inc(inc_file.get_path().c_str(), ios::in);
-    if (!inc) {
-        ostringstream os;
-        os << "Unable to open include file '" << inc_file.get_path();
-        throw path_exception(os.str());
-    }
-    do {
-        lineno++;
-        inc.getline(line, sizeof(line));
-        if (inc.fail() && !inc.eof()) {
-            ostringstream os;
-            os << "Insufficient buffer in c4s::include_vars reading file: " << inc_file.get_base()
-               << " on line: " << lineno;
-            throw c4s_exception(os.str());
-        }
-
-        // Ignore empty and comment lines.
-        if (line[0] == '#' || line[0] == '\r' || line[0] == '\n' || line[0] == ' ' ||
-            line[0] == '\t')
-            continue;
-
-        // If no equal sign: continue.
-        eq = strchr(line, '=');
-        if (!eq || eq == line)
-            continue;
-        // Trim the end of the key
-        ptr = eq;
-        do {
-            ptr--;
-        } while (ptr > line && (*ptr == ' ' || *ptr == ':' || *ptr == '\t'));
-        if (ptr == line && (*ptr == ' ' || *ptr == '\t'))
+    line_tokenizer lt(inc_file.get_path());
+    string_view name, value;
+    while (lt.next_pair(name, value)) {
+        while (!name.empty() &&
+               (name.back() == ':' || name.back() == ' ' || name.back() == '\t'))
+            name.remove_suffix(1);
+        if (name.empty() || value.empty())
             continue;
-        key.assign(line, ptr - line + 1);
-
-        // Trim beginning of value
-        ptr = eq;
-        do {
-            ptr++;
-        } while ((*ptr == ' ' || *ptr == '\t') && *ptr);
-        if (!ptr)
-            continue;
-        eq = ptr;
-
-        // Trim the end of the value
-        ptr = eq + strlen(eq);
-        do {
-            ptr--;
-        } while ((*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n') && ptr != eq);
-        if (ptr == eq)
-            continue;
-        *(ptr + 1) = 0;
+        string& val = vmap[string(name)];
+        val.assign(value);
 #ifdef _WIN32
-        exp_arch(builder::get_arch(), eq);
+        exp_arch(builder::get_arch(), val);
 #endif
-        // insert key and value to the map
 #ifdef C4S_DEBUGTRACE
-        cerr << "variables::include - adding key=" << key << "; value=" << eq << endl;
+        cerr << "variables::include - adding key=" << name << "; value=" << val << endl;
 #endif
-        vmap[key] = string(eq);
-
-    } while (!inc.eof());
-    inc.close();
+    }
+    values.clear();
 }
 // -------------------------------------------------------------------------------------------------
-/** Expands variables in the given source string. Variables have form $(name). Passed variables will
-  always override the environment variables. Throws 'c4s_exception' if variable is not
-  found.
+/** Expands variables in the given source string. Variables have form $(name) or
+  $(name:-default). Passed variables will always override the environment variables. Throws
+  'c4s_exception' if variable is not found. Sources are compiled into templates once and the
+  templates are cached, so repeated expansions of the same options do not parse them again.
    \param source Source string to replace
    \param se Search environment flag. If true then the environment variables are searched as well.
    \retval string expanded string.
@@ -114,40 +68,178 @@ c4s::variables::include(const path& inc_file)
 string
 c4s::variables::expand(const string& source, bool se)
 {
-    ostringstream result;
-    string name, enval;
-    map<string, string>::iterator mi;
-    size_t prev = 0, strend;
-
-    if (!vmap.size() && !se) {
+    if ((!vmap.size() && !se) || source.find("$(") == string::npos) {
         return string(source);
     }
+    auto ti = templates.find(source);
+    if (ti == templates.end()) {
+        if (templates.size() >= 64)
+            templates.clear();
+        ti = templates.emplace(source, compiled_template(source)).first;
+    }
+    string result;
+    ti->second.render(*this, result, se);
+    return result;
+}
+// -------------------------------------------------------------------------------------------------
+const string*
+c4s::variables::find(const string& name, bool se)
+{
+    auto vi = vmap.find(name);
+    if (vi != vmap.end())
+        return &vi->second;
+    if (!se)
+        return 0;
+    auto ei = env.find(name);
+    if (ei == env.end()) {
+        pair<bool, string> val;
+        val.first = get_env_var(name.c_str(), val.second);
+        ei = env.emplace(name, val).first;
+    }
+    return ei->second.first ? &ei->second.second : 0;
+}
+// -------------------------------------------------------------------------------------------------
+//! Returns the compiled value of a variable whose value contains references.
+const c4s::compiled_template&
+c4s::variables::get_value_template(const string& name, const string& value)
+{
+    auto vi = values.find(name);
+    if (vi == values.end())
+        vi = values.emplace(name, compiled_template(value)).first;
+    return vi->second;
+}
+
+// =================================================================================================
+/** Splits the source into literal text and references. Name and default of a reference are
+  compiled into their own templates if they contain references.
+  \param source Template text.
+*/
+void
+c4s::compiled_template::compile(string_view source)
+{
+    text.clear();
+    names.clear();
+    segments.clear();
+    subs.clear();
+    size_t prev = 0;
     size_t offset = source.find("$(");
-    while (offset != string::npos) {
-        result << source.substr(prev, offset - prev);
-        strend = source.find(')', offset + 3);
-        if (strend == string::npos)
-            throw c4s_exception("Variable syntax error.");
-        name = source.substr(offset + 2, strend - offset - 2);
-        mi = vmap.find(name);
-        if (mi == vmap.end()) {
-            if (!se) {
-                ostringstream os;
-                os << "Variable " << name << " definition not found.";
-                throw c4s_exception(os.str());
-            }
-            if (!get_env_var(name.c_str(), enval)) {
-                ostringstream os;
-                os << "Variable " << name << " not found from environment nor variable list.";
-                throw c4s_exception(os.str());
+    while (offset != string_view::npos) {
+        if (offset > prev) {
+            segments.push_back({ (uint32_t)text.size(), (uint32_t)(offset - prev), -1, -1, false });
+            text.append(source.substr(prev, offset - prev));
+        }
+        // Find the closing parenthesis and the default separator on this nesting level.
+        size_t end = offset + 2, sep = string_view::npos;
+        int depth = 0;
+        for (; end < source.size(); end++) {
+            if (source[end] == '$' && end + 1 < source.size() && source[end + 1] == '(') {
+                depth++;
+                end++;
+            } else if (source[end] == ')') {
+                if (!depth)
+                    break;
+                depth--;
+            } else if (!depth && sep == string_view::npos && source[end] == ':' &&
+                       end + 1 < source.size() && source[end + 1] == '-') {
+                sep = end;
             }
-            result << enval;
+        }
+        if (end >= source.size()) {
+            ostringstream os;
+            os << "Variable syntax error: missing ')' at " << offset << " in: " << source;
+            throw c4s_exception(os.str());
+        }
+        size_t name_end = sep == string_view::npos ? end : sep;
+        string_view name = source.substr(offset + 2, name_end - offset - 2);
+        if (name.empty()) {
+            ostringstream os;
+            os << "Variable syntax error: empty name at " << offset << " in: " << source;
+            throw c4s_exception(os.str());
+        }
+        segment seg = { 0, 0, -1, -1, true };
+        if (name.find("$(") != string_view::npos) {
+            seg.name = (int)subs.size();
+            subs.emplace_back(name);
         } else {
-            result << mi->second;
+            seg.off = (uint32_t)names.size();
+            names.emplace_back(name);
+        }
+        if (sep != string_view::npos) {
+            seg.def = (int)subs.size();
+            subs.emplace_back(source.substr(sep + 2, end - sep - 2));
         }
-        prev = strend + 1;
+        segments.push_back(seg);
+        prev = end + 1;
         offset = source.find("$(", prev);
     }
-    result << source.substr(prev);
-    return result.str();
+    if (prev < source.size()) {
+        uint32_t len = (uint32_t)(source.size() - prev);
+        segments.push_back({ (uint32_t)text.size(), len, -1, -1, false });
+        text.append(source.substr(prev));
+    }
+}
+// -------------------------------------------------------------------------------------------------
+bool
+c4s::compiled_template::is_literal() const
+{
+    for (const segment& seg : segments) {
+        if (seg.ref)
+            return false;
+    }
+    return true;
+}
+// -------------------------------------------------------------------------------------------------
+string&
+c4s::compiled_template::render(variables& vars, string& out, bool se) const
+{
+    out.clear();
+    append(vars, out, se, 0);
+    return out;
+}
+// -------------------------------------------------------------------------------------------------
+/**
+  \param depth Number of variable values being expanded around this one. Limits the recursion
+  when a variable refers to itself.
+*/
+void
+c4s::compiled_template::append(variables& vars, string& out, bool se, int depth) const
+{
+    string computed;
+    for (const segment& seg : segments) {
+        if (!seg.ref) {
+            out.append(text, seg.off, seg.len);
+            continue;
+        }
+        const string* name;
+        if (seg.name >= 0) {
+            computed.clear();
+            subs[seg.name].append(vars, computed, se, depth);
+            name = &computed;
+        } else
+            name = &names[seg.off];
+        const string* value = vars.find(*name, se);
+        if (!value) {
+            if (seg.def >= 0) {
+                subs[seg.def].append(vars, out, se, depth);
+                continue;
+            }
+            ostringstream os;
+            if (se)
+                os << "Variable " << *name << " not found from environment nor variable list.";
+            else
+                os << "Variable " << *name << " definition not found.";
+            throw c4s_exception(os.str());
+        }
+        // Only values from the variable list are expanded further. Environment is taken as is.
+        if (value->find("$(") == string::npos || vars.vmap.find(*name) == vars.vmap.end()) {
+            out.append(*value);
+            continue;
+        }
+        if (depth >= 16) {
+            ostringstream os;
+            os << "Variable " << *name << " refers to itself or nests too deep.";
+            throw c4s_exception(os.str());
+        }
+        vars.get_value_template(*name, *value).append(vars, out, se, depth + 1);
+    }
 }
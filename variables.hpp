@@ -9,17 +9,75 @@
 #ifndef C4S_VARIABLES_HPP
 #define C4S_VARIABLES_HPP
 
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 namespace c4s {
 
 class path;
+class variables;
+// -----------------------------------------------------------------------------------------------------------
+//! String with variable references that has been parsed once for repeated expansion.
+/*! References have the form $(NAME) or $(NAME:-default). The default is used when the variable is
+  not found. Both the name and the default can contain references themselves, e.g.
+  $(CFLAGS_$(ARCH)) or $(CC:-$(HOST)-gcc). Variable values that contain references are expanded
+  recursively. Text outside of references is copied as is.
+*/
+class compiled_template
+{
+  public:
+    compiled_template() {}
+    //! Parses the source. Throws c4s_exception on syntax error.
+    explicit compiled_template(std::string_view source) { compile(source); }
+    //! Parses the source replacing the current template. Throws c4s_exception on syntax error.
+    void compile(std::string_view source);
+    //! Expands the template into 'out' replacing its content. Capacity of 'out' is reused.
+    /*! Throws c4s_exception if a variable without a default is not found.
+        \param vars Variables to use.
+        \param out Output buffer.
+        \param se Search environment flag. If true the environment is searched as well.
+        \retval std::string& Reference to out.*/
+    std::string& render(variables& vars, std::string& out, bool se = false) const;
+    //! Returns the expanded template.
+    std::string render(variables& vars, bool se = false) const
+    {
+        std::string out;
+        return render(vars, out, se);
+    }
+    //! True if the template has no references.
+    bool is_literal() const;
+
+  protected:
+    friend class variables;
+    void append(variables& vars, std::string& out, bool se, int depth) const;
+
+    struct segment
+    {
+        uint32_t off;  //!< Literal text in 'text' or index of the name in 'names'.
+        uint32_t len;  //!< Length of the literal text.
+        int name;      //!< Index of the template for a computed name in 'subs' or -1.
+        int def;       //!< Index of the default in 'subs' or -1.
+        bool ref;      //!< True for a reference, false for literal text.
+    };
+    std::string text;
+    std::vector<std::string> names;
+    std::vector<segment> segments;
+    std::vector<compiled_template> subs;
+};
+
 // -----------------------------------------------------------------------------------------------------------
 /// Variable substitution class
 /*! Variables are simple string substitutions, i.e. one string is replaced with another. Variables
- are stored in STL map container. What makes this class convenient is the ability to read variable
+ are stored in a hash map. What makes this class convenient is the ability to read variable
  definitions from text files are run-time.
  Variable files follow unix common configuration files syntax: variable name is followed by equal
  sign. Rest of the line is taken as a value to variable. '#' can be used as a comment. Blank lines
- are ignored.
+ are ignored.<br>
+ Environment values are read once and cached. Call refresh_env() after changing the environment.
 */
 class variables
 {
@@ -28,10 +86,29 @@ class variables
     variables(const path& p) { include(p); }
     void include(const path&);
     std::string expand(const std::string&, bool se = false);
-    void push_back(const std::string& key, const std::string& value) { vmap[key] = value; }
+    void push_back(const std::string& key, const std::string& value)
+    {
+        vmap[key] = value;
+        values.clear();
+    }
+    //! Returns the value of the variable or null if not found.
+    /*! \param name Name of the variable.
+        \param se Search environment flag. Variables in the list override the environment.*/
+    const std::string* find(const std::string& name, bool se = false);
+    //! Forgets the cached environment values.
+    void refresh_env() { env.clear(); }
 
   protected:
-    std::map<std::string, std::string> vmap;
+    friend class compiled_template;
+    const compiled_template& get_value_template(const std::string& name, const std::string& value);
+
+    std::unordered_map<std::string, std::string> vmap;
+    //! Compiled values of the variables that contain references.
+    std::unordered_map<std::string, compiled_template> values;
+    //! Compiled sources of expand.
+    std::unordered_map<std::string, compiled_template> templates;
+    //! Environment values looked up so far. False if the variable is not set.
+    std::unordered_map<std::string, std::pair<bool, std::string>> env;
 };
 
 }